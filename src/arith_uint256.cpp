@@ -201,36 +201,47 @@ template void base_uint<256>::SetHex(const char*);
 template void base_uint<256>::SetHex(const std::string&);
 template unsigned int base_uint<256>::bits() const;
 
-// This implementation directly uses shifts instead of going
-// through an intermediate MPI representation.
-arith_uint256& arith_uint256::SetCompact(uint32_t nCompact, bool* pfNegative, bool* pfOverflow)
+// Explicit instantiations for base_uint<512>
+template base_uint<512>& base_uint<512>::operator<<=(unsigned int);
+template base_uint<512>& base_uint<512>::operator>>=(unsigned int);
+template base_uint<512>& base_uint<512>::operator*=(uint32_t b32);
+template base_uint<512>& base_uint<512>::operator*=(const base_uint<512>& b);
+template base_uint<512>& base_uint<512>::operator/=(const base_uint<512>& b);
+template int base_uint<512>::CompareTo(const base_uint<512>&) const;
+template bool base_uint<512>::EqualTo(uint64_t) const;
+template double base_uint<512>::getdouble() const;
+template unsigned int base_uint<512>::bits() const;
+
+template <unsigned int BITS>
+static void SetCompactBase(base_uint<BITS>& n, uint32_t nCompact, bool* pfNegative, bool* pfOverflow)
 {
     int nSize = nCompact >> 24;
     uint32_t nWord = nCompact & 0x007fffff;
     if (nSize <= 3) {
         nWord >>= 8 * (3 - nSize);
-        *this = nWord;
+        n = nWord;
     } else {
-        *this = nWord;
-        *this <<= 8 * (nSize - 3);
+        n = nWord;
+        n <<= 8 * (nSize - 3);
     }
+    const int nMaxSize = BITS / 8;
     if (pfNegative)
         *pfNegative = nWord != 0 && (nCompact & 0x00800000) != 0;
     if (pfOverflow)
-        *pfOverflow = nWord != 0 && ((nSize > 34) ||
-                                     (nWord > 0xff && nSize > 33) ||
-                                     (nWord > 0xffff && nSize > 32));
-    return *this;
+        *pfOverflow = nWord != 0 && ((nSize > nMaxSize + 2) ||
+                                     (nWord > 0xff && nSize > nMaxSize + 1) ||
+                                     (nWord > 0xffff && nSize > nMaxSize));
 }
 
-uint32_t arith_uint256::GetCompact(bool fNegative) const
+template <unsigned int BITS>
+static uint32_t GetCompactBase(const base_uint<BITS>& n, bool fNegative)
 {
-    int nSize = (bits() + 7) / 8;
+    int nSize = (n.bits() + 7) / 8;
     uint32_t nCompact = 0;
     if (nSize <= 3) {
-        nCompact = GetLow64() << 8 * (3 - nSize);
+        nCompact = n.GetLow64() << 8 * (3 - nSize);
     } else {
-        arith_uint256 bn = *this >> 8 * (nSize - 3);
+        base_uint<BITS> bn = n >> 8 * (nSize - 3);
         nCompact = bn.GetLow64();
     }
     // The 0x00800000 bit denotes the sign.
@@ -246,6 +257,36 @@ uint32_t arith_uint256::GetCompact(bool fNegative) const
     return nCompact;
 }
 
+// This implementation directly uses shifts instead of going
+// through an intermediate MPI representation.
+arith_uint256& arith_uint256::SetCompact(uint32_t nCompact, bool* pfNegative, bool* pfOverflow)
+{
+    SetCompactBase(*this, nCompact, pfNegative, pfOverflow);
+    return *this;
+}
+
+uint32_t arith_uint256::GetCompact(bool fNegative) const
+{
+    return GetCompactBase(*this, fNegative);
+}
+
+arith_uint512::arith_uint512(const arith_uint256& b)
+{
+    for (int x = 0; x < b.WIDTH; ++x)
+        pn[x] = b.pn[x];
+}
+
+arith_uint512& arith_uint512::SetCompact(uint32_t nCompact, bool* pfNegative, bool* pfOverflow)
+{
+    SetCompactBase(*this, nCompact, pfNegative, pfOverflow);
+    return *this;
+}
+
+uint32_t arith_uint512::GetCompact(bool fNegative) const
+{
+    return GetCompactBase(*this, fNegative);
+}
+
 uint256 ArithToUint256(const arith_uint256 &a)
 {
     uint256 b;
@@ -288,6 +288,24 @@ public:
 
     friend uint256 ArithToUint256(const arith_uint256 &);
     friend arith_uint256 UintToArith256(const uint256 &);
+    friend class arith_uint512;
+};
+
+/**
+ * 512-bit unsigned big integer. Wide enough to hold the product of a
+ * 256-bit target and a 64-bit or 128-bit factor without overflow, which
+ * is what the peercoin kernel and retarget calculations need.
+ */
+class arith_uint512 : public base_uint<512> {
+public:
+    arith_uint512() {}
+    arith_uint512(const base_uint<512>& b) : base_uint<512>(b) {}
+    arith_uint512(uint64_t b) : base_uint<512>(b) {}
+    explicit arith_uint512(const arith_uint256& b);
+
+    /** Same "compact" format as arith_uint256, overflowing at 512 bits. */
+    arith_uint512& SetCompact(uint32_t nCompact, bool *pfNegative = nullptr, bool *pfOverflow = nullptr);
+    uint32_t GetCompact(bool fNegative = false) const;
 };
 
 uint256 ArithToUint256(const arith_uint256 &);
@@ -5,8 +5,10 @@
 #include <bench/bench.h>
 #include <coins.h>
 #include <policy/policy.h>
+#include <random.h>
 #include <wallet/crypter.h>
 
+#include <unordered_map>
 #include <vector>
 
 // FIXME: Dedup with SetupDummyInputs in test/transaction_tests.cpp.
@@ -85,3 +87,43 @@ static void CCoinsCaching(benchmark::State& state)
 }
 
 BENCHMARK(CCoinsCaching, 170 * 1000);
+
+// Fill a coins map the way a large dbcache does, look every coin up, spend
+// half of them and clear it again, as FlushStateToDisk would.
+template <typename Map>
+static void CoinsMapMillions(benchmark::State& state)
+{
+    const size_t nCoins = 2000000;
+    FastRandomContext rng(true);
+    std::vector<COutPoint> vOutpoints;
+    vOutpoints.reserve(nCoins);
+    for (size_t i = 0; i < nCoins; i++)
+        vOutpoints.emplace_back(rng.rand256(), rng.randbits(2));
+
+    while (state.KeepRunning()) {
+        Map map;
+        for (const COutPoint& outpoint : vOutpoints) {
+            Coin coin(CTxOut(50 * CENT, CScript() << OP_1), 1, false, false, 0);
+            map.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::forward_as_tuple(std::move(coin)));
+        }
+        for (const COutPoint& outpoint : vOutpoints)
+            assert(map.find(outpoint) != map.end());
+        for (size_t i = 0; i < nCoins; i += 2)
+            map.erase(vOutpoints[i]);
+        assert(memusage::DynamicUsage(map) > 0);
+        map.clear();
+    }
+}
+
+static void CoinsMapMillionsUnordered(benchmark::State& state)
+{
+    CoinsMapMillions<std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> >(state);
+}
+
+static void CoinsMapMillionsFlat(benchmark::State& state)
+{
+    CoinsMapMillions<CCoinsMap>(state);
+}
+
+BENCHMARK(CoinsMapMillionsUnordered, 1);
+BENCHMARK(CoinsMapMillionsFlat, 1);
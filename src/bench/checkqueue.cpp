@@ -10,13 +10,15 @@
 #include <vector>
 #include <boost/thread/thread.hpp>
 #include <random.h>
+#include <crypto/sha256.h>
+#include <uint256.h>
 
 
 static const int MIN_CORES = 2;
 static const size_t BATCHES = 101;
 static const size_t BATCH_SIZE = 30;
 static const int PREVECTOR_SIZE = 28;
-static const unsigned int QUEUE_BATCH_SIZE = 128;
+static const size_t SWEEP_CHECKS = 3000;
 
 // This Benchmark tests the CheckQueue with a slightly realistic workload,
 // where checks all contain a prevector that is indirect 50% of the time
@@ -36,7 +38,7 @@ static void CCheckQueueSpeedPrevectorJob(benchmark::State& state)
         }
         void swap(PrevectorJob& x){p.swap(x.p);};
     };
-    CCheckQueue<PrevectorJob> queue {QUEUE_BATCH_SIZE};
+    CCheckQueue<PrevectorJob> queue;
     boost::thread_group tg;
     for (auto x = 0; x < std::max(MIN_CORES, GetNumCores()); ++x) {
        tg.create_thread([&]{queue.Thread();});
@@ -60,3 +62,59 @@ static void CCheckQueueSpeedPrevectorJob(benchmark::State& state)
     tg.join_all();
 }
 BENCHMARK(CCheckQueueSpeedPrevectorJob, 1400);
+
+// Sweep the number of threads, including the master, and the number of checks
+// added at a time, as one per input of a transaction is in ConnectBlock().
+// Each check hashes a little, so the overhead of the queue shows against some
+// work, and the threads can be seen to scale.
+static void CCheckQueueSweep(benchmark::State& state, int nThreads, size_t nChecksPerAdd)
+{
+    struct HashJob {
+        uint256 hash;
+        bool operator()()
+        {
+            for (int i = 0; i < 4; i++)
+                CSHA256().Write(hash.begin(), 32).Finalize(hash.begin());
+            return true;
+        }
+        void swap(HashJob& x) { std::swap(hash, x.hash); }
+    };
+    CCheckQueue<HashJob> queue;
+    boost::thread_group tg;
+    for (int x = 0; x < nThreads - 1; ++x) {
+       tg.create_thread([&]{queue.Thread();});
+    }
+    while (state.KeepRunning()) {
+        CCheckQueueControl<HashJob> control(&queue);
+        for (size_t n = 0; n < SWEEP_CHECKS; n += nChecksPerAdd) {
+            std::vector<HashJob> vChecks(std::min(nChecksPerAdd, SWEEP_CHECKS - n));
+            control.Add(vChecks);
+        }
+        control.Wait();
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+#define CHECKQUEUE_SWEEP(threads, checks) \
+    static void CCheckQueueSweep_##threads##Threads_##checks##Checks(benchmark::State& state) { CCheckQueueSweep(state, threads, checks); } \
+    BENCHMARK(CCheckQueueSweep_##threads##Threads_##checks##Checks, 300);
+
+CHECKQUEUE_SWEEP(1, 1)
+CHECKQUEUE_SWEEP(1, 30)
+CHECKQUEUE_SWEEP(1, 500)
+CHECKQUEUE_SWEEP(2, 1)
+CHECKQUEUE_SWEEP(2, 30)
+CHECKQUEUE_SWEEP(2, 500)
+CHECKQUEUE_SWEEP(4, 1)
+CHECKQUEUE_SWEEP(4, 30)
+CHECKQUEUE_SWEEP(4, 500)
+CHECKQUEUE_SWEEP(8, 1)
+CHECKQUEUE_SWEEP(8, 30)
+CHECKQUEUE_SWEEP(8, 500)
+CHECKQUEUE_SWEEP(16, 1)
+CHECKQUEUE_SWEEP(16, 30)
+CHECKQUEUE_SWEEP(16, 500)
+CHECKQUEUE_SWEEP(32, 1)
+CHECKQUEUE_SWEEP(32, 30)
+CHECKQUEUE_SWEEP(32, 500)
@@ -6,6 +6,7 @@
 
 #include <bench/bench.h>
 #include <bloom.h>
+#include <consensus/merkle.h>
 #include <hash.h>
 #include <random.h>
 #include <uint256.h>
@@ -52,6 +53,38 @@ static void SHA256_32b(benchmark::State& state)
     }
 }
 
+static void SHA256D_1block(benchmark::State& state, size_t nBlocks)
+{
+    std::vector<uint8_t> in(64 * nBlocks, 0);
+    std::vector<uint8_t> out(32 * nBlocks);
+    while (state.KeepRunning())
+        SHA256DOneBlock(out.data(), in.data(), nBlocks);
+}
+
+static void SHA256D_1block_x1(benchmark::State& state) { SHA256D_1block(state, 1); }
+static void SHA256D_1block_x64(benchmark::State& state) { SHA256D_1block(state, 64); }
+
+static void SHA256D64_1024(benchmark::State& state)
+{
+    std::vector<uint8_t> in(64 * 1024, 0);
+    while (state.KeepRunning())
+        SHA256D64(in.data(), in.data(), 1024);
+}
+
+// The merkle root of a block of 9001 transactions
+static void MerkleRoot(benchmark::State& state)
+{
+    FastRandomContext rng(true);
+    std::vector<uint256> leaves(9001);
+    for (auto& item : leaves)
+        item = rng.rand256();
+    while (state.KeepRunning()) {
+        bool mutation = false;
+        uint256 hash = ComputeMerkleRoot(leaves, &mutation);
+        leaves[mutation] = hash;
+    }
+}
+
 static void SHA512(benchmark::State& state)
 {
     uint8_t hash[CSHA512::OUTPUT_SIZE];
@@ -93,6 +126,10 @@ BENCHMARK(SHA256, 340);
 BENCHMARK(SHA512, 330);
 
 BENCHMARK(SHA256_32b, 4700 * 1000);
+BENCHMARK(SHA256D_1block_x1, 2000 * 1000);
+BENCHMARK(SHA256D_1block_x64, 50 * 1000);
+BENCHMARK(SHA256D64_1024, 7400);
+BENCHMARK(MerkleRoot, 800);
 BENCHMARK(SipHash_32b, 40 * 1000 * 1000);
 BENCHMARK(FastRandom_32bit, 110 * 1000 * 1000);
 BENCHMARK(FastRandom_1bit, 440 * 1000 * 1000);
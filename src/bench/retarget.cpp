@@ -0,0 +1,91 @@
+// Copyright (c) 2017 The Peercoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+
+#include <chain.h>
+#include <chainparams.h>
+#include <pow.h>
+
+#include <vector>
+
+// Retargeting on a synthetic 1M block index that is proof-of-stake only but
+// for a proof-of-work block every POW_GAP blocks. Finding the last
+// proof-of-work blocks used to walk back over the whole gap.
+
+static const int NUM_BLOCKS = 1000000;
+static const int POW_GAP = 100000;
+static const int64_t CHAIN_START_TIME = 1300000000;
+static const int64_t BLOCK_SPACING = 10 * 60;
+
+static std::vector<CBlockIndex> BuildIndex()
+{
+    std::vector<CBlockIndex> vIndex(NUM_BLOCKS);
+    for (int i = 0; i < NUM_BLOCKS; i++) {
+        CBlockIndex& index = vIndex[i];
+        index.nHeight = i;
+        index.nTime = CHAIN_START_TIME + i * BLOCK_SPACING;
+        index.nBits = 0x1c00ffff;
+        index.pprev = i ? &vIndex[i - 1] : nullptr;
+        if (i % POW_GAP != 0)
+            index.SetProofOfStake();
+        index.BuildSkip();
+    }
+    return vIndex;
+}
+
+// The walk GetLastBlockIndex did before the index kept the links
+static const CBlockIndex* GetLastBlockIndexWalk(const CBlockIndex* pindex, bool fProofOfStake)
+{
+    while (pindex && pindex->pprev && (pindex->IsProofOfStake() != fProofOfStake))
+        pindex = pindex->pprev;
+    return pindex;
+}
+
+static void RetargetProofOfWork(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    const Consensus::Params& params = Params().GetConsensus();
+    std::vector<CBlockIndex> vIndex = BuildIndex();
+    const CBlockIndex* pindexTip = &vIndex.back();
+    while (state.KeepRunning()) {
+        GetNextTargetRequired(pindexTip, false, params);
+    }
+}
+
+static void RetargetProofOfStake(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    const Consensus::Params& params = Params().GetConsensus();
+    std::vector<CBlockIndex> vIndex = BuildIndex();
+    const CBlockIndex* pindexTip = &vIndex.back();
+    while (state.KeepRunning()) {
+        GetNextTargetRequired(pindexTip, true, params);
+    }
+}
+
+static void LastProofOfWorkWalk(benchmark::State& state)
+{
+    std::vector<CBlockIndex> vIndex = BuildIndex();
+    const CBlockIndex* pindexTip = &vIndex.back();
+    while (state.KeepRunning()) {
+        const CBlockIndex* pindex = GetLastBlockIndexWalk(pindexTip, false);
+        GetLastBlockIndexWalk(pindex->pprev, false);
+    }
+}
+
+static void LastProofOfWorkLinks(benchmark::State& state)
+{
+    std::vector<CBlockIndex> vIndex = BuildIndex();
+    const CBlockIndex* pindexTip = &vIndex.back();
+    while (state.KeepRunning()) {
+        const CBlockIndex* pindex = GetLastBlockIndex(pindexTip, false);
+        GetLastBlockIndex(pindex->pprev, false);
+    }
+}
+
+BENCHMARK(RetargetProofOfWork, 10000);
+BENCHMARK(RetargetProofOfStake, 10000);
+BENCHMARK(LastProofOfWorkWalk, 10);
+BENCHMARK(LastProofOfWorkLinks, 100000);
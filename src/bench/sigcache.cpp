@@ -0,0 +1,54 @@
+// Copyright (c) 2020 The Peercoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <random.h>
+#include <script/sigcache.h>
+#include <uint256.h>
+
+#include <thread>
+#include <vector>
+
+// Threads looking up and inserting cache entries at the same time, as the
+// script check threads and the message handler do. A single shard stands for
+// the cache behind one lock it replaced.
+
+static const int CACHE_THREADS = 8;
+static const int CACHE_LOOKUPS = 20000;
+static const size_t CACHE_ENTRIES = 1 << 16;
+
+static void SigCacheContention(benchmark::State& state, int nShards)
+{
+    CShardedSignatureCache cache(nShards);
+    cache.Setup(DEFAULT_MAX_SIG_CACHE_SIZE << 20);
+    FastRandomContext rand(true);
+    std::vector<uint256> vEntries(CACHE_ENTRIES);
+    for (size_t i = 0; i < CACHE_ENTRIES; i++) {
+        vEntries[i] = rand.rand256();
+        if (i % 2)
+            cache.Insert(vEntries[i]);
+    }
+
+    while (state.KeepRunning()) {
+        std::vector<std::thread> vThreads;
+        for (int t = 0; t < CACHE_THREADS; t++) {
+            vThreads.emplace_back([&cache, &vEntries, t] {
+                // Half of the lookups hit, the misses are inserted
+                for (int i = 0; i < CACHE_LOOKUPS; i++) {
+                    const uint256& entry = vEntries[(t * 7919 + i * 31) % CACHE_ENTRIES];
+                    if (!cache.Contains(entry, false))
+                        cache.Insert(entry);
+                }
+            });
+        }
+        for (std::thread& thread : vThreads)
+            thread.join();
+    }
+}
+
+static void SigCacheContention1Shard(benchmark::State& state) { SigCacheContention(state, 1); }
+static void SigCacheContention16Shards(benchmark::State& state) { SigCacheContention(state, 16); }
+
+BENCHMARK(SigCacheContention1Shard, 20);
+BENCHMARK(SigCacheContention16Shards, 20);
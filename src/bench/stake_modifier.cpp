@@ -0,0 +1,110 @@
+// Copyright (c) 2017 The Peercoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+
+#include <arith_uint256.h>
+#include <chainparams.h>
+#include <kernel.h>
+#include <validation.h>
+
+#include <memory>
+
+// Looking up the kernel stake modifier on a long synthetic chain, with and
+// without the stake modifier index, and computing the modifiers of a stretch
+// of it as connecting blocks does. The chain has a block every 10 minutes
+// and regenerates the modifier every 6 hours, like mainnet.
+
+static const int NUM_BLOCKS = 500000;
+static const int64_t CHAIN_START_TIME = 1300000000;
+static const int64_t BLOCK_SPACING = 10 * 60;
+
+class CSyntheticChain
+{
+public:
+    std::vector<std::unique_ptr<CBlockIndex> > vIndex;
+
+    CSyntheticChain()
+    {
+        LOCK(cs_main);
+        SelectParams(CBaseChainParams::MAIN);
+        const int64_t nModifierInterval = Params().GetConsensus().nModifierInterval;
+        vIndex.reserve(NUM_BLOCKS);
+        CBlockIndex* pindexPrev = nullptr;
+        for (int i = 0; i < NUM_BLOCKS; i++) {
+            CBlockIndex* pindex = new CBlockIndex();
+            vIndex.emplace_back(pindex);
+            pindex->nHeight = i;
+            pindex->nTime = CHAIN_START_TIME + i * BLOCK_SPACING;
+            pindex->pprev = pindexPrev;
+            bool fGenerated = pindexPrev == nullptr || pindex->nTime / nModifierInterval != pindexPrev->nTime / nModifierInterval;
+            pindex->SetStakeModifier(fGenerated ? (uint64_t)i : pindexPrev->nStakeModifier, fGenerated);
+            BlockMap::iterator mi = mapBlockIndex.insert(std::make_pair(ArithToUint256(arith_uint256(i + 1)), pindex)).first;
+            pindex->phashBlock = &mi->first;
+            pindex->BuildSkip();
+            pindexPrev = pindex;
+        }
+        chainActive.SetTip(pindexPrev);
+        stakeModifierIndex.SetTip(pindexPrev);
+    }
+
+    ~CSyntheticChain()
+    {
+        LOCK(cs_main);
+        chainActive.SetTip(nullptr);
+        stakeModifierIndex.SetTip(nullptr);
+        stakeModifierCandidates.Clear();
+        for (const auto& pindex : vIndex)
+            mapBlockIndex.erase(pindex->GetBlockHash());
+    }
+};
+
+static void StakeModifier(benchmark::State& state, bool fV05, bool fUseIndex)
+{
+    CSyntheticChain chain;
+    LOCK(cs_main);
+    CBlockIndex* pindexPrev = chainActive.Tip();
+    // V0.3 kernels come from a block a month before the V0.5 switch
+    const CBlockIndex* pindexFrom = chain.vIndex[NUM_BLOCKS / 4].get();
+    unsigned int nTimeTx = fV05 ? pindexPrev->nTime + 60 : pindexFrom->nTime + 31 * 24 * 60 * 60;
+    assert(IsProtocolV05(nTimeTx) == fV05);
+
+    uint64_t nStakeModifier;
+    int nStakeModifierHeight;
+    int64_t nStakeModifierTime;
+    while (state.KeepRunning()) {
+        bool fFound = GetKernelStakeModifier(pindexPrev, pindexFrom->GetBlockHash(), nTimeTx, nStakeModifier, nStakeModifierHeight, nStakeModifierTime, false, fUseIndex);
+        assert(fFound);
+    }
+}
+
+static void StakeModifierV03Walk(benchmark::State& state) { StakeModifier(state, false, false); }
+static void StakeModifierV03Index(benchmark::State& state) { StakeModifier(state, false, true); }
+static void StakeModifierV05Walk(benchmark::State& state) { StakeModifier(state, true, false); }
+static void StakeModifierV05Index(benchmark::State& state) { StakeModifier(state, true, true); }
+
+// A day of blocks, selecting the four modifiers generated in it
+static void ComputeStakeModifiers(benchmark::State& state)
+{
+    CSyntheticChain chain;
+    LOCK(cs_main);
+    uint64_t nStakeModifier;
+    bool fGenerated;
+    while (state.KeepRunning()) {
+        stakeModifierCandidates.Clear();
+        for (int i = NUM_BLOCKS - 144; i < NUM_BLOCKS; i++) {
+            CBlockIndex* pindex = chain.vIndex[i].get();
+            pindex->nFlags &= ~CBlockIndex::BLOCK_STAKE_MODIFIER;
+            bool fComputed = ComputeNextStakeModifier(pindex, nStakeModifier, fGenerated);
+            assert(fComputed);
+            pindex->SetStakeModifier(nStakeModifier, fGenerated);
+        }
+    }
+}
+
+BENCHMARK(StakeModifierV03Walk, 1000);
+BENCHMARK(StakeModifierV03Index, 1000);
+BENCHMARK(StakeModifierV05Walk, 100);
+BENCHMARK(StakeModifierV05Index, 1000);
+BENCHMARK(ComputeStakeModifiers, 50);
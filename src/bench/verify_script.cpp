@@ -9,6 +9,7 @@
 #endif
 #include <script/script.h>
 #include <script/sign.h>
+#include <script/standard.h>
 #include <streams.h>
 
 #include <array>
@@ -106,3 +107,33 @@ static void VerifyScriptBench(benchmark::State& state)
 }
 
 BENCHMARK(VerifyScriptBench, 6300);
+
+// The legacy signature hashes of every input of a consolidation-sized
+// transaction, with and without the precomputed midstates.
+static void LegacySighashManyInputs(benchmark::State& state, bool fCached)
+{
+    CMutableTransaction txMutable;
+    txMutable.vin.resize(500);
+    for (size_t i = 0; i < txMutable.vin.size(); i++)
+        txMutable.vin[i].prevout = COutPoint(uint256S(std::to_string(i)), 0);
+    txMutable.vout.resize(2);
+    const CTransaction tx(txMutable);
+    const CScript scriptCode = GetScriptForDestination(CKeyID(uint160()));
+
+    while (state.KeepRunning()) {
+        if (fCached) {
+            const PrecomputedTransactionData txdata(tx);
+            for (unsigned int nIn = 0; nIn < tx.vin.size(); nIn++)
+                SignatureHash(scriptCode, tx, nIn, SIGHASH_ALL, 0, SIGVERSION_BASE, &txdata);
+        } else {
+            for (unsigned int nIn = 0; nIn < tx.vin.size(); nIn++)
+                SignatureHash(scriptCode, tx, nIn, SIGHASH_ALL, 0, SIGVERSION_BASE);
+        }
+    }
+}
+
+static void LegacySighashManyInputsUncached(benchmark::State& state) { LegacySighashManyInputs(state, false); }
+static void LegacySighashManyInputsCached(benchmark::State& state) { LegacySighashManyInputs(state, true); }
+
+BENCHMARK(LegacySighashManyInputsUncached, 2);
+BENCHMARK(LegacySighashManyInputsCached, 5);
@@ -0,0 +1,87 @@
+// Copyright (c) 2020 The Peercoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockfilereader.h>
+
+#include <util.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+CBlockFileReader::Mapping::~Mapping()
+{
+#ifndef WIN32
+    munmap(const_cast<unsigned char*>(pbegin), nSize);
+#endif
+}
+
+static std::shared_ptr<const CBlockFileReader::Mapping> MapFile(const fs::path& path)
+{
+#ifdef WIN32
+    return nullptr;
+#else
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd == -1)
+        return nullptr;
+    struct stat st;
+    void* p = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping outlives the descriptor
+    close(fd);
+    if (p == MAP_FAILED) {
+        LogPrintf("Unable to map %s into memory\n", path.string());
+        return nullptr;
+    }
+    return std::make_shared<const CBlockFileReader::Mapping>(static_cast<const unsigned char*>(p), st.st_size);
+#endif
+}
+
+std::shared_ptr<const CBlockFileReader::Mapping> CBlockFileReader::Get(int nFile, const fs::path& path)
+{
+    {
+        LOCK(cs);
+        if (nMaxMappings == 0)
+            return nullptr;
+        for (auto it = listMappings.begin(); it != listMappings.end(); ++it) {
+            if (it->first == nFile) {
+                listMappings.splice(listMappings.begin(), listMappings, it);
+                return it->second;
+            }
+        }
+    }
+
+    // Map outside of the lock; should two threads map the same file, one mapping is dropped
+    std::shared_ptr<const Mapping> mapping = MapFile(path);
+    if (!mapping)
+        return nullptr;
+
+    LOCK(cs);
+    for (const auto& item : listMappings) {
+        if (item.first == nFile)
+            return item.second;
+    }
+    listMappings.emplace_front(nFile, mapping);
+    while (listMappings.size() > nMaxMappings)
+        listMappings.pop_back();
+    return mapping;
+}
+
+void CBlockFileReader::SetMaxMappings(size_t n)
+{
+    LOCK(cs);
+    nMaxMappings = n;
+    while (listMappings.size() > nMaxMappings)
+        listMappings.pop_back();
+}
+
+size_t CBlockFileReader::Size()
+{
+    LOCK(cs);
+    return listMappings.size();
+}
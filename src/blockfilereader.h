@@ -0,0 +1,68 @@
+// Copyright (c) 2020 The Peercoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILEREADER_H
+#define BITCOIN_BLOCKFILEREADER_H
+
+#include <fs.h>
+#include <sync.h>
+
+#include <list>
+#include <memory>
+#include <utility>
+
+/**
+ * Keeps the most recently read block files mapped into memory, so that
+ * blocks can be deserialized straight from the page cache rather than
+ * through a file opened, seeked and read for each of them. Only files that
+ * are no longer written to may be mapped, as they do not change size.
+ *
+ * Mappings are shared: one dropped from the cache stays valid for those
+ * still reading from it.
+ */
+class CBlockFileReader
+{
+public:
+    //! A whole file mapped read-only into memory
+    class Mapping
+    {
+    private:
+        const unsigned char* pbegin;
+        size_t nSize;
+
+    public:
+        Mapping(const unsigned char* pbeginIn, size_t nSizeIn) : pbegin(pbeginIn), nSize(nSizeIn) {}
+        ~Mapping();
+        Mapping(const Mapping&) = delete;
+        Mapping& operator=(const Mapping&) = delete;
+
+        const unsigned char* begin() const { return pbegin; }
+        const unsigned char* end() const { return pbegin + nSize; }
+        size_t size() const { return nSize; }
+    };
+
+private:
+    CCriticalSection cs;
+    //! Most recently used first
+    std::list<std::pair<int, std::shared_ptr<const Mapping> > > listMappings;
+    size_t nMaxMappings;
+
+public:
+    explicit CBlockFileReader(size_t nMaxMappingsIn) : nMaxMappings(nMaxMappingsIn) {}
+
+    /**
+     * The mapping of the file at path, known as nFile, mapping it if it is
+     * not kept yet. Returns nullptr if no mappings are to be kept, or if the
+     * file cannot be mapped.
+     */
+    std::shared_ptr<const Mapping> Get(int nFile, const fs::path& path);
+
+    //! Keep at most n mappings, 0 to not map files at all
+    void SetMaxMappings(size_t n);
+
+    //! Number of mappings kept
+    size_t Size();
+};
+
+#endif // BITCOIN_BLOCKFILEREADER_H
@@ -0,0 +1,207 @@
+// Copyright (c) 2020 The Peercoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockimport.h>
+
+#include <chainparams.h>
+#include <clientversion.h>
+#include <consensus/validation.h>
+#include <protocol.h>
+#include <streams.h>
+#include <util.h>
+#include <utiltime.h>
+#include <validation.h>
+
+#include <algorithm>
+
+#include <boost/bind.hpp>
+
+struct CBlockImportPipeline::Entry
+{
+    Item item;
+    //! The block as stored, until it is deserialized
+    std::vector<unsigned char> vData;
+    size_t nSize = 0;
+    //! Guarded by the pipeline's mutex
+    bool fDone = false;
+};
+
+CBlockImportPipeline::CBlockImportPipeline(FILE* fileIn, const CChainParams& chainparamsIn, int nWorkers) :
+    chainparams(chainparamsIn), file(fileIn), nFileSize(0), nFrontSeq(0), nParseSeq(0), nPendingBytes(0),
+    nBytesScanned(0), fReadDone(false), fStop(false), nWaitTime(0)
+{
+    long nCur = ftell(file);
+    if (nCur >= 0 && fseek(file, 0, SEEK_END) == 0) {
+        long nEnd = ftell(file);
+        if (nEnd >= nCur)
+            nFileSize = nEnd - nCur;
+        fseek(file, nCur, SEEK_SET);
+    }
+
+    threadRead = boost::thread(&CBlockImportPipeline::ThreadRead, this);
+    for (int i = 0; i < std::max(1, nWorkers); i++)
+        threadsParse.create_thread(boost::bind(&CBlockImportPipeline::ThreadParse, this));
+}
+
+CBlockImportPipeline::~CBlockImportPipeline()
+{
+    Stop();
+}
+
+void CBlockImportPipeline::Stop()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fStop = true;
+    }
+    condRead.notify_all();
+    condParse.notify_all();
+    // Also when the importing thread is being interrupted
+    boost::this_thread::disable_interruption di;
+    threadRead.join();
+    threadsParse.join_all();
+}
+
+void CBlockImportPipeline::ThreadRead()
+{
+    RenameThread("peercoin-importread");
+    try {
+        // This takes over file and calls fclose() on it in the CBufferedFile destructor
+        CBufferedFile blkdat(file, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
+        uint64_t nRewind = blkdat.GetPos();
+        while (!blkdat.eof()) {
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                if (fStop)
+                    break;
+                nBytesScanned = nRewind;
+            }
+
+            blkdat.SetPos(nRewind);
+            nRewind++; // start one byte further next time, in case of failure
+            blkdat.SetLimit(); // remove former limit
+            unsigned int nSize = 0;
+            try {
+                // locate a header
+                unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
+                blkdat.FindByte(chainparams.MessageStart()[0]);
+                nRewind = blkdat.GetPos()+1;
+                blkdat >> FLATDATA(buf);
+                if (memcmp(buf, chainparams.MessageStart(), CMessageHeader::MESSAGE_START_SIZE))
+                    continue;
+                // read size
+                blkdat >> nSize;
+                if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
+                    continue;
+            } catch (const std::exception&) {
+                // no valid block header found; don't complain
+                break;
+            }
+            std::shared_ptr<Entry> entry = std::make_shared<Entry>();
+            try {
+                // read block, to be deserialized by the workers
+                uint64_t nBlockPos = blkdat.GetPos();
+                entry->item.nPos = nBlockPos;
+                blkdat.SetLimit(nBlockPos + nSize);
+                blkdat.SetPos(nBlockPos);
+                entry->vData.resize(nSize);
+                blkdat.read((char*)entry->vData.data(), nSize);
+                nRewind = blkdat.GetPos();
+            } catch (const std::exception& e) {
+                std::vector<unsigned char>().swap(entry->vData);
+                entry->item.strError = e.what();
+            }
+            Push(entry);
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("%s: %s\n", __func__, e.what());
+    }
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    fReadDone = true;
+    nBytesScanned = nFileSize;
+    condParse.notify_all();
+    condNext.notify_all();
+}
+
+void CBlockImportPipeline::Push(const std::shared_ptr<Entry>& entry)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    entry->nSize = entry->vData.size();
+    while (!fStop && !dequeEntries.empty() &&
+           (dequeEntries.size() >= MAX_PENDING_BLOCKS || nPendingBytes + entry->nSize > MAX_PENDING_BYTES))
+        condRead.wait(lock);
+    if (fStop)
+        return;
+    nPendingBytes += entry->nSize;
+    dequeEntries.push_back(entry);
+    condParse.notify_one();
+}
+
+void CBlockImportPipeline::Parse(Entry& entry)
+{
+    if (!entry.item.strError.empty())
+        return;
+    try {
+        std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+        CSpanReader(SER_DISK, CLIENT_VERSION, entry.vData.data(), entry.vData.data() + entry.vData.size()) >> *pblock;
+        entry.item.hash = pblock->GetHash();
+        // AcceptBlock() skips this for blocks that passed, and reports those that did not
+        CValidationState state;
+        if (!CheckBlock(*pblock, state, chainparams.GetConsensus()))
+            pblock->fChecked = false;
+        entry.item.pblock = pblock;
+    } catch (const std::exception& e) {
+        entry.item.strError = e.what();
+    }
+    std::vector<unsigned char>().swap(entry.vData);
+}
+
+void CBlockImportPipeline::ThreadParse()
+{
+    RenameThread("peercoin-importchk");
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (true) {
+        while (!fStop && nParseSeq == nFrontSeq + dequeEntries.size()) {
+            if (fReadDone)
+                return;
+            condParse.wait(lock);
+        }
+        if (fStop)
+            return;
+        std::shared_ptr<Entry> entry = dequeEntries[nParseSeq - nFrontSeq];
+        nParseSeq++;
+        lock.unlock();
+        Parse(*entry);
+        lock.lock();
+        entry->fDone = true;
+        if (entry == dequeEntries.front())
+            condNext.notify_one();
+    }
+}
+
+bool CBlockImportPipeline::Next(Item& item)
+{
+    int64_t nStart = GetTimeMicros();
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (dequeEntries.empty() ? !fReadDone : !dequeEntries.front()->fDone)
+        condNext.wait(lock);
+    nWaitTime += GetTimeMicros() - nStart;
+    if (dequeEntries.empty())
+        return false;
+
+    std::shared_ptr<Entry> entry = dequeEntries.front();
+    dequeEntries.pop_front();
+    nFrontSeq++;
+    nPendingBytes -= entry->nSize;
+    condRead.notify_one();
+    item = std::move(entry->item);
+    return true;
+}
+
+uint64_t CBlockImportPipeline::GetBytesScanned()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return nBytesScanned;
+}
@@ -0,0 +1,97 @@
+// Copyright (c) 2020 The Peercoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKIMPORT_H
+#define BITCOIN_BLOCKIMPORT_H
+
+#include <primitives/block.h>
+#include <uint256.h>
+
+#include <deque>
+#include <memory>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+class CChainParams;
+
+/**
+ * Reads the blocks of an import file (a block file being reindexed,
+ * bootstrap.dat or a -loadblock file) ahead of the thread importing them.
+ * One thread scans the file for blocks, a few others deserialize them and
+ * run the context-free CheckBlock() on them, and Next() hands them out in
+ * file order. The blocks read but not handed out yet are limited in number
+ * and size, which holds the scanning thread back.
+ */
+class CBlockImportPipeline
+{
+public:
+    //! Most blocks, and bytes of them as stored, read ahead
+    static const size_t MAX_PENDING_BLOCKS = 1024;
+    static const size_t MAX_PENDING_BYTES = 32 << 20;
+
+    struct Item
+    {
+        //! Where the block starts in the file
+        uint64_t nPos = 0;
+        //! Null if the block could not be read; strError says why
+        std::shared_ptr<CBlock> pblock;
+        uint256 hash;
+        std::string strError;
+    };
+
+private:
+    struct Entry;
+
+    const CChainParams& chainparams;
+    FILE* file;
+    uint64_t nFileSize;
+
+    boost::mutex mutex;
+    boost::condition_variable condRead;
+    boost::condition_variable condParse;
+    boost::condition_variable condNext;
+    //! Blocks read and not handed out yet, in file order. Guarded by mutex.
+    std::deque<std::shared_ptr<Entry> > dequeEntries;
+    //! Sequence numbers of the front entry and of the next one to deserialize
+    uint64_t nFrontSeq;
+    uint64_t nParseSeq;
+    size_t nPendingBytes;
+    uint64_t nBytesScanned;
+    bool fReadDone;
+    bool fStop;
+
+    int64_t nWaitTime;
+
+    boost::thread threadRead;
+    boost::thread_group threadsParse;
+
+    void ThreadRead();
+    void ThreadParse();
+    //! Queue a block read from the file, waiting for room
+    void Push(const std::shared_ptr<Entry>& entry);
+    void Parse(Entry& entry);
+    void Stop();
+
+public:
+    /** Start reading fileIn, which is closed when done, with nWorkers threads deserializing its blocks */
+    CBlockImportPipeline(FILE* fileIn, const CChainParams& chainparamsIn, int nWorkers);
+    ~CBlockImportPipeline();
+
+    //! Wait for the next block of the file. Returns false once all were handed out.
+    bool Next(Item& item);
+
+    //! Bytes of the file scanned, and its size (0 if unknown)
+    uint64_t GetBytesScanned();
+    uint64_t GetFileSize() const { return nFileSize; }
+
+    //! Microseconds Next() waited for blocks to be read and checked
+    int64_t GetWaitTime() const { return nWaitTime; }
+};
+
+#endif // BITCOIN_BLOCKIMPORT_H
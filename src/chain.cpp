@@ -5,6 +5,11 @@
 
 #include <chain.h>
 
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+
 /**
  * CChain implementation
  */
@@ -115,7 +120,149 @@ CBlockIndex* CBlockIndex::GetAncestor(int height)
 void CBlockIndex::BuildSkip()
 {
     if (pprev)
+    {
         pskip = pprev->GetAncestor(GetSkipHeight(nHeight));
+        pprevPoS = pprev->IsProofOfStake() ? pprev : pprev->pprevPoS;
+        pprevPoW = pprev->IsProofOfWork() ? pprev : pprev->pprevPoW;
+    }
+}
+
+namespace {
+
+struct CStakeSource
+{
+    COutPoint prevout;
+    unsigned int nTime;
+};
+
+/**
+ * Storage for heap allocated block index entries. Entries are carved out of
+ * chunks of CHUNK_SIZE, and freed ones are kept on a list for reuse, so the
+ * index has no per-entry allocation overhead and is laid out contiguously.
+ * Also holds the kernels of the proof-of-stake entries.
+ */
+class CBlockIndexPool
+{
+    static const size_t CHUNK_SIZE = 4096;
+
+    typedef std::aligned_storage<sizeof(CBlockIndex), alignof(CBlockIndex)>::type storage_type;
+
+    std::mutex cs;
+    std::vector<std::unique_ptr<storage_type[]> > vChunks;
+    size_t nChunkUsed = CHUNK_SIZE;
+    std::vector<void*> vFree;
+    size_t nAllocated = 0;
+    std::deque<CStakeSource> vStakeSource;
+    std::vector<uint32_t> vFreeStakeSource;
+
+public:
+    void* Allocate()
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        nAllocated++;
+        if (!vFree.empty()) {
+            void* p = vFree.back();
+            vFree.pop_back();
+            return p;
+        }
+        if (nChunkUsed == CHUNK_SIZE) {
+            vChunks.emplace_back(new storage_type[CHUNK_SIZE]);
+            nChunkUsed = 0;
+        }
+        return &vChunks.back()[nChunkUsed++];
+    }
+
+    void Free(void* p)
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        if (--nAllocated == 0) {
+            // Give the memory back once the whole index is unloaded
+            vChunks.clear();
+            nChunkUsed = CHUNK_SIZE;
+            vFree.clear();
+            vFree.shrink_to_fit();
+            return;
+        }
+        vFree.push_back(p);
+    }
+
+    void SetStakeSource(CStakeSourceRef& ref, const COutPoint& prevout, unsigned int nTime)
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        if (ref.nPos == CStakeSourceRef::NONE) {
+            if (!vFreeStakeSource.empty()) {
+                ref.nPos = vFreeStakeSource.back();
+                vFreeStakeSource.pop_back();
+            } else {
+                assert(vStakeSource.size() < CStakeSourceRef::NONE);
+                ref.nPos = vStakeSource.size();
+                vStakeSource.emplace_back();
+            }
+        }
+        vStakeSource[ref.nPos].prevout = prevout;
+        vStakeSource[ref.nPos].nTime = nTime;
+    }
+
+    void GetStakeSource(const CStakeSourceRef& ref, COutPoint& prevout, unsigned int& nTime)
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        prevout = vStakeSource[ref.nPos].prevout;
+        nTime = vStakeSource[ref.nPos].nTime;
+    }
+
+    void ReleaseStakeSource(const CStakeSourceRef& ref)
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        vFreeStakeSource.push_back(ref.nPos);
+        if (vFreeStakeSource.size() == vStakeSource.size()) {
+            vStakeSource.clear();
+            vStakeSource.shrink_to_fit();
+            vFreeStakeSource.clear();
+            vFreeStakeSource.shrink_to_fit();
+        }
+    }
+};
+
+CBlockIndexPool blockIndexPool;
+
+} // namespace
+
+CStakeSourceRef::~CStakeSourceRef()
+{
+    if (nPos != NONE)
+        blockIndexPool.ReleaseStakeSource(*this);
+}
+
+void CBlockIndex::SetStakeSource(const COutPoint& prevoutStake, unsigned int nStakeTime)
+{
+    blockIndexPool.SetStakeSource(stakeSource, prevoutStake, nStakeTime);
+}
+
+void CBlockIndex::GetStakeSource(COutPoint& prevoutStake, unsigned int& nStakeTime) const
+{
+    if (stakeSource.nPos == CStakeSourceRef::NONE) {
+        prevoutStake.SetNull();
+        nStakeTime = 0;
+        return;
+    }
+    blockIndexPool.GetStakeSource(stakeSource, prevoutStake, nStakeTime);
+}
+
+void* CBlockIndex::operator new(size_t nSize)
+{
+    // Derived classes are allocated normally
+    if (nSize != sizeof(CBlockIndex))
+        return ::operator new(nSize);
+    return blockIndexPool.Allocate();
+}
+
+void CBlockIndex::operator delete(void* p, size_t nSize)
+{
+    if (p == nullptr)
+        return;
+    if (nSize != sizeof(CBlockIndex))
+        return ::operator delete(p);
+    blockIndexPool.Free(p);
 }
 
 arith_uint256 GetBlockTrust(const CBlockIndex& block)
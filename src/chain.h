@@ -169,6 +169,21 @@ enum BlockStatus: uint32_t {
  * candidates to be the next block. A blockindex may have multiple pprev pointing
  * to it, but at most one of them can be part of the currently active branch.
  */
+/** peercoin: position of the stake kernel of a block index entry in a side
+ *  table. It belongs to the entry it was set on: copies don't share it, and
+ *  it is released with the entry. */
+class CStakeSourceRef
+{
+public:
+    static const uint32_t NONE = 0xffffffff;
+    uint32_t nPos;
+
+    CStakeSourceRef() : nPos(NONE) {}
+    CStakeSourceRef(const CStakeSourceRef&) : nPos(NONE) {}
+    CStakeSourceRef& operator=(const CStakeSourceRef&) { return *this; }
+    ~CStakeSourceRef();
+};
+
 class CBlockIndex
 {
 public:
@@ -181,6 +196,11 @@ public:
     //! pointer to the index of some further predecessor of this block
     CBlockIndex* pskip;
 
+    //! (memory only) pointers to the index of the last proof-of-stake and
+    //! proof-of-work predecessors of this block, if any
+    CBlockIndex* pprevPoS;
+    CBlockIndex* pprevPoW;
+
     //! height of the entry in the chain. The genesis block has height 0
     int nHeight;
 
@@ -222,10 +242,6 @@ public:
     unsigned int nTimeMax;
 
 // peercoin
-    // peercoin: money supply related block index fields
-    int64_t nMint;
-    int64_t nMoneySupply;
-
     // peercoin: proof-of-stake related block index fields
     unsigned int nFlags;  // peercoin: block index flags
     enum
@@ -234,11 +250,17 @@ public:
         BLOCK_STAKE_ENTROPY  = (1 << 1), // entropy bit for stake modifier
         BLOCK_STAKE_MODIFIER = (1 << 2), // regenerated stake modifier
     };
+
+    // peercoin: money supply related block index fields
+    int64_t nMint;
+    int64_t nMoneySupply;
+
     uint64_t nStakeModifier; // hash modifier for proof-of-stake
     unsigned int nStakeModifierChecksum; // checksum of index; in-memeory only
-    COutPoint prevoutStake;
-    unsigned int nStakeTime;
     uint256 hashProofOfStake;
+    // The kernel of a proof-of-stake block is only needed to write the entry
+    // to disk, so it is kept in a side table
+    CStakeSourceRef stakeSource;
 
     bool IsProofOfWork() const
     {
@@ -279,6 +301,15 @@ public:
         if (fGeneratedStakeModifier)
             nFlags |= BLOCK_STAKE_MODIFIER;
     }
+
+    //! Record the kernel of a proof-of-stake block
+    void SetStakeSource(const COutPoint& prevoutStake, unsigned int nStakeTime);
+    //! Look up the kernel of a proof-of-stake block, null if unknown
+    void GetStakeSource(COutPoint& prevoutStake, unsigned int& nStakeTime) const;
+
+    //! Heap allocated entries come from a pool of contiguous chunks
+    static void* operator new(size_t nSize);
+    static void operator delete(void* p, size_t nSize);
 // peercoin end
 
     void SetNull()
@@ -286,6 +317,8 @@ public:
         phashBlock = nullptr;
         pprev = nullptr;
         pskip = nullptr;
+        pprevPoS = nullptr;
+        pprevPoW = nullptr;
         nHeight = 0;
         nFile = 0;
         nDataPos = 0;
@@ -310,8 +343,6 @@ public:
         nStakeModifier = 0;
         nStakeModifierChecksum = 0;
         hashProofOfStake = uint256();
-        prevoutStake.SetNull();
-        nStakeTime = 0;
     }
 
     CBlockIndex()
@@ -421,6 +452,9 @@ public:
 
     std::string ToString() const
     {
+        COutPoint prevoutStake;
+        unsigned int nStakeTime;
+        GetStakeSource(prevoutStake, nStakeTime);
         return strprintf("CBlockIndex(nprev=%08x, nFile=%d, nHeight=%d, nMint=%s, nMoneySupply=%s, nFlags=(%s)(%d)(%s), nStakeModifier=%016llx, nStakeModifierChecksum=%08x, hashProofOfStake=%s, prevoutStake=(%s), nStakeTime=%d merkle=%s, hashBlock=%s)",
             pprev, nFile, nHeight,
             FormatMoney(nMint), FormatMoney(nMoneySupply),
@@ -455,7 +489,8 @@ public:
         return false;
     }
 
-    //! Build the skiplist pointer for this entry.
+    //! Build the skiplist pointer and the last proof-of-stake and
+    //! proof-of-work links for this entry. Requires pprev to be built.
     void BuildSkip();
 
     //! Efficiently find an ancestor of this block.
@@ -475,13 +510,17 @@ class CDiskBlockIndex : public CBlockIndex
 {
 public:
     uint256 hashPrev;
+    COutPoint prevoutStake;
+    unsigned int nStakeTime;
 
     CDiskBlockIndex() {
         hashPrev = uint256();
+        nStakeTime = 0;
     }
 
     explicit CDiskBlockIndex(const CBlockIndex* pindex) : CBlockIndex(*pindex) {
         hashPrev = (pprev ? pprev->GetBlockHash() : uint256());
+        pindex->GetStakeSource(prevoutStake, nStakeTime);
     }
 
     ADD_SERIALIZE_METHODS;
@@ -5,9 +5,14 @@
 #ifndef BITCOIN_CHECKQUEUE_H
 #define BITCOIN_CHECKQUEUE_H
 
+#include <crypto/common.h>
 #include <sync.h>
 
 #include <algorithm>
+#include <assert.h>
+#include <atomic>
+#include <memory>
+#include <thread>
 #include <vector>
 
 #include <boost/thread/condition_variable.hpp>
@@ -16,111 +21,297 @@
 template <typename T>
 class CCheckQueueControl;
 
-/** 
+/**
+ * Work stealing deque of ranges of queued checks, after Chase and Lev, with
+ * the memory orderings of Lê et al., "Correct and Efficient Work-Stealing for
+ * Weak Memory Models" (2013). Its owner pushes and takes at the bottom
+ * without taking a lock, the other threads steal from the top. Ranges are
+ * packed as end << 32 | begin, and 0 means there was none.
+ */
+class CCheckRangeDeque
+{
+private:
+    struct Buffer
+    {
+        const int64_t nMask;
+        std::unique_ptr<std::atomic<uint64_t>[]> data;
+
+        explicit Buffer(int64_t nSize) : nMask(nSize - 1), data(new std::atomic<uint64_t>[nSize]) {}
+        uint64_t Get(int64_t i) const { return data[i & nMask].load(std::memory_order_relaxed); }
+        void Put(int64_t i, uint64_t range) { data[i & nMask].store(range, std::memory_order_relaxed); }
+    };
+
+    //! Next position to steal from. Kept off the cache line of nBottom, which only the owner writes.
+    std::atomic<int64_t> nTop;
+    char padding[64];
+    std::atomic<int64_t> nBottom;
+    std::atomic<Buffer*> pbuffer;
+
+    //! All buffers, including the ones grown out of that thieves may still be reading
+    std::vector<std::unique_ptr<Buffer> > vBuffers;
+
+public:
+    CCheckRangeDeque() : nTop(0), nBottom(0)
+    {
+        vBuffers.emplace_back(new Buffer(32));
+        pbuffer.store(vBuffers.back().get(), std::memory_order_relaxed);
+    }
+
+    CCheckRangeDeque(const CCheckRangeDeque&) = delete;
+    CCheckRangeDeque& operator=(const CCheckRangeDeque&) = delete;
+
+    //! Owner only: add a range at the bottom
+    void Push(uint64_t range)
+    {
+        int64_t b = nBottom.load(std::memory_order_relaxed);
+        int64_t t = nTop.load(std::memory_order_acquire);
+        Buffer* buffer = pbuffer.load(std::memory_order_relaxed);
+        if (b - t > buffer->nMask) {
+            Buffer* bufferNew = new Buffer(2 * (buffer->nMask + 1));
+            vBuffers.emplace_back(bufferNew);
+            for (int64_t i = t; i < b; i++)
+                bufferNew->Put(i, buffer->Get(i));
+            pbuffer.store(bufferNew, std::memory_order_release);
+            buffer = bufferNew;
+        }
+        buffer->Put(b, range);
+        std::atomic_thread_fence(std::memory_order_release);
+        nBottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    //! Owner only: remove the range at the bottom, the one pushed last
+    uint64_t Take()
+    {
+        int64_t b = nBottom.load(std::memory_order_relaxed) - 1;
+        Buffer* buffer = pbuffer.load(std::memory_order_relaxed);
+        nBottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = nTop.load(std::memory_order_relaxed);
+        uint64_t range = 0;
+        if (t <= b) {
+            range = buffer->Get(b);
+            if (t == b) {
+                // The last range left: race the thieves for it
+                if (!nTop.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                    range = 0;
+                nBottom.store(b + 1, std::memory_order_relaxed);
+            }
+        } else {
+            nBottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return range;
+    }
+
+    //! Any thread: remove the range at the top, the oldest one
+    uint64_t Steal()
+    {
+        while (true) {
+            int64_t t = nTop.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t b = nBottom.load(std::memory_order_acquire);
+            if (t >= b)
+                return 0;
+            uint64_t range = pbuffer.load(std::memory_order_acquire)->Get(t);
+            if (nTop.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                return range;
+            // Another thread took it first, try the next one
+        }
+    }
+
+    //! Owner only: whether everything pushed has been taken or stolen
+    bool Empty() const
+    {
+        return nBottom.load(std::memory_order_relaxed) <= nTop.load(std::memory_order_relaxed);
+    }
+};
+
+/**
  * Queue for verifications that have to be performed.
-  * The verifications are represented by a type T, which must provide an
-  * operator(), returning a bool.
-  *
-  * One thread (the master) is assumed to push batches of verifications
-  * onto the queue, where they are processed by N-1 worker threads. When
-  * the master is done adding work, it temporarily joins the worker pool
-  * as an N'th worker, until all jobs are done.
-  */
+ * The verifications are represented by a type T, which must provide an
+ * operator(), returning a bool.
+ *
+ * One thread (the master) is assumed to push batches of verifications
+ * onto the queue, where they are processed by N-1 worker threads. When
+ * the master is done adding work, it temporarily joins the worker pool
+ * as an N'th worker, until all jobs are done.
+ *
+ * Each batch added becomes a range of checks on the master's deque. Every
+ * worker has a deque of its own, and an idle thread steals the oldest range
+ * of another one. A thread running a range keeps half of what is left of it
+ * up for stealing on its deque whenever that deque is empty, so ranges are
+ * split only as far as there are threads to take them. Ranges are run from
+ * their end, the checks added last first. Adding checks and running them
+ * takes no lock: the mutex is only taken to put idle threads to sleep and to
+ * wake them up again.
+ *
+ * Adding is done by one thread at a time: the one holding ControlMutex or,
+ * for a queue that is never waited for, whichever lock its caller holds.
+ */
 template <typename T>
 class CCheckQueue
 {
 private:
-    //! Mutex to protect the inner state
+    //! Deques of the master (the first) and the workers
+    static const int MAX_DEQUES = 1 + 64;
+
+    //! Rounds of stealing an idle thread tries before going to sleep
+    static const int IDLE_ROUNDS = 64;
+
+    //! The checks of the first segment of the storage, each one after that is twice as large
+    static const int FIRST_SEGMENT_BITS = 6;
+
+    //! Mutex for the idle threads to sleep on
     boost::mutex mutex;
 
     //! Worker threads block on this when out of work
     boost::condition_variable condWorker;
 
-    //! Master thread blocks on this when out of work
+    //! Master thread blocks on this when waiting for the workers to finish
     boost::condition_variable condMaster;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
+    //! The deques, of which the first nDeques are in use
+    std::atomic<CCheckRangeDeque*> vpDeques[MAX_DEQUES];
+    std::atomic<int> nDeques;
 
-    //! The number of workers (including the master) that are idle.
-    int nIdle;
-
-    //! The total number of workers (including the master).
-    int nTotal;
+    /**
+     * The checks added. They are never moved, so ranges of them can be run
+     * while more are added, and the storage is reused from the start when
+     * nothing is left to run.
+     */
+    std::vector<std::unique_ptr<T[]> > vSegments;
 
-    //! The temporary evaluation result.
-    bool fAllOk;
+    //! Position in the storage of the next check added. Only used by the adding thread.
+    uint32_t nNext;
 
     /**
      * Number of verifications that haven't completed yet.
-     * This includes elements that are no longer queued, but still in the
-     * worker's own batches.
+     * A check counts as completed once it has run and has been destroyed.
      */
-    unsigned int nTodo;
+    std::atomic<unsigned int> nTodo;
+
+    //! The temporary evaluation result.
+    std::atomic<bool> fAllOk;
+
+    //! Bumped whenever a range is pushed, for the threads going to sleep to notice
+    std::atomic<uint64_t> nEpoch;
+
+    //! The number of workers asleep
+    std::atomic<int> nSleeping;
+
+    //! Whether the master is asleep
+    std::atomic<bool> fMasterSleeping;
+
+    static uint64_t MakeRange(uint32_t nBegin, uint32_t nEnd) { return (uint64_t)nEnd << 32 | nBegin; }
+
+    T& At(uint32_t nPos)
+    {
+        uint64_t n = (uint64_t)nPos + (1 << FIRST_SEGMENT_BITS);
+        int bits = CountBits(n) - 1;
+        return vSegments[bits - FIRST_SEGMENT_BITS][n - ((uint64_t)1 << bits)];
+    }
+
+    //! Make sure the storage extends to nPos
+    void Reserve(uint32_t nPos)
+    {
+        uint64_t n = (uint64_t)nPos + (1 << FIRST_SEGMENT_BITS);
+        int bits = CountBits(n) - 1;
+        if (!vSegments[bits - FIRST_SEGMENT_BITS])
+            vSegments[bits - FIRST_SEGMENT_BITS].reset(new T[(size_t)1 << bits]);
+    }
+
+    //! Wake up workers for a range just pushed
+    void Notify(bool fAll)
+    {
+        nEpoch.fetch_add(1);
+        if (nSleeping.load() > 0) {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (fAll)
+                condWorker.notify_all();
+            else
+                condWorker.notify_one();
+        }
+    }
 
-    //! The maximum number of elements to be processed in one batch
-    unsigned int nBatchSize;
+    //! Steal a range from any deque other than nSelf, 0 if they are all empty
+    uint64_t Steal(int nSelf)
+    {
+        int n = nDeques.load(std::memory_order_acquire);
+        for (int i = 1; i <= n; i++) {
+            CCheckRangeDeque* pdeque = vpDeques[(nSelf + i) % n].load(std::memory_order_acquire);
+            if (pdeque == nullptr || (nSelf + i) % n == nSelf)
+                continue;
+            uint64_t range = pdeque->Steal();
+            if (range)
+                return range;
+        }
+        return 0;
+    }
+
+    //! Run a range of checks, from its end, offering part of the rest to the other threads
+    void Run(uint64_t range, CCheckRangeDeque& deque)
+    {
+        uint32_t nBegin = (uint32_t)range, nEnd = range >> 32;
+        unsigned int nDone = 0;
+        while (nEnd > nBegin) {
+            if (nEnd - nBegin > 1 && deque.Empty()) {
+                uint32_t nMid = nBegin + (nEnd - nBegin) / 2;
+                deque.Push(MakeRange(nBegin, nMid));
+                Notify(false);
+                nBegin = nMid;
+            }
+            T check;
+            check.swap(At(--nEnd));
+            // Check whether we need to do work at all
+            if (fAllOk.load(std::memory_order_relaxed) && !check())
+                fAllOk.store(false, std::memory_order_relaxed);
+            nDone++;
+        }
+        if (nTodo.fetch_sub(nDone) == nDone && fMasterSleeping.load()) {
+            // We processed the last element; inform the master it can exit and return the result
+            boost::unique_lock<boost::mutex> lock(mutex);
+            condMaster.notify_one();
+        }
+    }
 
     /** Internal function that does bulk of the verification work. */
-    bool Loop(bool fMaster = false)
-    {
-        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
-        std::vector<T> vChecks;
-        vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
-        do {
-            {
-                boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master it can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
-                }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if (fMaster && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
-                    }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
-                }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
+    void Loop(int nSelf, bool fMaster)
+    {
+        CCheckRangeDeque& deque = *vpDeques[nSelf].load(std::memory_order_relaxed);
+        int nIdleRounds = 0;
+        while (!fMaster || nTodo.load() != 0) {
+            uint64_t nEpochSeen = nEpoch.load();
+            uint64_t range = deque.Take();
+            if (!range)
+                range = Steal(nSelf);
+            if (range) {
+                Run(range, deque);
+                nIdleRounds = 0;
+                continue;
+            }
+            if (++nIdleRounds < IDLE_ROUNDS) {
+                std::this_thread::yield();
+                continue;
+            }
+            nIdleRounds = 0;
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (fMaster) {
+                // What is left is being run by the workers
+                fMasterSleeping.store(true);
+                while (nTodo.load() != 0)
+                    condMaster.wait(lock);
+                fMasterSleeping.store(false);
+            } else {
+                nSleeping++;
+                try {
+                    while (nEpoch.load() == nEpochSeen)
+                        condWorker.wait(lock);
+                } catch (...) {
+                    nSleeping--;
+                    throw;
                 }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
+                nSleeping--;
             }
-            // execute work
-            for (T& check : vChecks)
-                if (fOk)
-                    fOk = check();
-            vChecks.clear();
-        } while (true);
+        }
     }
 
 public:
@@ -128,42 +319,61 @@ public:
     boost::mutex ControlMutex;
 
     //! Create a new check queue
-    explicit CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), nBatchSize(nBatchSizeIn) {}
+    CCheckQueue() : nDeques(1), vSegments(32), nNext(0), nTodo(0), fAllOk(true), nEpoch(0), nSleeping(0), fMasterSleeping(false)
+    {
+        vpDeques[0].store(new CCheckRangeDeque(), std::memory_order_relaxed);
+        for (int i = 1; i < MAX_DEQUES; i++)
+            vpDeques[i].store(nullptr, std::memory_order_relaxed);
+    }
+
+    CCheckQueue(const CCheckQueue&) = delete;
+    CCheckQueue& operator=(const CCheckQueue&) = delete;
 
     //! Worker thread
     void Thread()
     {
-        Loop();
+        int nSelf = nDeques.fetch_add(1);
+        assert(nSelf < MAX_DEQUES);
+        vpDeques[nSelf].store(new CCheckRangeDeque(), std::memory_order_release);
+        Loop(nSelf, false);
     }
 
     //! Wait until execution finishes, and return whether all evaluations were successful.
     bool Wait()
     {
-        return Loop(true);
+        Loop(0, true);
+        // The storage can be reused from the start
+        nNext = 0;
+        // reset the status for new work later
+        return fAllOk.exchange(true);
     }
 
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
+        if (vChecks.empty())
+            return;
+        if (nTodo.load() == 0)
+            nNext = 0;
+        uint32_t nBegin = nNext;
         for (T& check : vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
+            Reserve(nNext);
+            check.swap(At(nNext++));
         }
         nTodo += vChecks.size();
-        if (vChecks.size() == 1)
-            condWorker.notify_one();
-        else if (vChecks.size() > 1)
-            condWorker.notify_all();
+        vpDeques[0].load(std::memory_order_relaxed)->Push(MakeRange(nBegin, nNext));
+        Notify(vChecks.size() > 1);
     }
 
     ~CCheckQueue()
     {
+        for (int i = 0; i < MAX_DEQUES; i++)
+            delete vpDeques[i].load(std::memory_order_relaxed);
     }
 
 };
 
-/** 
+/**
  * RAII-style controller object for a CCheckQueue that guarantees the passed
  * queue is finished before continuing.
  */
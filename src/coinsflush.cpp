@@ -0,0 +1,163 @@
+// Copyright (c) 2020 The Peercoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <coinsflush.h>
+
+#include <txdb.h>
+#include <util.h>
+#include <utiltime.h>
+
+CCoinsViewFlusher::CCoinsViewFlusher(CCoinsViewDB* dbIn) : db(dbIn), nSnapshotUsage(0), fFailed(false), fNextInBackground(false), nNextUsage(0) {}
+
+CCoinsViewFlusher::~CCoinsViewFlusher()
+{
+    WaitForWrite();
+}
+
+bool CCoinsViewFlusher::GetCoin(const COutPoint& outpoint, Coin& coin) const
+{
+    {
+        boost::shared_lock<boost::shared_mutex> lock(mutex);
+        if (!hashSnapshot.IsNull()) {
+            CCoinsMap::const_iterator it = mapSnapshot.find(outpoint);
+            if (it != mapSnapshot.end()) {
+                if (it->second.coin.IsSpent())
+                    return false;
+                coin = it->second.coin;
+                return true;
+            }
+        }
+    }
+    // Coins left out of the snapshot are not touched by its write
+    return db->GetCoin(outpoint, coin);
+}
+
+bool CCoinsViewFlusher::HaveCoin(const COutPoint& outpoint) const
+{
+    Coin coin;
+    return GetCoin(outpoint, coin);
+}
+
+uint256 CCoinsViewFlusher::GetBestBlock() const
+{
+    {
+        boost::shared_lock<boost::shared_mutex> lock(mutex);
+        if (!hashSnapshot.IsNull())
+            return hashSnapshot;
+    }
+    return db->GetBestBlock();
+}
+
+std::vector<uint256> CCoinsViewFlusher::GetHeadBlocks() const
+{
+    return db->GetHeadBlocks();
+}
+
+bool CCoinsViewFlusher::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
+{
+    if (!WaitForWrite())
+        return false;
+
+    if (!fNextInBackground) {
+        size_t nChanged = 0, nBytes = 0;
+        int64_t nStart = GetTimeMicros();
+        // The caller clears mapCoins afterwards anyway
+        bool fOk = db->WriteSnapshot(mapCoins, hashBlock, nChanged, nBytes);
+        if (fOk)
+            RecordWrite(nChanged, nBytes, GetTimeMicros() - nStart, false);
+        return fOk;
+    }
+
+    {
+        boost::unique_lock<boost::shared_mutex> lock(mutex);
+        mapSnapshot.swap(mapCoins);
+        hashSnapshot = hashBlock;
+        nSnapshotUsage = nNextUsage;
+    }
+    threadWrite = boost::thread(&CCoinsViewFlusher::ThreadWrite, this);
+    return true;
+}
+
+CCoinsViewCursor* CCoinsViewFlusher::Cursor() const
+{
+    return db->Cursor();
+}
+
+size_t CCoinsViewFlusher::EstimateSize() const
+{
+    return db->EstimateSize();
+}
+
+bool CCoinsViewFlusher::FlushInBackground(CCoinsViewCache& cache)
+{
+    fNextInBackground = true;
+    nNextUsage = cache.DynamicMemoryUsage();
+    bool fOk = cache.Flush();
+    fNextInBackground = false;
+    return fOk;
+}
+
+bool CCoinsViewFlusher::WaitForWrite()
+{
+    if (threadWrite.joinable())
+        threadWrite.join();
+    return !fFailed;
+}
+
+void CCoinsViewFlusher::ThreadWrite()
+{
+    RenameThread("peercoin-coinsflush");
+    size_t nChanged = 0, nBytes = 0;
+    int64_t nStart = GetTimeMicros();
+    bool fOk;
+    try {
+        fOk = db->WriteSnapshot(mapSnapshot, hashSnapshot, nChanged, nBytes);
+    } catch (const std::exception& e) {
+        LogPrintf("%s: %s\n", __func__, e.what());
+        fOk = false;
+    }
+    if (!fOk) {
+        // Keep serving the snapshot; the next flush reports the failure
+        LogPrintf("%s: failed to write to coin database\n", __func__);
+        fFailed = true;
+        return;
+    }
+    int64_t nDuration = GetTimeMicros() - nStart;
+    RecordWrite(nChanged, nBytes, nDuration, true);
+    LogPrint(BCLog::COINDB, "Wrote %u coins (%.2f MiB) to the coin database in the background in %.2fs\n", (unsigned int)nChanged, nBytes * (1.0 / 1048576.0), nDuration * 0.000001);
+
+    // Free the snapshot outside of the lock
+    CCoinsMap mapWritten;
+    {
+        boost::unique_lock<boost::shared_mutex> lock(mutex);
+        mapWritten.swap(mapSnapshot);
+        hashSnapshot.SetNull();
+        nSnapshotUsage = 0;
+    }
+}
+
+void CCoinsViewFlusher::RecordWrite(size_t nChanged, size_t nBytes, int64_t nDuration, bool fBackground)
+{
+    std::lock_guard<std::mutex> lock(csStats);
+    stats.nFlushes++;
+    if (fBackground)
+        stats.nBackgroundFlushes++;
+    stats.nLastCoins = nChanged;
+    stats.nLastBytes = nBytes;
+    stats.nLastDuration = nDuration;
+    stats.nTotalBytes += nBytes;
+    stats.nTotalDuration += nDuration;
+}
+
+CCoinsFlushStats CCoinsViewFlusher::GetStats() const
+{
+    CCoinsFlushStats ret;
+    {
+        std::lock_guard<std::mutex> lock(csStats);
+        ret = stats;
+    }
+    boost::shared_lock<boost::shared_mutex> lock(mutex);
+    ret.fInProgress = !hashSnapshot.IsNull() && !fFailed;
+    return ret;
+}
@@ -0,0 +1,102 @@
+// Copyright (c) 2020 The Peercoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COINSFLUSH_H
+#define BITCOIN_COINSFLUSH_H
+
+#include <coins.h>
+#include <uint256.h>
+
+#include <atomic>
+#include <mutex>
+
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+class CCoinsViewDB;
+
+/** What the writes to the coin database did since startup */
+struct CCoinsFlushStats
+{
+    //! Writes, and how many of them went to the background
+    uint64_t nFlushes = 0;
+    uint64_t nBackgroundFlushes = 0;
+    //! The last write: coins changed, bytes written and how long it took in microseconds
+    uint64_t nLastCoins = 0;
+    uint64_t nLastBytes = 0;
+    int64_t nLastDuration = 0;
+    uint64_t nTotalBytes = 0;
+    int64_t nTotalDuration = 0;
+    bool fInProgress = false;
+};
+
+/**
+ * Sits between the coins cache and the coin database, so that the cache can
+ * be flushed without waiting for the database. FlushInBackground() takes the
+ * whole cache as a snapshot that a thread writes out while the cache starts
+ * over empty; reads look at the snapshot before the database until the write
+ * is done. The write marks the database with its head blocks like any other,
+ * so an interrupted one is replayed at the next startup.
+ *
+ * Reads may come from several threads at once. Writes and waits are made by
+ * the thread owning the cache, with cs_main held.
+ */
+class CCoinsViewFlusher final : public CCoinsView
+{
+private:
+    CCoinsViewDB* db;
+
+    //! Taken shared by readers, exclusively to replace the snapshot
+    mutable boost::shared_mutex mutex;
+    //! Being written by threadWrite, which only reads it. Left alone by the
+    //! other writers until the thread is joined.
+    CCoinsMap mapSnapshot;
+    //! Block the snapshot is at, null when there is none
+    uint256 hashSnapshot;
+    std::atomic<size_t> nSnapshotUsage;
+    boost::thread threadWrite;
+    //! Set when a background write failed; the snapshot is kept then
+    std::atomic<bool> fFailed;
+    //! The next BatchWrite() is to go to the background, with the cache using that much memory
+    bool fNextInBackground;
+    size_t nNextUsage;
+
+    mutable std::mutex csStats;
+    CCoinsFlushStats stats;
+
+    void ThreadWrite();
+    void RecordWrite(size_t nChanged, size_t nBytes, int64_t nDuration, bool fBackground);
+
+public:
+    explicit CCoinsViewFlusher(CCoinsViewDB* dbIn);
+    ~CCoinsViewFlusher();
+
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const override;
+    bool HaveCoin(const COutPoint& outpoint) const override;
+    uint256 GetBestBlock() const override;
+    //! Only meaningful with no write in progress, as is Cursor()
+    std::vector<uint256> GetHeadBlocks() const override;
+    //! Waits for a background write in progress, then writes mapCoins unless
+    //! called from FlushInBackground()
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock) override;
+    CCoinsViewCursor* Cursor() const override;
+    size_t EstimateSize() const override;
+
+    /**
+     * Flush cache, which must sit on top of this view, handing its entries to
+     * a background write. A write still in progress is waited for first.
+     * Returns false if that or an earlier write failed.
+     */
+    bool FlushInBackground(CCoinsViewCache& cache);
+
+    //! Wait for the background write, if any. Returns false if it failed.
+    bool WaitForWrite();
+
+    //! Memory held by the snapshot being written
+    size_t GetSnapshotUsage() const { return nSnapshotUsage; }
+
+    CCoinsFlushStats GetStats() const;
+};
+
+#endif // BITCOIN_COINSFLUSH_H
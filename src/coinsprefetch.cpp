@@ -0,0 +1,194 @@
+// Copyright (c) 2020 The Peercoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <coinsprefetch.h>
+
+#include <algorithm>
+#include <set>
+
+struct CCoinsPrefetcher::Batch
+{
+    std::shared_ptr<const CBlock> pblock;
+    uint256 hash;
+    int nHeight;
+    const CCoinsView* base;
+    std::vector<COutPoint> vOutpoints;
+    //! Written by whoever claimed the range, read once all of it is done
+    std::vector<Coin> vCoins;
+    std::vector<char> vFound;
+    //! Outpoints handed out and read so far. Guarded by the prefetcher's mutex.
+    size_t nNext;
+    size_t nDone;
+
+    Batch(const std::shared_ptr<const CBlock>& pblockIn, int nHeightIn, const CCoinsView* baseIn) :
+        pblock(pblockIn), hash(pblockIn->GetHash()), nHeight(nHeightIn), base(baseIn), nNext(0), nDone(0) {}
+};
+
+CCoinsPrefetcher::CCoinsPrefetcher() : nThreads(0) {}
+
+CCoinsPrefetcher::~CCoinsPrefetcher() {}
+
+bool CCoinsPrefetcher::Claim(Batch& batch, size_t& nBegin, size_t& nEnd)
+{
+    if (batch.nNext == batch.vOutpoints.size())
+        return false;
+    nBegin = batch.nNext;
+    nEnd = std::min(nBegin + BATCH_SIZE, batch.vOutpoints.size());
+    batch.nNext = nEnd;
+    return true;
+}
+
+void CCoinsPrefetcher::Read(Batch& batch, size_t nBegin, size_t nEnd)
+{
+    for (size_t i = nBegin; i < nEnd; i++) {
+        try {
+            batch.vFound[i] = batch.base->GetCoin(batch.vOutpoints[i], batch.vCoins[i]);
+        } catch (const std::exception&) {
+            // Connecting the block runs into the same error, and reports it
+            batch.vFound[i] = false;
+        }
+    }
+}
+
+void CCoinsPrefetcher::Finish(Batch& batch, size_t nBegin, size_t nEnd)
+{
+    batch.nDone += nEnd - nBegin;
+    if (batch.nDone == batch.vOutpoints.size())
+        condDone.notify_all();
+}
+
+void CCoinsPrefetcher::Prefetch(const std::shared_ptr<const CBlock>& pblock, int nHeight, const CCoinsView* base, const CCoinsViewCache& cache)
+{
+    if (!IsEnabled())
+        return;
+    std::shared_ptr<Batch> pbatch = std::make_shared<Batch>(pblock, nHeight, base);
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        for (const auto& p : vPending) {
+            if (p->hash == pbatch->hash)
+                return;
+        }
+        if (vPending.size() == MAX_PENDING_BLOCKS && vPending.back()->nHeight <= nHeight)
+            return;
+    }
+
+    std::set<uint256> setCreated;
+    for (const auto& tx : pblock->vtx)
+        setCreated.insert(tx->GetHash());
+    for (const auto& tx : pblock->vtx) {
+        if (tx->IsCoinBase())
+            continue;
+        for (const CTxIn& txin : tx->vin) {
+            if (!setCreated.count(txin.prevout.hash) && !cache.HaveCoinInCache(txin.prevout))
+                pbatch->vOutpoints.push_back(txin.prevout);
+        }
+    }
+    pbatch->vCoins.resize(pbatch->vOutpoints.size());
+    pbatch->vFound.resize(pbatch->vOutpoints.size());
+
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        auto it = std::upper_bound(vPending.begin(), vPending.end(), pbatch, [](const std::shared_ptr<Batch>& a, const std::shared_ptr<Batch>& b) { return a->nHeight < b->nHeight; });
+        vPending.insert(it, pbatch);
+        if (vPending.size() > MAX_PENDING_BLOCKS)
+            vPending.pop_back();
+    }
+    condWorker.notify_all();
+}
+
+bool CCoinsPrefetcher::IsPending(const uint256& hash)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    for (const auto& p : vPending) {
+        if (p->hash == hash)
+            return true;
+    }
+    return false;
+}
+
+std::shared_ptr<const CBlock> CCoinsPrefetcher::GetBlock(const uint256& hash)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    for (const auto& p : vPending) {
+        if (p->hash == hash)
+            return p->pblock;
+    }
+    return nullptr;
+}
+
+size_t CCoinsPrefetcher::Apply(const uint256& hash, CCoinsViewCache& cache)
+{
+    std::shared_ptr<Batch> pbatch;
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        for (auto it = vPending.begin(); it != vPending.end(); ++it) {
+            if ((*it)->hash == hash) {
+                pbatch = *it;
+                vPending.erase(it);
+                break;
+            }
+        }
+        if (!pbatch)
+            return 0;
+
+        // Read what is left, rather than wait for the workers to get to it
+        size_t nBegin, nEnd;
+        while (Claim(*pbatch, nBegin, nEnd)) {
+            lock.unlock();
+            Read(*pbatch, nBegin, nEnd);
+            lock.lock();
+            Finish(*pbatch, nBegin, nEnd);
+        }
+        while (pbatch->nDone != pbatch->vOutpoints.size())
+            condDone.wait(lock);
+    }
+
+    size_t nAdded = 0;
+    for (size_t i = 0; i < pbatch->vOutpoints.size(); i++) {
+        if (pbatch->vFound[i] && !pbatch->vCoins[i].IsSpent() && cache.EmplaceBaseCoin(pbatch->vOutpoints[i], std::move(pbatch->vCoins[i])))
+            nAdded++;
+    }
+    return nAdded;
+}
+
+void CCoinsPrefetcher::Prune(int nHeight)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    vPending.erase(vPending.begin(), std::lower_bound(vPending.begin(), vPending.end(), nHeight, [](const std::shared_ptr<Batch>& p, int n) { return p->nHeight < n; }));
+}
+
+void CCoinsPrefetcher::Clear()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    vPending.clear();
+}
+
+void CCoinsPrefetcher::Thread()
+{
+    nThreads++;
+    try {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (true) {
+            std::shared_ptr<Batch> pbatch;
+            size_t nBegin = 0, nEnd = 0;
+            for (const auto& p : vPending) {
+                if (Claim(*p, nBegin, nEnd)) {
+                    pbatch = p;
+                    break;
+                }
+            }
+            if (!pbatch) {
+                condWorker.wait(lock);
+                continue;
+            }
+            lock.unlock();
+            Read(*pbatch, nBegin, nEnd);
+            lock.lock();
+            Finish(*pbatch, nBegin, nEnd);
+        }
+    } catch (const boost::thread_interrupted&) {
+        nThreads--;
+        throw;
+    }
+}
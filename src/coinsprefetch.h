@@ -0,0 +1,92 @@
+// Copyright (c) 2020 The Peercoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COINSPREFETCH_H
+#define BITCOIN_COINSPREFETCH_H
+
+#include <coins.h>
+#include <primitives/block.h>
+#include <uint256.h>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+/**
+ * Reads the coins spent by blocks about to be connected from the coins
+ * database on a few worker threads, so that ConnectBlock() finds them in the
+ * cache instead of waiting on one database read after the other.
+ *
+ * The reads go straight to the view below the cache (the database, or the
+ * snapshot being written to it; see CCoinsViewFlusher), without cs_main. A
+ * coin missing from the cache has the same value there, so the coins read can
+ * be added to the cache where it has no entry for them yet - as long as it
+ * was not flushed since. Clear() must be called before the cache
+ * is flushed; it drops all pending reads.
+ */
+class CCoinsPrefetcher
+{
+private:
+    struct Batch;
+
+    boost::mutex mutex;
+    boost::condition_variable condWorker;
+    boost::condition_variable condDone;
+    //! Blocks with reads pending, lowest first. Guarded by mutex.
+    std::vector<std::shared_ptr<Batch> > vPending;
+    std::atomic<int> nThreads;
+
+    //! Take the next range of outpoints to read from batch, if any are left. Requires mutex.
+    static bool Claim(Batch& batch, size_t& nBegin, size_t& nEnd);
+    static void Read(Batch& batch, size_t nBegin, size_t nEnd);
+    //! Account for a range that was read. Requires mutex.
+    void Finish(Batch& batch, size_t nBegin, size_t nEnd);
+
+public:
+    //! Most blocks whose reads are kept at a time; the lowest ones are kept
+    static const size_t MAX_PENDING_BLOCKS = 16;
+    //! Outpoints read in one go before looking for more work
+    static const size_t BATCH_SIZE = 16;
+
+    CCoinsPrefetcher();
+    ~CCoinsPrefetcher();
+
+    //! Whether any worker thread runs
+    bool IsEnabled() const { return nThreads > 0; }
+
+    /**
+     * Queue reads from base for the inputs of block at nHeight, leaving out
+     * those created in the block and those cache has an entry for. The block
+     * is queued even with nothing to read, for GetBlock(). base must allow
+     * reads from several threads at once.
+     */
+    void Prefetch(const std::shared_ptr<const CBlock>& pblock, int nHeight, const CCoinsView* base, const CCoinsViewCache& cache);
+
+    //! Whether reads for the block hash are pending
+    bool IsPending(const uint256& hash);
+
+    //! The block queued under hash, or nullptr
+    std::shared_ptr<const CBlock> GetBlock(const uint256& hash);
+
+    /**
+     * Finish the reads for the block hash, joining the workers, and add the
+     * coins found to cache where it has no entry for them. Returns the
+     * number of coins added.
+     */
+    size_t Apply(const uint256& hash, CCoinsViewCache& cache);
+
+    //! Drop the reads for blocks below nHeight, such as those that were never connected
+    void Prune(int nHeight);
+
+    //! Drop all pending reads
+    void Clear();
+
+    //! Run a worker, until the thread is interrupted
+    void Thread();
+};
+
+#endif // BITCOIN_COINSPREFETCH_H
@@ -19,6 +19,33 @@ void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks);
 #endif
 #endif
 
+#if defined(ENABLE_SSE41) && !defined(BUILD_BITCOIN_INTERNAL)
+namespace sha256d_sse41
+{
+void Transform_4way_1block(unsigned char* out, const unsigned char* in);
+void Transform_4way(unsigned char* out, const unsigned char* in);
+}
+#endif
+
+#if defined(ENABLE_AVX2) && !defined(BUILD_BITCOIN_INTERNAL)
+namespace sha256d_avx2
+{
+void Transform_8way_1block(unsigned char* out, const unsigned char* in);
+void Transform_8way(unsigned char* out, const unsigned char* in);
+}
+#endif
+
+#if defined(ENABLE_SHANI) && !defined(BUILD_BITCOIN_INTERNAL)
+namespace sha256_shani
+{
+void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks);
+}
+namespace sha256d64_shani
+{
+void Transform_2way(unsigned char* out, const unsigned char* in);
+}
+#endif
+
 // Internal implementation code.
 namespace
 {
@@ -174,21 +201,147 @@ bool SelfTest(TransformType tr) {
 
 TransformType Transform = sha256::Transform;
 
+/** Double-SHA256 of one padded single-block message, using the selected Transform. */
+void TransformD1Block(unsigned char* out, const unsigned char* in)
+{
+    uint32_t s[8];
+    unsigned char buf[64] = {0};
+    sha256::Initialize(s);
+    Transform(s, in, 1);
+    for (int i = 0; i < 8; i++)
+        WriteBE32(buf + 4 * i, s[i]);
+    buf[32] = 0x80;
+    buf[62] = 0x01; // 256 bits
+    sha256::Initialize(s);
+    Transform(s, buf, 1);
+    for (int i = 0; i < 8; i++)
+        WriteBE32(out + 4 * i, s[i]);
+}
+
+/** Double-SHA256 of one 64-byte message, using the selected Transform. */
+void TransformD64(unsigned char* out, const unsigned char* in)
+{
+    uint32_t s[8];
+    unsigned char buf[64] = {0};
+    sha256::Initialize(s);
+    Transform(s, in, 1);
+    buf[0] = 0x80;
+    buf[62] = 0x02; // 512 bits
+    Transform(s, buf, 1);
+    memset(buf, 0, sizeof(buf));
+    for (int i = 0; i < 8; i++)
+        WriteBE32(buf + 4 * i, s[i]);
+    buf[32] = 0x80;
+    buf[62] = 0x01; // 256 bits
+    sha256::Initialize(s);
+    Transform(s, buf, 1);
+    for (int i = 0; i < 8; i++)
+        WriteBE32(out + 4 * i, s[i]);
+}
+
+typedef void (*TransformD1BlockType)(unsigned char*, const unsigned char*);
+typedef void (*TransformD64Type)(unsigned char*, const unsigned char*);
+
+TransformD1BlockType TransformD1Block4Way = nullptr;
+TransformD1BlockType TransformD1Block8Way = nullptr;
+TransformD64Type TransformD64_2way = nullptr;
+TransformD64Type TransformD64_4way = nullptr;
+TransformD64Type TransformD64_8way = nullptr;
+
+/** Check a multi-way implementation against the one block at a time code. */
+bool SelfTestD1Block(TransformD1BlockType tr, size_t ways)
+{
+    unsigned char in[8 * 64] = {0};
+    unsigned char out[8 * 32], expected[8 * 32];
+    // lane i hashes a message of 7 * i bytes
+    for (size_t i = 0; i < ways; i++) {
+        size_t len = 7 * i;
+        for (size_t j = 0; j < len; j++)
+            in[64 * i + j] = (unsigned char)(i * 31 + j);
+        in[64 * i + len] = 0x80;
+        WriteBE64(in + 64 * i + 56, len << 3);
+        TransformD1Block(expected + 32 * i, in + 64 * i);
+    }
+    tr(out, in);
+    return memcmp(out, expected, 32 * ways) == 0;
+}
+
+/** Check a multi-way 64-byte implementation against the one message at a time code. */
+bool SelfTestD64(TransformD64Type tr, size_t ways)
+{
+    unsigned char in[8 * 64];
+    unsigned char out[8 * 32], expected[8 * 32];
+    for (size_t i = 0; i < sizeof(in); i++)
+        in[i] = (unsigned char)(i * 7 + 1);
+    for (size_t i = 0; i < ways; i++)
+        TransformD64(expected + 32 * i, in + 64 * i);
+    tr(out, in);
+    return memcmp(out, expected, 32 * ways) == 0;
+}
+
+#if defined(USE_ASM) && (defined(__x86_64__) || defined(__amd64__))
+/** Check whether the OS has enabled AVX registers. */
+bool AVXEnabled()
+{
+    uint32_t a, d;
+    __asm__("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+    return (a & 6) == 6;
+}
+#endif
+
 } // namespace
 
 std::string SHA256AutoDetect()
 {
+    std::string ret = "standard";
 #if defined(USE_ASM) && (defined(__x86_64__) || defined(__amd64__))
     uint32_t eax, ebx, ecx, edx;
-    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx >> 19) & 1) {
-        Transform = sha256_sse4::Transform;
+    bool have_sse4 = false, have_avx2 = false, have_shani = false;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        have_sse4 = (ecx >> 19) & 1;
+        bool have_avx = ((ecx >> 27) & 1) && ((ecx >> 28) & 1) && AVXEnabled();
+        if (__get_cpuid_max(0, nullptr) >= 7) {
+            __cpuid_count(7, 0, eax, ebx, ecx, edx);
+            have_avx2 = have_avx && ((ebx >> 5) & 1);
+            have_shani = have_sse4 && ((ebx >> 29) & 1);
+        }
+    }
+#if defined(ENABLE_SHANI) && !defined(BUILD_BITCOIN_INTERNAL)
+    if (have_shani) {
+        // The SHA instructions beat the multi-way code, so use them for all
+        Transform = sha256_shani::Transform;
         assert(SelfTest(Transform));
-        return "sse4";
+        TransformD64_2way = sha256d64_shani::Transform_2way;
+        assert(SelfTestD64(TransformD64_2way, 2));
+        return "shani(1way,2way)";
+    }
+#endif
+    if (have_sse4) {
+        Transform = sha256_sse4::Transform;
+        ret = "sse4";
+    }
+#if defined(ENABLE_SSE41) && !defined(BUILD_BITCOIN_INTERNAL)
+    if (have_sse4) {
+        TransformD1Block4Way = sha256d_sse41::Transform_4way_1block;
+        assert(SelfTestD1Block(TransformD1Block4Way, 4));
+        TransformD64_4way = sha256d_sse41::Transform_4way;
+        assert(SelfTestD64(TransformD64_4way, 4));
+        ret += ",sse41(4way)";
+    }
+#endif
+#if defined(ENABLE_AVX2) && !defined(BUILD_BITCOIN_INTERNAL)
+    if (have_avx2) {
+        TransformD1Block8Way = sha256d_avx2::Transform_8way_1block;
+        assert(SelfTestD1Block(TransformD1Block8Way, 8));
+        TransformD64_8way = sha256d_avx2::Transform_8way;
+        assert(SelfTestD64(TransformD64_8way, 8));
+        ret += ",avx2(8way)";
     }
+#endif
 #endif
 
     assert(SelfTest(Transform));
-    return "standard";
+    return ret;
 }
 
 ////// SHA-256
@@ -247,3 +400,63 @@ CSHA256& CSHA256::Reset()
     sha256::Initialize(s);
     return *this;
 }
+
+void SHA256DOneBlock(unsigned char* output, const unsigned char* input, size_t blocks)
+{
+    if (TransformD1Block8Way) {
+        while (blocks >= 8) {
+            TransformD1Block8Way(output, input);
+            output += 256;
+            input += 512;
+            blocks -= 8;
+        }
+    }
+    if (TransformD1Block4Way) {
+        while (blocks >= 4) {
+            TransformD1Block4Way(output, input);
+            output += 128;
+            input += 256;
+            blocks -= 4;
+        }
+    }
+    while (blocks) {
+        TransformD1Block(output, input);
+        output += 32;
+        input += 64;
+        --blocks;
+    }
+}
+
+void SHA256D64(unsigned char* output, const unsigned char* input, size_t blocks)
+{
+    if (TransformD64_8way) {
+        while (blocks >= 8) {
+            TransformD64_8way(output, input);
+            output += 256;
+            input += 512;
+            blocks -= 8;
+        }
+    }
+    if (TransformD64_4way) {
+        while (blocks >= 4) {
+            TransformD64_4way(output, input);
+            output += 128;
+            input += 256;
+            blocks -= 4;
+        }
+    }
+    if (TransformD64_2way) {
+        while (blocks >= 2) {
+            TransformD64_2way(output, input);
+            output += 64;
+            input += 128;
+            blocks -= 2;
+        }
+    }
+    while (blocks) {
+        TransformD64(output, input);
+        output += 32;
+        input += 64;
+        --blocks;
+    }
+}
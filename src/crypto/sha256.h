@@ -31,4 +31,17 @@ public:
  */
 std::string SHA256AutoDetect();
 
+/** Compute the double-SHA256 of `blocks` messages of at most 55 bytes each.
+ *  The input holds each message already padded to a single 64-byte block,
+ *  and the output receives 32 bytes per message. Uses the multi-way
+ *  implementations picked by SHA256AutoDetect when available.
+ */
+void SHA256DOneBlock(unsigned char* output, const unsigned char* input, size_t blocks);
+
+/** Compute the double-SHA256 of `blocks` messages of exactly 64 bytes each,
+ *  such as the concatenated pairs of a merkle tree level. The output, 32
+ *  bytes per message, may overlap the start of the input.
+ */
+void SHA256D64(unsigned char* output, const unsigned char* input, size_t blocks);
+
 #endif // BITCOIN_CRYPTO_SHA256_H
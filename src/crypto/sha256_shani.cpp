@@ -0,0 +1,178 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifdef ENABLE_SHANI
+
+#include <stdint.h>
+#include <immintrin.h>
+
+#include <crypto/common.h>
+
+namespace {
+
+alignas(16) const uint32_t k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+const uint32_t init[8] = {0x6a09e667ul, 0xbb67ae85ul, 0x3c6ef372ul, 0xa54ff53aul, 0x510e527ful, 0x9b05688cul, 0x1f83d9abul, 0x5be0cd19ul};
+
+/** Byte order of the message words within a 16-byte load. */
+__m128i inline ByteSwapMask() { return _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL); }
+
+/** Load four big endian message words. */
+__m128i inline Load(const unsigned char* in) { return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)in), ByteSwapMask()); }
+
+/** Store four big endian output words. */
+void inline Store(unsigned char* out, __m128i v) { _mm_storeu_si128((__m128i*)out, _mm_shuffle_epi8(v, ByteSwapMask())); }
+
+/** Convert the state words a..h into the ABEF/CDGH halves the SHA instructions work on. */
+void inline Unpack(const uint32_t* s, __m128i& abef, __m128i& cdgh)
+{
+    __m128i dcba = _mm_loadu_si128((const __m128i*)s);
+    __m128i hgfe = _mm_loadu_si128((const __m128i*)(s + 4));
+    __m128i cdab = _mm_shuffle_epi32(dcba, 0xB1);
+    __m128i efgh = _mm_shuffle_epi32(hgfe, 0x1B);
+    abef = _mm_alignr_epi8(cdab, efgh, 8);
+    cdgh = _mm_blend_epi16(efgh, cdab, 0xF0);
+}
+
+/** Convert ABEF/CDGH back into the state words a..h, as two vectors of four. */
+void inline Pack(__m128i abef, __m128i cdgh, __m128i& dcba, __m128i& hgfe)
+{
+    __m128i feba = _mm_shuffle_epi32(abef, 0x1B);
+    __m128i dchg = _mm_shuffle_epi32(cdgh, 0xB1);
+    dcba = _mm_blend_epi16(feba, dchg, 0xF0);
+    hgfe = _mm_alignr_epi8(dchg, feba, 8);
+}
+
+/** Run one compression on abef/cdgh, for the 16 message words in msg. */
+void inline Compress(__m128i& abef, __m128i& cdgh, const __m128i* msg)
+{
+    __m128i w[16];
+    for (int i = 0; i < 4; i++)
+        w[i] = msg[i];
+    for (int i = 4; i < 16; i++)
+        w[i] = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(w[i - 4], w[i - 3]), _mm_alignr_epi8(w[i - 1], w[i - 2], 4)), w[i - 1]);
+
+    __m128i state0 = abef, state1 = cdgh;
+    for (int i = 0; i < 16; i++) {
+        __m128i m = _mm_add_epi32(w[i], _mm_load_si128((const __m128i*)(k + 4 * i)));
+        state1 = _mm_sha256rnds2_epu32(state1, state0, m);
+        state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(m, 0x0E));
+    }
+    abef = _mm_add_epi32(abef, state0);
+    cdgh = _mm_add_epi32(cdgh, state1);
+}
+
+/** Run one compression on two independent states, so their rounds interleave. */
+void inline Compress2(__m128i& abef0, __m128i& cdgh0, const __m128i* msg0, __m128i& abef1, __m128i& cdgh1, const __m128i* msg1)
+{
+    __m128i w0[16], w1[16];
+    for (int i = 0; i < 4; i++) {
+        w0[i] = msg0[i];
+        w1[i] = msg1[i];
+    }
+    for (int i = 4; i < 16; i++) {
+        w0[i] = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(w0[i - 4], w0[i - 3]), _mm_alignr_epi8(w0[i - 1], w0[i - 2], 4)), w0[i - 1]);
+        w1[i] = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(w1[i - 4], w1[i - 3]), _mm_alignr_epi8(w1[i - 1], w1[i - 2], 4)), w1[i - 1]);
+    }
+
+    __m128i state00 = abef0, state01 = cdgh0, state10 = abef1, state11 = cdgh1;
+    for (int i = 0; i < 16; i++) {
+        __m128i kv = _mm_load_si128((const __m128i*)(k + 4 * i));
+        __m128i m0 = _mm_add_epi32(w0[i], kv);
+        __m128i m1 = _mm_add_epi32(w1[i], kv);
+        state01 = _mm_sha256rnds2_epu32(state01, state00, m0);
+        state11 = _mm_sha256rnds2_epu32(state11, state10, m1);
+        state00 = _mm_sha256rnds2_epu32(state00, state01, _mm_shuffle_epi32(m0, 0x0E));
+        state10 = _mm_sha256rnds2_epu32(state10, state11, _mm_shuffle_epi32(m1, 0x0E));
+    }
+    abef0 = _mm_add_epi32(abef0, state00);
+    cdgh0 = _mm_add_epi32(cdgh0, state01);
+    abef1 = _mm_add_epi32(abef1, state10);
+    cdgh1 = _mm_add_epi32(cdgh1, state11);
+}
+
+/** The padding block of a 64-byte message. */
+void inline PaddingD64(__m128i* msg)
+{
+    msg[0] = _mm_set_epi32(0, 0, 0, 0x80000000);
+    msg[1] = _mm_setzero_si128();
+    msg[2] = _mm_setzero_si128();
+    msg[3] = _mm_set_epi32(512, 0, 0, 0);
+}
+
+/** The message of the second hash: a 32-byte digest and its padding. */
+void inline DigestD64(__m128i abef, __m128i cdgh, __m128i* msg)
+{
+    Pack(abef, cdgh, msg[0], msg[1]);
+    msg[2] = _mm_set_epi32(0, 0, 0, 0x80000000);
+    msg[3] = _mm_set_epi32(256, 0, 0, 0);
+}
+
+}
+
+namespace sha256_shani {
+
+void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks)
+{
+    __m128i abef, cdgh, msg[4];
+    Unpack(s, abef, cdgh);
+    while (blocks--) {
+        for (int i = 0; i < 4; i++)
+            msg[i] = Load(chunk + 16 * i);
+        Compress(abef, cdgh, msg);
+        chunk += 64;
+    }
+    __m128i dcba, hgfe;
+    Pack(abef, cdgh, dcba, hgfe);
+    _mm_storeu_si128((__m128i*)s, dcba);
+    _mm_storeu_si128((__m128i*)(s + 4), hgfe);
+}
+
+}
+
+namespace sha256d64_shani {
+
+void Transform_2way(unsigned char* out, const unsigned char* in)
+{
+    __m128i abef0, cdgh0, abef1, cdgh1, msg0[4], msg1[4];
+
+    // First hash: the 64-byte message of each lane, then its padding block
+    Unpack(init, abef0, cdgh0);
+    Unpack(init, abef1, cdgh1);
+    for (int i = 0; i < 4; i++) {
+        msg0[i] = Load(in + 16 * i);
+        msg1[i] = Load(in + 64 + 16 * i);
+    }
+    Compress2(abef0, cdgh0, msg0, abef1, cdgh1, msg1);
+    PaddingD64(msg0);
+    Compress2(abef0, cdgh0, msg0, abef1, cdgh1, msg0);
+
+    // Second hash: the 32-byte digest, followed by its fixed padding
+    DigestD64(abef0, cdgh0, msg0);
+    DigestD64(abef1, cdgh1, msg1);
+    Unpack(init, abef0, cdgh0);
+    Unpack(init, abef1, cdgh1);
+    Compress2(abef0, cdgh0, msg0, abef1, cdgh1, msg1);
+
+    __m128i dcba, hgfe;
+    Pack(abef0, cdgh0, dcba, hgfe);
+    Store(out, dcba);
+    Store(out + 16, hgfe);
+    Pack(abef1, cdgh1, dcba, hgfe);
+    Store(out + 32, dcba);
+    Store(out + 48, hgfe);
+}
+
+}
+
+#endif
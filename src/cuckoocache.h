@@ -203,6 +203,11 @@ private:
      * */
     const Hash hash_function;
 
+    /** evicted counts the elements dropped while they were still wanted: aged
+     * out with their epoch, or pushed out by an insert running out of depth.
+     */
+    uint64_t evicted;
+
     /** compute_hashes is convenience for not having to write out this
      * expression everywhere we use the hash values of an Element.
      *
@@ -306,8 +311,10 @@ private:
             for (uint32_t i = 0; i < size; ++i)
                 if (epoch_flags[i])
                     epoch_flags[i] = false;
-                else
+                else {
+                    evicted += !collection_flags.bit_is_set(i);
                     allow_erase(i);
+                }
             epoch_heuristic_counter = epoch_size;
         } else
             // reset the epoch_heuristic_counter to next do a scan when worst
@@ -325,7 +332,7 @@ public:
      * call to setup or setup_bytes, otherwise operations may segfault.
      */
     cache() : table(), size(), collection_flags(0), epoch_flags(),
-    epoch_heuristic_counter(), epoch_size(), depth_limit(0), hash_function()
+    epoch_heuristic_counter(), epoch_size(), depth_limit(0), hash_function(), evicted(0)
     {
     }
 
@@ -437,6 +444,14 @@ public:
             // Recompute the locs -- unfortunately happens one too many times!
             locs = compute_hashes(e);
         }
+        // e is dropped
+        ++evicted;
+    }
+
+    /** evictions returns the number of elements evicted so far */
+    uint64_t evictions() const
+    {
+        return evicted;
     }
 
     /* contains iterates through the hash locations for a given element
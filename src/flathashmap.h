@@ -0,0 +1,354 @@
+// Copyright (c) 2020 The Peercoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_FLATHASHMAP_H
+#define BITCOIN_FLATHASHMAP_H
+
+#include <crypto/common.h>
+
+#include <algorithm>
+#include <assert.h>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <stdint.h>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/** Hash map with an open-addressing index over densely stored entries.
+ *
+ * Entries live in chunks that double in size up to MAX_CHUNK_BITS, so they
+ * are never moved once constructed: pointers and iterators to them stay valid until the entry is
+ * erased, also across inserts. Lookups go through a linearly probed table
+ * of 8-byte slots, each holding the position of an entry and 32 bits of
+ * its hash, so a probe rarely has to look at an entry that doesn't match.
+ *
+ * Compared to std::unordered_map this saves the per-node allocation, the
+ * bucket array and the node links. Iteration is in order of entry position.
+ * Erased positions are reused by later inserts.
+ */
+template <typename K, typename V, typename Hasher = std::hash<K>, typename KeyEqual = std::equal_to<K> >
+class flat_hash_map
+{
+public:
+    typedef K key_type;
+    typedef V mapped_type;
+    typedef std::pair<const K, V> value_type;
+    typedef size_t size_type;
+
+private:
+    typedef typename std::aligned_storage<sizeof(value_type), alignof(value_type)>::type storage_type;
+
+    //! Entries of the first chunk; each further chunk is twice as large, up
+    //! to the maximum size, so that the unused tail of the last one stays small
+    static constexpr uint32_t FIRST_CHUNK_BITS = 4;
+    static constexpr uint32_t MAX_CHUNK_BITS = 12;
+    //! Slot values below this are free: empty, or erased (a tombstone)
+    static constexpr uint64_t SLOT_EMPTY = 0;
+    static constexpr uint64_t SLOT_ERASED = 1;
+    static constexpr uint64_t SLOT_FIRST_ENTRY = 2;
+    static constexpr uint32_t NO_ENTRY = 0xffffffff;
+
+    std::vector<std::unique_ptr<storage_type[]> > m_chunks;
+    std::vector<bool> m_live;
+    std::vector<uint32_t> m_free;
+    //! Low 32 bits: entry position + SLOT_FIRST_ENTRY, high 32 bits: hash tag.
+    //! The slot is picked by the high bits of the mixed hash, the tag is its low bits.
+    std::vector<uint64_t> m_slots;
+    size_type m_size;
+    size_type m_erased_slots;
+    int m_shift;
+    Hasher m_hasher;
+    KeyEqual m_key_equal;
+
+    static size_t ChunkOf(uint32_t pos, size_t& offset)
+    {
+        uint64_t n = (uint64_t)pos + (1 << FIRST_CHUNK_BITS);
+        if (n >= ((uint64_t)1 << (MAX_CHUNK_BITS + 1))) {
+            offset = n & ((1 << MAX_CHUNK_BITS) - 1);
+            return (n >> MAX_CHUNK_BITS) + MAX_CHUNK_BITS - FIRST_CHUNK_BITS - 1;
+        }
+        int bits = CountBits(n) - 1;
+        offset = n - ((uint64_t)1 << bits);
+        return bits - FIRST_CHUNK_BITS;
+    }
+
+    static size_t ChunkSize(size_t chunk)
+    {
+        return (size_t)1 << std::min(chunk + FIRST_CHUNK_BITS, (size_t)MAX_CHUNK_BITS);
+    }
+
+    value_type* Entry(uint32_t pos) const
+    {
+        size_t offset;
+        size_t chunk = ChunkOf(pos, offset);
+        return reinterpret_cast<value_type*>(&m_chunks[chunk][offset]);
+    }
+
+    uint64_t Mix(const K& key) const
+    {
+        return (uint64_t)m_hasher(key) * 0x9E3779B97F4A7C15ULL;
+    }
+
+    size_t SlotMask() const { return m_slots.size() - 1; }
+
+    uint32_t NextLive(uint32_t pos) const
+    {
+        while (pos < m_live.size() && !m_live[pos])
+            pos++;
+        return pos < m_live.size() ? pos : NO_ENTRY;
+    }
+
+    uint32_t Find(const K& key) const
+    {
+        if (m_size == 0)
+            return NO_ENTRY;
+        uint64_t h = Mix(key);
+        uint64_t tag = h << 32;
+        for (size_t i = h >> m_shift; ; i = (i + 1) & SlotMask()) {
+            uint64_t slot = m_slots[i];
+            if (slot == SLOT_EMPTY)
+                return NO_ENTRY;
+            if ((slot & 0xffffffff00000000ULL) == tag && (uint32_t)slot >= SLOT_FIRST_ENTRY) {
+                uint32_t pos = (uint32_t)slot - SLOT_FIRST_ENTRY;
+                if (m_key_equal(Entry(pos)->first, key))
+                    return pos;
+            }
+        }
+    }
+
+    void PlaceSlot(uint32_t pos, uint64_t h)
+    {
+        for (size_t i = h >> m_shift; ; i = (i + 1) & SlotMask()) {
+            if (m_slots[i] < SLOT_FIRST_ENTRY) {
+                if (m_slots[i] == SLOT_ERASED)
+                    m_erased_slots--;
+                m_slots[i] = (h << 32) | ((uint64_t)pos + SLOT_FIRST_ENTRY);
+                return;
+            }
+        }
+    }
+
+    void Rehash(size_t nSlots)
+    {
+        int bits = CountBits(nSlots - 1);
+        m_slots.assign((size_t)1 << bits, SLOT_EMPTY);
+        m_shift = 64 - bits;
+        m_erased_slots = 0;
+        for (uint32_t pos = NextLive(0); pos != NO_ENTRY; pos = NextLive(pos + 1))
+            PlaceSlot(pos, Mix(Entry(pos)->first));
+    }
+
+    //! Make room for one more entry, keeping the table at most 3/4 full
+    void Grow()
+    {
+        size_t nUsed = m_size + m_erased_slots + 1;
+        if (nUsed * 4 <= m_slots.size() * 3)
+            return;
+        size_t nSlots = std::max<size_t>(m_slots.size(), 16);
+        while ((m_size + 1) * 2 > nSlots)
+            nSlots *= 2;
+        Rehash(nSlots);
+    }
+
+    uint32_t AllocateEntry()
+    {
+        if (!m_free.empty()) {
+            uint32_t pos = m_free.back();
+            m_free.pop_back();
+            return pos;
+        }
+        assert(m_live.size() < NO_ENTRY - SLOT_FIRST_ENTRY);
+        uint32_t pos = m_live.size();
+        size_t offset;
+        size_t chunk = ChunkOf(pos, offset);
+        if (chunk == m_chunks.size())
+            m_chunks.emplace_back(new storage_type[ChunkSize(chunk)]);
+        m_live.push_back(false);
+        return pos;
+    }
+
+    void EraseEntry(uint32_t pos)
+    {
+        uint64_t h = Mix(Entry(pos)->first);
+        for (size_t i = h >> m_shift; ; i = (i + 1) & SlotMask()) {
+            if (m_slots[i] == ((h << 32) | ((uint64_t)pos + SLOT_FIRST_ENTRY))) {
+                m_slots[i] = SLOT_ERASED;
+                m_erased_slots++;
+                break;
+            }
+        }
+        Entry(pos)->~value_type();
+        m_live[pos] = false;
+        m_free.push_back(pos);
+        m_size--;
+    }
+
+public:
+    template <bool Const>
+    class iterator_base
+    {
+        friend class flat_hash_map;
+        template <bool> friend class iterator_base;
+        typedef typename std::conditional<Const, const flat_hash_map*, flat_hash_map*>::type map_pointer;
+        map_pointer m_map;
+        uint32_t m_pos;
+
+        iterator_base(map_pointer map, uint32_t pos) : m_map(map), m_pos(pos) {}
+
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef typename flat_hash_map::value_type value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef typename std::conditional<Const, const value_type*, value_type*>::type pointer;
+        typedef typename std::conditional<Const, const value_type&, value_type&>::type reference;
+
+        iterator_base() : m_map(nullptr), m_pos(NO_ENTRY) {}
+        template <bool C = Const, typename = typename std::enable_if<C>::type>
+        iterator_base(const iterator_base<false>& it) : m_map(it.m_map), m_pos(it.m_pos) {}
+
+        reference operator*() const { return *m_map->Entry(m_pos); }
+        pointer operator->() const { return m_map->Entry(m_pos); }
+        iterator_base& operator++() { m_pos = m_map->NextLive(m_pos + 1); return *this; }
+        iterator_base operator++(int) { iterator_base copy(*this); ++(*this); return copy; }
+        bool operator==(const iterator_base& other) const { return m_pos == other.m_pos; }
+        bool operator!=(const iterator_base& other) const { return m_pos != other.m_pos; }
+    };
+    typedef iterator_base<false> iterator;
+    typedef iterator_base<true> const_iterator;
+
+    flat_hash_map() : m_size(0), m_erased_slots(0), m_shift(64) {}
+    flat_hash_map(const flat_hash_map&) = delete;
+    flat_hash_map& operator=(const flat_hash_map&) = delete;
+    ~flat_hash_map() { clear(); }
+
+    iterator begin() { return iterator(this, NextLive(0)); }
+    iterator end() { return iterator(this, NO_ENTRY); }
+    const_iterator begin() const { return const_iterator(this, NextLive(0)); }
+    const_iterator end() const { return const_iterator(this, NO_ENTRY); }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+
+    bool empty() const { return m_size == 0; }
+    size_type size() const { return m_size; }
+
+    iterator find(const K& key) { return iterator(this, Find(key)); }
+    const_iterator find(const K& key) const { return const_iterator(this, Find(key)); }
+    size_type count(const K& key) const { return Find(key) != NO_ENTRY; }
+
+    template <typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args)
+    {
+        uint32_t pos = AllocateEntry();
+        value_type* entry = ::new (Entry(pos)) value_type(std::forward<Args>(args)...);
+        uint32_t existing = Find(entry->first);
+        if (existing != NO_ENTRY) {
+            entry->~value_type();
+            m_free.push_back(pos);
+            return std::make_pair(iterator(this, existing), false);
+        }
+        Grow();
+        PlaceSlot(pos, Mix(entry->first));
+        m_live[pos] = true;
+        m_size++;
+        return std::make_pair(iterator(this, pos), true);
+    }
+
+    std::pair<iterator, bool> insert(const value_type& value) { return emplace(value); }
+
+    V& operator[](const K& key)
+    {
+        uint32_t pos = Find(key);
+        if (pos != NO_ENTRY)
+            return Entry(pos)->second;
+        return emplace(std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple()).first->second;
+    }
+
+    iterator erase(const_iterator it)
+    {
+        uint32_t pos = it.m_pos;
+        EraseEntry(pos);
+        return iterator(this, NextLive(pos + 1));
+    }
+
+    size_type erase(const K& key)
+    {
+        uint32_t pos = Find(key);
+        if (pos == NO_ENTRY)
+            return 0;
+        EraseEntry(pos);
+        return 1;
+    }
+
+    void clear()
+    {
+        for (uint32_t pos = NextLive(0); pos != NO_ENTRY; pos = NextLive(pos + 1))
+            Entry(pos)->~value_type();
+        m_chunks.clear();
+        m_live.clear();
+        m_free.clear();
+        m_slots.clear();
+        m_size = 0;
+        m_erased_slots = 0;
+        m_shift = 64;
+    }
+
+    void reserve(size_type n)
+    {
+        size_t nSlots = 16;
+        while (n * 4 > nSlots * 3)
+            nSlots *= 2;
+        if (nSlots > m_slots.size())
+            Rehash(nSlots);
+    }
+
+    void swap(flat_hash_map& other)
+    {
+        std::swap(m_chunks, other.m_chunks);
+        std::swap(m_live, other.m_live);
+        std::swap(m_free, other.m_free);
+        std::swap(m_slots, other.m_slots);
+        std::swap(m_size, other.m_size);
+        std::swap(m_erased_slots, other.m_erased_slots);
+        std::swap(m_shift, other.m_shift);
+        std::swap(m_hasher, other.m_hasher);
+        std::swap(m_key_equal, other.m_key_equal);
+    }
+
+    //! Heap memory held by the map, not counting what the entries point to.
+    //! Each allocation is passed through usage, which can add the allocator's
+    //! overhead (see memusage::MallocUsage).
+    template <typename Usage>
+    size_t DynamicMemoryUsage(Usage usage) const
+    {
+        size_t nUsage = 0;
+        for (size_t chunk = 0; chunk < m_chunks.size(); chunk++)
+            nUsage += usage(ChunkSize(chunk) * sizeof(storage_type));
+        auto capacity = [&usage](size_t nBytes) { return nBytes ? usage(nBytes) : 0; };
+        return nUsage + capacity(m_slots.capacity() * sizeof(uint64_t)) + capacity(m_free.capacity() * sizeof(uint32_t)) +
+            capacity((m_live.capacity() + 63) / 64 * 8) + capacity(m_chunks.capacity() * sizeof(void*));
+    }
+
+    size_t DynamicMemoryUsage() const
+    {
+        return DynamicMemoryUsage([](size_t nBytes) { return nBytes; });
+    }
+};
+
+template <typename K, typename V, typename Hasher, typename KeyEqual>
+constexpr uint32_t flat_hash_map<K, V, Hasher, KeyEqual>::FIRST_CHUNK_BITS;
+template <typename K, typename V, typename Hasher, typename KeyEqual>
+constexpr uint32_t flat_hash_map<K, V, Hasher, KeyEqual>::MAX_CHUNK_BITS;
+template <typename K, typename V, typename Hasher, typename KeyEqual>
+constexpr uint64_t flat_hash_map<K, V, Hasher, KeyEqual>::SLOT_EMPTY;
+template <typename K, typename V, typename Hasher, typename KeyEqual>
+constexpr uint64_t flat_hash_map<K, V, Hasher, KeyEqual>::SLOT_ERASED;
+template <typename K, typename V, typename Hasher, typename KeyEqual>
+constexpr uint64_t flat_hash_map<K, V, Hasher, KeyEqual>::SLOT_FIRST_ENTRY;
+template <typename K, typename V, typename Hasher, typename KeyEqual>
+constexpr uint32_t flat_hash_map<K, V, Hasher, KeyEqual>::NO_ENTRY;
+
+#endif // BITCOIN_FLATHASHMAP_H
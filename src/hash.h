@@ -229,7 +229,4 @@ public:
 uint64_t SipHashUint256(uint64_t k0, uint64_t k1, const uint256& val);
 uint64_t SipHashUint256Extra(uint64_t k0, uint64_t k1, const uint256& val, uint32_t extra);
 
-extern int32_t peercoinRandseed;
-int univHash(const uint256 &x);
-
 #endif // BITCOIN_HASH_H
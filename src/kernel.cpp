@@ -8,7 +8,10 @@
 #include <validation.h>
 #include <streams.h>
 #include <timedata.h>
-#include <bignum.h>
+#include <arith_uint256.h>
+#include <crypto/common.h>
+#include <crypto/sha256.h>
+#include <hash.h>
 #include <txdb.h>
 #include <consensus/validation.h>
 #include <random.h>
@@ -119,6 +122,109 @@ bool IsBTC16BIPsEnabled(uint32_t nTimeTx)
     return (nTimeTx >= (fTestNet? nBTC16BIPsTestSwitchTime : nBTC16BIPsSwitchTime));
 }
 
+CStakeModifierIndex stakeModifierIndex;
+
+void CStakeModifierIndex::SetTip(const CBlockIndex* pindexNew)
+{
+    const CBlockIndex* pindexFork = (pindexTip && pindexNew) ? LastCommonAncestor(pindexTip, pindexNew) : nullptr;
+    int nForkHeight = pindexFork ? pindexFork->nHeight : -1;
+    while (!vGenerated.empty() && vGenerated.back().nHeight > nForkHeight)
+        vGenerated.pop_back();
+
+    std::vector<CGeneratedModifier> vConnect;
+    for (const CBlockIndex* pindex = pindexNew; pindex && pindex != pindexFork; pindex = pindex->pprev)
+        if (pindex->GeneratedStakeModifier())
+            vConnect.push_back(CGeneratedModifier{pindex->nHeight, pindex->GetBlockTime(), pindex});
+    vGenerated.insert(vGenerated.end(), vConnect.rbegin(), vConnect.rend());
+    pindexTip = pindexNew;
+}
+
+const CBlockIndex* CStakeModifierIndex::FindNext(int nHeightFrom, int64_t nTime) const
+{
+    auto it = std::upper_bound(vGenerated.begin(), vGenerated.end(), nHeightFrom,
+        [](int nHeight, const CGeneratedModifier& item) { return nHeight < item.nHeight; });
+    // block times are not strictly ordered, but generated modifiers are
+    // an interval apart so this loop only looks at a few entries
+    for (; it != vGenerated.end(); ++it)
+        if (it->nTime >= nTime)
+            return it->pindex;
+    return nullptr;
+}
+
+const CBlockIndex* CStakeModifierIndex::FindPrev(int nHeightTo, int64_t nTime) const
+{
+    auto it = std::lower_bound(vGenerated.begin(), vGenerated.end(), nHeightTo,
+        [](const CGeneratedModifier& item, int nHeight) { return item.nHeight < nHeight; });
+    while (it != vGenerated.begin()) {
+        --it;
+        if (it->nTime <= nTime)
+            return it->pindex;
+    }
+    return nullptr;
+}
+
+CStakeModifierCandidates stakeModifierCandidates;
+
+// Timestamp order, block hash order for equal timestamps
+static bool CandidateLess(const CStakeModifierCandidates::CCandidate& a, const CStakeModifierCandidates::CCandidate& b)
+{
+    if (a.nTime != b.nTime)
+        return a.nTime < b.nTime;
+    const uint32_t *pa = a.hashBlock.GetDataPtr();
+    const uint32_t *pb = b.hashBlock.GetDataPtr();
+    int cnt = 256 / 32;
+    do {
+        --cnt;
+        if (pa[cnt] != pb[cnt])
+            return pa[cnt] < pb[cnt];
+    } while(cnt);
+    return false; // Elements are equal
+}
+
+void CStakeModifierCandidates::Update(const CBlockIndex* pindexPrev, int64_t nSelectionIntervalStart)
+{
+    AssertLockHeld(cs_main);
+    // The window can be moved on if pindexPrev extends it and the interval
+    // start did not go back
+    bool fExtend = pindexLast && nSelectionIntervalStart >= nIntervalStart && pindexPrev->GetAncestor(pindexLast->nHeight) == pindexLast;
+
+    std::vector<CCandidate> vNew;
+    const CBlockIndex* pindex = pindexPrev;
+    while (pindex && pindex->GetBlockTime() >= nSelectionIntervalStart && !(fExtend && pindex == pindexLast)) {
+        vNew.push_back(CCandidate{pindex->GetBlockTime(), pindex->GetBlockHash(), pindex});
+        pindex = pindex->pprev;
+    }
+
+    if (!fExtend || pindex != pindexLast) {
+        // A block before the interval start cuts off everything below it
+        vCandidates.clear();
+    } else if (nSelectionIntervalStart != nIntervalStart) {
+        // Drop the blocks up to the last one now before the interval start
+        int nHeightCut = -1;
+        for (const CCandidate& candidate : vCandidates)
+            if (candidate.nTime < nSelectionIntervalStart)
+                nHeightCut = std::max(nHeightCut, candidate.pindex->nHeight);
+        if (nHeightCut >= 0)
+            vCandidates.erase(std::remove_if(vCandidates.begin(), vCandidates.end(),
+                [nHeightCut](const CCandidate& candidate) { return candidate.pindex->nHeight <= nHeightCut; }), vCandidates.end());
+    }
+
+    std::sort(vNew.begin(), vNew.end(), CandidateLess);
+    size_t nOld = vCandidates.size();
+    vCandidates.insert(vCandidates.end(), vNew.begin(), vNew.end());
+    std::inplace_merge(vCandidates.begin(), vCandidates.begin() + nOld, vCandidates.end(), CandidateLess);
+
+    pindexLast = pindexPrev;
+    nIntervalStart = nSelectionIntervalStart;
+}
+
+void CStakeModifierCandidates::Clear()
+{
+    vCandidates.clear();
+    pindexLast = nullptr;
+    nIntervalStart = 0;
+}
+
 // Get the last stake modifier and its generation time from a given block
 static bool GetLastStakeModifier(const CBlockIndex* pindex, uint64_t& nStakeModifier, int64_t& nModifierTime)
 {
@@ -149,50 +255,58 @@ static int64_t GetStakeModifierSelectionInterval()
     return nSelectionInterval;
 }
 
-// select a block from the candidate blocks in vSortedByTimestamp, excluding
-// already selected blocks in vSelectedBlocks, and with timestamp up to
-// nSelectionIntervalStop.
+// compute the selection hash of a candidate block by hashing its proof-hash
+// and the previous proof-of-stake modifier
+static arith_uint256 GetSelectionHash(const CBlockIndex* pindex, uint64_t nStakeModifierPrev)
+{
+    const uint256& hashProof = pindex->IsProofOfStake()? pindex->hashProofOfStake : *pindex->phashBlock;
+    // serialized as hashProof followed by the little endian modifier
+    unsigned char data[32 + 8];
+    memcpy(data, hashProof.begin(), 32);
+    WriteLE64(data + 32, nStakeModifierPrev);
+    uint256 hash;
+    CHash256().Write(data, sizeof(data)).Finalize(hash.begin());
+    arith_uint256 hashSelection = UintToArith256(hash);
+    // the selection hash is divided by 2**32 so that proof-of-stake block
+    // is always favored over proof-of-work block. this is to preserve
+    // the energy efficiency property
+    if (pindex->IsProofOfStake())
+        hashSelection >>= 32;
+    return hashSelection;
+}
+
+// select a block from the candidate blocks in vCandidates, excluding
+// already selected blocks in vSelected, and with timestamp up to
+// nSelectionIntervalStop. The selection hashes only depend on the previous
+// modifier, so they are computed once for all rounds.
 static bool SelectBlockFromCandidates(
-    vector<pair<int64_t, uint256> >& vSortedByTimestamp,
-    map<uint256, const CBlockIndex*>& mapSelectedBlocks,
-    int64_t nSelectionIntervalStop, uint64_t nStakeModifierPrev,
+    const vector<CStakeModifierCandidates::CCandidate>& vCandidates,
+    const vector<arith_uint256>& vHashSelection,
+    vector<bool>& vSelected,
+    int64_t nSelectionIntervalStop,
     const CBlockIndex** pindexSelected)
 {
     bool fSelected = false;
     arith_uint256 hashBest = 0;
+    size_t nBest = 0;
     *pindexSelected = (const CBlockIndex*) 0;
-    for (const auto& item : vSortedByTimestamp)
+    for (size_t i = 0; i < vCandidates.size(); i++)
     {
-        if (!mapBlockIndex.count(item.second))
-            return error("SelectBlockFromCandidates: failed to find block index for candidate block %s", item.second.ToString());
-        const CBlockIndex* pindex = mapBlockIndex[item.second];
-        if (fSelected && pindex->GetBlockTime() > nSelectionIntervalStop)
+        if (fSelected && vCandidates[i].nTime > nSelectionIntervalStop)
             break;
-        if (mapSelectedBlocks.count(pindex->GetBlockHash()) > 0)
+        if (vSelected[i])
             continue;
-        // compute the selection hash by hashing its proof-hash and the
-        // previous proof-of-stake modifier
-        uint256 hashProof = pindex->IsProofOfStake()? pindex->hashProofOfStake : pindex->GetBlockHash();
-        CDataStream ss(SER_GETHASH, 0);
-        ss << hashProof << nStakeModifierPrev;
-        arith_uint256 hashSelection = UintToArith256(Hash(ss.begin(), ss.end()));
-        // the selection hash is divided by 2**32 so that proof-of-stake block
-        // is always favored over proof-of-work block. this is to preserve
-        // the energy efficiency property
-        if (pindex->IsProofOfStake())
-            hashSelection >>= 32;
-        if (fSelected && hashSelection < hashBest)
-        {
-            hashBest = hashSelection;
-            *pindexSelected = (const CBlockIndex*) pindex;
-        }
-        else if (!fSelected)
+        if (!fSelected || vHashSelection[i] < hashBest)
         {
             fSelected = true;
-            hashBest = hashSelection;
-            *pindexSelected = (const CBlockIndex*) pindex;
+            hashBest = vHashSelection[i];
+            nBest = i;
         }
     }
+    if (fSelected) {
+        vSelected[nBest] = true;
+        *pindexSelected = vCandidates[nBest].pindex;
+    }
     if (gArgs.GetBoolArg("-debug", false) && gArgs.GetBoolArg("-printstakemodifier", false))
         LogPrintf("SelectBlockFromCandidates: selection hash=%s\n", hashBest.ToString());
     return fSelected;
@@ -251,54 +365,30 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexCurrent, uint64_t &nStake
         }
     }
 
-    // Sort candidate blocks by timestamp
-    vector<pair<int64_t, uint256> > vSortedByTimestamp;
-    vSortedByTimestamp.reserve(64 * params.nModifierInterval / params.nStakeTargetSpacing);
+    // Candidate blocks sorted by timestamp
     int64_t nSelectionInterval = GetStakeModifierSelectionInterval();
     int64_t nSelectionIntervalStart = (pindexPrev->GetBlockTime() / params.nModifierInterval) * params.nModifierInterval - nSelectionInterval;
-    const CBlockIndex* pindex = pindexPrev;
-    while (pindex && pindex->GetBlockTime() >= nSelectionIntervalStart)
-    {
-        vSortedByTimestamp.push_back(make_pair(pindex->GetBlockTime(), pindex->GetBlockHash()));
-        pindex = pindex->pprev;
-    }
-    int nHeightFirstCandidate = pindex ? (pindex->nHeight + 1) : 0;
-
-    // Shuffle before sort
-    for(int i = vSortedByTimestamp.size() - 1; i > 1; --i)
-    std::swap(vSortedByTimestamp[i], vSortedByTimestamp[GetRand(i)]);
-
-    sort(vSortedByTimestamp.begin(), vSortedByTimestamp.end(), [] (const pair<int64_t, uint256> &a, const pair<int64_t, uint256> &b)
-    {
-        if (a.first != b.first)
-            return a.first < b.first;
-        // Timestamp equals - compare block hashes
-        const uint32_t *pa = a.second.GetDataPtr();
-        const uint32_t *pb = b.second.GetDataPtr();
-        int cnt = 256 / 32;
-        do {
-            --cnt;
-            if (pa[cnt] != pb[cnt])
-                return pa[cnt] < pb[cnt];
-        } while(cnt);
-            return false; // Elements are equal
-    });
+    stakeModifierCandidates.Update(pindexPrev, nSelectionIntervalStart);
+    const vector<CStakeModifierCandidates::CCandidate>& vCandidates = stakeModifierCandidates.Get();
+    vector<arith_uint256> vHashSelection;
+    vHashSelection.reserve(vCandidates.size());
+    for (const auto& candidate : vCandidates)
+        vHashSelection.push_back(GetSelectionHash(candidate.pindex, nStakeModifier));
 
     // Select 64 blocks from candidate blocks to generate stake modifier
     uint64_t nStakeModifierNew = 0;
     int64_t nSelectionIntervalStop = nSelectionIntervalStart;
-    map<uint256, const CBlockIndex*> mapSelectedBlocks;
-    for (int nRound=0; nRound<min(64, (int)vSortedByTimestamp.size()); nRound++)
+    vector<bool> vSelected(vCandidates.size(), false);
+    const CBlockIndex* pindex = nullptr;
+    for (int nRound=0; nRound<min(64, (int)vCandidates.size()); nRound++)
     {
         // add an interval section to the current selection round
         nSelectionIntervalStop += GetStakeModifierSelectionIntervalSection(nRound);
         // select a block from the candidates of current round
-        if (!SelectBlockFromCandidates(vSortedByTimestamp, mapSelectedBlocks, nSelectionIntervalStop, nStakeModifier, &pindex))
+        if (!SelectBlockFromCandidates(vCandidates, vHashSelection, vSelected, nSelectionIntervalStop, &pindex))
             return error("ComputeNextStakeModifier: unable to select block at round %d", nRound);
         // write the entropy bit of the selected block
         nStakeModifierNew |= (((uint64_t)pindex->GetStakeEntropyBit()) << nRound);
-        // add the selected block from candidates to selected list
-        mapSelectedBlocks.insert(make_pair(pindex->GetBlockHash(), pindex));
         if (gArgs.GetBoolArg("-debug", false) && gArgs.GetBoolArg("-printstakemodifier", false))
             LogPrintf("ComputeNextStakeModifier: selected round %d stop=%s height=%d bit=%d\n",
                 nRound, DateTimeStrFormat(nSelectionIntervalStop), pindex->nHeight, pindex->GetStakeEntropyBit());
@@ -307,6 +397,9 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexCurrent, uint64_t &nStake
     // Print selection map for visualization of the selected blocks
     if (gArgs.GetBoolArg("-debug", false) && gArgs.GetBoolArg("-printstakemodifier", false))
     {
+        int nHeightFirstCandidate = pindexPrev->nHeight + 1;
+        for (const auto& candidate : vCandidates)
+            nHeightFirstCandidate = std::min(nHeightFirstCandidate, candidate.pindex->nHeight);
         string strSelectionMap = "";
         // '-' indicates proof-of-work blocks not selected
         strSelectionMap.insert(0, pindexPrev->nHeight - nHeightFirstCandidate + 1, '-');
@@ -318,11 +411,14 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexCurrent, uint64_t &nStake
                 strSelectionMap.replace(pindex->nHeight - nHeightFirstCandidate, 1, "=");
             pindex = pindex->pprev;
         }
-        for (const auto& item : mapSelectedBlocks)
+        for (size_t i = 0; i < vCandidates.size(); i++)
         {
+            if (!vSelected[i])
+                continue;
             // 'S' indicates selected proof-of-stake blocks
             // 'W' indicates selected proof-of-work blocks
-            strSelectionMap.replace(item.second->nHeight - nHeightFirstCandidate, 1, item.second->IsProofOfStake()? "S" : "W");
+            const CBlockIndex* pindexSelected = vCandidates[i].pindex;
+            strSelectionMap.replace(pindexSelected->nHeight - nHeightFirstCandidate, 1, pindexSelected->IsProofOfStake()? "S" : "W");
         }
         LogPrintf("ComputeNextStakeModifier: selection height [%d, %d] map %s\n", nHeightFirstCandidate, pindexPrev->nHeight, strSelectionMap);
     }
@@ -337,8 +433,9 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexCurrent, uint64_t &nStake
 // V0.5: Stake modifier used to hash for a stake kernel is chosen as the stake
 // modifier that is (nStakeMinAge minus a selection interval) earlier than the
 // stake, thus at least a selection interval later than the coin generating the // kernel, as the generating coin is from at least nStakeMinAge ago.
-static bool GetKernelStakeModifierV05(CBlockIndex* pindexPrev, unsigned int nTimeTx, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake)
+static bool GetKernelStakeModifierV05(CBlockIndex* pindexPrev, unsigned int nTimeTx, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake, bool fUseIndex)
 {
+    AssertLockHeld(cs_main);
     const Consensus::Params& params = Params().GetConsensus();
     const CBlockIndex* pindex = pindexPrev;
     nStakeModifierHeight = pindex->nHeight;
@@ -355,6 +452,38 @@ static bool GetKernelStakeModifierV05(CBlockIndex* pindexPrev, unsigned int nTim
         else
             return false;
     }
+
+    if (fUseIndex)
+    {
+        // The walk below stops at the first block generating a modifier
+        // (nStakeMinAge minus a selection interval) before the kernel. Check
+        // the part of pindexPrev's branch outside the active chain, then look
+        // the rest up in the index.
+        int64_t nTimeMax = (int64_t) nTimeTx - params.nStakeMinAge + nStakeModifierSelectionInterval;
+        const CBlockIndex* pindexFork = chainActive.FindFork(pindexPrev);
+        const CBlockIndex* pindexFound = nullptr;
+        for (pindex = pindexPrev->pprev; pindexFork != pindexPrev && pindex && pindex != pindexFork; pindex = pindex->pprev)
+        {
+            if (pindex->GeneratedStakeModifier() && pindex->GetBlockTime() <= nTimeMax)
+            {
+                pindexFound = pindex;
+                break;
+            }
+        }
+        if (!pindexFound && pindexFork)
+        {
+            if (stakeModifierIndex.Tip() != chainActive.Tip())
+                stakeModifierIndex.SetTip(chainActive.Tip());
+            pindexFound = stakeModifierIndex.FindPrev(pindexFork == pindexPrev ? pindexPrev->nHeight : pindexFork->nHeight + 1, nTimeMax);
+        }
+        if (!pindexFound)
+            return error("GetKernelStakeModifier() : reached genesis block");
+        nStakeModifierHeight = pindexFound->nHeight;
+        nStakeModifierTime = pindexFound->GetBlockTime();
+        nStakeModifier = pindexFound->nStakeModifier;
+        return true;
+    }
+
     // loop to find the stake modifier earlier by 
     // (nStakeMinAge minus a selection interval)
     while (nStakeModifierTime + params.nStakeMinAge - nStakeModifierSelectionInterval >(int64_t) nTimeTx)
@@ -376,8 +505,9 @@ static bool GetKernelStakeModifierV05(CBlockIndex* pindexPrev, unsigned int nTim
 
 // V0.3: Stake modifier used to hash for a stake kernel is chosen as the stake
 // modifier about a selection interval later than the coin generating the kernel
-static bool GetKernelStakeModifierV03(CBlockIndex* pindexPrev, uint256 hashBlockFrom, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake)
+static bool GetKernelStakeModifierV03(CBlockIndex* pindexPrev, uint256 hashBlockFrom, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake, bool fUseIndex)
 {
+    AssertLockHeld(cs_main);
     const Consensus::Params& params = Params().GetConsensus();
     nStakeModifier = 0;
     if (!mapBlockIndex.count(hashBlockFrom))
@@ -387,6 +517,32 @@ static bool GetKernelStakeModifierV03(CBlockIndex* pindexPrev, uint256 hashBlock
     nStakeModifierTime = pindexFrom->GetBlockTime();
     int64_t nStakeModifierSelectionInterval = GetStakeModifierSelectionInterval();
 
+    if (fUseIndex && chainActive.Contains(pindexFrom))
+    {
+        // The walk below follows the active chain up to its tip, or up to the
+        // fork point if pindexPrev is on a side chain
+        const CBlockIndex* pindexLast = chainActive.Contains(pindexPrev) ? chainActive.Tip() : chainActive.FindFork(pindexPrev);
+        if (stakeModifierIndex.Tip() != chainActive.Tip())
+            stakeModifierIndex.SetTip(chainActive.Tip());
+        const CBlockIndex* pindex = stakeModifierIndex.FindNext(pindexFrom->nHeight, pindexFrom->GetBlockTime() + nStakeModifierSelectionInterval);
+        if (pindex && pindex->nHeight <= pindexLast->nHeight)
+        {
+            nStakeModifierHeight = pindex->nHeight;
+            nStakeModifierTime = pindex->GetBlockTime();
+            nStakeModifier = pindex->nStakeModifier;
+            return true;
+        }
+        if (pindexLast == chainActive.Tip())
+        {   // reached best block; may happen if node is behind on block chain
+            if (fPrintProofOfStake || (pindexLast->GetBlockTime() + params.nStakeMinAge - nStakeModifierSelectionInterval > GetAdjustedTime()))
+                return error("GetKernelStakeModifier() : reached best block %s at height %d from block %s",
+                    pindexLast->GetBlockHash().ToString(), pindexLast->nHeight, hashBlockFrom.ToString());
+            else
+                return false;
+        }
+        // otherwise the modifier is on pindexPrev's side chain, walk it
+    }
+
 
     // we need to iterate index forward but we cannot depend on chainActive.Next()
     // because there is no guarantee that we are checking blocks in active chain.
@@ -429,12 +585,84 @@ static bool GetKernelStakeModifierV03(CBlockIndex* pindexPrev, uint256 hashBlock
 }
 
 // Get the stake modifier specified by the protocol to hash for a stake kernel
-static bool GetKernelStakeModifier(CBlockIndex* pindexPrev, uint256 hashBlockFrom, unsigned int nTimeTx, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake)
+bool GetKernelStakeModifier(CBlockIndex* pindexPrev, uint256 hashBlockFrom, unsigned int nTimeTx, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake, bool fUseIndex)
 {
     if (IsProtocolV05(nTimeTx))
-        return GetKernelStakeModifierV05(pindexPrev, nTimeTx, nStakeModifier, nStakeModifierHeight, nStakeModifierTime, fPrintProofOfStake);
+        return GetKernelStakeModifierV05(pindexPrev, nTimeTx, nStakeModifier, nStakeModifierHeight, nStakeModifierTime, fPrintProofOfStake, fUseIndex);
     else
-        return GetKernelStakeModifierV03(pindexPrev, hashBlockFrom, nStakeModifier, nStakeModifierHeight, nStakeModifierTime, fPrintProofOfStake);
+        return GetKernelStakeModifierV03(pindexPrev, hashBlockFrom, nStakeModifier, nStakeModifierHeight, nStakeModifierTime, fPrintProofOfStake, fUseIndex);
+}
+
+void ComputeKernelHashes(const KernelInput* pkernel, size_t nKernels, uint256* phash)
+{
+    // Every kernel message fits one SHA-256 block, so hash them a batch of
+    // padded blocks at a time with SHA256DOneBlock
+    static const size_t BATCH_SIZE = 8;
+    unsigned char buf[BATCH_SIZE * 64];
+    unsigned char out[BATCH_SIZE * CSHA256::OUTPUT_SIZE];
+    while (nKernels)
+    {
+        size_t nBatch = std::min(nKernels, BATCH_SIZE);
+        memset(buf, 0, nBatch * 64);
+        for (size_t i = 0; i < nBatch; i++)
+        {
+            const KernelInput& kernel = pkernel[i];
+            unsigned char* pbegin = buf + 64 * i;
+            unsigned char* p = pbegin;
+            if (IsProtocolV03(kernel.nTimeTx))
+            {
+                WriteLE64(p, kernel.nStakeModifier);
+                p += 8;
+            }
+            else
+            {
+                WriteLE32(p, kernel.nBits);
+                p += 4;
+            }
+            WriteLE32(p, kernel.nTimeBlockFrom);
+            WriteLE32(p + 4, kernel.nTxPrevOffset);
+            WriteLE32(p + 8, kernel.nTimeTxPrev);
+            WriteLE32(p + 12, kernel.nPrevoutN);
+            WriteLE32(p + 16, kernel.nTimeTx);
+            p += 20;
+            *p = 0x80;
+            WriteBE64(pbegin + 56, (p - pbegin) << 3);
+        }
+        SHA256DOneBlock(out, buf, nBatch);
+        for (size_t i = 0; i < nBatch; i++)
+            memcpy(phash[i].begin(), out + i * CSHA256::OUTPUT_SIZE, CSHA256::OUTPUT_SIZE);
+        pkernel += nBatch;
+        phash += nBatch;
+        nKernels -= nBatch;
+    }
+}
+
+// Check hashProofOfStake <= nValueIn * nTimeWeight / COIN / (24 * 60 * 60) * target
+// with the truncation and sign rules of the OpenSSL big numbers this was
+// originally computed with: divisions round toward zero and a negative
+// coin day weight or target makes the product negative.
+bool CheckStakeKernelTarget(const uint256& hashProofOfStake, unsigned int nBits, CAmount nValueIn, int64_t nTimeWeight)
+{
+    bool fTargetNegative, fTargetOverflow;
+    arith_uint256 bnTarget;
+    bnTarget.SetCompact(nBits, &fTargetNegative, &fTargetOverflow);
+
+    // |nValueIn * nTimeWeight| fits in 128 bits
+    arith_uint256 bnWeight = arith_uint256(nValueIn < 0 ? -(uint64_t)nValueIn : (uint64_t)nValueIn);
+    bnWeight *= arith_uint256(nTimeWeight < 0 ? -(uint64_t)nTimeWeight : (uint64_t)nTimeWeight);
+    bnWeight /= COIN * 24 * 60 * 60;
+    bool fWeightNegative = ((nValueIn < 0) != (nTimeWeight < 0)) && bnWeight != 0;
+
+    if (bnWeight == 0 || (bnTarget == 0 && !fTargetOverflow))
+        return hashProofOfStake.IsNull();
+    if (fWeightNegative != fTargetNegative)
+        return false;
+    // The hash is below 2^256, so a larger target passes whatever the weight
+    if (fTargetOverflow)
+        return true;
+    arith_uint512 bnCoinDayWeightTarget(bnWeight);
+    bnCoinDayWeightTarget *= arith_uint512(bnTarget);
+    return arith_uint512(UintToArith256(hashProofOfStake)) <= bnCoinDayWeightTarget;
 }
 
 // peercoin kernel protocol
@@ -464,58 +692,52 @@ static bool GetKernelStakeModifier(CBlockIndex* pindexPrev, uint256 hashBlockFro
 //   a proof-of-work situation.
 //
 bool CheckStakeKernelHash(unsigned int nBits, CBlockIndex* pindexPrev, const CBlockHeader& blockFrom, unsigned int nTxPrevOffset, const CTransactionRef& txPrev, const COutPoint& prevout, unsigned int nTimeTx, uint256& hashProofOfStake, bool fPrintProofOfStake)
+{
+    return CheckStakeKernelHash(nBits, pindexPrev, blockFrom.GetBlockTime(), blockFrom.GetHash(), nTxPrevOffset, txPrev->nTime, txPrev->vout[prevout.n].nValue, prevout, nTimeTx, hashProofOfStake, fPrintProofOfStake);
+}
+
+bool CheckStakeKernelHash(unsigned int nBits, CBlockIndex* pindexPrev, unsigned int nTimeBlockFrom, const uint256& hashBlockFrom, unsigned int nTxPrevOffset, unsigned int nTimeTxPrev, CAmount nValueIn, const COutPoint& prevout, unsigned int nTimeTx, uint256& hashProofOfStake, bool fPrintProofOfStake)
 {
     const Consensus::Params& params = Params().GetConsensus();
-    if (nTimeTx < txPrev->nTime)  // Transaction timestamp violation
+    if (nTimeTx < nTimeTxPrev)  // Transaction timestamp violation
         return error("CheckStakeKernelHash() : nTime violation");
 
-    unsigned int nTimeBlockFrom = blockFrom.GetBlockTime();
     if (nTimeBlockFrom + params.nStakeMinAge > nTimeTx) // Min age requirement
         return error("CheckStakeKernelHash() : min age violation");
 
-    CBigNum bnTargetPerCoinDay;
-    bnTargetPerCoinDay.SetCompact(nBits);
-    int64_t nValueIn = txPrev->vout[prevout.n].nValue;
     // v0.3 protocol kernel hash weight starts from 0 at the 30-day min age
     // this change increases active coins participating the hash and helps
     // to secure the network when proof-of-stake difficulty is low
-    int64_t nTimeWeight = min((int64_t)nTimeTx - txPrev->nTime, params.nStakeMaxAge) - (IsProtocolV03(nTimeTx)? params.nStakeMinAge : 0);
-    CBigNum bnCoinDayWeight = CBigNum(nValueIn) * nTimeWeight / COIN / (24 * 60 * 60);
+    int64_t nTimeWeight = min((int64_t)nTimeTx - nTimeTxPrev, params.nStakeMaxAge) - (IsProtocolV03(nTimeTx)? params.nStakeMinAge : 0);
     // Calculate hash
-    CDataStream ss(SER_GETHASH, 0);
     uint64_t nStakeModifier = 0;
     int nStakeModifierHeight = 0;
     int64_t nStakeModifierTime = 0;
     if (IsProtocolV03(nTimeTx))  // v0.3 protocol
     {
-        if (!GetKernelStakeModifier(pindexPrev, blockFrom.GetHash(), nTimeTx, nStakeModifier, nStakeModifierHeight, nStakeModifierTime, fPrintProofOfStake))
+        if (!GetKernelStakeModifier(pindexPrev, hashBlockFrom, nTimeTx, nStakeModifier, nStakeModifierHeight, nStakeModifierTime, fPrintProofOfStake))
             return false;
-        ss << nStakeModifier;
-    }
-    else // v0.2 protocol
-    {
-        ss << nBits;
     }
 
-    ss << nTimeBlockFrom << nTxPrevOffset << txPrev->nTime << prevout.n << nTimeTx;
-    hashProofOfStake = Hash(ss.begin(), ss.end());
+    KernelInput kernel = {nStakeModifier, nBits, nTimeBlockFrom, nTxPrevOffset, nTimeTxPrev, prevout.n, nTimeTx};
+    ComputeKernelHashes(&kernel, 1, &hashProofOfStake);
     if (fPrintProofOfStake)
     {
         if (IsProtocolV03(nTimeTx))
             LogPrintf("CheckStakeKernelHash() : using modifier 0x%016x at height=%d timestamp=%s for block from height=%d timestamp=%s\n",
                 nStakeModifier, nStakeModifierHeight,
                 DateTimeStrFormat(nStakeModifierTime),
-                mapBlockIndex[blockFrom.GetHash()]->nHeight,
-                DateTimeStrFormat(blockFrom.GetBlockTime()));
+                mapBlockIndex[hashBlockFrom]->nHeight,
+                DateTimeStrFormat(nTimeBlockFrom));
         LogPrintf("CheckStakeKernelHash() : check protocol=%s modifier=0x%016x nTimeBlockFrom=%u nTxPrevOffset=%u nTimeTxPrev=%u nPrevout=%u nTimeTx=%u hashProof=%s\n",
             IsProtocolV05(nTimeTx)? "0.5" : (IsProtocolV03(nTimeTx)? "0.3" : "0.2"),
             IsProtocolV03(nTimeTx)? nStakeModifier : (uint64_t) nBits,
-            nTimeBlockFrom, nTxPrevOffset, txPrev->nTime, prevout.n, nTimeTx,
+            nTimeBlockFrom, nTxPrevOffset, nTimeTxPrev, prevout.n, nTimeTx,
             hashProofOfStake.ToString());
     }
 
     // Now check if proof-of-stake hash meets target protocol
-    if (CBigNum(hashProofOfStake) > bnCoinDayWeight * bnTargetPerCoinDay)
+    if (!CheckStakeKernelTarget(hashProofOfStake, nBits, nValueIn, nTimeWeight))
         return false;
     if (gArgs.GetBoolArg("-debug", false) && !fPrintProofOfStake)
     {
@@ -523,33 +745,127 @@ bool CheckStakeKernelHash(unsigned int nBits, CBlockIndex* pindexPrev, const CBl
             LogPrintf("CheckStakeKernelHash() : using modifier 0x%016x at height=%d timestamp=%s for block from height=%d timestamp=%s\n",
                 nStakeModifier, nStakeModifierHeight, 
                 DateTimeStrFormat(nStakeModifierTime),
-                mapBlockIndex[blockFrom.GetHash()]->nHeight,
-                DateTimeStrFormat(blockFrom.GetBlockTime()));
+                mapBlockIndex[hashBlockFrom]->nHeight,
+                DateTimeStrFormat(nTimeBlockFrom));
         LogPrintf("CheckStakeKernelHash() : pass protocol=%s modifier=0x%016x nTimeBlockFrom=%u nTxPrevOffset=%u nTimeTxPrev=%u nPrevout=%u nTimeTx=%u hashProof=%s\n",
             IsProtocolV03(nTimeTx)? "0.3" : "0.2",
             IsProtocolV03(nTimeTx)? nStakeModifier : (uint64_t) nBits,
-            nTimeBlockFrom, nTxPrevOffset, txPrev->nTime, prevout.n, nTimeTx,
+            nTimeBlockFrom, nTxPrevOffset, nTimeTxPrev, prevout.n, nTimeTx,
             hashProofOfStake.ToString());
     }
     return true;
 }
 
-// Check kernel hash target and coinstake signature
-bool CheckProofOfStake(CValidationState &state, CBlockIndex* pindexPrev, const CTransactionRef& tx, unsigned int nBits, uint256& hashProofOfStake)
+void GetStakeKernels(unsigned int nBits, CBlockIndex* pindexPrev, unsigned int nTimeBlockFrom, const uint256& hashBlockFrom, unsigned int nTxPrevOffset, unsigned int nTimeTxPrev, const COutPoint& prevout, unsigned int nTimeTxFrom, unsigned int nSearchInterval, std::vector<KernelInput>& vKernel)
 {
-    if (!tx->IsCoinStake())
-        return error("CheckProofOfStake() : called on non-coinstake %s", tx->GetHash().ToString());
+    const Consensus::Params& params = Params().GetConsensus();
+    vKernel.clear();
+    vKernel.reserve(nSearchInterval);
+    for (unsigned int n = 0; n < nSearchInterval && n <= nTimeTxFrom; n++)
+    {
+        KernelInput kernel = {0, nBits, nTimeBlockFrom, nTxPrevOffset, nTimeTxPrev, prevout.n, nTimeTxFrom - n};
+        if (kernel.nTimeTx < nTimeTxPrev || nTimeBlockFrom + params.nStakeMinAge > kernel.nTimeTx)
+            continue;
+        if (IsProtocolV03(kernel.nTimeTx))
+        {
+            int nStakeModifierHeight;
+            int64_t nStakeModifierTime;
+            if (!GetKernelStakeModifier(pindexPrev, hashBlockFrom, kernel.nTimeTx, kernel.nStakeModifier, nStakeModifierHeight, nStakeModifierTime, false))
+                continue;
+        }
+        vKernel.push_back(kernel);
+    }
+}
 
-    // Kernel (input 0) must match the stake hash target per coin age (nBits)
-    const CTxIn& txin = tx->vin[0];
+void CStakeModifierSnapshot::Take(CBlockIndex* pindexPrev, unsigned int nTimeTxFromIn, unsigned int nSearchInterval)
+{
+    AssertLockHeld(cs_main);
+    nTimeTxFrom = nTimeTxFromIn;
+    fComplete = true;
+    vEntry.clear();
+    vEntry.reserve(nSearchInterval);
+    for (unsigned int n = 0; n < nSearchInterval && n <= nTimeTxFrom; n++)
+    {
+        Entry entry = {false, 0};
+        if (IsProtocolV05(nTimeTxFrom - n))
+        {
+            int nStakeModifierHeight;
+            int64_t nStakeModifierTime;
+            entry.fFound = GetKernelStakeModifier(pindexPrev, uint256(), nTimeTxFrom - n, entry.nStakeModifier, nStakeModifierHeight, nStakeModifierTime, false);
+        }
+        else
+            fComplete = false;
+        vEntry.push_back(entry);
+    }
+}
+
+void CStakeModifierSnapshot::GetKernels(unsigned int nBits, unsigned int nTimeBlockFrom, unsigned int nTxPrevOffset, unsigned int nTimeTxPrev, const COutPoint& prevout, std::vector<KernelInput>& vKernel) const
+{
+    assert(fComplete);
+    const Consensus::Params& params = Params().GetConsensus();
+    vKernel.clear();
+    vKernel.reserve(vEntry.size());
+    for (unsigned int n = 0; n < vEntry.size(); n++)
+    {
+        KernelInput kernel = {vEntry[n].nStakeModifier, nBits, nTimeBlockFrom, nTxPrevOffset, nTimeTxPrev, prevout.n, nTimeTxFrom - n};
+        if (kernel.nTimeTx < nTimeTxPrev || nTimeBlockFrom + params.nStakeMinAge > kernel.nTimeTx)
+            continue;
+        if (!vEntry[n].fFound)
+            continue;
+        vKernel.push_back(kernel);
+    }
+}
+
+int64_t GetLastStakeKernelTime(const CBlockIndex* pindexPrev)
+{
+    return pindexPrev->GetBlockTime() + Params().GetConsensus().nStakeMinAge - GetStakeModifierSelectionInterval() - 1;
+}
 
+int64_t GetStakeKernelWeight(const KernelInput& kernel)
+{
+    const Consensus::Params& params = Params().GetConsensus();
+    return min((int64_t)kernel.nTimeTx - kernel.nTimeTxPrev, params.nStakeMaxAge) - (IsProtocolV03(kernel.nTimeTx)? params.nStakeMinAge : 0);
+}
+
+int FindStakeKernel(const std::vector<KernelInput>& vKernel, CAmount nValueIn)
+{
+    std::vector<uint256> vHash(vKernel.size());
+    ComputeKernelHashes(vKernel.data(), vKernel.size(), vHash.data());
+    for (size_t i = 0; i < vKernel.size(); i++)
+    {
+        const KernelInput& kernel = vKernel[i];
+        if (CheckStakeKernelTarget(vHash[i], kernel.nBits, nValueIn, GetStakeKernelWeight(kernel)))
+            return i;
+    }
+    return -1;
+}
+
+bool CStakeKernelCheck::operator()()
+{
+    int nKernel = FindStakeKernel(vKernel, nValueIn);
+    if (nKernel < 0)
+        return true;
+    std::lock_guard<std::mutex> lock(presult->mutex);
+    if (presult->nCoin < 0)
+    {
+        presult->nCoin = nCoin;
+        presult->nTimeTx = vKernel[nKernel].nTimeTx;
+    }
+    return false;
+}
+
+// Check kernel hash target and coinstake signature
+// Read the kernel inputs of the output a coinstake stakes and the output
+// itself through the transaction index and the block files
+static bool ReadStakeKernelFromDisk(const COutPoint& prevout, unsigned int& nTimeBlockFrom, uint256& hashBlockFrom, unsigned int& nTxPrevOffset, unsigned int& nTimeTxPrev, CTxOut& txoutPrev)
+{
     // Transaction index is required to get to block header
     if (!fTxIndex)
         return error("CheckProofOfStake() : transaction index not available");
 
     // Get transaction index for the previous transaction
     CDiskTxPos postx;
-    if (!pblocktree->ReadTxIndex(txin.prevout.hash, postx))
+    if (!pblocktree->ReadTxIndex(prevout.hash, postx))
         return error("CheckProofOfStake() : tx index not found");  // tx index not found
 
     // Read txPrev and header of its block
@@ -564,21 +880,71 @@ bool CheckProofOfStake(CValidationState &state, CBlockIndex* pindexPrev, const C
         } catch (std::exception &e) {
             return error("%s() : deserialize or I/O error in CheckProofOfStake()", __PRETTY_FUNCTION__);
         }
-        if (txPrev->GetHash() != txin.prevout.hash)
+        if (txPrev->GetHash() != prevout.hash || prevout.n >= txPrev->vout.size())
             return error("%s() : txid mismatch in CheckProofOfStake()", __PRETTY_FUNCTION__);
     }
 
+    nTimeBlockFrom = header.GetBlockTime();
+    hashBlockFrom = header.GetHash();
+    nTxPrevOffset = postx.nTxOffset + CBlockHeader::NORMAL_SERIALIZE_SIZE;
+    nTimeTxPrev = txPrev->nTime;
+    txoutPrev = txPrev->vout[prevout.n];
+    return true;
+}
+
+bool ReadStakeKernelFromIndex(const CCoinsView& view, const CCoinsViewDB& db, const COutPoint& prevout, unsigned int& nTimeBlockFrom, uint256& hashBlockFrom, unsigned int& nTxPrevOffset, unsigned int& nTimeTxPrev, CTxOut& txoutPrev)
+{
+    AssertLockHeld(cs_main);
+    Coin coinPrev;
+    CKernelIndexEntry entry;
+    if (!view.GetCoin(prevout, coinPrev) || !db.ReadKernelIndex(prevout.hash, entry))
+        return false;
+
+    // Entries are written and erased as blocks are connected and disconnected,
+    // apart from the coins. One left from a block no longer active, as after a
+    // crash with the coins written behind a reorg, may hold another offset.
+    const CBlockIndex* pindexFrom = chainActive[entry.nHeight];
+    if (entry.nHeight != (int)coinPrev.nHeight || !pindexFrom || pindexFrom->GetBlockHash() != entry.hashBlock)
+        return false;
+
+    nTimeBlockFrom = pindexFrom->GetBlockTime();
+    hashBlockFrom = pindexFrom->GetBlockHash();
+    nTxPrevOffset = entry.nTxOffset;
+    nTimeTxPrev = coinPrev.nTime;
+    txoutPrev = coinPrev.out;
+    return true;
+}
+
+bool CheckProofOfStake(CValidationState &state, CBlockIndex* pindexPrev, const CTransactionRef& tx, unsigned int nBits, uint256& hashProofOfStake, bool fCheckSignature)
+{
+    AssertLockHeld(cs_main);
+    if (!tx->IsCoinStake())
+        return error("CheckProofOfStake() : called on non-coinstake %s", tx->GetHash().ToString());
+
+    // Kernel (input 0) must match the stake hash target per coin age (nBits)
+    const CTxIn& txin = tx->vin[0];
+
+    // While the staked output is unspent at the tip, its coin and the kernel
+    // index hold the kernel inputs. Only fall back to the block files for a
+    // kernel spent on the active chain or connected before the kernel index.
+    unsigned int nTimeBlockFrom, nTxPrevOffset, nTimeTxPrev;
+    uint256 hashBlockFrom;
+    CTxOut txoutPrev;
+    if (!ReadStakeKernelFromIndex(*pcoinsTip, *pcoinsdbview, txin.prevout, nTimeBlockFrom, hashBlockFrom, nTxPrevOffset, nTimeTxPrev, txoutPrev)
+        && !ReadStakeKernelFromDisk(txin.prevout, nTimeBlockFrom, hashBlockFrom, nTxPrevOffset, nTimeTxPrev, txoutPrev))
+        return false;
+
     // Verify signature
-    {
+    if (fCheckSignature) {
         int nIn = 0;
-        const CTxOut& prevOut = txPrev->vout[tx->vin[nIn].prevout.n];
-        TransactionSignatureChecker checker(&(*tx), nIn, prevOut.nValue, PrecomputedTransactionData(*tx));
+        const PrecomputedTransactionData txdata(*tx);
+        TransactionSignatureChecker checker(&(*tx), nIn, txoutPrev.nValue, txdata);
 
-        if (!VerifyScript(tx->vin[nIn].scriptSig, prevOut.scriptPubKey, &(tx->vin[nIn].scriptWitness), SCRIPT_VERIFY_P2SH, checker, nullptr))
+        if (!VerifyScript(tx->vin[nIn].scriptSig, txoutPrev.scriptPubKey, &(tx->vin[nIn].scriptWitness), SCRIPT_VERIFY_P2SH, checker, nullptr))
             return state.DoS(100, false, REJECT_INVALID, "invalid-pos-script", false, strprintf("%s: VerifyScript failed on coinstake %s", __func__, tx->GetHash().ToString()));
     }
 
-    if (!CheckStakeKernelHash(nBits, pindexPrev, header, postx.nTxOffset + CBlockHeader::NORMAL_SERIALIZE_SIZE, txPrev, txin.prevout, tx->nTime, hashProofOfStake, gArgs.GetBoolArg("-debug", false)))
+    if (!CheckStakeKernelHash(nBits, pindexPrev, nTimeBlockFrom, hashBlockFrom, nTxPrevOffset, nTimeTxPrev, txoutPrev.nValue, txin.prevout, tx->nTime, hashProofOfStake, gArgs.GetBoolArg("-debug", false)))
         return state.DoS(1, error("CheckProofOfStake() : INFO: check kernel failed on coinstake %s, hashProof=%s", tx->GetHash().ToString(), hashProofOfStake.ToString())); // may occur during initial download or if behind on block chain sync
 
     return true;
@@ -6,7 +6,12 @@
 
 #include <primitives/transaction.h> // CTransaction(Ref)
 
+#include <mutex>
+#include <vector>
+
 class CBlockIndex;
+class CCoinsView;
+class CCoinsViewDB;
 class CValidationState;
 class CBlockHeader;
 class CBlock;
@@ -34,16 +39,204 @@ bool IsProtocolV07(unsigned int nTimeTx);
 // Whether a given block is subject to new BIPs from bitcoin 0.16.x
 bool IsBTC16BIPsEnabled(uint32_t nTimeTx);
 
+/** peercoin: blocks of the active chain that generated a stake modifier, in
+ * height order. Lets the kernel find the modifier in force for a coin with a
+ * lookup instead of walking the chain block by block. Protected by cs_main.
+ */
+class CStakeModifierIndex
+{
+private:
+    struct CGeneratedModifier
+    {
+        int nHeight;
+        int64_t nTime;
+        const CBlockIndex* pindex;
+    };
+    std::vector<CGeneratedModifier> vGenerated;
+    const CBlockIndex* pindexTip;
+
+public:
+    CStakeModifierIndex() : pindexTip(nullptr) {}
+
+    /** Move the index to a new active chain tip. Only the blocks between the
+     *  fork point and the new tip are visited, so following ConnectTip and
+     *  DisconnectTip is constant time. */
+    void SetTip(const CBlockIndex* pindexNew);
+    const CBlockIndex* Tip() const { return pindexTip; }
+
+    /** First block above nHeightFrom that generated a modifier at or after nTime */
+    const CBlockIndex* FindNext(int nHeightFrom, int64_t nTime) const;
+    /** Last block below nHeightTo that generated a modifier at or before nTime */
+    const CBlockIndex* FindPrev(int nHeightTo, int64_t nTime) const;
+};
+
+extern CStakeModifierIndex stakeModifierIndex;
+
+/** The candidate blocks a new stake modifier is selected from: the blocks
+ *  since the start of the selection interval, in timestamp order. The window
+ *  is kept from one modifier computation to the next, so moving along a
+ *  chain only visits and sorts the blocks added since. */
+class CStakeModifierCandidates
+{
+public:
+    struct CCandidate
+    {
+        int64_t nTime;
+        uint256 hashBlock;
+        const CBlockIndex* pindex;
+    };
+
+private:
+    std::vector<CCandidate> vCandidates;
+    const CBlockIndex* pindexLast;
+    int64_t nIntervalStart;
+
+public:
+    CStakeModifierCandidates() : pindexLast(nullptr), nIntervalStart(0) {}
+
+    /** Move the window to the blocks up to pindexPrev back to the last one
+     *  timestamped before nSelectionIntervalStart */
+    void Update(const CBlockIndex* pindexPrev, int64_t nSelectionIntervalStart);
+    /** Forget the window, for when the block index goes away */
+    void Clear();
+    const std::vector<CCandidate>& Get() const { return vCandidates; }
+};
+
+extern CStakeModifierCandidates stakeModifierCandidates;
+
 // Compute the hash modifier for proof-of-stake
 bool ComputeNextStakeModifier(const CBlockIndex* pindexCurrent, uint64_t& nStakeModifier, bool& fGeneratedStakeModifier);
 
+// Get the stake modifier specified by the protocol to hash for a stake kernel
+// fUseIndex=false forces the chain walk instead of the stake modifier index
+bool GetKernelStakeModifier(CBlockIndex* pindexPrev, uint256 hashBlockFrom, unsigned int nTimeTx, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake, bool fUseIndex=true);
+
+// The fields hashed into a stake kernel. nStakeModifier is hashed from
+// protocol v0.3 on, nBits before that.
+struct KernelInput
+{
+    uint64_t nStakeModifier;
+    unsigned int nBits;
+    unsigned int nTimeBlockFrom;
+    unsigned int nTxPrevOffset;
+    unsigned int nTimeTxPrev;
+    unsigned int nPrevoutN;
+    unsigned int nTimeTx;
+};
+
+// Compute the kernel hashes of nKernels kernels at once, using the
+// multi-way SHA-256 implementations where the CPU has them
+void ComputeKernelHashes(const KernelInput* pkernel, size_t nKernels, uint256* phash);
+
+// Check whether a kernel hash is within the target weighted by coin age
+bool CheckStakeKernelTarget(const uint256& hashProofOfStake, unsigned int nBits, CAmount nValueIn, int64_t nTimeWeight);
+
 // Check whether stake kernel meets hash target
 // Sets hashProofOfStake on success return
 bool CheckStakeKernelHash(unsigned int nBits, CBlockIndex* pindexPrev, const CBlockHeader& blockFrom, unsigned int nTxPrevOffset, const CTransactionRef& txPrev, const COutPoint& prevout, unsigned int nTimeTx, uint256& hashProofOfStake, bool fPrintProofOfStake=false);
 
+// Check whether stake kernel meets hash target, given the static kernel
+// inputs of the staked output instead of its block header and transaction
+// Sets hashProofOfStake on success return
+bool CheckStakeKernelHash(unsigned int nBits, CBlockIndex* pindexPrev, unsigned int nTimeBlockFrom, const uint256& hashBlockFrom, unsigned int nTxPrevOffset, unsigned int nTimeTxPrev, CAmount nValueIn, const COutPoint& prevout, unsigned int nTimeTx, uint256& hashProofOfStake, bool fPrintProofOfStake=false);
+
+// Collect the kernels of the coinstake timestamps nTimeTxFrom, nTimeTxFrom - 1,
+// ... back over nSearchInterval seconds, leaving out the ones that
+// CheckStakeKernelHash rejects before hashing. Requires cs_main
+void GetStakeKernels(unsigned int nBits, CBlockIndex* pindexPrev, unsigned int nTimeBlockFrom, const uint256& hashBlockFrom, unsigned int nTxPrevOffset, unsigned int nTimeTxPrev, const COutPoint& prevout, unsigned int nTimeTxFrom, unsigned int nSearchInterval, std::vector<KernelInput>& vKernel);
+
+/** The stake modifiers of the coinstake timestamps a search runs over on
+ *  top of a tip. Since protocol v0.5 the modifier only depends on the
+ *  timestamp, so a snapshot taken once under cs_main serves the kernels of
+ *  every coin, which are then collected without holding it.
+ */
+class CStakeModifierSnapshot
+{
+private:
+    struct Entry
+    {
+        bool fFound;
+        uint64_t nStakeModifier;
+    };
+
+    unsigned int nTimeTxFrom;
+    //! Modifier of nTimeTxFrom - n at position n
+    std::vector<Entry> vEntry;
+    //! Whether all the timestamps are v0.5 ones
+    bool fComplete;
+
+public:
+    CStakeModifierSnapshot() : nTimeTxFrom(0), fComplete(false) {}
+
+    /** Look up the modifiers of nTimeTxFrom, nTimeTxFrom - 1, ... back over
+     *  nSearchInterval seconds. Requires cs_main */
+    void Take(CBlockIndex* pindexPrev, unsigned int nTimeTxFrom, unsigned int nSearchInterval);
+
+    /** Whether GetKernels can do without a per coin lookup */
+    bool IsComplete() const { return fComplete; }
+
+    /** Same kernels as GetStakeKernels over the snapshot's timestamps, needing
+     *  no locks. Only for a complete snapshot */
+    void GetKernels(unsigned int nBits, unsigned int nTimeBlockFrom, unsigned int nTxPrevOffset, unsigned int nTimeTxPrev, const COutPoint& prevout, std::vector<KernelInput>& vKernel) const;
+};
+
+// Latest coinstake timestamp that gets a stake modifier on top of pindexPrev
+// since protocol v0.5; later kernels have to wait for a newer tip
+int64_t GetLastStakeKernelTime(const CBlockIndex* pindexPrev);
+
+// Coin age weight in seconds a kernel is checked with, as in CheckStakeKernelHash
+int64_t GetStakeKernelWeight(const KernelInput& kernel);
+
+// Position of the first kernel meeting the hash target for a coin worth
+// nValueIn, or -1. Only hashes, so it needs no locks
+int FindStakeKernel(const std::vector<KernelInput>& vKernel, CAmount nValueIn);
+
+/** peercoin: the kernel search of one coin, run on the stake search threads
+ * through a CCheckQueue. Evaluates to false once a kernel is found so that
+ * the queue skips the coins not searched yet.
+ */
+class CStakeKernelCheck
+{
+public:
+    /** Where the first kernel found is recorded, shared by the checks of a search */
+    struct Result
+    {
+        std::mutex mutex;
+        int nCoin;
+        unsigned int nTimeTx;
+        Result() : nCoin(-1), nTimeTx(0) {}
+    };
+
+private:
+    std::vector<KernelInput> vKernel;
+    CAmount nValueIn;
+    int nCoin;
+    Result* presult;
+
+public:
+    CStakeKernelCheck() : nValueIn(0), nCoin(-1), presult(nullptr) {}
+    CStakeKernelCheck(std::vector<KernelInput>&& vKernelIn, CAmount nValueInIn, int nCoinIn, Result* presultIn) :
+        vKernel(std::move(vKernelIn)), nValueIn(nValueInIn), nCoin(nCoinIn), presult(presultIn) {}
+
+    bool operator()();
+
+    void swap(CStakeKernelCheck& check) {
+        vKernel.swap(check.vKernel);
+        std::swap(nValueIn, check.nValueIn);
+        std::swap(nCoin, check.nCoin);
+        std::swap(presult, check.presult);
+    }
+};
+
+// Get the kernel inputs of an output unspent in view from its coin and the
+// kernel index in db, provided the index entry is for the block at that
+// height on the active chain. Requires cs_main
+bool ReadStakeKernelFromIndex(const CCoinsView& view, const CCoinsViewDB& db, const COutPoint& prevout, unsigned int& nTimeBlockFrom, uint256& hashBlockFrom, unsigned int& nTxPrevOffset, unsigned int& nTimeTxPrev, CTxOut& txoutPrev);
+
 // Check kernel hash target and coinstake signature
 // Sets hashProofOfStake on success return
-bool CheckProofOfStake(CValidationState &state, CBlockIndex* pindexPrev, const CTransactionRef &tx, unsigned int nBits, uint256& hashProofOfStake);
+// The signature check can be skipped when it has already been verified
+bool CheckProofOfStake(CValidationState &state, CBlockIndex* pindexPrev, const CTransactionRef &tx, unsigned int nBits, uint256& hashProofOfStake, bool fCheckSignature=true);
 
 // Check whether the coinstake timestamp meets protocol
 bool CheckCoinStakeTimestamp(int64_t nTimeBlock, int64_t nTimeTx);
@@ -5,6 +5,7 @@
 #ifndef BITCOIN_MEMUSAGE_H
 #define BITCOIN_MEMUSAGE_H
 
+#include <flathashmap.h>
 #include <indirectmap.h>
 
 #include <stdlib.h>
@@ -165,6 +166,12 @@ static inline size_t DynamicUsage(const std::unordered_map<X, Y, Z>& m)
     return MallocUsage(sizeof(unordered_node<std::pair<const X, Y> >)) * m.size() + MallocUsage(sizeof(void*) * m.bucket_count());
 }
 
+template<typename X, typename Y, typename Z, typename W>
+static inline size_t DynamicUsage(const flat_hash_map<X, Y, Z, W>& m)
+{
+    return m.DynamicMemoryUsage(MallocUsage);
+}
+
 }
 
 #endif // BITCOIN_MEMUSAGE_H
@@ -6,6 +6,7 @@
 #include <miner.h>
 
 #include <amount.h>
+#include <arith_uint256.h>
 #include <chain.h>
 #include <chainparams.h>
 #include <coins.h>
@@ -14,6 +15,7 @@
 #include <consensus/merkle.h>
 #include <consensus/validation.h>
 #include <hash.h>
+#include <kernel.h>
 #include <validation.h>
 #include <net.h>
 #include <policy/policy.h>
@@ -49,6 +51,9 @@
 uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockWeight = 0;
 int64_t nLastCoinStakeSearchInterval = 0;
+CStakeMinterStats stakeMinterStats;
+// peercoin: coinstake timestamps up to this one have been searched on the current tip
+static int64_t nLastCoinStakeSearchTime = 0;
 
 int64_t UpdateTime(CBlockHeader* pblock)
 {
@@ -109,10 +114,55 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
         return nullptr;
     pblock = &pblocktemplate->block; // pointer for convenience
 
+    // peercoin: if coinstake available add coinstake tx. The kernel search
+    // takes cs_main only around its chain lookups, so it runs before the
+    // block is assembled under the lock
+    CBlockIndex* pindexStake = nullptr;
+    CMutableTransaction txCoinStake;
+
+    if (pwallet)  // attemp to find a coinstake
+    {
+        *pfPoSCancel = true;
+        {
+            LOCK(cs_main);
+            pindexStake = chainActive.Tip();
+            pblock->nBits = GetNextTargetRequired(pindexStake, true, chainparams.GetConsensus());
+        }
+        int64_t nSearchTime = txCoinStake.nTime; // search to current time
+        if (nSearchTime > nLastCoinStakeSearchTime)
+        {
+            int64_t nSearchInterval = nSearchTime - nLastCoinStakeSearchTime;
+            int64_t nSearchStart = GetTimeMicros();
+            uint64_t nKernels = 0;
+            bool fCoinStake = pwallet->CreateCoinStake(*pwallet, pblock->nBits, nSearchInterval, txCoinStake, &nKernels);
+            stakeMinterStats.nSecondsSearched += std::min(nSearchInterval, MAX_STAKE_SEARCH_INTERVAL);
+            stakeMinterStats.nSecondsSkipped += std::max(nSearchInterval - MAX_STAKE_SEARCH_INTERVAL, (int64_t)0);
+            stakeMinterStats.nKernelsHashed += nKernels;
+            stakeMinterStats.nSearchMicros += GetTimeMicros() - nSearchStart;
+            if (fCoinStake)
+            {
+                if (txCoinStake.nTime >= std::max(pindexStake->GetMedianTimePast()+1, pindexStake->GetBlockTime() - MAX_FUTURE_BLOCK_TIME))
+                {   // make sure coinstake would meet timestamp protocol
+                    // as it would be the same as the block timestamp
+                    *pfPoSCancel = false;
+                }
+            }
+            nLastCoinStakeSearchInterval = nSearchTime - nLastCoinStakeSearchTime;
+            nLastCoinStakeSearchTime = nSearchTime;
+        }
+        if (*pfPoSCancel)
+            return nullptr; // peercoin: there is no point to continue if we failed to create coinstake
+    }
+
     LOCK(cs_main);
     CBlockIndex* pindexPrev = chainActive.Tip();
     assert(pindexPrev != nullptr);
     nHeight = pindexPrev->nHeight + 1;
+    if (pwallet && pindexPrev != pindexStake)
+    {
+        *pfPoSCancel = true;
+        return nullptr; // the coinstake was made for a block that is no longer the tip
+    }
 
     // Create coinbase transaction.
     CMutableTransaction coinbaseTx;
@@ -121,7 +171,7 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     coinbaseTx.vout.resize(1);
     coinbaseTx.vout[0].scriptPubKey = scriptPubKeyIn;
 
-    if (pblock->IsProofOfWork()) {
+    if (!pwallet) { // proof-of-work block
         pblock->nBits = GetNextTargetRequired(pindexPrev, false, chainparams.GetConsensus());
         coinbaseTx.vout[0].nValue = GetProofOfWorkReward(pblock->nBits);
         }
@@ -131,33 +181,11 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     pblocktemplate->vTxFees.push_back(-1); // updated at end
     pblocktemplate->vTxSigOpsCost.push_back(-1); // updated at end
 
-    // peercoin: if coinstake available add coinstake tx
-    static int64_t nLastCoinStakeSearchTime = GetAdjustedTime();  // only initialized at startup
-
-    if (pwallet)  // attemp to find a coinstake
+    if (pwallet)
     {
-        *pfPoSCancel = true;
-        pblock->nBits = GetNextTargetRequired(pindexPrev, true, chainparams.GetConsensus());
-        CMutableTransaction txCoinStake;
-        int64_t nSearchTime = txCoinStake.nTime; // search to current time
-        if (nSearchTime > nLastCoinStakeSearchTime)
-        {
-            if (pwallet->CreateCoinStake(*pwallet, pblock->nBits, nSearchTime-nLastCoinStakeSearchTime, txCoinStake))
-            {
-                if (txCoinStake.nTime >= std::max(pindexPrev->GetMedianTimePast()+1, pindexPrev->GetBlockTime() - MAX_FUTURE_BLOCK_TIME))
-                {   // make sure coinstake would meet timestamp protocol
-                    // as it would be the same as the block timestamp
-                    coinbaseTx.vout[0].SetEmpty();
-                    coinbaseTx.nTime = txCoinStake.nTime;
-                    pblock->vtx.push_back(MakeTransactionRef(CTransaction(txCoinStake)));
-                    *pfPoSCancel = false;
-                }
-            }
-            nLastCoinStakeSearchInterval = nSearchTime - nLastCoinStakeSearchTime;
-            nLastCoinStakeSearchTime = nSearchTime;
-        }
-        if (*pfPoSCancel)
-            return nullptr; // peercoin: there is no point to continue if we failed to create coinstake
+        coinbaseTx.vout[0].SetEmpty();
+        coinbaseTx.nTime = txCoinStake.nTime;
+        pblock->vtx.push_back(MakeTransactionRef(CTransaction(txCoinStake)));
     }
 
     LOCK(mempool.cs);
@@ -508,6 +536,294 @@ static bool ProcessBlockFound(const CBlock* pblock, const CChainParams& chainpar
     return true;
 }
 
+/** peercoin: wakes the stake minter up when there may be something new to
+ * search: a new tip, a change to the wallet's transactions or the wallet
+ * being unlocked. In between the minter only wakes for each new second.
+ */
+class CStakeMinterNotifier : public CValidationInterface
+{
+private:
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    bool fNotified;
+    const CBlockIndex* pindexNewTip;
+
+public:
+    CStakeMinterNotifier() : fNotified(false), pindexNewTip(nullptr) {}
+
+    void Notify()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fNotified = true;
+        }
+        cond.notify_all();
+    }
+
+    /** Wait at most nMilliseconds for a notification. Returns the new tip
+     *  if the tip changed since the last call, and nullptr otherwise. */
+    const CBlockIndex* Wait(int64_t nMilliseconds)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (nMilliseconds > 0 && !fNotified)
+            cond.wait_for(lock, boost::chrono::milliseconds(nMilliseconds));
+        fNotified = false;
+        const CBlockIndex* pindexRet = pindexNewTip;
+        pindexNewTip = nullptr;
+        return pindexRet;
+    }
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex* pindexNew, const CBlockIndex* pindexFork, bool fInitialDownload) override
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            pindexNewTip = pindexNew;
+        }
+        Notify();
+    }
+};
+
+static CStakeMinterNotifier stakeMinterNotifier;
+
+CStakePlanner stakePlanner;
+
+// Seconds of kernels gathered per cs_main lock while planning
+static const int64_t STAKE_PLAN_CHUNK = 10 * 60;
+
+void CStakePlanner::Wake()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutexWake);
+        fWake = true;
+    }
+    condWake.notify_all();
+}
+
+void CStakePlanner::UpdatedBlockTip(const CBlockIndex* pindexNew, const CBlockIndex* pindexFork, bool fInitialDownload)
+{
+    Wake();
+}
+
+void CStakePlanner::WalletChanged()
+{
+    {
+        LOCK(cs);
+        fWalletChanged = true;
+    }
+    Wake();
+}
+
+void CStakePlanner::WaitForTip(int64_t nMilliseconds)
+{
+    boost::unique_lock<boost::mutex> lock(mutexWake);
+    if (!fWake)
+        condWake.wait_for(lock, boost::chrono::milliseconds(nMilliseconds));
+    fWake = false;
+}
+
+void CStakePlanner::Plan(CWallet* pwallet, int64_t nHorizon)
+{
+    int64_t nNow = GetAdjustedTime();
+
+    // A wallet change from here on leaves this plan behind again
+    {
+        LOCK(cs);
+        fWalletChanged = false;
+    }
+
+    // Take stock of the tip, its target and the outputs that can stake
+    CBlockIndex* pindexTip;
+    unsigned int nBits;
+    std::map<COutPoint, CStakeCacheEntry> mapStakeable;
+    {
+        LOCK2(cs_main, pwallet->cs_wallet);
+        pindexTip = chainActive.Tip();
+        nBits = GetNextTargetRequired(pindexTip, true, Params().GetConsensus());
+        std::vector<COutput> vCoins;
+        pwallet->AvailableCoins(vCoins, true, nullptr, 1, MAX_MONEY, MAX_MONEY, 0, 0, 9999999, nNow);
+        for (const COutput& out : vCoins)
+        {
+            COutPoint prevout(out.tx->GetHash(), out.i);
+            CStakeCacheEntry kernel;
+            if (pwallet->GetStakeCacheEntry(prevout, kernel))
+                mapStakeable[prevout] = kernel;
+        }
+    }
+
+    Plan(pindexTip, nBits, mapStakeable, nNow, nNow + nHorizon);
+}
+
+void CStakePlanner::Plan(CBlockIndex* pindexTip, unsigned int nBits, const std::map<COutPoint, CStakeCacheEntry>& mapStakeable, int64_t nNow, int64_t nUntil)
+{
+    // Kernels past the tip's last one are hashed once a newer tip gives them a modifier
+    nUntil = std::min(nUntil, GetLastStakeKernelTime(pindexTip));
+
+    // The candidates kept so far still hold if the chain was only extended
+    // and the target is within the loose one they were picked with
+    std::map<COutPoint, CPlannedCoin> mapWork;
+    unsigned int nBitsLooseWork;
+    {
+        LOCK(cs);
+        arith_uint256 bnTarget, bnLoose;
+        bnTarget.SetCompact(nBits);
+        bnLoose.SetCompact(nBitsLoose);
+        bool fReplan = !pindexPlanned || pindexTip->GetAncestor(pindexPlanned->nHeight) != pindexPlanned;
+        // A newly generated modifier may be the one later kernels hash with
+        for (const CBlockIndex* pindex = pindexTip; !fReplan && pindex != pindexPlanned; pindex = pindex->pprev)
+            fReplan = pindex->GeneratedStakeModifier();
+        if (fReplan || nBitsLoose == 0 || bnTarget > bnLoose)
+        {
+            if (bnTarget <= ~arith_uint256() / STAKE_PLAN_SLACK)
+                bnTarget *= STAKE_PLAN_SLACK;
+            nBitsLooseWork = bnTarget.GetCompact();
+        }
+        else
+        {
+            mapWork = mapCoins;
+            nBitsLooseWork = nBitsLoose;
+        }
+    }
+
+    int64_t nPlanStart = GetTimeMicros();
+    uint64_t nKernels = 0;
+    for (const auto& item : mapStakeable)
+    {
+        const COutPoint& prevout = item.first;
+        const CStakeCacheEntry& kernel = item.second;
+        CPlannedCoin& coin = mapWork[prevout];
+        if (coin.hashBlock != kernel.hashBlock)
+        {
+            coin.hashBlock = kernel.hashBlock;
+            coin.nTimeBlock = kernel.nTimeBlock;
+            coin.nTxOffset = kernel.nTxOffset;
+            coin.nTimeTx = kernel.nTimeTx;
+            coin.nValue = kernel.nValue;
+            coin.nPlannedUntil = nNow - 1;
+            coin.vCandidates.clear();
+        }
+        coin.vCandidates.erase(std::remove_if(coin.vCandidates.begin(), coin.vCandidates.end(),
+            [nNow](const CPlannedCoin::CCandidate& candidate) { return candidate.nTime < nNow; }), coin.vCandidates.end());
+
+        // Hash the kernels of the seconds the horizon moved over, once the coin is old enough
+        int64_t nFromStart = std::max(std::max(coin.nPlannedUntil + 1, nNow), (int64_t)coin.nTimeBlock + Params().GetConsensus().nStakeMinAge);
+        for (int64_t nFrom = nFromStart; nFrom <= nUntil; nFrom += STAKE_PLAN_CHUNK)
+        {
+            int64_t nTo = std::min(nFrom + STAKE_PLAN_CHUNK - 1, nUntil);
+            std::vector<KernelInput> vKernel;
+            {
+                LOCK(cs_main);
+                GetStakeKernels(nBits, pindexTip, coin.nTimeBlock, coin.hashBlock, coin.nTxOffset, coin.nTimeTx, prevout, nTo, nTo - nFrom + 1, vKernel);
+            }
+            std::vector<uint256> vHash(vKernel.size());
+            ComputeKernelHashes(vKernel.data(), vKernel.size(), vHash.data());
+            for (size_t i = vKernel.size(); i-- > 0; )
+            {
+                int64_t nTimeWeight = GetStakeKernelWeight(vKernel[i]);
+                if (CheckStakeKernelTarget(vHash[i], nBitsLooseWork, coin.nValue, nTimeWeight))
+                    coin.vCandidates.push_back(CPlannedCoin::CCandidate{vKernel[i].nTimeTx, nTimeWeight, vHash[i]});
+            }
+            nKernels += vKernel.size();
+            coin.nPlannedUntil = nTo;
+        }
+    }
+    for (auto it = mapWork.begin(); it != mapWork.end(); )
+    {
+        if (mapStakeable.count(it->first))
+            ++it;
+        else
+            it = mapWork.erase(it);
+    }
+    stakeMinterStats.nKernelsHashed += nKernels;
+    stakeMinterStats.nSearchMicros += GetTimeMicros() - nPlanStart;
+
+    // Pick the hits at the actual target
+    LOCK(cs);
+    mapCoins.swap(mapWork);
+    heapHits = decltype(heapHits)();
+    for (const auto& item : mapCoins)
+    {
+        for (const CPlannedCoin::CCandidate& candidate : item.second.vCandidates)
+        {
+            if (CheckStakeKernelTarget(candidate.hash, nBits, item.second.nValue, candidate.nTimeWeight))
+                heapHits.push(CStakeHit{candidate.nTime, item.first, item.second.nValue});
+        }
+    }
+    pindexPlanned = pindexTip;
+    nBitsPlanned = nBits;
+    nBitsLoose = nBitsLooseWork;
+    nPlannedUntil = nUntil;
+    LogPrint(BCLog::BENCH, "%s: %u outputs planned until %d at nBits %08x, %u hits, %u kernels hashed in %.2fms\n", __func__, mapCoins.size(), nUntil, nBits, heapHits.size(), nKernels, (GetTimeMicros() - nPlanStart) * 0.001);
+}
+
+bool CStakePlanner::NextHit(const CBlockIndex* pindexTip, int64_t nTimeFrom, int64_t& nTime)
+{
+    LOCK(cs);
+    if (pindexTip == nullptr || pindexTip != pindexPlanned || fWalletChanged)
+        return false;
+    while (!heapHits.empty() && heapHits.top().nTime < nTimeFrom)
+        heapHits.pop();
+    nTime = heapHits.empty() ? nPlannedUntil + 1 : heapHits.top().nTime;
+    return true;
+}
+
+std::vector<CStakeHit> CStakePlanner::GetSchedule(int64_t nTimeFrom, size_t nMax) const
+{
+    LOCK(cs);
+    std::vector<CStakeHit> vHits;
+    auto heap = heapHits;
+    while (!heap.empty() && vHits.size() < nMax)
+    {
+        if (heap.top().nTime >= nTimeFrom)
+            vHits.push_back(heap.top());
+        heap.pop();
+    }
+    return vHits;
+}
+
+const CBlockIndex* CStakePlanner::GetPlannedTip(unsigned int& nBits, int64_t& nUntil) const
+{
+    LOCK(cs);
+    nBits = nBitsPlanned;
+    nUntil = nPlannedUntil;
+    return pindexPlanned;
+}
+
+// peercoin: stake planner thread
+void static ThreadStakePlanner(CWallet* pwallet, int64_t nHorizon)
+{
+    LogPrintf("ThreadStakePlanner started\n");
+    RenameThread("peercoin-stakeplan");
+    RegisterValidationInterface(&stakePlanner);
+    try
+    {
+        while (true)
+        {
+            if (!IsInitialBlockDownload())
+            {
+                stakePlanner.Plan(pwallet, nHorizon);
+                stakeMinterNotifier.Notify();
+            }
+            // Replan for each new tip, and before the horizon runs short
+            stakePlanner.WaitForTip(nHorizon * 1000 / 4);
+        }
+    }
+    catch (boost::thread_interrupted)
+    {
+    }
+    catch (std::exception& e) {
+        PrintExceptionContinue(&e, "ThreadStakePlanner()");
+    }
+    UnregisterValidationInterface(&stakePlanner);
+    LogPrintf("ThreadStakePlanner exiting\n");
+}
+
+// Milliseconds until the next second starts, when a new coinstake timestamp can be searched
+static int64_t MillisToNextSecond()
+{
+    return 1000 - GetTimeMillis() % 1000;
+}
+
 void PoSMiner(CWallet *pwallet)
 {
     LogPrintf("CPUMiner started for proof-of-stake\n");
@@ -518,15 +834,6 @@ void PoSMiner(CWallet *pwallet)
     std::shared_ptr<CReserveScript> coinbaseScript;
     pwallet->GetScriptForMining(coinbaseScript);
 
-    // Compute timeout for pos as sqrt(numUTXO)
-    unsigned int pos_timio;
-    {
-        std::vector<COutput> vCoins;
-        pwallet->AvailableCoins(vCoins, false);
-        pos_timio = gArgs.GetArg("-staketimio", 500) + 30 * sqrt(vCoins.size());
-        LogPrintf("Set proof-of-stake timeout: %ums for %u UTXOs\n", pos_timio, vCoins.size());
-    }
-
     std::string strMintMessage = _("Info: Minting suspended due to locked wallet.");
     std::string strMintSyncMessage = _("Info: Minting suspended while synchronizing wallet.");
     std::string strMintDisabledMessage = _("Info: Minting disabled by 'nominting' option.");
@@ -539,6 +846,16 @@ void PoSMiner(CWallet *pwallet)
         return;
     }
 
+    // Wake up for new tips and whatever may change the wallet's stakeable coins.
+    // Until the planner has seen such a change its plan may miss new coins, so
+    // every second is searched again.
+    RegisterValidationInterface(&stakeMinterNotifier);
+    boost::signals2::scoped_connection connTransactionChanged = pwallet->NotifyTransactionChanged.connect(
+        [](CWallet*, const uint256&, ChangeType) { stakePlanner.WalletChanged(); stakeMinterNotifier.Notify(); });
+    boost::signals2::scoped_connection connStatusChanged = pwallet->NotifyStatusChanged.connect(
+        [](CCryptoKeyStore*) { stakePlanner.WalletChanged(); stakeMinterNotifier.Notify(); });
+    nLastCoinStakeSearchTime = GetAdjustedTime();  // only initialized at startup
+
     try {
 
         // Throw an error if no script was provided.  This can happen
@@ -548,25 +865,72 @@ void PoSMiner(CWallet *pwallet)
             throw std::runtime_error("No coinbase script available (mining requires a wallet)");
 
         while (true) {
+            // Seconds nobody searched while minting was suspended are skipped
+            bool fSuspended = false;
             while (pwallet->IsLocked()) {
                 strMintWarning = strMintMessage;
-                MilliSleep(5000);
+                fSuspended = true;
+                stakeMinterNotifier.Wait(5000);
             }
             if (Params().MiningRequiresPeers()) {
-                // Busy-wait for the network to come online so we don't waste time mining
+                // Wait for the network to come online so we don't waste time mining
                 // on an obsolete chain. In regtest mode we expect to fly solo.
-                while(g_connman == nullptr || g_connman->GetNodeCount(CConnman::CONNECTIONS_ALL) == 0 || IsInitialBlockDownload())
-                    MilliSleep(5 * 1000);
+                while(g_connman == nullptr || g_connman->GetNodeCount(CConnman::CONNECTIONS_ALL) == 0 || IsInitialBlockDownload()) {
+                    fSuspended = true;
+                    stakeMinterNotifier.Wait(5 * 1000);
+                }
             }
-            while (GuessVerificationProgress(Params().TxData(), chainActive.Tip()) < 0.996)
+            if (GuessVerificationProgress(Params().TxData(), chainActive.Tip()) < 0.996)
             {
                 LogPrintf("Minter thread sleeps while sync at %f\n", GuessVerificationProgress(Params().TxData(), chainActive.Tip()));
                 strMintWarning = strMintSyncMessage;
-                MilliSleep(10000);
+                fSuspended = true;
+                while (GuessVerificationProgress(Params().TxData(), chainActive.Tip()) < 0.996)
+                    stakeMinterNotifier.Wait(10000);
+            }
+            if (fSuspended)
+            {
+                int64_t nNow = GetAdjustedTime();
+                if (nNow > nLastCoinStakeSearchTime)
+                {
+                    stakeMinterStats.nSecondsSkipped += nNow - nLastCoinStakeSearchTime;
+                    nLastCoinStakeSearchTime = nNow;
+                }
             }
 
             strMintWarning = strMintEmpty;
 
+            // A new tip has a new target and kernel timestamps not yet searched
+            // against it, back to the tip's own time
+            const CBlockIndex* pindexNewTip = stakeMinterNotifier.Wait(0);
+            if (pindexNewTip)
+                nLastCoinStakeSearchTime = std::min(nLastCoinStakeSearchTime, pindexNewTip->GetBlockTime());
+            if (GetAdjustedTime() <= nLastCoinStakeSearchTime)
+            {
+                // Everything up to now has been searched on this tip
+                stakeMinterNotifier.Wait(MillisToNextSecond());
+                continue;
+            }
+
+            // With a plan for this tip there is nothing to search until the next hit
+            const CBlockIndex* pindexTip;
+            {
+                LOCK(cs_main);
+                pindexTip = chainActive.Tip();
+            }
+            int64_t nNextHit;
+            if (stakePlanner.NextHit(pindexTip, nLastCoinStakeSearchTime + 1, nNextHit))
+            {
+                int64_t nNow = GetAdjustedTime();
+                if (nNextHit > nNow)
+                {
+                    stakeMinterStats.nSecondsSearched += nNow - nLastCoinStakeSearchTime;
+                    nLastCoinStakeSearchTime = nNow;
+                    stakeMinterNotifier.Wait((nNextHit - nNow - 1) * 1000 + MillisToNextSecond());
+                    continue;
+                }
+            }
+
             //
             // Create new block
             //
@@ -576,13 +940,10 @@ void PoSMiner(CWallet *pwallet)
             if (!pblocktemplate.get())
             {
                 if (fPoSCancel == true)
-                {
-                    MilliSleep(pos_timio);
                     continue;
-                }
                 strMintWarning = strMintBlockMessage;
                 LogPrintf("Error in PeercoinMiner: Keypool ran out, please call keypoolrefill before restarting the mining thread\n");
-                return;
+                break;
             }
             CBlock *pblock = &pblocktemplate->block;
             IncrementExtraNonce(pblock, pindexPrev, nExtraNonce);
@@ -598,25 +959,18 @@ void PoSMiner(CWallet *pwallet)
                 }
                 LogPrintf("CPUMiner : proof-of-stake block found %s\n", pblock->GetHash().ToString());
                 ProcessBlockFound(pblock, Params());
-                // Rest for ~3 minutes after successful block to preserve close quick
-                MilliSleep(60 * 1000 + GetRand(4 * 60 * 1000));
             }
-            MilliSleep(pos_timio);
-
-            continue;
         }
     }
     catch (boost::thread_interrupted)
     {
         LogPrintf("PeercoinMiner terminated\n");
-    return;
-        // throw;
     }
     catch (const std::runtime_error &e)
     {
         LogPrintf("PeercoinMiner runtime error: %s\n", e.what());
-        return;
     }
+    UnregisterValidationInterface(&stakeMinterNotifier);
 }
 
 // peercoin: stake minter thread
@@ -640,6 +994,26 @@ void static ThreadStakeMinter(void* parg)
 void MintStake(boost::thread_group& threadGroup)
 {
     // peercoin: mint proof-of-stake blocks in the background
-    if (!vpwallets.empty())
-        threadGroup.create_thread(boost::bind(&ThreadStakeMinter, vpwallets[0]));
+    if (vpwallets.empty())
+        return;
+
+    // -stakethreads counts the minter thread, which joins the search
+    nStakeThreads = gArgs.GetArg("-stakethreads", DEFAULT_STAKE_THREADS);
+    if (nStakeThreads <= 0)
+        nStakeThreads += GetNumCores();
+    if (nStakeThreads <= 1)
+        nStakeThreads = 0;
+    else if (nStakeThreads > MAX_STAKE_THREADS)
+        nStakeThreads = MAX_STAKE_THREADS;
+    LogPrintf("Using %u threads for the stake kernel search\n", std::max(nStakeThreads, 1));
+    for (int i = 0; i < nStakeThreads - 1; i++)
+        threadGroup.create_thread(&ThreadStakeKernelCheck);
+
+    // The planner looks ahead for the minter, which falls back to searching
+    // every second while there is no plan for the tip
+    int64_t nPlanHours = gArgs.GetArg("-stakeplanhours", DEFAULT_STAKE_PLAN_HOURS);
+    if (nPlanHours > 0 && gArgs.GetBoolArg("-minting", true))
+        threadGroup.create_thread(boost::bind(&ThreadStakePlanner, vpwallets[0], nPlanHours * 60 * 60));
+
+    threadGroup.create_thread(boost::bind(&ThreadStakeMinter, vpwallets[0]));
 }
@@ -7,18 +7,40 @@
 #define BITCOIN_MINER_H
 
 #include <primitives/block.h>
+#include <sync.h>
 #include <txmempool.h>
+#include <validationinterface.h>
 
 #include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <map>
 #include <memory>
+#include <queue>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/ordered_index.hpp>
 
 extern int64_t nLastCoinStakeSearchInterval;
 
+/** peercoin: what the proof-of-stake minter did since startup */
+struct CStakeMinterStats
+{
+    //! Coinstake timestamps searched for a kernel, counted once per tip
+    std::atomic<int64_t> nSecondsSearched{0};
+    //! Timestamps that passed without being searched
+    std::atomic<int64_t> nSecondsSkipped{0};
+    //! Stake kernels hashed, and the time spent on it
+    std::atomic<uint64_t> nKernelsHashed{0};
+    std::atomic<int64_t> nSearchMicros{0};
+};
+extern CStakeMinterStats stakeMinterStats;
+
 class CBlockIndex;
 class CChainParams;
 class CScript;
+class CStakeCacheEntry;
 class CWallet;
 
 namespace Consensus { struct Params; };
@@ -197,6 +219,98 @@ private:
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 int64_t UpdateTime(CBlockHeader* pblock);
 
+//! How many times looser than the current target the stake planner keeps candidates for
+static const int STAKE_PLAN_SLACK = 4;
+
+/** peercoin: a coinstake timestamp at which a wallet output meets the kernel target */
+struct CStakeHit
+{
+    int64_t nTime;
+    COutPoint prevout;
+    CAmount nValue;
+
+    bool operator>(const CStakeHit& other) const
+    {
+        return nTime > other.nTime || (nTime == other.nTime && other.prevout < prevout);
+    }
+};
+
+/** peercoin: plans ahead at which timestamps the wallet's outputs can stake.
+ *
+ * The kernel of an output at a future timestamp can be hashed in advance:
+ * its stake modifier was fixed long before, and only the target moves with
+ * nBits. The planner hashes each output's kernels up to a horizon ahead and
+ * keeps the timestamps that meet a target STAKE_PLAN_SLACK times looser than
+ * the current one. As long as nBits stays within that slack, a new tip only
+ * filters these candidates again, and time passing only hashes the seconds
+ * the horizon moved over.
+ */
+class CStakePlanner : public CValidationInterface
+{
+private:
+    struct CPlannedCoin
+    {
+        uint256 hashBlock;
+        unsigned int nTimeBlock;
+        unsigned int nTxOffset;
+        unsigned int nTimeTx;
+        CAmount nValue;
+        //! Kernels are hashed up to this timestamp
+        int64_t nPlannedUntil;
+        //! Timestamps meeting the loose target, with their kernel hash and weight
+        struct CCandidate
+        {
+            int64_t nTime;
+            int64_t nTimeWeight;
+            uint256 hash;
+        };
+        std::vector<CCandidate> vCandidates;
+    };
+
+    mutable CCriticalSection cs;
+    std::map<COutPoint, CPlannedCoin> mapCoins;
+    //! Upcoming hits at the current target, earliest on top
+    std::priority_queue<CStakeHit, std::vector<CStakeHit>, std::greater<CStakeHit> > heapHits;
+    const CBlockIndex* pindexPlanned;
+    unsigned int nBitsPlanned;
+    unsigned int nBitsLoose;
+    int64_t nPlannedUntil;
+    //! The wallet's outputs changed since the last plan took stock of them
+    bool fWalletChanged;
+
+    boost::mutex mutexWake;
+    boost::condition_variable condWake;
+    bool fWake;
+
+    void Wake();
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex* pindexNew, const CBlockIndex* pindexFork, bool fInitialDownload) override;
+
+public:
+    CStakePlanner() : pindexPlanned(nullptr), nBitsPlanned(0), nBitsLoose(0), nPlannedUntil(0), fWalletChanged(false), fWake(false) {}
+
+    /** Bring the plan up to the current tip and extend it to nHorizon seconds ahead */
+    void Plan(CWallet* pwallet, int64_t nHorizon);
+    /** Plan the outputs in mapStakeable from nNow until nUntil, on top of pindexTip at nBits */
+    void Plan(CBlockIndex* pindexTip, unsigned int nBits, const std::map<COutPoint, CStakeCacheEntry>& mapStakeable, int64_t nNow, int64_t nUntil);
+    /** Wait at most nMilliseconds for a new tip to plan for */
+    void WaitForTip(int64_t nMilliseconds);
+    /** Hold off the plan until the planner has taken stock of the wallet again */
+    void WalletChanged();
+
+    /** Whether the plan is up to date with pindexTip and the wallet. If so, nTime is set to
+     *  the earliest hit at or after nTimeFrom, or just past the planned time
+     *  when there is none. */
+    bool NextHit(const CBlockIndex* pindexTip, int64_t nTimeFrom, int64_t& nTime);
+    /** Upcoming hits at or after nTimeFrom in time order, at most nMax of them */
+    std::vector<CStakeHit> GetSchedule(int64_t nTimeFrom, size_t nMax) const;
+    /** The tip and nBits the plan was made for */
+    const CBlockIndex* GetPlannedTip(unsigned int& nBits, int64_t& nUntil) const;
+};
+
+extern CStakePlanner stakePlanner;
+
 namespace boost {
     class thread_group;
 } // namespace boost
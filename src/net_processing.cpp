@@ -1120,8 +1120,17 @@ void static ProcessGetBlockData(CNode* pfrom, const Consensus::Params& consensus
     if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
     {
         std::shared_ptr<const CBlock> pblock;
+        CSerializedNetMsg msgRaw;
         if (a_recent_block && a_recent_block->GetHash() == (*mi).second->GetBlockHash()) {
             pblock = a_recent_block;
+        } else if ((inv.type == MSG_WITNESS_BLOCK || (inv.type == MSG_BLOCK && !IsWitnessEnabled(mi->second->pprev, consensusParams))) &&
+                   ReadRawBlockFromDisk(msgRaw.data, (*mi).second, Params().MessageStart())) {
+            // Send block from disk as it is stored there, which is how it is serialized
+            // with witness data - or without, for blocks that cannot have any
+            msgRaw.command = NetMsgType::BLOCK;
+            // peercoin: the header of newer clients carries the flags, which blocks read from disk have cleared
+            if (pfrom->GetSendVersion() > OLD_VERSION)
+                msgRaw.data.insert(msgRaw.data.begin() + CBlockHeader::NORMAL_SERIALIZE_SIZE, sizeof(int32_t), 0);
         } else {
             // Send block from disk
             std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
@@ -1129,7 +1138,9 @@ void static ProcessGetBlockData(CNode* pfrom, const Consensus::Params& consensus
                 assert(!"cannot load block from disk");
             pblock = pblockRead;
         }
-        if (inv.type == MSG_BLOCK)
+        if (!pblock)
+            connman->PushMessage(pfrom, std::move(msgRaw));
+        else if (inv.type == MSG_BLOCK)
             connman->PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, *pblock));
         else if (inv.type == MSG_WITNESS_BLOCK)
             connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, *pblock));
@@ -2733,6 +2744,14 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
                 if (pblock2->IsProofOfStake() && !IsInitialBlockDownload())
                     nPoSTemperature += 1;
 
+                // peercoin: an unrequested block reusing the stake of another
+                // block is not worth validating
+                if (IsDuplicateStake(*pblock2)) {
+                    nPoSTemperature += 100;
+                    MarkBlockAsReceived(hash2);
+                    return error("duplicate proof-of-stake in block %s", hash2.ToString());
+                }
+
                 if (!miPrev->second->IsValid(BLOCK_VALID_TRANSACTIONS)) {
                     MarkBlockAsReceived(hash2);
                     return error("this block does not connect to any valid known blocks");
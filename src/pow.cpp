@@ -10,15 +10,16 @@
 #include <primitives/block.h>
 #include <uint256.h>
 
-#include <bignum.h>
 #include <chainparams.h>
 
 // peercoin: find last block index up to pindex
 const CBlockIndex* GetLastBlockIndex(const CBlockIndex* pindex, bool fProofOfStake)
 {
-    while (pindex && pindex->pprev && (pindex->IsProofOfStake() != fProofOfStake))
-        pindex = pindex->pprev;
-    return pindex;
+    if (!pindex || pindex->IsProofOfStake() == fProofOfStake)
+        return pindex;
+    // Follow the link to the last block of the kind, or stop at genesis
+    const CBlockIndex* pindexLast = fProofOfStake ? pindex->pprevPoS : pindex->pprevPoW;
+    return pindexLast ? pindexLast : pindex->GetAncestor(0);
 }
 
 unsigned int GetNextTargetRequired(const CBlockIndex* pindexLast, bool fProofOfStake, const Consensus::Params& params)
@@ -37,19 +38,30 @@ unsigned int GetNextTargetRequired(const CBlockIndex* pindexLast, bool fProofOfS
 
     // peercoin: target change every block
     // peercoin: retarget with exponential moving toward target spacing
-    CBigNum bnNew;
-    bnNew.SetCompact(pindexPrev->nBits);
+    // nBits on the chain never exceeds powLimit, so 512 bits hold the target
+    // times any spacing. The sign is kept apart since a block far enough out
+    // of order makes the multiplier negative.
+    bool fNegative;
+    arith_uint512 bnNew;
+    bnNew.SetCompact(pindexPrev->nBits, &fNegative);
     if (Params().NetworkIDString() != CBaseChainParams::REGTEST) {
         int64_t nTargetSpacing = fProofOfStake? params.nStakeTargetSpacing : std::min(params.nTargetSpacingWorkMax, params.nStakeTargetSpacing * (1 + pindexLast->nHeight - pindexPrev->nHeight));
         int64_t nInterval = params.nTargetTimespan / nTargetSpacing;
-        bnNew *= ((nInterval - 1) * nTargetSpacing + nActualSpacing + nActualSpacing);
-        bnNew /= ((nInterval + 1) * nTargetSpacing);
+        int64_t nMultiplier = (nInterval - 1) * nTargetSpacing + nActualSpacing + nActualSpacing;
+        if (nMultiplier < 0) {
+            fNegative = !fNegative;
+            nMultiplier = -nMultiplier;
+        }
+        bnNew *= arith_uint512(nMultiplier);
+        bnNew /= arith_uint512((nInterval + 1) * nTargetSpacing);
         }
+    fNegative = fNegative && bnNew != 0;
 
-    if (bnNew > CBigNum(params.powLimit))
-        bnNew = CBigNum(params.powLimit);
+    const arith_uint512 bnLimit(UintToArith256(params.powLimit));
+    if (!fNegative && bnNew > bnLimit)
+        bnNew = bnLimit;
 
-    return bnNew.GetCompact();
+    return bnNew.GetCompact(fNegative);
 }
 
 bool CheckProofOfWork(uint256 hash, unsigned int nBits, const Consensus::Params& params)
@@ -209,6 +209,7 @@ static bool rest_block(HTTPRequest* req,
         return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
 
     CBlock block;
+    std::vector<unsigned char> vBlock;
     CBlockIndex* pblockindex = nullptr;
     {
         LOCK(cs_main);
@@ -217,23 +218,27 @@ static bool rest_block(HTTPRequest* req,
 
         pblockindex = mapBlockIndex[hash];
 
-        if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
-            return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+        // The block as stored on disk is serialized with witness data, so it can be
+        // passed on as it is unless witness data is to be left out
+        bool fRaw = rf != RF_JSON && (!(RPCSerializationFlags() & SERIALIZE_TRANSACTION_NO_WITNESS) || !IsWitnessEnabled(pblockindex->pprev, Params().GetConsensus()));
+        if (!fRaw || !ReadRawBlockFromDisk(vBlock, pblockindex, Params().MessageStart())) {
+            if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
+                return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+            if (rf != RF_JSON)
+                CVectorWriter(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags(), vBlock, 0, block);
+        }
     }
 
-    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
-    ssBlock << block;
-
     switch (rf) {
     case RF_BINARY: {
-        std::string binaryBlock = ssBlock.str();
+        std::string binaryBlock(vBlock.begin(), vBlock.end());
         req->WriteHeader("Content-Type", "application/octet-stream");
         req->WriteReply(HTTP_OK, binaryBlock);
         return true;
     }
 
     case RF_HEX: {
-        std::string strHex = HexStr(ssBlock.begin(), ssBlock.end()) + "\n";
+        std::string strHex = HexStr(vBlock.begin(), vBlock.end()) + "\n";
         req->WriteHeader("Content-Type", "text/plain");
         req->WriteReply(HTTP_OK, strHex);
         return true;
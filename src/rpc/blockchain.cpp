@@ -10,12 +10,14 @@
 #include <chainparams.h>
 #include <checkpoints.h>
 #include <coins.h>
+#include <coinsflush.h>
 #include <consensus/validation.h>
 #include <validation.h>
 #include <core_io.h>
 #include <policy/policy.h>
 #include <primitives/transaction.h>
 #include <rpc/server.h>
+#include <script/sigcache.h>
 #include <streams.h>
 #include <sync.h>
 #include <txdb.h>
@@ -788,6 +790,14 @@ UniValue getblock(const JSONRPCRequest& request)
     CBlock block;
     CBlockIndex* pblockindex = mapBlockIndex[hash];
 
+    // The block as stored on disk is serialized with witness data, so it can be
+    // passed on as it is unless witness data is to be left out
+    if (verbosity <= 0 && (!(RPCSerializationFlags() & SERIALIZE_TRANSACTION_NO_WITNESS) || !IsWitnessEnabled(pblockindex->pprev, Params().GetConsensus()))) {
+        std::vector<unsigned char> vBlock;
+        if (ReadRawBlockFromDisk(vBlock, pblockindex, Params().MessageStart()))
+            return HexStr(vBlock.begin(), vBlock.end());
+    }
+
     if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
         // Block not found on disk. This could be because we have the block
         // header in our index but don't have the block (for example if a
@@ -1270,6 +1280,87 @@ UniValue getmempoolinfo(const JSONRPCRequest& request)
     return mempoolInfoToJSON();
 }
 
+static UniValue CacheStatsToJSON(const CShardedSignatureCache::Stats& stats)
+{
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("hits", (uint64_t)stats.nHits));
+    ret.push_back(Pair("misses", (uint64_t)stats.nMisses));
+    ret.push_back(Pair("evictions", (uint64_t)stats.nEvictions));
+    ret.push_back(Pair("elements", (uint64_t)stats.nElements));
+    ret.push_back(Pair("bytes", (uint64_t)stats.nBytes));
+    return ret;
+}
+
+UniValue getsigcacheinfo(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 0)
+        throw std::runtime_error(
+            "getsigcacheinfo\n"
+            "\nReturns the counters of the signature cache and of the script execution cache since startup.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"signatures\": {            (json object) The cache of valid signatures\n"
+            "    \"hits\": xxxxx,            (numeric) Lookups that found their entry\n"
+            "    \"misses\": xxxxx,          (numeric) Lookups that did not\n"
+            "    \"evictions\": xxxxx,       (numeric) Inserts that had to drop an entry\n"
+            "    \"elements\": xxxxx,        (numeric) Entries the cache can hold\n"
+            "    \"bytes\": xxxxx            (numeric) Memory used for them\n"
+            "  },\n"
+            "  \"scripts\": {               (json object) The cache of transactions whose scripts all passed, same fields\n"
+            "    ...\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getsigcacheinfo", "")
+            + HelpExampleRpc("getsigcacheinfo", "")
+        );
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("signatures", CacheStatsToJSON(GetSignatureCacheStats())));
+    ret.push_back(Pair("scripts", CacheStatsToJSON(GetScriptExecutionCacheStats())));
+    return ret;
+}
+
+UniValue getcoinsflushinfo(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 0)
+        throw std::runtime_error(
+            "getcoinsflushinfo\n"
+            "\nReturns how the writes of the in-memory UTXO set to disk went since startup.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"background\": true|false,    (boolean) Whether writes are made in the background (see -backgroundflush)\n"
+            "  \"in_progress\": true|false,   (boolean) Whether a background write is in progress\n"
+            "  \"flushes\": xxxxx,            (numeric) Writes completed\n"
+            "  \"background_flushes\": xxxxx, (numeric) How many of them were made in the background\n"
+            "  \"last_coins\": xxxxx,         (numeric) Coins changed by the last write\n"
+            "  \"last_bytes\": xxxxx,         (numeric) Bytes written by the last write\n"
+            "  \"last_duration\": x.xxx,      (numeric) Seconds the last write took\n"
+            "  \"total_bytes\": xxxxx,        (numeric) Bytes written by all writes\n"
+            "  \"total_duration\": x.xxx      (numeric) Seconds all writes took\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getcoinsflushinfo", "")
+            + HelpExampleRpc("getcoinsflushinfo", "")
+        );
+
+    LOCK(cs_main);
+    if (!pcoinsflusher)
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Coins database not loaded");
+    CCoinsFlushStats stats = pcoinsflusher->GetStats();
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("background", fBackgroundFlush));
+    ret.push_back(Pair("in_progress", stats.fInProgress));
+    ret.push_back(Pair("flushes", stats.nFlushes));
+    ret.push_back(Pair("background_flushes", stats.nBackgroundFlushes));
+    ret.push_back(Pair("last_coins", stats.nLastCoins));
+    ret.push_back(Pair("last_bytes", stats.nLastBytes));
+    ret.push_back(Pair("last_duration", stats.nLastDuration * 0.000001));
+    ret.push_back(Pair("total_bytes", stats.nTotalBytes));
+    ret.push_back(Pair("total_duration", stats.nTotalDuration * 0.000001));
+    return ret;
+}
+
 UniValue preciousblock(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 1)
@@ -1498,6 +1589,8 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getmempoolentry",        &getmempoolentry,        {"txid"} },
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         {} },
     { "blockchain",         "getrawmempool",          &getrawmempool,          {"verbose"} },
+    { "blockchain",         "getsigcacheinfo",        &getsigcacheinfo,        {} },
+    { "blockchain",         "getcoinsflushinfo",      &getcoinsflushinfo,      {} },
     { "blockchain",         "gettxout",               &gettxout,               {"txid","n","include_mempool"} },
     { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        {} },
     { "blockchain",         "savemempool",            &savemempool,            {} },
@@ -19,6 +19,7 @@
 #include <rpc/blockchain.h>
 #include <rpc/mining.h>
 #include <rpc/server.h>
+#include <timedata.h>
 #include <txmempool.h>
 #include <util.h>
 #include <utilstrencodings.h>
@@ -242,6 +243,11 @@ UniValue getmininginfo(const JSONRPCRequest& request)
             "  \"networkhashps\": nnn,      (numeric) The network hashes per second\n"
             "  \"pooledtx\": n              (numeric) The size of the mempool\n"
             "  \"chain\": \"xxxx\",           (string) current network name as defined in BIP70 (main, test, regtest)\n"
+            "  \"stakesearch\": {           (json object) what the proof-of-stake minter searched since startup\n"
+            "    \"searched\": nnn,         (numeric) coinstake timestamps searched, counted once per tip\n"
+            "    \"skipped\": nnn,          (numeric) timestamps that passed without being searched\n"
+            "    \"hashespersec\": nnn      (numeric) stake kernels hashed per second of searching\n"
+            "  },\n"
             "  \"warnings\": \"...\"          (string) any network and blockchain warnings\n"
             "  \"errors\": \"...\"            (string) DEPRECATED. Same as warnings. Only shown when peercoind is started with -deprecatedrpc=getmininginfo\n"
             "}\n"
@@ -262,6 +268,12 @@ UniValue getmininginfo(const JSONRPCRequest& request)
     obj.push_back(Pair("networkghps",      getnetworkghps(request)));
     obj.push_back(Pair("pooledtx",         (uint64_t)mempool.size()));
     obj.push_back(Pair("chain",            Params().NetworkIDString()));
+    UniValue stakesearch(UniValue::VOBJ);
+    int64_t nSearchMicros = stakeMinterStats.nSearchMicros;
+    stakesearch.push_back(Pair("searched",     stakeMinterStats.nSecondsSearched.load()));
+    stakesearch.push_back(Pair("skipped",      stakeMinterStats.nSecondsSkipped.load()));
+    stakesearch.push_back(Pair("hashespersec", nSearchMicros ? (int64_t)(stakeMinterStats.nKernelsHashed * 1000000 / nSearchMicros) : 0));
+    obj.push_back(Pair("stakesearch",      stakesearch));
     if (IsDeprecatedRPCEnabled("getmininginfo")) {
         obj.push_back(Pair("errors",       GetWarnings("statusbar")));
     } else {
@@ -271,6 +283,68 @@ UniValue getmininginfo(const JSONRPCRequest& request)
 }
 
 
+UniValue getstakeschedule(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() > 1)
+        throw std::runtime_error(
+            "getstakeschedule ( count )\n"
+            "\nReturns the upcoming proof-of-stake kernel hits the stake planner predicts for the wallet.\n"
+            "The hits hold for the planned tip only; a new block changes the target and the schedule.\n"
+            "\nArguments:\n"
+            "1. count          (numeric, optional, default=10) The number of hits to return\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"tip\": \"xxxx\",             (string) the hash of the tip the schedule was planned for\n"
+            "  \"bits\": \"xxxxxxxx\",        (string) the proof-of-stake target on top of that tip\n"
+            "  \"planneduntil\": xxx,       (numeric) the last timestamp searched, in seconds since epoch\n"
+            "  \"hits\": [                  (array) the hits in time order\n"
+            "    {\n"
+            "      \"time\": xxx,           (numeric) the coinstake timestamp meeting the target\n"
+            "      \"txid\": \"xxxx\",        (string) the transaction id of the staking output\n"
+            "      \"vout\": n,             (numeric) the output number\n"
+            "      \"amount\": x.xxx        (numeric) the value of the output in " + CURRENCY_UNIT + "\n"
+            "    }\n"
+            "    ,...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getstakeschedule", "")
+            + HelpExampleCli("getstakeschedule", "50")
+            + HelpExampleRpc("getstakeschedule", "50")
+        );
+
+    int nCount = 10;
+    if (!request.params[0].isNull())
+        nCount = request.params[0].get_int();
+    if (nCount < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative count");
+
+    unsigned int nBits;
+    int64_t nPlannedUntil;
+    const CBlockIndex* pindexPlanned = stakePlanner.GetPlannedTip(nBits, nPlannedUntil);
+    if (!pindexPlanned)
+        throw JSONRPCError(RPC_MISC_ERROR, "No stake schedule has been planned, see -stakeplanhours");
+
+    UniValue hits(UniValue::VARR);
+    for (const CStakeHit& hit : stakePlanner.GetSchedule(GetAdjustedTime(), nCount))
+    {
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("time",   hit.nTime));
+        entry.push_back(Pair("txid",   hit.prevout.hash.GetHex()));
+        entry.push_back(Pair("vout",   (int)hit.prevout.n));
+        entry.push_back(Pair("amount", ValueFromAmount(hit.nValue)));
+        hits.push_back(entry);
+    }
+
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("tip",          pindexPlanned->GetBlockHash().GetHex()));
+    obj.push_back(Pair("bits",         strprintf("%08x", nBits)));
+    obj.push_back(Pair("planneduntil", nPlannedUntil));
+    obj.push_back(Pair("hits",         hits));
+    return obj;
+}
+
+
 // NOTE: Assumes a conclusive result; if result is inconclusive, it must be handled by caller
 static UniValue BIP22ValidationResult(const CValidationState& state)
 {
@@ -811,6 +885,7 @@ static const CRPCCommand commands[] =
   //  --------------------- ------------------------  -----------------------  ----------
     { "mining",             "getnetworkhashps",       &getnetworkhashps,       {"nblocks","height"} },
     { "mining",             "getmininginfo",          &getmininginfo,          {} },
+    { "mining",             "getstakeschedule",       &getstakeschedule,       {"count"} },
     { "mining",             "getblocktemplate",       &getblocktemplate,       {"template_request"} },
     { "mining",             "submitblock",            &submitblock,            {"hexdata","dummy"} },
 
@@ -10,6 +10,7 @@
 #include <crypto/sha256.h>
 #include <pubkey.h>
 #include <script/script.h>
+#include <streams.h>
 #include <uint256.h>
 
 typedef std::vector<unsigned char> valtype;
@@ -1152,6 +1153,32 @@ public:
     }
 };
 
+/** Serializes straight into a SHA256 hasher, which may be resumed from a midstate */
+class CSHA256Writer
+{
+private:
+    CSHA256& sha;
+
+public:
+    explicit CSHA256Writer(CSHA256& shaIn) : sha(shaIn) {}
+
+    int GetType() const { return SER_GETHASH; }
+    int GetVersion() const { return 0; }
+
+    void write(const char *pch, size_t size) {
+        sha.Write((const unsigned char*)pch, size);
+    }
+
+    template<typename T>
+    CSHA256Writer& operator<<(const T& obj) {
+        ::Serialize(*this, obj);
+        return *this;
+    }
+};
+
+/** Size of an input with its scriptSig blanked out: prevout, empty script, nSequence */
+static const size_t LEGACY_BLANK_INPUT_SIZE = 36 + 1 + 4;
+
 uint256 GetPrevoutHash(const CTransaction& txTo) {
     CHashWriter ss(SER_GETHASH, 0);
     for (const auto& txin : txTo.vin) {
@@ -1187,8 +1214,76 @@ PrecomputedTransactionData::PrecomputedTransactionData(const CTransaction& txTo)
         hashOutputs = GetOutputsHash(txTo);
         ready = true;
     }
+
+    // With a single input there is nothing to share between legacy signature hashes
+    if (txTo.vin.size() > 1) {
+        CVectorWriter inputs(SER_GETHASH, 0, legacyInputs, 0);
+        CVectorWriter inputsNoSequence(SER_GETHASH, 0, legacyInputsNoSequence, 0);
+        for (const auto& txin : txTo.vin) {
+            inputs << txin.prevout << CScript() << txin.nSequence;
+            inputsNoSequence << txin.prevout << CScript() << (int)0;
+        }
+        assert(legacyInputs.size() == LEGACY_BLANK_INPUT_SIZE * txTo.vin.size());
+        CVectorWriter(SER_GETHASH, 0, legacyOutputs, 0, txTo.vout);
+
+        legacyMidstates.resize(txTo.vin.size());
+        CSHA256Writer header(legacyMidstates[0]);
+        header << txTo.nVersion << txTo.nTime;
+        ::WriteCompactSize(header, txTo.vin.size());
+        for (size_t i = 1; i < legacyMidstates.size(); i++) {
+            legacyMidstates[i] = legacyMidstates[i - 1];
+            legacyMidstates[i].Write(&legacyInputs[LEGACY_BLANK_INPUT_SIZE * (i - 1)], LEGACY_BLANK_INPUT_SIZE);
+        }
+        legacyReady = true;
+    }
 }
 
+namespace {
+
+/**
+ * The legacy signature hash of SignatureHash, from the fragments of
+ * PrecomputedTransactionData instead of reserializing txTo. Only the input
+ * being signed is serialized; the inputs before it come from a midstate
+ * (SIGHASH_ALL) or a precomputed buffer (SIGHASH_NONE and SIGHASH_SINGLE).
+ */
+uint256 LegacySignatureHashCached(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, const PrecomputedTransactionData& cache)
+{
+    const bool fHashSingle = (nHashType & 0x1f) == SIGHASH_SINGLE;
+    const bool fHashNone = (nHashType & 0x1f) == SIGHASH_NONE;
+    const std::vector<unsigned char>& vchInputs = (fHashSingle || fHashNone) ? cache.legacyInputsNoSequence : cache.legacyInputs;
+    const size_t nInputs = txTo.vin.size();
+
+    CSHA256 sha;
+    CSHA256Writer s(sha);
+    if (fHashSingle || fHashNone) {
+        s << txTo.nVersion << txTo.nTime;
+        ::WriteCompactSize(s, nInputs);
+        sha.Write(vchInputs.data(), LEGACY_BLANK_INPUT_SIZE * nIn);
+    } else {
+        sha = cache.legacyMidstates[nIn];
+    }
+    CTransactionSignatureSerializer(txTo, scriptCode, nIn, nHashType).SerializeInput(s, nIn);
+    sha.Write(vchInputs.data() + LEGACY_BLANK_INPUT_SIZE * (nIn + 1), LEGACY_BLANK_INPUT_SIZE * (nInputs - nIn - 1));
+    if (fHashNone) {
+        ::WriteCompactSize(s, 0);
+    } else if (fHashSingle) {
+        ::WriteCompactSize(s, nIn + 1);
+        for (unsigned int nOutput = 0; nOutput < nIn; nOutput++)
+            s << CTxOut();
+        s << txTo.vout[nIn];
+    } else {
+        sha.Write(cache.legacyOutputs.data(), cache.legacyOutputs.size());
+    }
+    s << txTo.nLockTime << nHashType;
+
+    uint256 hash;
+    sha.Finalize(hash.begin());
+    sha.Reset().Write(hash.begin(), CSHA256::OUTPUT_SIZE).Finalize(hash.begin());
+    return hash;
+}
+
+} // namespace
+
 uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, const CAmount& amount, SigVersion sigversion, const PrecomputedTransactionData* cache)
 {
     assert(nIn < txTo.vin.size());
@@ -1251,6 +1346,9 @@ uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsig
         }
     }
 
+    if (cache && cache->legacyReady && !(nHashType & SIGHASH_ANYONECANPAY))
+        return LegacySignatureHashCached(scriptCode, txTo, nIn, nHashType, *cache);
+
     // Wrapper to serialize only the necessary parts of the transaction being signed
     CTransactionSignatureSerializer txTmp(txTo, scriptCode, nIn, nHashType);
 
@@ -6,6 +6,7 @@
 #ifndef BITCOIN_SCRIPT_INTERPRETER_H
 #define BITCOIN_SCRIPT_INTERPRETER_H
 
+#include <crypto/sha256.h>
 #include <script/script_error.h>
 #include <primitives/transaction.h>
 
@@ -124,6 +125,18 @@ struct PrecomputedTransactionData
     uint256 hashPrevouts, hashSequence, hashOutputs;
     bool ready = false;
 
+    /**
+     * Serialized fragments of the legacy signature hash, for transactions
+     * with more than one input: every input with its scriptSig blanked out,
+     * once with its nSequence and once with nSequence zeroed (SIGHASH_NONE
+     * and SIGHASH_SINGLE), and the outputs with their count. legacyMidstates[i]
+     * holds the SHA256 state after the header and the first i blanked inputs,
+     * so a SIGHASH_ALL hash only has to cover input i and what follows it.
+     */
+    std::vector<unsigned char> legacyInputs, legacyInputsNoSequence, legacyOutputs;
+    std::vector<CSHA256> legacyMidstates;
+    bool legacyReady = false;
+
     explicit PrecomputedTransactionData(const CTransaction& tx);
 };
 
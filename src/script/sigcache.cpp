@@ -11,9 +11,81 @@
 #include <uint256.h>
 #include <util.h>
 
+#include <crypto/common.h>
 #include <cuckoocache.h>
+
+#include <atomic>
+
 #include <boost/thread.hpp>
 
+struct CShardedSignatureCache::Shard
+{
+    CuckooCache::cache<uint256, SignatureCacheHasher> cache;
+    boost::shared_mutex mutex;
+    size_t nElements = 0;
+    std::atomic<uint64_t> nHits{0};
+    std::atomic<uint64_t> nMisses{0};
+};
+
+CShardedSignatureCache::CShardedSignatureCache(int nShards)
+{
+    int nBits = CountBits(std::max(nShards, 1)) - 1;
+    for (int i = 0; i < (1 << nBits); i++)
+        vShards.emplace_back(new Shard());
+}
+
+CShardedSignatureCache::~CShardedSignatureCache() {}
+
+CShardedSignatureCache::Shard& CShardedSignatureCache::ShardOf(const uint256& entry) const
+{
+    // The cuckoo hashes place entries by the high bits of their words, the shard is picked by low ones
+    return *vShards[ReadLE32(entry.begin()) & (vShards.size() - 1)];
+}
+
+size_t CShardedSignatureCache::Setup(size_t nBytes)
+{
+    size_t nElements = 0;
+    for (const auto& shard : vShards) {
+        boost::unique_lock<boost::shared_mutex> lock(shard->mutex);
+        shard->nElements = shard->cache.setup_bytes(nBytes / vShards.size());
+        nElements += shard->nElements;
+    }
+    return nElements;
+}
+
+bool CShardedSignatureCache::Contains(const uint256& entry, bool fErase)
+{
+    Shard& shard = ShardOf(entry);
+    bool fFound;
+    {
+        boost::shared_lock<boost::shared_mutex> lock(shard.mutex);
+        fFound = shard.cache.contains(entry, fErase);
+    }
+    (fFound ? shard.nHits : shard.nMisses).fetch_add(1, std::memory_order_relaxed);
+    return fFound;
+}
+
+void CShardedSignatureCache::Insert(const uint256& entry)
+{
+    Shard& shard = ShardOf(entry);
+    boost::unique_lock<boost::shared_mutex> lock(shard.mutex);
+    shard.cache.insert(entry);
+}
+
+CShardedSignatureCache::Stats CShardedSignatureCache::GetStats() const
+{
+    Stats stats = {};
+    for (const auto& shard : vShards) {
+        stats.nHits += shard->nHits.load(std::memory_order_relaxed);
+        stats.nMisses += shard->nMisses.load(std::memory_order_relaxed);
+        boost::shared_lock<boost::shared_mutex> lock(shard->mutex);
+        stats.nEvictions += shard->cache.evictions();
+        stats.nElements += shard->nElements;
+    }
+    stats.nBytes = stats.nElements * sizeof(uint256);
+    return stats;
+}
+
 namespace {
 /**
  * Valid signature cache, to avoid doing expensive ECDSA signature checking
@@ -25,9 +97,7 @@ class CSignatureCache
 private:
      //! Entries are SHA256(nonce || signature hash || public key || signature):
     uint256 nonce;
-    typedef CuckooCache::cache<uint256, SignatureCacheHasher> map_type;
-    map_type setValid;
-    boost::shared_mutex cs_sigcache;
+    CShardedSignatureCache setValid;
 
 public:
     CSignatureCache()
@@ -44,18 +114,20 @@ public:
     bool
     Get(const uint256& entry, const bool erase)
     {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
-        return setValid.contains(entry, erase);
+        return setValid.Contains(entry, erase);
     }
 
     void Set(uint256& entry)
     {
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-        setValid.insert(entry);
+        setValid.Insert(entry);
+    }
+    size_t setup_bytes(size_t n)
+    {
+        return setValid.Setup(n);
     }
-    uint32_t setup_bytes(size_t n)
+    CShardedSignatureCache::Stats GetStats() const
     {
-        return setValid.setup_bytes(n);
+        return setValid.GetStats();
     }
 };
 
@@ -80,6 +152,11 @@ void InitSignatureCache()
             (nElems*sizeof(uint256)) >>20, (nMaxCacheSize*2)>>20, nElems);
 }
 
+CShardedSignatureCache::Stats GetSignatureCacheStats()
+{
+    return signatureCache.GetStats();
+}
+
 bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
 {
     uint256 entry;
@@ -8,6 +8,7 @@
 
 #include <script/interpreter.h>
 
+#include <memory>
 #include <vector>
 
 // DoS prevention: limit cache size to 32MB (over 1000000 entries on 64-bit
@@ -40,6 +41,45 @@ public:
     }
 };
 
+/**
+ * A cache of nonced hashes, split into shards picked by the hash. Each shard
+ * is a CuckooCache::cache behind a lock of its own, so the threads validating
+ * blocks and relayed transactions only contend when they look up or insert
+ * entries of the same shard. Counts hits, misses and evictions.
+ */
+class CShardedSignatureCache
+{
+public:
+    static const int DEFAULT_SHARDS = 16;
+
+    struct Stats
+    {
+        uint64_t nHits;
+        uint64_t nMisses;
+        uint64_t nEvictions;
+        //! Entries the shards can hold, and the memory they use for it
+        size_t nElements;
+        size_t nBytes;
+    };
+
+    //! nShards is rounded down to a power of two
+    explicit CShardedSignatureCache(int nShards = DEFAULT_SHARDS);
+    ~CShardedSignatureCache();
+
+    //! Size the cache to about nBytes, split evenly over the shards. Returns the number of elements it can hold.
+    size_t Setup(size_t nBytes);
+    //! Whether entry is in the cache. With fErase it can be overwritten from now on.
+    bool Contains(const uint256& entry, bool fErase);
+    void Insert(const uint256& entry);
+    Stats GetStats() const;
+
+private:
+    struct Shard;
+    std::vector<std::unique_ptr<Shard> > vShards;
+
+    Shard& ShardOf(const uint256& entry) const;
+};
+
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
 private:
@@ -52,5 +92,6 @@ public:
 };
 
 void InitSignatureCache();
+CShardedSignatureCache::Stats GetSignatureCacheStats();
 
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
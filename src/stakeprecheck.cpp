@@ -0,0 +1,68 @@
+// Copyright (c) 2020 The Peercoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <stakeprecheck.h>
+
+#include <coins.h>
+#include <kernel.h>
+#include <script/interpreter.h>
+#include <validation.h>
+
+bool CStakePrecheck::Check() const
+{
+    const CBlock& block = *pblock;
+    if ((block.IsProofOfStake() || !IsBTC16BIPsEnabled(block.GetBlockTime())) && !CheckBlockSignature(block))
+        return false;
+    if (block.IsProofOfStake()) {
+        const CTransaction& txCoinStake = *block.vtx[1];
+        const PrecomputedTransactionData txdata(txCoinStake);
+        TransactionSignatureChecker checker(&txCoinStake, 0, txoutKernel.nValue, txdata);
+        if (!VerifyScript(txCoinStake.vin[0].scriptSig, txoutKernel.scriptPubKey, &txCoinStake.vin[0].scriptWitness, SCRIPT_VERIFY_P2SH, checker, nullptr))
+            return false;
+    }
+    return true;
+}
+
+std::shared_ptr<CStakePrecheck> CStakePrecheck::Make(const std::shared_ptr<const CBlock>& pblock, const CCoinsView& view)
+{
+    if (!pblock->IsProofOfStake() && IsBTC16BIPsEnabled(pblock->GetBlockTime()))
+        return nullptr;
+    CTxOut txoutKernel;
+    if (pblock->IsProofOfStake()) {
+        Coin coin;
+        if (!view.GetCoin(pblock->vtx[1]->vin[0].prevout, coin))
+            return nullptr;
+        txoutKernel = coin.out;
+    }
+    return std::make_shared<CStakePrecheck>(pblock, txoutKernel);
+}
+
+void CStakePrecheck::Start()
+{
+    if (fStarted.exchange(true))
+        return;
+    bool fOk = Check();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        fValid = fOk;
+        fDone = true;
+    }
+    cond.notify_all();
+}
+
+bool CStakePrecheck::Wait()
+{
+    Start();
+    std::unique_lock<std::mutex> lock(mutex);
+    cond.wait(lock, [this] { return fDone; });
+    return fValid;
+}
+
+bool StakePrecheckPassed(const StakePrecheckMap& mapPrechecks, const CBlockIndex* pindex, const CBlock& block)
+{
+    auto it = mapPrechecks.find(pindex);
+    if (it == mapPrechecks.end() || it->second->GetBlock().get() != &block)
+        return false;
+    return it->second->Wait();
+}
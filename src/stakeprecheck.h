@@ -0,0 +1,88 @@
+// Copyright (c) 2020 The Peercoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_STAKEPRECHECK_H
+#define BITCOIN_STAKEPRECHECK_H
+
+#include <primitives/block.h>
+#include <primitives/transaction.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+
+class CBlockIndex;
+class CCoinsView;
+
+/**
+ * peercoin: the block signature and coinstake signature checks of a block
+ * about to be connected. Whichever thread gets to it first, a stake precheck
+ * thread or the one connecting the block, runs them. A failed precheck is
+ * not an error: ConnectBlock() then runs the checks itself and reports why.
+ */
+class CStakePrecheck
+{
+private:
+    const std::shared_ptr<const CBlock> pblock;
+    //! The output staked by the coinstake, if any
+    const CTxOut txoutKernel;
+    std::atomic<bool> fStarted;
+    bool fDone;
+    bool fValid;
+    std::mutex mutex;
+    std::condition_variable cond;
+
+    bool Check() const;
+
+public:
+    CStakePrecheck(const std::shared_ptr<const CBlock>& pblockIn, const CTxOut& txoutKernelIn) : pblock(pblockIn), txoutKernel(txoutKernelIn), fStarted(false), fDone(false), fValid(false) {}
+
+    /**
+     * The precheck of a block, or nullptr if there is nothing to check ahead:
+     * a proof-of-work block without a signature, or a coinstake spending an
+     * output that is not in view yet, as it is created within the window.
+     */
+    static std::shared_ptr<CStakePrecheck> Make(const std::shared_ptr<const CBlock>& pblock, const CCoinsView& view);
+
+    const std::shared_ptr<const CBlock>& GetBlock() const { return pblock; }
+
+    //! Run the checks, unless another thread already does
+    void Start();
+
+    //! Return whether both signatures are valid, running the checks if nobody started them yet
+    bool Wait();
+};
+
+typedef std::map<const CBlockIndex*, std::shared_ptr<CStakePrecheck> > StakePrecheckMap;
+
+/**
+ * Whether the signature checks of block, about to be connected at pindex,
+ * can be skipped. Only a precheck of that very block object counts: the
+ * block signature is not covered by the block hash, so another copy of the
+ * block may carry a different one.
+ */
+bool StakePrecheckPassed(const StakePrecheckMap& mapPrechecks, const CBlockIndex* pindex, const CBlock& block);
+
+/** A queued stake precheck. Always succeeds: the result is kept by the precheck itself. */
+class CStakePrecheckJob
+{
+private:
+    std::shared_ptr<CStakePrecheck> pprecheck;
+
+public:
+    CStakePrecheckJob() {}
+    explicit CStakePrecheckJob(const std::shared_ptr<CStakePrecheck>& pprecheckIn) : pprecheck(pprecheckIn) {}
+
+    bool operator()()
+    {
+        pprecheck->Start();
+        return true;
+    }
+
+    void swap(CStakePrecheckJob& job) { pprecheck.swap(job.pprecheck); }
+};
+
+#endif // BITCOIN_STAKEPRECHECK_H
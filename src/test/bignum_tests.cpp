@@ -0,0 +1,183 @@
+// Copyright (c) 2012-2020 The Peercoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <arith_uint256.h>
+#include <chain.h>
+#include <chainparams.h>
+#include <kernel.h>
+#include <pow.h>
+#include <validation.h>
+#include <bignum.h>
+#include <test/test_bitcoin.h>
+
+#include <boost/test/unit_test.hpp>
+
+// The kernel, retarget and mint calculations used to be done with CBigNum.
+// Check that the fixed width replacements give the same results.
+
+BOOST_FIXTURE_TEST_SUITE(bignum_tests, BasicTestingSetup)
+
+namespace {
+
+// Compact values around the interesting exponents, with and without sign
+uint32_t RandomCompact()
+{
+    uint32_t nSize = InsecureRandBool() ? InsecureRandRange(36) : InsecureRandRange(64);
+    uint32_t nWord = InsecureRandBits(23);
+    if (InsecureRandRange(8) == 0)
+        nWord >>= InsecureRandRange(24);
+    uint32_t nCompact = (nSize << 24) | nWord;
+    if (InsecureRandRange(8) == 0)
+        nCompact |= 0x00800000;
+    return nCompact;
+}
+
+int64_t RandomInt64(int nBits)
+{
+    int64_t n = InsecureRandBits(nBits);
+    return InsecureRandBool() ? n : -n;
+}
+
+bool CheckStakeKernelTargetBigNum(const uint256& hashProofOfStake, unsigned int nBits, CAmount nValueIn, int64_t nTimeWeight)
+{
+    CBigNum bnTargetPerCoinDay;
+    bnTargetPerCoinDay.SetCompact(nBits);
+    CBigNum bnCoinDayWeight = CBigNum(nValueIn) * nTimeWeight / COIN / (24 * 60 * 60);
+    return !(CBigNum(hashProofOfStake) > bnCoinDayWeight * bnTargetPerCoinDay);
+}
+
+unsigned int GetNextTargetRequiredBigNum(unsigned int nBits, int64_t nActualSpacing, int64_t nTargetSpacing, const Consensus::Params& params)
+{
+    CBigNum bnNew;
+    bnNew.SetCompact(nBits);
+    int64_t nInterval = params.nTargetTimespan / nTargetSpacing;
+    bnNew *= ((nInterval - 1) * nTargetSpacing + nActualSpacing + nActualSpacing);
+    bnNew /= ((nInterval + 1) * nTargetSpacing);
+    if (bnNew > CBigNum(params.powLimit))
+        bnNew = CBigNum(params.powLimit);
+    return bnNew.GetCompact();
+}
+
+int64_t GetProofOfWorkRewardBigNum(unsigned int nBits)
+{
+    CBigNum bnSubsidyLimit = MAX_MINT_PROOF_OF_WORK;
+    CBigNum bnTarget;
+    bnTarget.SetCompact(nBits);
+    CBigNum bnTargetLimit(Params().GetConsensus().powLimit);
+    bnTargetLimit.SetCompact(bnTargetLimit.GetCompact());
+    CBigNum bnLowerBound = CENT;
+    CBigNum bnUpperBound = bnSubsidyLimit;
+    while (bnLowerBound + CENT <= bnUpperBound)
+    {
+        CBigNum bnMidValue = (bnLowerBound + bnUpperBound) / 2;
+        if (bnMidValue * bnMidValue * bnMidValue * bnMidValue * bnTargetLimit > bnSubsidyLimit * bnSubsidyLimit * bnSubsidyLimit * bnSubsidyLimit * bnTarget)
+            bnUpperBound = bnMidValue;
+        else
+            bnLowerBound = bnMidValue;
+    }
+    int64_t nSubsidy = bnUpperBound.getuint64();
+    nSubsidy = (nSubsidy / CENT) * CENT;
+    return std::min(nSubsidy, MAX_MINT_PROOF_OF_WORK);
+}
+
+void CheckKernelTarget(const uint256& hash, unsigned int nBits, CAmount nValueIn, int64_t nTimeWeight)
+{
+    BOOST_CHECK_MESSAGE(CheckStakeKernelTarget(hash, nBits, nValueIn, nTimeWeight) == CheckStakeKernelTargetBigNum(hash, nBits, nValueIn, nTimeWeight),
+        strprintf("hash=%s nBits=%08x nValueIn=%d nTimeWeight=%d", hash.ToString(), nBits, nValueIn, nTimeWeight));
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(compact_512)
+{
+    for (int i = 0; i < 100000; i++) {
+        uint32_t nCompact = RandomCompact();
+        CBigNum bn;
+        bn.SetCompact(nCompact);
+        bool fNegative, fOverflow;
+        arith_uint512 n;
+        n.SetCompact(nCompact, &fNegative, &fOverflow);
+        BOOST_CHECK_EQUAL(fOverflow, (bn < 0 ? -bn : bn) >= (CBigNum(1) << 512));
+        if (fOverflow)
+            continue;
+        BOOST_CHECK_EQUAL(fNegative, bn < 0);
+        BOOST_CHECK_EQUAL(n.GetCompact(fNegative), bn.GetCompact());
+
+        arith_uint256 n256;
+        bool fOverflow256;
+        n256.SetCompact(nCompact, nullptr, &fOverflow256);
+        if (!fOverflow256) {
+            BOOST_CHECK(arith_uint512(n256) == n);
+            BOOST_CHECK_EQUAL(n256.GetCompact(fNegative), n.GetCompact(fNegative));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(stake_kernel_target)
+{
+    const Consensus::Params& params = Params().GetConsensus();
+    for (int i = 0; i < 20000; i++) {
+        unsigned int nBits = RandomCompact();
+        CAmount nValueIn = InsecureRandRange(16) ? (CAmount)InsecureRandRange(MAX_MONEY) : RandomInt64(63);
+        int64_t nTimeWeight = InsecureRandRange(16) ? (int64_t)InsecureRandRange(params.nStakeMaxAge + params.nStakeMinAge) - params.nStakeMinAge : RandomInt64(40);
+        CheckKernelTarget(InsecureRand256(), nBits, nValueIn, nTimeWeight);
+        CheckKernelTarget(uint256(), nBits, nValueIn, nTimeWeight);
+
+        // hashes right at the weighted target
+        CBigNum bnTarget;
+        bnTarget.SetCompact(nBits);
+        CBigNum bnProduct = CBigNum(nValueIn) * nTimeWeight / COIN / (24 * 60 * 60) * bnTarget;
+        if (bnProduct >= 0 && bnProduct < (CBigNum(1) << 256)) {
+            for (int nDelta = -1; nDelta <= 1; nDelta++) {
+                CBigNum bnHash = bnProduct + nDelta;
+                if (bnHash >= 0 && bnHash < (CBigNum(1) << 256))
+                    CheckKernelTarget(bnHash.getuint256(), nBits, nValueIn, nTimeWeight);
+            }
+        }
+    }
+    // the weight truncates to zero
+    CheckKernelTarget(uint256(), 0x1d00ffff, COIN, 24 * 60 * 60 - 1);
+    CheckKernelTarget(uint256S("01"), 0x1d00ffff, -COIN, 24 * 60 * 60 - 1);
+}
+
+BOOST_AUTO_TEST_CASE(next_target_required)
+{
+    const Consensus::Params& params = Params().GetConsensus();
+    CBlockIndex vIndex[3];
+    for (int i = 0; i < 3; i++) {
+        vIndex[i].nHeight = i;
+        vIndex[i].pprev = i ? &vIndex[i - 1] : nullptr;
+    }
+    for (int i = 0; i < 20000; i++) {
+        bool fProofOfStake = InsecureRandBool();
+        for (int j = 1; j < 3; j++) {
+            vIndex[j].nFlags = 0;
+            if (fProofOfStake)
+                vIndex[j].SetProofOfStake();
+            vIndex[j].BuildSkip();
+        }
+        // far out of order blocks make the multiplier negative
+        int64_t nActualSpacing = InsecureRandRange(4) ? (int64_t)InsecureRandRange(10000) - 1000 : -(int64_t)InsecureRandRange(1000000);
+        vIndex[1].nTime = 1000000000;
+        vIndex[2].nTime = vIndex[1].nTime + nActualSpacing;
+        vIndex[2].nBits = RandomCompact();
+        if ((vIndex[2].nBits >> 24) > 33)
+            vIndex[2].nBits = (vIndex[2].nBits & 0x00ffffff) | (InsecureRandRange(34) << 24);
+
+        int64_t nTargetSpacing = fProofOfStake ? params.nStakeTargetSpacing : std::min(params.nTargetSpacingWorkMax, params.nStakeTargetSpacing);
+        BOOST_CHECK_EQUAL(GetNextTargetRequired(&vIndex[2], fProofOfStake, params), GetNextTargetRequiredBigNum(vIndex[2].nBits, nActualSpacing, nTargetSpacing, params));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(proof_of_work_reward)
+{
+    for (int i = 0; i < 2000; i++) {
+        unsigned int nBits = RandomCompact();
+        BOOST_CHECK_EQUAL(GetProofOfWorkReward(nBits), GetProofOfWorkRewardBigNum(nBits));
+    }
+    BOOST_CHECK_EQUAL(GetProofOfWorkReward(0x1d00ffff), GetProofOfWorkRewardBigNum(0x1d00ffff));
+    BOOST_CHECK_EQUAL(GetProofOfWorkReward(0x1c00ffff), GetProofOfWorkRewardBigNum(0x1c00ffff));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,95 @@
+// Copyright (c) 2020 The Peercoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockfilereader.h>
+#include <chainparams.h>
+#include <clientversion.h>
+#include <streams.h>
+#include <util.h>
+#include <validation.h>
+
+#include <test/test_bitcoin.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockfilereader_tests, TestingSetup)
+
+namespace {
+
+fs::path WriteFile(const std::string& strName, const std::vector<unsigned char>& vData)
+{
+    fs::path path = GetDataDir() / strName;
+    CAutoFile file(fsbridge::fopen(path, "wb"), SER_DISK, CLIENT_VERSION);
+    file.write((const char*)vData.data(), vData.size());
+    return path;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(blockfilereader_mappings)
+{
+    CBlockFileReader reader(2);
+
+    // A block deserializes the same from a mapping
+    CBlock block;
+    BOOST_CHECK(ReadBlockFromDisk(block, chainActive.Tip(), Params().GetConsensus()));
+    std::vector<unsigned char> vBlock;
+    CVectorWriter(SER_DISK, CLIENT_VERSION, vBlock, 0, block);
+    fs::path path0 = WriteFile("map0.dat", vBlock);
+    std::shared_ptr<const CBlockFileReader::Mapping> mapping0 = reader.Get(0, path0);
+    BOOST_REQUIRE(mapping0);
+    BOOST_CHECK_EQUAL(mapping0->size(), vBlock.size());
+    CBlock blockMapped;
+    CSpanReader(SER_DISK, CLIENT_VERSION, mapping0->begin(), mapping0->end()) >> blockMapped;
+    BOOST_CHECK(blockMapped.GetHash() == block.GetHash());
+    BOOST_CHECK_EQUAL(blockMapped.vtx.size(), block.vtx.size());
+    BOOST_CHECK(blockMapped.vchBlockSig == block.vchBlockSig);
+    CSpanReader readerShort(SER_DISK, CLIENT_VERSION, mapping0->begin(), mapping0->end() - 1);
+    BOOST_CHECK_THROW(readerShort >> blockMapped, std::ios_base::failure);
+
+    // The mapping is kept, until two others were used since
+    BOOST_CHECK(reader.Get(0, path0) == mapping0);
+    fs::path path1 = WriteFile("map1.dat", {1, 2, 3});
+    fs::path path2 = WriteFile("map2.dat", {4, 5});
+    BOOST_CHECK_EQUAL(reader.Get(1, path1)->size(), 3U);
+    BOOST_CHECK(reader.Get(0, path0) == mapping0);
+    BOOST_CHECK_EQUAL(reader.Get(2, path2)->size(), 2U);
+    BOOST_CHECK_EQUAL(reader.Size(), 2U);
+    BOOST_CHECK(reader.Get(0, path0) == mapping0);
+    BOOST_CHECK(reader.Get(2, path2)->begin()[1] == 5);
+
+    // A mapping dropped from the cache stays valid for those still holding it
+    BOOST_CHECK(reader.Get(1, path1) != nullptr);
+    BOOST_CHECK(reader.Get(0, path0) != mapping0);
+    BOOST_CHECK(std::equal(mapping0->begin(), mapping0->end(), vBlock.begin()));
+
+    // Missing and empty files are not mapped, nor is anything with no mappings to keep
+    BOOST_CHECK(reader.Get(3, GetDataDir() / "missing.dat") == nullptr);
+    BOOST_CHECK(reader.Get(4, WriteFile("empty.dat", {})) == nullptr);
+    reader.SetMaxMappings(0);
+    BOOST_CHECK_EQUAL(reader.Size(), 0U);
+    BOOST_CHECK(reader.Get(1, path1) == nullptr);
+}
+
+BOOST_AUTO_TEST_CASE(blockfilereader_raw_block)
+{
+    // A block read as stored serializes the same as the block deserialized from there
+    CBlock block;
+    BOOST_CHECK(ReadBlockFromDisk(block, chainActive.Tip(), Params().GetConsensus()));
+    std::vector<unsigned char> vExpected;
+    CVectorWriter(SER_NETWORK, PROTOCOL_VERSION, vExpected, 0, block);
+    std::vector<unsigned char> vRaw;
+    BOOST_CHECK(ReadRawBlockFromDisk(vRaw, chainActive.Tip(), Params().MessageStart()));
+    BOOST_CHECK(vRaw == vExpected);
+
+    // Only at the position of a block
+    CDiskBlockPos pos = chainActive.Tip()->GetBlockPos();
+    pos.nPos += 1;
+    BOOST_CHECK(!ReadRawBlockFromDisk(vRaw, pos, Params().MessageStart()));
+    BOOST_CHECK(vRaw.empty());
+    CMessageHeader::MessageStartChars wrong_start = {0, 0, 0, 0};
+    BOOST_CHECK(!ReadRawBlockFromDisk(vRaw, chainActive.Tip(), wrong_start));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,110 @@
+// Copyright (c) 2020 The Peercoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockimport.h>
+#include <chainparams.h>
+#include <clientversion.h>
+#include <streams.h>
+#include <util.h>
+
+#include <test/test_bitcoin.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockimport_tests, TestingSetup)
+
+namespace {
+
+void AppendBlock(std::vector<unsigned char>& vData, const CBlock& block)
+{
+    std::vector<unsigned char> vBlock;
+    CVectorWriter(SER_DISK, CLIENT_VERSION, vBlock, 0, block);
+    CVectorWriter(SER_DISK, CLIENT_VERSION, vData, vData.size(), FLATDATA(Params().MessageStart()), (unsigned int)vBlock.size());
+    vData.insert(vData.end(), vBlock.begin(), vBlock.end());
+}
+
+FILE* WriteFile(const std::string& strName, const std::vector<unsigned char>& vData)
+{
+    fs::path path = GetDataDir() / strName;
+    {
+        CAutoFile file(fsbridge::fopen(path, "wb"), SER_DISK, CLIENT_VERSION);
+        file.write((const char*)vData.data(), vData.size());
+    }
+    return fsbridge::fopen(path, "rb");
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(blockimport_order)
+{
+    const CBlock& genesis = Params().GenesisBlock();
+    CBlock block = genesis;
+    block.nNonce++;
+
+    // Blocks between garbage, one that does not deserialize and one cut short
+    std::vector<unsigned char> vData = {1, 2, 3};
+    AppendBlock(vData, genesis);
+    uint64_t nPos0 = vData.size() - ::GetSerializeSize(genesis, SER_DISK, CLIENT_VERSION);
+    vData.insert(vData.end(), Params().MessageStart(), Params().MessageStart() + 3);
+    AppendBlock(vData, block);
+    uint64_t nPos1 = vData.size() - ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+    CVectorWriter(SER_DISK, CLIENT_VERSION, vData, vData.size(), FLATDATA(Params().MessageStart()), (unsigned int)81);
+    uint64_t nPos2 = vData.size();
+    vData.insert(vData.end(), 81, 0xff);
+    AppendBlock(vData, genesis);
+    vData.resize(vData.size() - 1);
+
+    CBlockImportPipeline pipeline(WriteFile("import.dat", vData), Params(), 2);
+    BOOST_CHECK_EQUAL(pipeline.GetFileSize(), vData.size());
+    CBlockImportPipeline::Item item;
+    BOOST_REQUIRE(pipeline.Next(item));
+    BOOST_CHECK_EQUAL(item.nPos, nPos0);
+    BOOST_REQUIRE(item.pblock);
+    BOOST_CHECK(item.hash == genesis.GetHash());
+    BOOST_CHECK(item.pblock->GetHash() == item.hash);
+    BOOST_REQUIRE(pipeline.Next(item));
+    BOOST_CHECK_EQUAL(item.nPos, nPos1);
+    BOOST_REQUIRE(item.pblock);
+    BOOST_CHECK(item.hash == block.GetHash());
+    BOOST_REQUIRE(pipeline.Next(item));
+    BOOST_CHECK_EQUAL(item.nPos, nPos2);
+    BOOST_CHECK(!item.pblock);
+    BOOST_CHECK(!item.strError.empty());
+    while (pipeline.Next(item))
+        BOOST_CHECK(!item.pblock);
+    BOOST_CHECK(!pipeline.Next(item));
+    BOOST_CHECK_EQUAL(pipeline.GetBytesScanned(), vData.size());
+}
+
+BOOST_AUTO_TEST_CASE(blockimport_read_ahead)
+{
+    // More blocks than are read ahead come out in order, and stopping early is fine
+    std::vector<unsigned char> vData;
+    std::vector<uint256> vHashes;
+    CBlock block = Params().GenesisBlock();
+    for (size_t i = 0; i < CBlockImportPipeline::MAX_PENDING_BLOCKS + 100; i++) {
+        block.nNonce++;
+        AppendBlock(vData, block);
+        vHashes.push_back(block.GetHash());
+    }
+
+    {
+        CBlockImportPipeline pipeline(WriteFile("many.dat", vData), Params(), 3);
+        CBlockImportPipeline::Item item;
+        for (const uint256& hash : vHashes) {
+            BOOST_REQUIRE(pipeline.Next(item));
+            BOOST_CHECK(item.pblock && item.hash == hash);
+        }
+        BOOST_CHECK(!pipeline.Next(item));
+    }
+
+    {
+        CBlockImportPipeline pipeline(WriteFile("many.dat", vData), Params(), 1);
+        CBlockImportPipeline::Item item;
+        BOOST_REQUIRE(pipeline.Next(item));
+        BOOST_CHECK(item.hash == vHashes[0]);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -24,8 +24,6 @@
 // otherwise.
 BOOST_FIXTURE_TEST_SUITE(checkqueue_tests, TestingSetup)
 
-static const unsigned int QUEUE_BATCH_SIZE = 128;
-
 struct FakeCheck {
     bool operator()()
     {
@@ -148,7 +146,7 @@ typedef CCheckQueue<FrozenCleanupCheck> FrozenCleanup_Queue;
  */
 void Correct_Queue_range(std::vector<size_t> range)
 {
-    auto small_queue = std::unique_ptr<Correct_Queue>(new Correct_Queue {QUEUE_BATCH_SIZE});
+    auto small_queue = std::unique_ptr<Correct_Queue>(new Correct_Queue);
     boost::thread_group tg;
     for (auto x = 0; x < nScriptCheckThreads; ++x) {
        tg.create_thread([&]{small_queue->Thread();});
@@ -213,7 +211,7 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_Correct_Random)
 /** Test that failing checks are caught */
 BOOST_AUTO_TEST_CASE(test_CheckQueue_Catches_Failure)
 {
-    auto fail_queue = std::unique_ptr<Failing_Queue>(new Failing_Queue {QUEUE_BATCH_SIZE});
+    auto fail_queue = std::unique_ptr<Failing_Queue>(new Failing_Queue);
 
     boost::thread_group tg;
     for (auto x = 0; x < nScriptCheckThreads; ++x) {
@@ -246,7 +244,7 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_Catches_Failure)
 // future blocks, ie, the bad state is cleared.
 BOOST_AUTO_TEST_CASE(test_CheckQueue_Recovers_From_Failure)
 {
-    auto fail_queue = std::unique_ptr<Failing_Queue>(new Failing_Queue {QUEUE_BATCH_SIZE});
+    auto fail_queue = std::unique_ptr<Failing_Queue>(new Failing_Queue);
     boost::thread_group tg;
     for (auto x = 0; x < nScriptCheckThreads; ++x) {
        tg.create_thread([&]{fail_queue->Thread();});
@@ -274,7 +272,7 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_Recovers_From_Failure)
 // more than once as well
 BOOST_AUTO_TEST_CASE(test_CheckQueue_UniqueCheck)
 {
-    auto queue = std::unique_ptr<Unique_Queue>(new Unique_Queue {QUEUE_BATCH_SIZE});
+    auto queue = std::unique_ptr<Unique_Queue>(new Unique_Queue);
     boost::thread_group tg;
     for (auto x = 0; x < nScriptCheckThreads; ++x) {
        tg.create_thread([&]{queue->Thread();});
@@ -310,7 +308,7 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_UniqueCheck)
 // time could leave the data hanging across a sequence of blocks.
 BOOST_AUTO_TEST_CASE(test_CheckQueue_Memory)
 {
-    auto queue = std::unique_ptr<Memory_Queue>(new Memory_Queue {QUEUE_BATCH_SIZE});
+    auto queue = std::unique_ptr<Memory_Queue>(new Memory_Queue);
     boost::thread_group tg;
     for (auto x = 0; x < nScriptCheckThreads; ++x) {
        tg.create_thread([&]{queue->Thread();});
@@ -341,7 +339,7 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_Memory)
 // have been destructed
 BOOST_AUTO_TEST_CASE(test_CheckQueue_FrozenCleanup)
 {
-    auto queue = std::unique_ptr<FrozenCleanup_Queue>(new FrozenCleanup_Queue {QUEUE_BATCH_SIZE});
+    auto queue = std::unique_ptr<FrozenCleanup_Queue>(new FrozenCleanup_Queue);
     boost::thread_group tg;
     bool fails = false;
     for (auto x = 0; x < nScriptCheckThreads; ++x) {
@@ -384,7 +382,7 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_FrozenCleanup)
 /** Test that CCheckQueueControl is threadsafe */
 BOOST_AUTO_TEST_CASE(test_CheckQueueControl_Locks)
 {
-    auto queue = std::unique_ptr<Standard_Queue>(new Standard_Queue{QUEUE_BATCH_SIZE});
+    auto queue = std::unique_ptr<Standard_Queue>(new Standard_Queue);
     {
         boost::thread_group tg;
         std::atomic<int> nThreads {0};
@@ -441,5 +439,66 @@ BOOST_AUTO_TEST_CASE(test_CheckQueueControl_Locks)
         tg.join_all();
     }
 }
+
+/** Test that every range pushed on a deque is taken or stolen exactly once */
+BOOST_AUTO_TEST_CASE(test_CheckRangeDeque_Steal)
+{
+    const int nRanges = 100000;
+    CCheckRangeDeque deque;
+    std::vector<std::atomic<int>> vSeen(nRanges + 1);
+    for (auto& seen : vSeen)
+        seen = 0;
+    std::atomic<bool> fDone {false};
+    boost::thread_group tg;
+    for (int x = 0; x < 3; ++x) {
+        tg.create_thread([&]{
+            while (!fDone) {
+                uint64_t range = deque.Steal();
+                if (range)
+                    vSeen[range]++;
+            }
+        });
+    }
+    // The owner pushes, and now and then takes a few back, growing the deque on the way
+    for (int i = 1; i <= nRanges; ++i) {
+        deque.Push(i);
+        if (InsecureRandRange(4) == 0) {
+            for (int n = InsecureRandRange(8); n > 0; --n) {
+                uint64_t range = deque.Take();
+                if (range)
+                    vSeen[range]++;
+            }
+        }
+    }
+    while (uint64_t range = deque.Take())
+        vSeen[range]++;
+    fDone = true;
+    tg.join_all();
+    BOOST_CHECK(deque.Empty());
+    for (int i = 1; i <= nRanges; ++i)
+        BOOST_REQUIRE_EQUAL(vSeen[i].load(), 1);
+}
+
+/** Test that checks added without waiting for them are all run */
+BOOST_AUTO_TEST_CASE(test_CheckQueue_Add_Without_Wait)
+{
+    auto queue = std::unique_ptr<Correct_Queue>(new Correct_Queue);
+    boost::thread_group tg;
+    for (auto x = 0; x < std::max(1, nScriptCheckThreads); ++x) {
+       tg.create_thread([&]{queue->Thread();});
+    }
+    FakeCheckCheckCompletion::n_calls = 0;
+    size_t nAdded = 0;
+    for (int i = 0; i < 1000; ++i) {
+        std::vector<FakeCheckCheckCompletion> vChecks(InsecureRandRange(10));
+        nAdded += vChecks.size();
+        queue->Add(vChecks);
+    }
+    for (int i = 0; i < 1000 && FakeCheckCheckCompletion::n_calls != nAdded; ++i)
+        MilliSleep(10);
+    BOOST_REQUIRE_EQUAL(FakeCheckCheckCompletion::n_calls, nAdded);
+    tg.interrupt_all();
+    tg.join_all();
+}
 BOOST_AUTO_TEST_SUITE_END()
 
@@ -0,0 +1,87 @@
+// Copyright (c) 2020 The Peercoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <coinsflush.h>
+#include <txdb.h>
+
+#include <test/test_bitcoin.h>
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(coinsflush_tests, BasicTestingSetup)
+
+namespace {
+
+Coin MakeCoin(CAmount nValue)
+{
+    return Coin(CTxOut(nValue, CScript() << OP_TRUE), 1, false, false, 0);
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(coinsflush_background)
+{
+    CCoinsViewDB db(1 << 20, true);
+    CCoinsViewFlusher flusher(&db);
+    CCoinsViewCache cache(&flusher);
+
+    std::vector<COutPoint> vOutpoints;
+    for (uint32_t n = 0; n < 1000; n++) {
+        vOutpoints.emplace_back(InsecureRand256(), n);
+        cache.AddCoin(vOutpoints.back(), MakeCoin(n + 1), false);
+    }
+    uint256 hashFirst = InsecureRand256();
+    cache.SetBestBlock(hashFirst);
+    BOOST_CHECK(cache.Flush());
+    CCoinsFlushStats stats = flusher.GetStats();
+    BOOST_CHECK_EQUAL(stats.nFlushes, 1U);
+    BOOST_CHECK_EQUAL(stats.nBackgroundFlushes, 0U);
+    BOOST_CHECK_EQUAL(stats.nLastCoins, 1000U);
+    BOOST_CHECK(stats.nLastBytes > 0);
+    BOOST_CHECK_EQUAL(db.GetBestBlock(), hashFirst);
+
+    // Spend every other coin and add as many, then hand them to the background
+    for (uint32_t n = 0; n < 1000; n += 2)
+        BOOST_CHECK(cache.SpendCoin(vOutpoints[n]));
+    for (uint32_t n = 1000; n < 1500; n++) {
+        vOutpoints.emplace_back(InsecureRand256(), n);
+        cache.AddCoin(vOutpoints.back(), MakeCoin(n + 1), false);
+    }
+    uint256 hashSecond = InsecureRand256();
+    cache.SetBestBlock(hashSecond);
+    BOOST_CHECK(flusher.FlushInBackground(cache));
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+
+    // The cache on top reads the same coins, whether the write is done or not
+    BOOST_CHECK_EQUAL(cache.GetBestBlock(), hashSecond);
+    for (uint32_t n = 0; n < 1500; n++) {
+        bool fUnspent = n >= 1000 || n % 2;
+        BOOST_CHECK_EQUAL(cache.HaveCoin(vOutpoints[n]), fUnspent);
+        if (fUnspent)
+            BOOST_CHECK_EQUAL(cache.AccessCoin(vOutpoints[n]).out.nValue, (CAmount)n + 1);
+    }
+
+    // Spending a coin of the snapshot erases it with the next write
+    BOOST_CHECK(cache.SpendCoin(vOutpoints[1001]));
+    uint256 hashThird = InsecureRand256();
+    cache.SetBestBlock(hashThird);
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(flusher.WaitForWrite());
+    BOOST_CHECK_EQUAL(flusher.GetSnapshotUsage(), 0U);
+
+    stats = flusher.GetStats();
+    BOOST_CHECK_EQUAL(stats.nFlushes, 3U);
+    BOOST_CHECK_EQUAL(stats.nBackgroundFlushes, 1U);
+    BOOST_CHECK(!stats.fInProgress);
+    BOOST_CHECK_EQUAL(stats.nLastCoins, 1U);
+
+    BOOST_CHECK_EQUAL(db.GetBestBlock(), hashThird);
+    BOOST_CHECK(db.GetHeadBlocks().empty());
+    for (uint32_t n = 0; n < 1500; n++)
+        BOOST_CHECK_EQUAL(db.HaveCoin(vOutpoints[n]), (n >= 1000 || n % 2) && n != 1001);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,153 @@
+// Copyright (c) 2020 The Peercoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <coinsprefetch.h>
+
+#include <test/test_bitcoin.h>
+
+#include <atomic>
+#include <map>
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(coinsprefetch_tests, BasicTestingSetup)
+
+namespace {
+
+// A read-only view that counts its reads, safe to use from several threads
+class CountingCoinsView : public CCoinsView
+{
+public:
+    std::map<COutPoint, Coin> mapCoins;
+    mutable std::atomic<int> nReads;
+
+    CountingCoinsView() : nReads(0) {}
+
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const override
+    {
+        nReads++;
+        auto it = mapCoins.find(outpoint);
+        if (it == mapCoins.end())
+            return false;
+        coin = it->second;
+        return true;
+    }
+};
+
+Coin MakeCoin(CAmount nValue)
+{
+    return Coin(CTxOut(nValue, CScript() << OP_TRUE), 1, false, false, 0);
+}
+
+std::shared_ptr<const CBlock> MakeBlock(const std::vector<COutPoint>& vSpent, uint32_t nNonce)
+{
+    CBlock block;
+    block.nNonce = nNonce;
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].prevout.SetNull();
+    coinbase.vout.resize(1);
+    block.vtx.push_back(MakeTransactionRef(coinbase));
+    CMutableTransaction tx;
+    for (const COutPoint& outpoint : vSpent)
+        tx.vin.emplace_back(outpoint);
+    tx.vout.resize(1);
+    block.vtx.push_back(MakeTransactionRef(tx));
+    // Spend an output created within the block
+    CMutableTransaction txChild;
+    txChild.vin.emplace_back(block.vtx[1]->GetHash(), 0);
+    txChild.vout.resize(1);
+    block.vtx.push_back(MakeTransactionRef(txChild));
+    return std::make_shared<const CBlock>(block);
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(coinsprefetch_apply)
+{
+    CountingCoinsView base;
+    CCoinsViewCache cache(&base);
+    CCoinsPrefetcher prefetcher;
+
+    // Without workers nothing is queued
+    std::vector<COutPoint> vSpent;
+    for (uint32_t n = 0; n < 100; n++) {
+        vSpent.emplace_back(InsecureRand256(), n);
+        if (n % 4)
+            base.mapCoins.emplace(vSpent.back(), MakeCoin(n));
+    }
+    std::shared_ptr<const CBlock> pblock = MakeBlock(vSpent, 0);
+    prefetcher.Prefetch(pblock, 1, &base, cache);
+    BOOST_CHECK(!prefetcher.IsPending(pblock->GetHash()));
+
+    boost::thread_group threads;
+    for (int i = 0; i < 3; i++)
+        threads.create_thread([&prefetcher] { prefetcher.Thread(); });
+    while (!prefetcher.IsEnabled())
+        boost::this_thread::yield();
+
+    // A coin in the cache is neither read nor replaced
+    Coin coinCached = MakeCoin(12345);
+    cache.AddCoin(vSpent[1], std::move(coinCached), false);
+
+    prefetcher.Prefetch(pblock, 1, &base, cache);
+    BOOST_CHECK(prefetcher.IsPending(pblock->GetHash()));
+    BOOST_CHECK(prefetcher.GetBlock(pblock->GetHash()) == pblock);
+    BOOST_CHECK_EQUAL(prefetcher.Apply(pblock->GetHash(), cache), 74U);
+    BOOST_CHECK_EQUAL(base.nReads, 99);
+    BOOST_CHECK(!prefetcher.IsPending(pblock->GetHash()));
+    BOOST_CHECK_EQUAL(prefetcher.Apply(pblock->GetHash(), cache), 0U);
+
+    base.nReads = 0;
+    for (uint32_t n = 0; n < 100; n++) {
+        BOOST_CHECK_EQUAL(cache.HaveCoinInCache(vSpent[n]), n % 4 != 0);
+        if (n % 4)
+            BOOST_CHECK_EQUAL(cache.AccessCoin(vSpent[n]).out.nValue, n == 1 ? 12345 : (CAmount)n);
+    }
+    BOOST_CHECK_EQUAL(base.nReads, 0);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 75U);
+
+    // Reads pending when the cache is flushed are dropped
+    CCoinsViewCache cacheEmpty(&base);
+    std::shared_ptr<const CBlock> pblockOther = MakeBlock(vSpent, 1);
+    prefetcher.Prefetch(pblockOther, 2, &base, cacheEmpty);
+    prefetcher.Clear();
+    BOOST_CHECK_EQUAL(prefetcher.Apply(pblockOther->GetHash(), cacheEmpty), 0U);
+    BOOST_CHECK_EQUAL(cacheEmpty.GetCacheSize(), 0U);
+
+    threads.interrupt_all();
+    threads.join_all();
+    BOOST_CHECK(!prefetcher.IsEnabled());
+}
+
+BOOST_AUTO_TEST_CASE(coinsprefetch_pending_limit)
+{
+    CountingCoinsView base;
+    CCoinsViewCache cache(&base);
+    CCoinsPrefetcher prefetcher;
+    boost::thread_group threads;
+    threads.create_thread([&prefetcher] { prefetcher.Thread(); });
+    while (!prefetcher.IsEnabled())
+        boost::this_thread::yield();
+
+    // The lowest blocks are kept
+    std::vector<std::shared_ptr<const CBlock> > vBlocks;
+    for (uint32_t n = 0; n <= CCoinsPrefetcher::MAX_PENDING_BLOCKS; n++)
+        vBlocks.push_back(MakeBlock({COutPoint(InsecureRand256(), 0)}, n));
+    for (size_t n = 1; n < vBlocks.size(); n++)
+        prefetcher.Prefetch(vBlocks[n], n, &base, cache);
+    prefetcher.Prefetch(vBlocks[0], 0, &base, cache);
+    for (size_t n = 0; n < vBlocks.size(); n++)
+        BOOST_CHECK_EQUAL(prefetcher.IsPending(vBlocks[n]->GetHash()), n < CCoinsPrefetcher::MAX_PENDING_BLOCKS);
+
+    prefetcher.Prune(5);
+    for (size_t n = 0; n < vBlocks.size(); n++)
+        BOOST_CHECK_EQUAL(prefetcher.IsPending(vBlocks[n]->GetHash()), n >= 5 && n < CCoinsPrefetcher::MAX_PENDING_BLOCKS);
+
+    threads.interrupt_all();
+    threads.join_all();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <crypto/aes.h>
+#include <crypto/common.h>
 #include <crypto/chacha20.h>
 #include <crypto/ripemd160.h>
 #include <crypto/sha1.h>
@@ -10,6 +11,7 @@
 #include <crypto/sha512.h>
 #include <crypto/hmac_sha256.h>
 #include <crypto/hmac_sha512.h>
+#include <hash.h>
 #include <random.h>
 #include <utilstrencodings.h>
 #include <test/test_bitcoin.h>
@@ -524,6 +526,49 @@ BOOST_AUTO_TEST_CASE(chacha20_testvector)
                  "fab78c9");
 }
 
+BOOST_AUTO_TEST_CASE(sha256d_one_block_tests)
+{
+    // Whatever implementation is picked at runtime has to agree with CHash256
+    // for every batch size, including the leftovers after full multi-way batches
+    for (size_t nBlocks = 0; nBlocks <= 19; nBlocks++) {
+        std::vector<unsigned char> in(64 * nBlocks, 0);
+        std::vector<unsigned char> out(32 * nBlocks);
+        std::vector<uint256> vExpected(nBlocks);
+        for (size_t i = 0; i < nBlocks; i++) {
+            size_t nLen = InsecureRandRange(56);
+            unsigned char* p = in.data() + 64 * i;
+            for (size_t j = 0; j < nLen; j++)
+                p[j] = InsecureRandBits(8);
+            p[nLen] = 0x80;
+            WriteBE64(p + 56, nLen << 3);
+            CHash256().Write(p, nLen).Finalize(vExpected[i].begin());
+        }
+        SHA256DOneBlock(out.data(), in.data(), nBlocks);
+        for (size_t i = 0; i < nBlocks; i++)
+            BOOST_CHECK(memcmp(out.data() + 32 * i, vExpected[i].begin(), 32) == 0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sha256d64)
+{
+    // Same for the 64-byte variant, also when hashing in place
+    for (size_t nBlocks = 0; nBlocks <= 19; nBlocks++) {
+        std::vector<unsigned char> in(64 * nBlocks);
+        for (size_t i = 0; i < in.size(); i++)
+            in[i] = InsecureRandBits(8);
+        std::vector<unsigned char> out(32 * nBlocks);
+        std::vector<uint256> vExpected(nBlocks);
+        for (size_t i = 0; i < nBlocks; i++)
+            CHash256().Write(in.data() + 64 * i, 64).Finalize(vExpected[i].begin());
+        SHA256D64(out.data(), in.data(), nBlocks);
+        SHA256D64(in.data(), in.data(), nBlocks);
+        for (size_t i = 0; i < nBlocks; i++) {
+            BOOST_CHECK(memcmp(out.data() + 32 * i, vExpected[i].begin(), 32) == 0);
+            BOOST_CHECK(memcmp(in.data() + 32 * i, vExpected[i].begin(), 32) == 0);
+        }
+    }
+}
+
 BOOST_AUTO_TEST_CASE(countbits_tests)
 {
     FastRandomContext ctx;
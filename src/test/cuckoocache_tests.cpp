@@ -377,4 +377,46 @@ BOOST_AUTO_TEST_CASE(cuckoocache_generations)
     test_cache_generations<CuckooCache::cache<uint256, SignatureCacheHasher>>();
 }
 
+/* Test that the sharded cache finds what was inserted in any shard, and
+ * counts its hits, misses and evictions.
+ */
+BOOST_AUTO_TEST_CASE(sharded_signature_cache)
+{
+    local_rand_ctx = FastRandomContext(true);
+    CShardedSignatureCache cache;
+    size_t nElements = cache.Setup(1 << 20);
+    BOOST_CHECK_EQUAL(cache.GetStats().nElements, nElements);
+    BOOST_CHECK(nElements > 30000 && nElements <= (1 << 20) / sizeof(uint256));
+
+    std::vector<uint256> hashes(nElements / 4);
+    for (uint256& hash : hashes) {
+        insecure_GetRandHash(hash);
+        cache.Insert(hash);
+    }
+    for (const uint256& hash : hashes)
+        BOOST_CHECK(cache.Contains(hash, false));
+    uint256 hashMissing;
+    insecure_GetRandHash(hashMissing);
+    BOOST_CHECK(!cache.Contains(hashMissing, false));
+
+    CShardedSignatureCache::Stats stats = cache.GetStats();
+    BOOST_CHECK_EQUAL(stats.nHits, hashes.size());
+    BOOST_CHECK_EQUAL(stats.nMisses, 1U);
+    BOOST_CHECK_EQUAL(stats.nEvictions, 0U);
+
+    // Inserting many more entries than it can hold evicts about as many
+    for (size_t i = 0; i < 4 * nElements; i++) {
+        insecure_GetRandHash(hashMissing);
+        cache.Insert(hashMissing);
+    }
+    stats = cache.GetStats();
+    BOOST_CHECK(stats.nEvictions > 2 * nElements && stats.nEvictions < 4 * nElements);
+
+    // A single shard behaves the same
+    CShardedSignatureCache cacheSingle(1);
+    BOOST_CHECK(cacheSingle.Setup(1 << 20) >= nElements);
+    cacheSingle.Insert(hashes[0]);
+    BOOST_CHECK(cacheSingle.Contains(hashes[0], false) && !cacheSingle.Contains(hashes[1], false));
+}
+
 BOOST_AUTO_TEST_SUITE_END();
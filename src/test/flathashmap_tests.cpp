@@ -0,0 +1,130 @@
+// Copyright (c) 2020 The Peercoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <flathashmap.h>
+
+#include <test/test_bitcoin.h>
+
+#include <map>
+#include <string>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(flathashmap_tests, BasicTestingSetup)
+
+namespace {
+
+// Puts many keys in few slots, to exercise long probe sequences
+struct CollidingHasher
+{
+    size_t operator()(int n) const { return n & 7; }
+};
+
+template <typename Map>
+void CheckSameAs(const Map& map, const std::map<int, std::string>& expected)
+{
+    BOOST_CHECK_EQUAL(map.size(), expected.size());
+    BOOST_CHECK_EQUAL(map.empty(), expected.empty());
+    size_t nIterated = 0;
+    for (const auto& item : map) {
+        auto it = expected.find(item.first);
+        BOOST_CHECK(it != expected.end() && it->second == item.second);
+        nIterated++;
+    }
+    BOOST_CHECK_EQUAL(nIterated, expected.size());
+}
+
+template <typename Hasher>
+void RandomOperations(int nKeyRange)
+{
+    flat_hash_map<int, std::string, Hasher> map;
+    std::map<int, std::string> expected;
+    for (int i = 0; i < 20000; i++) {
+        int key = InsecureRandRange(nKeyRange);
+        switch (InsecureRandRange(4)) {
+        case 0: {
+            auto ret = map.emplace(key, std::to_string(i));
+            auto ret_expected = expected.emplace(key, std::to_string(i));
+            BOOST_CHECK_EQUAL(ret.second, ret_expected.second);
+            BOOST_CHECK(ret.first->first == key && ret.first->second == ret_expected.first->second);
+            break;
+        }
+        case 1:
+            BOOST_CHECK_EQUAL(map.erase(key), expected.erase(key));
+            break;
+        case 2:
+            map[key] += "x";
+            expected[key] += "x";
+            break;
+        case 3: {
+            auto it = map.find(key);
+            BOOST_CHECK_EQUAL(it != map.end(), expected.count(key) == 1);
+            BOOST_CHECK_EQUAL(map.count(key), expected.count(key));
+            if (it != map.end())
+                BOOST_CHECK(it->second == expected[key]);
+            break;
+        }
+        }
+        if (i % 1000 == 0)
+            CheckSameAs(map, expected);
+    }
+    CheckSameAs(map, expected);
+    map.clear();
+    BOOST_CHECK(map.empty() && map.begin() == map.end() && map.find(0) == map.end());
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(flathashmap_random)
+{
+    RandomOperations<std::hash<int> >(100);
+    RandomOperations<std::hash<int> >(100000);
+    RandomOperations<CollidingHasher>(500);
+}
+
+BOOST_AUTO_TEST_CASE(flathashmap_stable_entries)
+{
+    flat_hash_map<int, int> map;
+    std::vector<const std::pair<const int, int>*> vEntries;
+    for (int i = 0; i < 10000; i++)
+        vEntries.push_back(&*map.emplace(i, i).first);
+    for (int i = 0; i < 10000; i++) {
+        // Inserts and rehashes leave the entries where they were
+        BOOST_CHECK(&*map.find(i) == vEntries[i]);
+        BOOST_CHECK_EQUAL(vEntries[i]->second, i);
+    }
+
+    // Erasing while iterating visits every entry once
+    size_t nVisited = 0;
+    for (auto it = map.begin(); it != map.end(); nVisited++) {
+        if (it->first % 2)
+            it = map.erase(it);
+        else
+            ++it;
+    }
+    BOOST_CHECK_EQUAL(nVisited, 10000U);
+    BOOST_CHECK_EQUAL(map.size(), 5000U);
+    for (int i = 0; i < 10000; i += 2)
+        BOOST_CHECK(&*map.find(i) == vEntries[i]);
+
+    // Erased positions are reused
+    size_t nUsage = map.DynamicMemoryUsage();
+    for (int i = 1; i < 10000; i += 2)
+        map.emplace(i, i);
+    BOOST_CHECK_EQUAL(map.size(), 10000U);
+    BOOST_CHECK_EQUAL(map.DynamicMemoryUsage(), nUsage);
+
+    // Swapping moves the entries without touching them
+    flat_hash_map<int, int> mapOther;
+    mapOther.emplace(-1, -1);
+    map.swap(mapOther);
+    BOOST_CHECK_EQUAL(map.size(), 1U);
+    BOOST_CHECK_EQUAL(mapOther.size(), 10000U);
+    for (int i = 0; i < 10000; i += 2)
+        BOOST_CHECK(&*mapOther.find(i) == vEntries[i]);
+    BOOST_CHECK(map.find(0) == map.end());
+    BOOST_CHECK_EQUAL(map.find(-1)->second, -1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
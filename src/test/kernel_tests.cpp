@@ -0,0 +1,568 @@
+// Copyright (c) 2012-2020 The Peercoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <arith_uint256.h>
+#include <chainparams.h>
+#include <checkqueue.h>
+#include <coins.h>
+#include <hash.h>
+#include <kernel.h>
+#include <miner.h>
+#include <streams.h>
+#include <txdb.h>
+#include <validation.h>
+#include <wallet/wallet.h>
+#include <test/test_bitcoin.h>
+
+#include <limits>
+#include <memory>
+#include <set>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(kernel_tests, BasicTestingSetup)
+
+namespace {
+
+// A main chain straddling the v0.5 switch and a side chain forking off it,
+// with modifiers generated every nModifierInterval like the real chain.
+class CStakeModifierTestChain
+{
+public:
+    std::vector<std::unique_ptr<CBlockIndex> > vIndex;
+    CBlockIndex* pindexMainTip;
+    CBlockIndex* pindexSideTip;
+
+    CStakeModifierTestChain()
+    {
+        const int64_t nStart = 1461700000 - 5000 * 600;
+        pindexMainTip = Extend(nullptr, 10000, nStart, 600);
+        pindexSideTip = Extend(pindexMainTip->GetAncestor(8000), 1500, 0, 590);
+    }
+
+    ~CStakeModifierTestChain()
+    {
+        chainActive.SetTip(nullptr);
+        stakeModifierIndex.SetTip(nullptr);
+        stakeModifierCandidates.Clear();
+        for (const auto& pindex : vIndex)
+            mapBlockIndex.erase(pindex->GetBlockHash());
+    }
+
+    CBlockIndex* Extend(CBlockIndex* pindexPrev, int nBlocks, int64_t nStart, int64_t nSpacing)
+    {
+        const int64_t nModifierInterval = Params().GetConsensus().nModifierInterval;
+        for (int i = 0; i < nBlocks; i++) {
+            CBlockIndex* pindex = new CBlockIndex();
+            vIndex.emplace_back(pindex);
+            pindex->pprev = pindexPrev;
+            pindex->nHeight = pindexPrev ? pindexPrev->nHeight + 1 : 0;
+            pindex->nTime = pindexPrev ? pindexPrev->nTime + nSpacing : nStart;
+            bool fGenerated = !pindexPrev || pindex->nTime / nModifierInterval != pindexPrev->nTime / nModifierInterval;
+            pindex->SetStakeModifier(fGenerated ? (uint64_t)vIndex.size() : pindexPrev->nStakeModifier, fGenerated);
+            BlockMap::iterator mi = mapBlockIndex.insert(std::make_pair(ArithToUint256(arith_uint256(vIndex.size())), pindex)).first;
+            pindex->phashBlock = &mi->first;
+            pindex->BuildSkip();
+            pindexPrev = pindex;
+        }
+        return pindexPrev;
+    }
+};
+
+void CheckSameModifier(CBlockIndex* pindexPrev, const CBlockIndex* pindexFrom, unsigned int nTimeTx)
+{
+    uint64_t nModifierWalk = 0, nModifierIndex = 0;
+    int nHeightWalk = 0, nHeightIndex = 0;
+    int64_t nTimeWalk = 0, nTimeIndex = 0;
+    bool fWalk = GetKernelStakeModifier(pindexPrev, pindexFrom->GetBlockHash(), nTimeTx, nModifierWalk, nHeightWalk, nTimeWalk, false, false);
+    bool fIndex = GetKernelStakeModifier(pindexPrev, pindexFrom->GetBlockHash(), nTimeTx, nModifierIndex, nHeightIndex, nTimeIndex, false, true);
+    BOOST_CHECK_EQUAL(fWalk, fIndex);
+    if (fWalk && fIndex) {
+        BOOST_CHECK_EQUAL(nModifierWalk, nModifierIndex);
+        BOOST_CHECK_EQUAL(nHeightWalk, nHeightIndex);
+        BOOST_CHECK_EQUAL(nTimeWalk, nTimeIndex);
+    }
+}
+
+void CheckAllModifiers(const CStakeModifierTestChain& chain)
+{
+    const Consensus::Params& params = Params().GetConsensus();
+    std::vector<CBlockIndex*> vPrev = {chain.pindexMainTip, chain.pindexSideTip,
+        chain.pindexMainTip->GetAncestor(9000), chain.pindexSideTip->GetAncestor(8001),
+        chain.pindexSideTip->GetAncestor(8700)};
+    for (CBlockIndex* pindexPrev : vPrev) {
+        // v0.3: the modifier only depends on the block the kernel comes from
+        for (int nHeight = 0; nHeight < pindexPrev->nHeight; nHeight += 37)
+            CheckSameModifier(pindexPrev, pindexPrev->GetAncestor(nHeight), 1400000000);
+        // v0.5: the modifier only depends on the kernel timestamp
+        for (int64_t nAge = params.nStakeMinAge - 2 * params.nModifierInterval; nAge < 40 * 24 * 60 * 60; nAge += 1001) {
+            unsigned int nTimeTx = pindexPrev->nTime + nAge;
+            if (IsProtocolV05(nTimeTx))
+                CheckSameModifier(pindexPrev, pindexPrev, nTimeTx);
+        }
+    }
+}
+
+// The modifier selection as it was before the candidate window: walk back
+// over the selection interval, sort, and hash each candidate every round.
+uint64_t SelectModifierReference(const CBlockIndex* pindexPrev)
+{
+    const int64_t nModifierInterval = Params().GetConsensus().nModifierInterval;
+    const CBlockIndex* pindexLast = pindexPrev;
+    while (pindexLast->pprev && !pindexLast->GeneratedStakeModifier())
+        pindexLast = pindexLast->pprev;
+    uint64_t nStakeModifierPrev = pindexLast->nStakeModifier;
+
+    std::vector<int64_t> vSection;
+    int64_t nSelectionInterval = 0;
+    for (int nSection = 0; nSection < 64; nSection++) {
+        vSection.push_back(nModifierInterval * 63 / (63 + ((63 - nSection) * (MODIFIER_INTERVAL_RATIO - 1))));
+        nSelectionInterval += vSection.back();
+    }
+    int64_t nSelectionIntervalStart = (pindexPrev->GetBlockTime() / nModifierInterval) * nModifierInterval - nSelectionInterval;
+    std::vector<const CBlockIndex*> vSorted;
+    for (const CBlockIndex* pindex = pindexPrev; pindex && pindex->GetBlockTime() >= nSelectionIntervalStart; pindex = pindex->pprev)
+        vSorted.push_back(pindex);
+    std::sort(vSorted.begin(), vSorted.end(), [](const CBlockIndex* a, const CBlockIndex* b) {
+        if (a->GetBlockTime() != b->GetBlockTime())
+            return a->GetBlockTime() < b->GetBlockTime();
+        return UintToArith256(a->GetBlockHash()) < UintToArith256(b->GetBlockHash());
+    });
+
+    uint64_t nStakeModifierNew = 0;
+    int64_t nSelectionIntervalStop = nSelectionIntervalStart;
+    std::set<const CBlockIndex*> setSelected;
+    for (int nRound = 0; nRound < std::min(64, (int)vSorted.size()); nRound++) {
+        nSelectionIntervalStop += vSection[nRound];
+        const CBlockIndex* pindexBest = nullptr;
+        arith_uint256 hashBest;
+        for (const CBlockIndex* pindex : vSorted) {
+            if (pindexBest && pindex->GetBlockTime() > nSelectionIntervalStop)
+                break;
+            if (setSelected.count(pindex))
+                continue;
+            CDataStream ss(SER_GETHASH, 0);
+            ss << (pindex->IsProofOfStake() ? pindex->hashProofOfStake : pindex->GetBlockHash()) << nStakeModifierPrev;
+            arith_uint256 hashSelection = UintToArith256(Hash(ss.begin(), ss.end()));
+            if (pindex->IsProofOfStake())
+                hashSelection >>= 32;
+            if (!pindexBest || hashSelection < hashBest) {
+                pindexBest = pindex;
+                hashBest = hashSelection;
+            }
+        }
+        nStakeModifierNew |= ((uint64_t)pindexBest->GetStakeEntropyBit()) << nRound;
+        setSelected.insert(pindexBest);
+    }
+    return nStakeModifierNew;
+}
+
+typedef std::vector<std::pair<int64_t, COutPoint> > StakeHitList;
+
+// The hits of every second from nFrom to nTo, checked one by one
+StakeHitList ScanStakeHits(unsigned int nBits, CBlockIndex* pindexTip, const std::map<COutPoint, CStakeCacheEntry>& mapCoins, int64_t nFrom, int64_t nTo)
+{
+    StakeHitList vHits;
+    for (int64_t nTime = nFrom; nTime <= nTo; nTime++) {
+        for (const auto& item : mapCoins) {
+            const CStakeCacheEntry& coin = item.second;
+            uint256 hashProofOfStake;
+            if (CheckStakeKernelHash(nBits, pindexTip, coin.nTimeBlock, coin.hashBlock, coin.nTxOffset, coin.nTimeTx, coin.nValue, item.first, nTime, hashProofOfStake))
+                vHits.emplace_back(nTime, item.first);
+        }
+    }
+    return vHits;
+}
+
+void CheckStakePlan(CStakePlanner& planner, unsigned int nBits, CBlockIndex* pindexTip, const std::map<COutPoint, CStakeCacheEntry>& mapCoins, int64_t nNow, int64_t nUntil)
+{
+    planner.Plan(pindexTip, nBits, mapCoins, nNow, nUntil);
+    StakeHitList vScan = ScanStakeHits(nBits, pindexTip, mapCoins, nNow, nUntil);
+    StakeHitList vPlanned;
+    for (const CStakeHit& hit : planner.GetSchedule(nNow, std::numeric_limits<size_t>::max()))
+        vPlanned.emplace_back(hit.nTime, hit.prevout);
+    BOOST_CHECK(!vScan.empty());
+    BOOST_CHECK_EQUAL(vPlanned.size(), vScan.size());
+    BOOST_CHECK(vPlanned == vScan);
+
+    int64_t nNextHit;
+    BOOST_CHECK(planner.NextHit(pindexTip, nNow, nNextHit));
+    BOOST_CHECK_EQUAL(nNextHit, vScan.empty() ? nUntil + 1 : vScan[0].first);
+    BOOST_CHECK(!planner.NextHit(pindexTip->pprev, nNow, nNextHit));
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(stake_modifier_index)
+{
+    LOCK(cs_main);
+    CStakeModifierTestChain chain;
+
+    chainActive.SetTip(chain.pindexMainTip);
+    CheckAllModifiers(chain);
+
+    // the index follows a reorg onto the side chain and back
+    chainActive.SetTip(chain.pindexSideTip);
+    CheckAllModifiers(chain);
+    BOOST_CHECK(stakeModifierIndex.Tip() == chain.pindexSideTip);
+    const CBlockIndex* pindexLast = stakeModifierIndex.FindPrev(chain.pindexSideTip->nHeight + 1, chain.pindexSideTip->nTime);
+    BOOST_CHECK(pindexLast && pindexLast->GeneratedStakeModifier() && pindexLast->nHeight > 8000);
+    BOOST_CHECK(pindexLast == chain.pindexSideTip->GetAncestor(pindexLast->nHeight));
+
+    chainActive.SetTip(chain.pindexMainTip);
+    CheckAllModifiers(chain);
+}
+
+BOOST_AUTO_TEST_CASE(stake_modifier_snapshot)
+{
+    LOCK(cs_main);
+    CStakeModifierTestChain chain;
+    chainActive.SetTip(chain.pindexMainTip);
+    const Consensus::Params& params = Params().GetConsensus();
+
+    // The kernels collected from a snapshot match the ones looked up per coin
+    for (int nRun = 0; nRun < 50; nRun++) {
+        CBlockIndex* pindexPrev = InsecureRandBool() ? chain.pindexMainTip : chain.pindexSideTip;
+        unsigned int nTimeTxFrom = pindexPrev->nTime + InsecureRandRange(2 * params.nStakeMinAge);
+        unsigned int nSearchInterval = InsecureRandRange(120);
+        CStakeModifierSnapshot snapshot;
+        snapshot.Take(pindexPrev, nTimeTxFrom, nSearchInterval);
+        BOOST_CHECK(snapshot.IsComplete());
+
+        unsigned int nTimeBlockFrom = nTimeTxFrom - params.nStakeMinAge - 60 + InsecureRandRange(120);
+        unsigned int nTimeTxPrev = nTimeBlockFrom - InsecureRandRange(2);
+        COutPoint prevout(InsecureRand256(), InsecureRandRange(4));
+        std::vector<KernelInput> vSnapshot, vLookup;
+        snapshot.GetKernels(0x1d00ffff, nTimeBlockFrom, 81, nTimeTxPrev, prevout, vSnapshot);
+        GetStakeKernels(0x1d00ffff, pindexPrev, nTimeBlockFrom, uint256(), 81, nTimeTxPrev, prevout, nTimeTxFrom, nSearchInterval, vLookup);
+        BOOST_CHECK_EQUAL(vSnapshot.size(), vLookup.size());
+        for (size_t i = 0; i < std::min(vSnapshot.size(), vLookup.size()); i++) {
+            BOOST_CHECK_EQUAL(vSnapshot[i].nTimeTx, vLookup[i].nTimeTx);
+            BOOST_CHECK_EQUAL(vSnapshot[i].nStakeModifier, vLookup[i].nStakeModifier);
+        }
+    }
+
+    // Pre v0.5 timestamps need the block the coin is from
+    CStakeModifierSnapshot snapshot;
+    snapshot.Take(chain.pindexMainTip, 1400000000, 60);
+    BOOST_CHECK(!snapshot.IsComplete());
+}
+
+BOOST_AUTO_TEST_CASE(stake_modifier_candidates)
+{
+    LOCK(cs_main);
+    CStakeModifierTestChain chain;
+    // Mixed block types, and timestamps out of order or equal
+    for (const auto& pindex : chain.vIndex) {
+        if (InsecureRandBool()) {
+            pindex->SetProofOfStake();
+            pindex->hashProofOfStake = InsecureRand256();
+        }
+        pindex->SetStakeEntropyBit(InsecureRandBool());
+        if (pindex->pprev && InsecureRandRange(8) == 0)
+            pindex->nTime = pindex->pprev->nTime;
+        else
+            pindex->nTime += InsecureRandRange(1200);
+    }
+
+    // Following the main chain, switching to the side chain and going back
+    // has to select the same modifiers as the walk over the whole interval
+    std::vector<const CBlockIndex*> vCurrent;
+    for (int nHeight = 1; nHeight <= chain.pindexMainTip->nHeight; nHeight++)
+        vCurrent.push_back(chain.pindexMainTip->GetAncestor(nHeight));
+    for (int nHeight = 8001; nHeight <= chain.pindexSideTip->nHeight; nHeight++)
+        vCurrent.push_back(chain.pindexSideTip->GetAncestor(nHeight));
+    for (int nHeight = 7000; nHeight <= 9000; nHeight++)
+        vCurrent.push_back(chain.pindexMainTip->GetAncestor(nHeight));
+    int nGenerated = 0;
+    for (const CBlockIndex* pindexCurrent : vCurrent) {
+        uint64_t nStakeModifier;
+        bool fGenerated;
+        BOOST_CHECK(ComputeNextStakeModifier(pindexCurrent, nStakeModifier, fGenerated));
+        // the reference is slow, check a sample of the modifiers against it
+        if (fGenerated && nGenerated++ % 16 == 0)
+            BOOST_CHECK_EQUAL(nStakeModifier, SelectModifierReference(pindexCurrent->pprev));
+    }
+    BOOST_CHECK(nGenerated > 100);
+}
+
+BOOST_AUTO_TEST_CASE(stake_seen_index)
+{
+    LOCK(cs_main);
+    auto MakeBlock = [](const COutPoint& prevout, unsigned int nTime, uint32_t nNonce) {
+        CBlock block;
+        CMutableTransaction txCoinBase;
+        txCoinBase.vin.resize(1);
+        txCoinBase.vout.resize(1);
+        CMutableTransaction txCoinStake;
+        txCoinStake.nTime = nTime;
+        txCoinStake.vin.emplace_back(prevout);
+        txCoinStake.vout.resize(2);
+        txCoinStake.vout[0].SetEmpty();
+        txCoinStake.vout[1].nValue = COIN;
+        block.vtx.push_back(MakeTransactionRef(txCoinBase));
+        block.vtx.push_back(MakeTransactionRef(txCoinStake));
+        block.nNonce = nNonce;
+        return block;
+    };
+
+    std::vector<CBlock> vBlocks;
+    for (int i = 0; i < 100; i++) {
+        vBlocks.push_back(MakeBlock(COutPoint(InsecureRand256(), InsecureRandRange(4)), 1500000000 + InsecureRandRange(1000), i));
+        BOOST_CHECK(vBlocks.back().IsProofOfStake());
+        BOOST_CHECK(!IsDuplicateStake(vBlocks.back()));
+        AddStakeSeen(vBlocks.back());
+    }
+    for (const CBlock& block : vBlocks) {
+        // seeing the same block again is no duplicate
+        BOOST_CHECK(!IsDuplicateStake(block));
+        const CTransaction& txCoinStake = *block.vtx[1];
+        BOOST_CHECK(IsDuplicateStake(MakeBlock(txCoinStake.vin[0].prevout, txCoinStake.nTime, block.nNonce + 1000)));
+        // the same kernel at another time is another stake
+        BOOST_CHECK(!IsDuplicateStake(MakeBlock(txCoinStake.vin[0].prevout, txCoinStake.nTime + 1, block.nNonce + 1000)));
+    }
+
+    // In an index too small for them, the stakes dropped are unknown rather
+    // than duplicates, and the latest ones are still told apart
+    gArgs.ForceSetArg("-maxstakeseensize", "0");
+    InitStakeSeenIndex();
+    for (const CBlock& block : vBlocks)
+        AddStakeSeen(block);
+    for (const CBlock& block : vBlocks)
+        BOOST_CHECK(!IsDuplicateStake(block));
+    const CTransaction& txCoinStakeLast = *vBlocks.back().vtx[1];
+    BOOST_CHECK(IsDuplicateStake(MakeBlock(txCoinStakeLast.vin[0].prevout, txCoinStakeLast.nTime, vBlocks.back().nNonce + 1000)));
+    const CTransaction& txCoinStakeFirst = *vBlocks.front().vtx[1];
+    BOOST_CHECK(!IsDuplicateStake(MakeBlock(txCoinStakeFirst.vin[0].prevout, txCoinStakeFirst.nTime, vBlocks.front().nNonce + 1000)));
+    gArgs.ForceSetArg("-maxstakeseensize", std::to_string(DEFAULT_MAX_STAKESEEN_SIZE));
+    InitStakeSeenIndex();
+}
+
+BOOST_AUTO_TEST_CASE(kernel_index_db)
+{
+    CCoinsViewDB db(1 << 20, true);
+    std::vector<std::pair<uint256, CKernelIndexEntry> > vEntry;
+    for (int i = 0; i < 100; i++)
+        vEntry.push_back(std::make_pair(InsecureRand256(), CKernelIndexEntry(InsecureRandRange(1000000), InsecureRand256(), 81 + InsecureRandRange(1000000))));
+    BOOST_CHECK(db.WriteKernelIndex(vEntry));
+
+    // the index is kept apart from the coins
+    BOOST_CHECK(db.GetBestBlock().IsNull());
+    std::unique_ptr<CCoinsViewCursor> pcursor(db.Cursor());
+    BOOST_CHECK(!pcursor->Valid());
+
+    for (const auto& item : vEntry) {
+        CKernelIndexEntry entry;
+        BOOST_CHECK(db.ReadKernelIndex(item.first, entry));
+        BOOST_CHECK_EQUAL(entry.nHeight, item.second.nHeight);
+        BOOST_CHECK(entry.hashBlock == item.second.hashBlock);
+        BOOST_CHECK_EQUAL(entry.nTxOffset, item.second.nTxOffset);
+    }
+    CKernelIndexEntry entry;
+    BOOST_CHECK(!db.ReadKernelIndex(InsecureRand256(), entry));
+
+    // a transaction connected again is found where it was last connected
+    vEntry.resize(1);
+    vEntry[0].second.nHeight++;
+    BOOST_CHECK(db.WriteKernelIndex(vEntry));
+    BOOST_CHECK(db.ReadKernelIndex(vEntry[0].first, entry));
+    BOOST_CHECK_EQUAL(entry.nHeight, vEntry[0].second.nHeight);
+
+    // and gone once disconnected
+    BOOST_CHECK(db.EraseKernelIndex(std::vector<uint256>{vEntry[0].first}));
+    BOOST_CHECK(!db.ReadKernelIndex(vEntry[0].first, entry));
+}
+
+BOOST_AUTO_TEST_CASE(kernel_index_active_block)
+{
+    LOCK(cs_main);
+    CStakeModifierTestChain chain;
+    chainActive.SetTip(chain.pindexMainTip);
+    CCoinsViewDB db(1 << 20, true);
+    CCoinsViewCache view(&db);
+
+    // An unspent output of a transaction connected at the same height on both branches
+    const int nHeight = 8500;
+    const CBlockIndex* pindexMain = chain.pindexMainTip->GetAncestor(nHeight);
+    const CBlockIndex* pindexSide = chain.pindexSideTip->GetAncestor(nHeight);
+    COutPoint prevout(InsecureRand256(), 1);
+    CTxOut txout(5 * COIN, CScript() << OP_TRUE);
+    view.AddCoin(prevout, Coin(txout, nHeight, false, false, pindexMain->nTime - 100), false);
+
+    unsigned int nTimeBlockFrom, nTxPrevOffset, nTimeTxPrev;
+    uint256 hashBlockFrom;
+    CTxOut txoutPrev;
+    auto ReadFromIndex = [&]() {
+        return ReadStakeKernelFromIndex(view, db, prevout, nTimeBlockFrom, hashBlockFrom, nTxPrevOffset, nTimeTxPrev, txoutPrev);
+    };
+    auto WriteEntry = [&](const CKernelIndexEntry& entry) {
+        BOOST_CHECK(db.WriteKernelIndex({std::make_pair(prevout.hash, entry)}));
+    };
+
+    // no entry yet
+    BOOST_CHECK(!ReadFromIndex());
+
+    // the entry of the active block
+    WriteEntry(CKernelIndexEntry(nHeight, pindexMain->GetBlockHash(), 1234));
+    BOOST_CHECK(ReadFromIndex());
+    BOOST_CHECK_EQUAL(nTimeBlockFrom, pindexMain->nTime);
+    BOOST_CHECK(hashBlockFrom == pindexMain->GetBlockHash());
+    BOOST_CHECK_EQUAL(nTxPrevOffset, 1234U);
+    BOOST_CHECK_EQUAL(nTimeTxPrev, pindexMain->nTime - 100);
+    BOOST_CHECK(txoutPrev == txout);
+
+    // an entry left from the other branch at the same height, or from another height
+    WriteEntry(CKernelIndexEntry(nHeight, pindexSide->GetBlockHash(), 4321));
+    BOOST_CHECK(!ReadFromIndex());
+    WriteEntry(CKernelIndexEntry(nHeight + 1, chain.pindexMainTip->GetAncestor(nHeight + 1)->GetBlockHash(), 1234));
+    BOOST_CHECK(!ReadFromIndex());
+
+    // once the side branch is active, its entry is the one used
+    WriteEntry(CKernelIndexEntry(nHeight, pindexSide->GetBlockHash(), 4321));
+    chainActive.SetTip(chain.pindexSideTip);
+    BOOST_CHECK(ReadFromIndex());
+    BOOST_CHECK(hashBlockFrom == pindexSide->GetBlockHash());
+    BOOST_CHECK_EQUAL(nTxPrevOffset, 4321U);
+
+    // nor is a spent output looked up
+    view.SpendCoin(prevout);
+    BOOST_CHECK(!ReadFromIndex());
+}
+
+BOOST_AUTO_TEST_CASE(kernel_hash_batch)
+{
+    // The batch hasher has to match the serialized kernel of either protocol
+    for (size_t nKernels = 0; nKernels <= 19; nKernels++) {
+        std::vector<KernelInput> vKernel(nKernels);
+        for (KernelInput& kernel : vKernel) {
+            kernel.nStakeModifier = (uint64_t)InsecureRand32() << 32 | InsecureRand32();
+            kernel.nBits = InsecureRand32();
+            kernel.nTimeBlockFrom = InsecureRand32();
+            kernel.nTxPrevOffset = InsecureRand32();
+            kernel.nTimeTxPrev = InsecureRand32();
+            kernel.nPrevoutN = InsecureRand32();
+            kernel.nTimeTx = InsecureRandBool() ? 1300000000 + InsecureRandRange(200000000) : InsecureRand32();
+        }
+        std::vector<uint256> vHash(nKernels);
+        ComputeKernelHashes(vKernel.data(), nKernels, vHash.data());
+        for (size_t i = 0; i < nKernels; i++) {
+            const KernelInput& kernel = vKernel[i];
+            CDataStream ss(SER_GETHASH, 0);
+            if (IsProtocolV03(kernel.nTimeTx))
+                ss << kernel.nStakeModifier;
+            else
+                ss << kernel.nBits;
+            ss << kernel.nTimeBlockFrom << kernel.nTxPrevOffset << kernel.nTimeTxPrev << kernel.nPrevoutN << kernel.nTimeTx;
+            BOOST_CHECK(vHash[i] == Hash(ss.begin(), ss.end()));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(stake_kernel_check_queue)
+{
+    // Only one coin can meet the target: the others have no value, which
+    // leaves them a zero weighted target. Whichever thread gets to it, the
+    // search has to report that coin and its first kernel meeting the target.
+    const unsigned int nTimeTxFrom = 1500000000;
+    CCheckQueue<CStakeKernelCheck> queue;
+    boost::thread_group tg;
+    for (int i = 0; i < 3; i++)
+        tg.create_thread([&]{queue.Thread();});
+
+    for (int nRun = 0; nRun < 20; nRun++) {
+        int nCoins = 1 + InsecureRandRange(200);
+        int nCoinHit = InsecureRandRange(nCoins);
+        CStakeKernelCheck::Result result;
+        std::vector<CStakeKernelCheck> vChecks;
+        std::vector<KernelInput> vKernelHit;
+        int nKernelHit = -1;
+        for (int nCoin = 0; nCoin < nCoins; nCoin++) {
+            std::vector<KernelInput> vKernel;
+            do {
+                // about one in eight kernels of the valued coin meets the target
+                vKernel.clear();
+                uint64_t nStakeModifier = (uint64_t)InsecureRand32() << 32 | InsecureRand32();
+                unsigned int nTxPrevOffset = 81 + InsecureRandRange(1000);
+                unsigned int nPrevoutN = InsecureRandRange(4);
+                for (unsigned int n = 0; n < 60; n++) {
+                    KernelInput kernel = {nStakeModifier, 0x1e00ffff, nTimeTxFrom - 90 * 24 * 60 * 60, nTxPrevOffset, nTimeTxFrom - 60 * 24 * 60 * 60, nPrevoutN, nTimeTxFrom - n};
+                    vKernel.push_back(kernel);
+                }
+                if (nCoin == nCoinHit) {
+                    vKernelHit = vKernel;
+                    nKernelHit = FindStakeKernel(vKernelHit, 100000 * COIN);
+                }
+            } while (nCoin == nCoinHit && nKernelHit < 0);
+            BOOST_CHECK_EQUAL(FindStakeKernel(vKernel, 0), -1);
+            vChecks.emplace_back(std::move(vKernel), nCoin == nCoinHit ? 100000 * COIN : 0, nCoin, &result);
+        }
+
+        CCheckQueueControl<CStakeKernelCheck> control(&queue);
+        control.Add(vChecks);
+        BOOST_CHECK(!control.Wait());
+        BOOST_CHECK_EQUAL(result.nCoin, nCoinHit);
+        BOOST_CHECK_EQUAL(result.nTimeTx, vKernelHit[nKernelHit].nTimeTx);
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+BOOST_AUTO_TEST_CASE(stake_planner)
+{
+    LOCK(cs_main);
+    CStakeModifierTestChain chain;
+    CBlockIndex* pindexTip = chain.pindexMainTip;
+    chainActive.SetTip(pindexTip);
+
+    // Outputs close to 50 days old when planned, together hitting about every half minute
+    std::map<COutPoint, CStakeCacheEntry> mapCoins;
+    for (int i = 0; i < 3; i++) {
+        const CBlockIndex* pindexFrom = pindexTip->GetAncestor(pindexTip->nHeight - 4000 - 100 * i);
+        CStakeCacheEntry& coin = mapCoins[COutPoint(InsecureRand256(), i)];
+        coin.hashBlock = pindexFrom->GetBlockHash();
+        coin.nTimeBlock = pindexFrom->nTime;
+        coin.nTxOffset = 81 + InsecureRandRange(1000);
+        coin.nTimeTx = pindexFrom->nTime - InsecureRandRange(600);
+        coin.nValue = 10000 * COIN;
+    }
+
+    // An hour reaching past the last kernel the tip gives a modifier for
+    CStakePlanner planner;
+    int64_t nNow = GetLastStakeKernelTime(pindexTip) - 1800;
+    CheckStakePlan(planner, 0x1e00ffff, pindexTip, mapCoins, nNow, nNow + 3600);
+
+    // Time passing, with the target moving within the slack and back
+    nNow += 600;
+    CheckStakePlan(planner, 0x1e01fffe, pindexTip, mapCoins, nNow, nNow + 3600);
+    CheckStakePlan(planner, 0x1e007fff, pindexTip, mapCoins, nNow, nNow + 3600);
+
+    // The target moving past the slack
+    static_assert(STAKE_PLAN_SLACK < 8, "the target below moves past the slack");
+    CheckStakePlan(planner, 0x1e07fff8, pindexTip, mapCoins, nNow, nNow + 3600);
+
+    // A new tip generating no modifier makes later kernels valid
+    const int64_t nModifierInterval = Params().GetConsensus().nModifierInterval;
+    int64_t nNextInterval = (pindexTip->GetBlockTime() / nModifierInterval + 1) * nModifierInterval;
+    BOOST_REQUIRE(nNextInterval - pindexTip->GetBlockTime() > 60);
+    pindexTip = chain.Extend(pindexTip, 1, 0, 60);
+    BOOST_CHECK(!pindexTip->GeneratedStakeModifier());
+    chainActive.SetTip(pindexTip);
+    CheckStakePlan(planner, 0x1e07fff8, pindexTip, mapCoins, nNow, nNow + 3600);
+
+    // A new tip generating a modifier, with the coins planned again
+    pindexTip = chain.Extend(pindexTip, 1, 0, nNextInterval - pindexTip->GetBlockTime());
+    BOOST_CHECK(pindexTip->GeneratedStakeModifier());
+    chainActive.SetTip(pindexTip);
+    nNow += 600;
+    CheckStakePlan(planner, 0x1e07fff8, pindexTip, mapCoins, nNow, nNow + 3600);
+
+    // A wallet change holds the plan off until the wallet is taken stock of again
+    planner.WalletChanged();
+    int64_t nNextHit;
+    BOOST_CHECK(!planner.NextHit(pindexTip, nNow, nNextHit));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
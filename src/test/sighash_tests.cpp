@@ -155,6 +155,8 @@ BOOST_AUTO_TEST_CASE(sighash_test)
         std::cout << "\n";
         #endif
         BOOST_CHECK(sh == sho);
+        const PrecomputedTransactionData txdata(txTo);
+        BOOST_CHECK(SignatureHash(scriptCode, txTo, nIn, nHashType, 0, SIGVERSION_BASE, &txdata) == sho);
     }
     #if defined(PRINT_SIGHASH_JSON)
     std::cout << "]\n";
@@ -206,6 +208,34 @@ BOOST_AUTO_TEST_CASE(sighash_from_data)
 
         sh = SignatureHash(scriptCode, *tx, nIn, nHashType, 0, SIGVERSION_BASE);
         BOOST_CHECK_MESSAGE(sh.GetHex() == sigHashHex, strTest);
+        const PrecomputedTransactionData txdata(*tx);
+        sh = SignatureHash(scriptCode, *tx, nIn, nHashType, 0, SIGVERSION_BASE, &txdata);
+        BOOST_CHECK_MESSAGE(sh.GetHex() == sigHashHex, strTest);
+    }
+}
+
+// Goal: check that the legacy midstates give the same hash for every input of a large transaction
+BOOST_AUTO_TEST_CASE(sighash_cached_many_inputs)
+{
+    SeedInsecureRand(false);
+
+    CMutableTransaction txTo;
+    RandomTransaction(txTo, false);
+    while (txTo.vin.size() < 200) {
+        txTo.vin.push_back(txTo.vin.back());
+        txTo.vin.back().prevout.hash = InsecureRand256();
+        txTo.vin.back().nSequence = InsecureRand32();
+        txTo.vout.push_back(txTo.vout.back());
+        txTo.vout.back().nValue = InsecureRandRange(100000000);
+    }
+    const PrecomputedTransactionData txdata(txTo);
+    for (unsigned int nIn = 0; nIn < txTo.vin.size(); nIn++) {
+        CScript scriptCode;
+        RandomScript(scriptCode);
+        for (int nHashType : std::vector<int>{SIGHASH_ALL, SIGHASH_NONE, SIGHASH_SINGLE, SIGHASH_ALL | SIGHASH_ANYONECANPAY, (int)InsecureRand32()}) {
+            uint256 sho = SignatureHashOld(scriptCode, txTo, nIn, nHashType);
+            BOOST_CHECK(SignatureHash(scriptCode, txTo, nIn, nHashType, 0, SIGVERSION_BASE, &txdata) == sho);
+        }
     }
 }
 BOOST_AUTO_TEST_SUITE_END()
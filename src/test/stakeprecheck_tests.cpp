@@ -0,0 +1,157 @@
+// Copyright (c) 2020 The Peercoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chain.h>
+#include <coins.h>
+#include <key.h>
+#include <keystore.h>
+#include <script/sign.h>
+#include <stakeprecheck.h>
+#include <validation.h>
+
+#include <test/test_bitcoin.h>
+
+#include <limits>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(stakeprecheck_tests, BasicTestingSetup)
+
+namespace {
+
+struct StakeBlock
+{
+    CBasicKeyStore keystore;
+    CKey key;
+    COutPoint prevoutKernel;
+    CTxOut txoutKernel;
+    std::shared_ptr<CBlock> pblock;
+
+    StakeBlock()
+    {
+        key.MakeNewKey(true);
+        keystore.AddKey(key);
+        prevoutKernel = COutPoint(InsecureRand256(), 0);
+        txoutKernel = CTxOut(100 * COIN, CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG);
+
+        CMutableTransaction txCoinBase;
+        txCoinBase.vin.resize(1);
+        txCoinBase.vin[0].prevout.SetNull();
+        txCoinBase.vout.resize(1);
+        txCoinBase.vout[0].SetEmpty();
+
+        CMutableTransaction txCoinStake;
+        txCoinStake.vin.emplace_back(prevoutKernel);
+        txCoinStake.vout.resize(2);
+        txCoinStake.vout[0].SetEmpty();
+        txCoinStake.vout[1] = CTxOut(101 * COIN, txoutKernel.scriptPubKey);
+        BOOST_REQUIRE(SignSignature(keystore, txoutKernel.scriptPubKey, txCoinStake, 0, txoutKernel.nValue, SIGHASH_ALL));
+
+        pblock = std::make_shared<CBlock>();
+        pblock->vtx.push_back(MakeTransactionRef(txCoinBase));
+        pblock->vtx.push_back(MakeTransactionRef(txCoinStake));
+        pblock->nTime = 1;
+        BOOST_REQUIRE(pblock->IsProofOfStake());
+        BOOST_REQUIRE(SignBlock(*pblock, keystore));
+    }
+
+    void AddKernel(CCoinsViewCache& view) const
+    {
+        view.AddCoin(prevoutKernel, Coin(txoutKernel, 1, false, false, 1), false);
+    }
+};
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(stakeprecheck_same_block)
+{
+    // The checks are only skipped for the very block that passed
+    StakeBlock stake;
+    CCoinsView viewDummy;
+    CCoinsViewCache view(&viewDummy);
+    stake.AddKernel(view);
+
+    std::shared_ptr<CStakePrecheck> pprecheck = CStakePrecheck::Make(stake.pblock, view);
+    BOOST_REQUIRE(pprecheck);
+    CBlockIndex index, indexOther;
+    StakePrecheckMap mapPrechecks;
+    mapPrechecks.emplace(&index, pprecheck);
+    BOOST_CHECK(StakePrecheckPassed(mapPrechecks, &index, *stake.pblock));
+
+    // Another block at the same height
+    BOOST_CHECK(!StakePrecheckPassed(mapPrechecks, &indexOther, *stake.pblock));
+    // A copy of the block, with the same hash but another block signature
+    CBlock blockCopy(*stake.pblock);
+    BOOST_CHECK(!StakePrecheckPassed(mapPrechecks, &index, blockCopy));
+    blockCopy.vchBlockSig.back() ^= 1;
+    BOOST_CHECK(blockCopy.GetHash() == stake.pblock->GetHash());
+    BOOST_CHECK(!StakePrecheckPassed(mapPrechecks, &index, blockCopy));
+}
+
+BOOST_AUTO_TEST_CASE(stakeprecheck_failed)
+{
+    CCoinsView viewDummy;
+    CCoinsViewCache view(&viewDummy);
+    CBlockIndex index;
+
+    // A bad block signature
+    {
+        StakeBlock stake;
+        stake.AddKernel(view);
+        stake.pblock->vchBlockSig.back() ^= 1;
+        StakePrecheckMap mapPrechecks;
+        mapPrechecks.emplace(&index, CStakePrecheck::Make(stake.pblock, view));
+        BOOST_REQUIRE(mapPrechecks[&index]);
+        BOOST_CHECK(!StakePrecheckPassed(mapPrechecks, &index, *stake.pblock));
+    }
+
+    // A bad coinstake signature, under a valid block signature
+    {
+        StakeBlock stake;
+        stake.AddKernel(view);
+        CMutableTransaction txCoinStake(*stake.pblock->vtx[1]);
+        CKey keyOther;
+        keyOther.MakeNewKey(true);
+        CBasicKeyStore keystoreOther;
+        keystoreOther.AddKey(keyOther);
+        const CScript scriptOther = CScript() << ToByteVector(keyOther.GetPubKey()) << OP_CHECKSIG;
+        BOOST_REQUIRE(SignSignature(keystoreOther, scriptOther, txCoinStake, 0, stake.txoutKernel.nValue, SIGHASH_ALL));
+        stake.pblock->vtx[1] = MakeTransactionRef(txCoinStake);
+        BOOST_REQUIRE(SignBlock(*stake.pblock, stake.keystore));
+        BOOST_REQUIRE(CheckBlockSignature(*stake.pblock));
+        StakePrecheckMap mapPrechecks;
+        mapPrechecks.emplace(&index, CStakePrecheck::Make(stake.pblock, view));
+        BOOST_REQUIRE(mapPrechecks[&index]);
+        BOOST_CHECK(!StakePrecheckPassed(mapPrechecks, &index, *stake.pblock));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(stakeprecheck_none)
+{
+    CCoinsView viewDummy;
+    CCoinsViewCache view(&viewDummy);
+
+    // The kernel coin is created within the precheck window
+    StakeBlock stake;
+    BOOST_CHECK(!CStakePrecheck::Make(stake.pblock, view));
+    stake.AddKernel(view);
+    BOOST_CHECK(CStakePrecheck::Make(stake.pblock, view));
+
+    // Proof-of-work blocks are only signed before the BIPs of Bitcoin 0.16
+    std::shared_ptr<CBlock> pblockWork = std::make_shared<CBlock>();
+    pblockWork->vtx.push_back(stake.pblock->vtx[0]);
+    BOOST_REQUIRE(pblockWork->IsProofOfWork());
+    pblockWork->nTime = std::numeric_limits<uint32_t>::max();
+    BOOST_CHECK(!CStakePrecheck::Make(pblockWork, view));
+    pblockWork->nTime = 1;
+    std::shared_ptr<CStakePrecheck> pprecheck = CStakePrecheck::Make(pblockWork, view);
+    BOOST_REQUIRE(pprecheck);
+    // Unsigned, and so not passed
+    StakePrecheckMap mapPrechecks;
+    CBlockIndex index;
+    mapPrechecks.emplace(&index, pprecheck);
+    BOOST_CHECK(!StakePrecheckPassed(mapPrechecks, &index, *pblockWork));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,299 @@
+// Copyright (c) 2020 The Peercoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chain.h>
+#include <chainparams.h>
+#include <hash.h>
+#include <kernel.h>
+#include <txdb.h>
+#include <util.h>
+#include <validation.h>
+
+#include <test/test_bitcoin.h>
+
+#include <deque>
+#include <map>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(txdb_tests, TestingSetup)
+
+namespace {
+
+//! Proof-of-stake block index entries on top of the genesis block
+struct SnapshotChain
+{
+    std::deque<uint256> vHash;
+    std::deque<CBlockIndex> vIndex;
+
+    explicit SnapshotChain(int nBlocks)
+    {
+        for (int i = 0; i < nBlocks; i++) {
+            vIndex.emplace_back();
+            CBlockIndex& index = vIndex.back();
+            index.nHeight = i + 1;
+            index.nFile = 0;
+            index.nDataPos = 1000 * (i + 1);
+            index.nUndoPos = 500 * (i + 1);
+            index.nVersion = 3;
+            index.hashMerkleRoot = InsecureRand256();
+            index.nTime = Params().GenesisBlock().nTime + 600 * (i + 1);
+            index.nBits = Params().GenesisBlock().nBits;
+            index.nNonce = InsecureRand32();
+            index.nStatus = BLOCK_VALID_TREE | BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO;
+            index.nTx = i + 2;
+            index.nMint = (i + 1) * COIN;
+            index.nMoneySupply = (i + 1) * 1000 * COIN;
+            index.SetProofOfStake();
+            index.SetStakeEntropyBit(i % 2);
+            index.SetStakeModifier(InsecureRandBits(64), i % 3 == 0);
+            index.hashProofOfStake = InsecureRand256();
+            index.SetStakeSource(COutPoint(InsecureRand256(), i), index.nTime - 1);
+        }
+    }
+
+    //! Link the entries to genesis and give them their hashes and stake modifier checksums
+    void Link(CBlockIndex* pindexGenesis)
+    {
+        vHash.clear();
+        CBlockIndex* pindexPrev = pindexGenesis;
+        for (CBlockIndex& index : vIndex) {
+            index.pprev = pindexPrev;
+            vHash.push_back(index.GetBlockHeader().GetHash());
+            index.phashBlock = &vHash.back();
+            index.nStakeModifierChecksum = GetStakeModifierChecksum(&index);
+            pindexPrev = &index;
+        }
+    }
+
+    std::vector<const CBlockIndex*> SortedByHeight() const
+    {
+        std::vector<const CBlockIndex*> vSorted(1, vIndex.front().pprev);
+        for (const CBlockIndex& index : vIndex)
+            vSorted.push_back(&index);
+        return vSorted;
+    }
+};
+
+//! The block index as loaded by a test, like mapBlockIndex
+struct LoadedIndex
+{
+    std::map<uint256, CBlockIndex> mapIndex;
+    std::vector<CBlockIndex*> vSortedByHeight;
+
+    CBlockIndex* Insert(const uint256& hash)
+    {
+        if (hash.IsNull())
+            return nullptr;
+        auto it = mapIndex.emplace(hash, CBlockIndex()).first;
+        it->second.phashBlock = &it->first;
+        return &it->second;
+    }
+
+    bool Load(CBlockTreeDB& db, const fs::path& path)
+    {
+        mapIndex.clear();
+        vSortedByHeight.clear();
+        return db.LoadBlockIndexSnapshot(path, [this](const uint256& hash) { return Insert(hash); }, vSortedByHeight);
+    }
+};
+
+void CheckSameIndex(const CBlockIndex& a, const CBlockIndex& b)
+{
+    BOOST_CHECK(a.GetBlockHash() == b.GetBlockHash());
+    BOOST_CHECK((a.pprev ? a.pprev->GetBlockHash() : uint256()) == (b.pprev ? b.pprev->GetBlockHash() : uint256()));
+    BOOST_CHECK_EQUAL(a.nHeight, b.nHeight);
+    BOOST_CHECK_EQUAL(a.nFile, b.nFile);
+    BOOST_CHECK_EQUAL(a.nDataPos, b.nDataPos);
+    BOOST_CHECK_EQUAL(a.nUndoPos, b.nUndoPos);
+    BOOST_CHECK_EQUAL(a.nStatus, b.nStatus);
+    BOOST_CHECK_EQUAL(a.nTx, b.nTx);
+    BOOST_CHECK_EQUAL(a.nVersion, b.nVersion);
+    BOOST_CHECK(a.hashMerkleRoot == b.hashMerkleRoot);
+    BOOST_CHECK_EQUAL(a.nTime, b.nTime);
+    BOOST_CHECK_EQUAL(a.nBits, b.nBits);
+    BOOST_CHECK_EQUAL(a.nNonce, b.nNonce);
+    BOOST_CHECK_EQUAL(a.nMint, b.nMint);
+    BOOST_CHECK_EQUAL(a.nMoneySupply, b.nMoneySupply);
+    BOOST_CHECK_EQUAL(a.nFlags, b.nFlags);
+    BOOST_CHECK_EQUAL(a.nStakeModifier, b.nStakeModifier);
+    BOOST_CHECK_EQUAL(a.nStakeModifierChecksum, b.nStakeModifierChecksum);
+    BOOST_CHECK(a.hashProofOfStake == b.hashProofOfStake);
+    COutPoint prevoutA, prevoutB;
+    unsigned int nTimeA, nTimeB;
+    a.GetStakeSource(prevoutA, nTimeA);
+    b.GetStakeSource(prevoutB, nTimeB);
+    BOOST_CHECK(prevoutA == prevoutB);
+    BOOST_CHECK_EQUAL(nTimeA, nTimeB);
+}
+
+std::vector<unsigned char> ReadSnapshot(const fs::path& path)
+{
+    std::vector<unsigned char> vData(fs::file_size(path));
+    FILE* file = fsbridge::fopen(path, "rb");
+    BOOST_REQUIRE(file);
+    BOOST_REQUIRE_EQUAL(fread(vData.data(), 1, vData.size(), file), vData.size());
+    fclose(file);
+    return vData;
+}
+
+//! Write a snapshot file, with a checksum matching its content
+void WriteSnapshot(const fs::path& path, std::vector<unsigned char> vData)
+{
+    vData.resize(vData.size() - sizeof(uint256));
+    uint256 checksum = Hash(vData.begin(), vData.end());
+    vData.insert(vData.end(), checksum.begin(), checksum.end());
+    FILE* file = fsbridge::fopen(path, "wb");
+    BOOST_REQUIRE(file);
+    BOOST_REQUIRE_EQUAL(fwrite(vData.data(), 1, vData.size(), file), vData.size());
+    fclose(file);
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(blockindex_snapshot_roundtrip)
+{
+    CBlockTreeDB db(1 << 20, true);
+    CBlockFileInfo info;
+    info.AddBlock(1, Params().GenesisBlock().nTime);
+    BOOST_REQUIRE(db.WriteBatchSync({std::make_pair(0, &info)}, 0, {}));
+
+    SnapshotChain chain(10);
+    chain.Link(chainActive.Genesis());
+    const std::vector<const CBlockIndex*> vSorted = chain.SortedByHeight();
+    const fs::path path = GetDataDir() / "snapshot.dat";
+    BOOST_REQUIRE(db.WriteBlockIndexSnapshot(path, vSorted));
+
+    LoadedIndex loaded;
+    BOOST_REQUIRE(loaded.Load(db, path));
+    BOOST_REQUIRE_EQUAL(loaded.vSortedByHeight.size(), vSorted.size());
+    BOOST_CHECK_EQUAL(loaded.mapIndex.size(), vSorted.size());
+    for (size_t i = 0; i < vSorted.size(); i++) {
+        const CBlockIndex* pindex = loaded.vSortedByHeight[i];
+        CheckSameIndex(*pindex, *vSorted[i]);
+        BOOST_CHECK(pindex->pprev == (i ? loaded.vSortedByHeight[i - 1] : nullptr));
+    }
+
+    // Still current when loaded again
+    BOOST_CHECK(loaded.Load(db, path));
+}
+
+BOOST_AUTO_TEST_CASE(blockindex_snapshot_outdated)
+{
+    CBlockTreeDB db(1 << 20, true);
+    CBlockFileInfo info;
+    info.AddBlock(1, Params().GenesisBlock().nTime);
+    BOOST_REQUIRE(db.WriteBatchSync({std::make_pair(0, &info)}, 0, {}));
+
+    SnapshotChain chain(5);
+    chain.Link(chainActive.Genesis());
+    const fs::path path = GetDataDir() / "snapshot.dat";
+    LoadedIndex loaded;
+
+    // Any flush of the block index erases the token
+    BOOST_REQUIRE(db.WriteBlockIndexSnapshot(path, chain.SortedByHeight()));
+    BOOST_REQUIRE(loaded.Load(db, path));
+    BOOST_REQUIRE(db.WriteBatchSync({}, 0, {&chain.vIndex.back()}));
+    BOOST_CHECK(!loaded.Load(db, path));
+
+    // The last block file changed, under the current token
+    BOOST_REQUIRE(db.WriteBlockIndexSnapshot(path, chain.SortedByHeight()));
+    std::vector<unsigned char> vOld = ReadSnapshot(path);
+    info.AddBlock(2, info.nTimeLast + 600);
+    BOOST_REQUIRE(db.WriteBatchSync({std::make_pair(0, &info)}, 0, {}));
+    BOOST_REQUIRE(db.WriteBlockIndexSnapshot(path, chain.SortedByHeight()));
+    std::vector<unsigned char> vNew = ReadSnapshot(path);
+    // The version is followed by the token
+    std::copy(vNew.begin() + sizeof(uint64_t), vNew.begin() + sizeof(uint64_t) + sizeof(uint256), vOld.begin() + sizeof(uint64_t));
+    WriteSnapshot(path, vOld);
+    BOOST_CHECK(!loaded.Load(db, path));
+    WriteSnapshot(path, vNew);
+    BOOST_CHECK(loaded.Load(db, path));
+
+    // A damaged file
+    vNew[vNew.size() / 2] ^= 1;
+    FILE* file = fsbridge::fopen(path, "wb");
+    BOOST_REQUIRE(file);
+    fwrite(vNew.data(), 1, vNew.size(), file);
+    fclose(file);
+    BOOST_CHECK(!loaded.Load(db, path));
+
+    // No file at all
+    fs::remove(path);
+    BOOST_CHECK(!loaded.Load(db, path));
+}
+
+BOOST_AUTO_TEST_CASE(blockindex_snapshot_mismatch)
+{
+    // A snapshot that is current, but whose entries do not add up, is
+    // replaced by the block index in the database
+    LOCK(cs_main);
+    FlushStateToDisk();
+    SnapshotChain chain(5);
+    chain.Link(chainActive.Genesis());
+    std::vector<const CBlockIndex*> vBlockInfo(chain.vIndex.size());
+    for (size_t i = 0; i < chain.vIndex.size(); i++)
+        vBlockInfo[i] = &chain.vIndex[i];
+    int nLastFile = 0;
+    BOOST_REQUIRE(pblocktree->ReadLastBlockFile(nLastFile));
+    BOOST_REQUIRE(pblocktree->WriteBatchSync({}, nLastFile, vBlockInfo));
+    const CBlockIndex& indexLast = chain.vIndex.back();
+    const fs::path path = GetDataDir() / "blockindex.dat";
+
+    auto reload = [&chain]() {
+        UnloadBlockIndex();
+        BOOST_REQUIRE(LoadBlockIndex(Params()));
+        BOOST_REQUIRE_EQUAL(mapBlockIndex.size(), chain.vIndex.size() + 1);
+        BlockMap::iterator it = mapBlockIndex.find(Params().GetConsensus().hashGenesisBlock);
+        BOOST_REQUIRE(it != mapBlockIndex.end());
+        chain.Link(it->second);
+        for (const CBlockIndex& index : chain.vIndex) {
+            it = mapBlockIndex.find(index.GetBlockHash());
+            BOOST_REQUIRE(it != mapBlockIndex.end());
+            CheckSameIndex(*it->second, index);
+        }
+    };
+
+    BOOST_REQUIRE(pblocktree->WriteBlockIndexSnapshot(path, chain.SortedByHeight()));
+    reload();
+
+    // Another stake modifier checksum
+    {
+        CBlockIndex indexBad(indexLast);
+        COutPoint prevoutStake;
+        unsigned int nStakeTime;
+        indexLast.GetStakeSource(prevoutStake, nStakeTime);
+        indexBad.SetStakeSource(prevoutStake, nStakeTime);
+        indexBad.nStakeModifierChecksum ^= 1;
+        std::vector<const CBlockIndex*> vSorted = chain.SortedByHeight();
+        vSorted.back() = &indexBad;
+        BOOST_REQUIRE(pblocktree->WriteBlockIndexSnapshot(path, vSorted));
+        reload();
+    }
+
+    // Another height, which the checksum does not cover
+    {
+        CBlockIndex indexBad(indexLast);
+        COutPoint prevoutStake;
+        unsigned int nStakeTime;
+        indexLast.GetStakeSource(prevoutStake, nStakeTime);
+        indexBad.SetStakeSource(prevoutStake, nStakeTime);
+        indexBad.nHeight++;
+        BOOST_REQUIRE_EQUAL(GetStakeModifierChecksum(&indexBad), indexLast.nStakeModifierChecksum);
+        std::vector<const CBlockIndex*> vSorted = chain.SortedByHeight();
+        vSorted.back() = &indexBad;
+        BOOST_REQUIRE(pblocktree->WriteBlockIndexSnapshot(path, vSorted));
+        reload();
+    }
+
+    // An entry missing, but still referred to by the next one
+    {
+        std::vector<const CBlockIndex*> vSorted = chain.SortedByHeight();
+        vSorted.erase(vSorted.begin() + 2);
+        BOOST_REQUIRE(pblocktree->WriteBlockIndexSnapshot(path, vSorted));
+        reload();
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
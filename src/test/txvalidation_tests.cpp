@@ -8,6 +8,9 @@
 #include <consensus/validation.h>
 #include <primitives/transaction.h>
 #include <script/script.h>
+#include <script/sign.h>
+#include <keystore.h>
+#include <coins.h>
 #include <test/test_bitcoin.h>
 
 #include <boost/test/unit_test.hpp>
@@ -42,9 +45,7 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_reject_coinbase, TestChain100Setup)
             false,
             AcceptToMemoryPool(mempool, state, MakeTransactionRef(coinbaseTx),
                 nullptr /* pfMissingInputs */,
-                nullptr /* plTxnReplaced */,
-                true /* bypass_limits */,
-                0 /* nAbsurdFee */));
+                true /* bypass_limits */));
 
     // Check that the transaction hasn't been added to mempool.
     BOOST_CHECK_EQUAL(mempool.size(), initialPoolSize);
@@ -58,4 +59,78 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_reject_coinbase, TestChain100Setup)
     BOOST_CHECK_EQUAL(nDoS, 100);
 }
 
+/**
+ * Ensure that the script checks of a transaction with many inputs, run on
+ * the script check threads, reject it just like the inline checks do.
+ */
+BOOST_FIXTURE_TEST_CASE(tx_mempool_parallel_inputs, TestingSetup)
+{
+    CKey key, keyOther;
+    key.MakeNewKey(true);
+    keyOther.MakeNewKey(true);
+    CBasicKeyStore keystore, keystoreOther;
+    keystore.AddKey(key);
+    keystoreOther.AddKey(keyOther);
+    CScript scriptPubKey = CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
+    const unsigned int nInputs = MIN_PARALLEL_MEMPOOL_INPUTS + 2;
+
+    LOCK(cs_main);
+
+    // Two sets of confirmed coins to spend
+    CMutableTransaction txFrom;
+    txFrom.vin.resize(1);
+    txFrom.vin[0].prevout = COutPoint(InsecureRand256(), 0);
+    txFrom.vout.resize(2 * nInputs);
+    for (CTxOut& txout : txFrom.vout) {
+        txout.nValue = 1 * COIN;
+        txout.scriptPubKey = scriptPubKey;
+    }
+    txFrom.nTime -= 60;
+    AddCoins(*pcoinsTip, txFrom, 0);
+
+    auto spend = [&](unsigned int nFirst) {
+        CMutableTransaction tx;
+        for (unsigned int i = 0; i < nInputs; i++)
+            tx.vin.emplace_back(COutPoint(txFrom.GetHash(), nFirst + i));
+        tx.vout.emplace_back((nInputs - 1) * COIN, scriptPubKey);
+        for (unsigned int i = 0; i < nInputs; i++)
+            BOOST_CHECK(SignSignature(keystore, txFrom, tx, i, SIGHASH_ALL));
+        return tx;
+    };
+
+    // One bad signature among the inputs: a valid one, but by another key
+    CMutableTransaction txBad = spend(0);
+    {
+        CMutableTransaction txOther(txBad);
+        CScript scriptOther = CScript() << ToByteVector(keyOther.GetPubKey()) << OP_CHECKSIG;
+        BOOST_CHECK(SignSignature(keystoreOther, scriptOther, txOther, nInputs / 2, 1 * COIN, SIGHASH_ALL));
+        txBad.vin[nInputs / 2].scriptSig = txOther.vin[nInputs / 2].scriptSig;
+    }
+
+    BOOST_REQUIRE(nScriptCheckThreads > 0);
+    CValidationState stateParallel;
+    BOOST_CHECK(!AcceptToMemoryPool(mempool, stateParallel, MakeTransactionRef(txBad), nullptr, true));
+    const int nScriptCheckThreadsSaved = nScriptCheckThreads;
+    nScriptCheckThreads = 0;
+    CValidationState stateInline;
+    BOOST_CHECK(!AcceptToMemoryPool(mempool, stateInline, MakeTransactionRef(txBad), nullptr, true));
+    nScriptCheckThreads = nScriptCheckThreadsSaved;
+
+    int nDoSParallel, nDoSInline;
+    BOOST_CHECK(stateParallel.IsInvalid(nDoSParallel));
+    BOOST_CHECK(stateInline.IsInvalid(nDoSInline));
+    BOOST_CHECK_EQUAL(stateParallel.GetRejectReason(), stateInline.GetRejectReason());
+    BOOST_CHECK_EQUAL(stateParallel.GetRejectCode(), stateInline.GetRejectCode());
+    BOOST_CHECK_EQUAL(nDoSParallel, nDoSInline);
+    BOOST_CHECK(stateParallel.GetRejectReason().find("script-verify-flag") != std::string::npos);
+    BOOST_CHECK(!mempool.exists(txBad.GetHash()));
+
+    // A valid transaction of the same size
+    CMutableTransaction txGood = spend(nInputs);
+    CValidationState state;
+    BOOST_CHECK(AcceptToMemoryPool(mempool, state, MakeTransactionRef(txGood), nullptr, true));
+    BOOST_CHECK(state.IsValid());
+    BOOST_CHECK(mempool.exists(txGood.GetHash()));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
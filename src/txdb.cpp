@@ -16,6 +16,8 @@
 
 #include <stdint.h>
 
+#include <future>
+
 #include <boost/thread.hpp>
 
 static const char DB_COIN = 'C';
@@ -29,6 +31,13 @@ static const char DB_HEAD_BLOCKS = 'H';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_KERNEL_INDEX = 'K';
+static const char DB_BLOCK_INDEX_SNAPSHOT = 'S';
+
+//! Version of the block index snapshot file format
+static const uint64_t BLOCK_INDEX_SNAPSHOT_VERSION = 1;
+//! Number of block index entries read from the database at a time
+static const size_t BLOCK_INDEX_LOAD_BATCH = 4096;
 
 namespace {
 
@@ -82,9 +91,19 @@ std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const {
 }
 
 bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    return WriteCoins(mapCoins, hashBlock, true, nullptr, nullptr);
+}
+
+bool CCoinsViewDB::WriteSnapshot(const CCoinsMap &mapCoins, const uint256 &hashBlock, size_t &nChanged, size_t &nBytes) {
+    // Nothing is erased from the map without fErase
+    return WriteCoins(const_cast<CCoinsMap&>(mapCoins), hashBlock, false, &nChanged, &nBytes);
+}
+
+bool CCoinsViewDB::WriteCoins(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase, size_t *pnChanged, size_t *pnBytes) {
     CDBBatch batch(db);
     size_t count = 0;
     size_t changed = 0;
+    size_t written = 0;
     size_t batch_size = (size_t)gArgs.GetArg("-dbbatchsize", nDefaultDbBatchSize);
     int crash_simulate = gArgs.GetArg("-dbcrashratio", 0);
     assert(!hashBlock.IsNull());
@@ -116,10 +135,15 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+        if (fErase) {
+            CCoinsMap::iterator itOld = it++;
+            mapCoins.erase(itOld);
+        } else {
+            ++it;
+        }
         if (batch.SizeEstimate() > batch_size) {
             LogPrint(BCLog::COINDB, "Writing partial batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
+            written += batch.SizeEstimate();
             db.WriteBatch(batch);
             batch.Clear();
             if (crash_simulate) {
@@ -137,8 +161,13 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     batch.Write(DB_BEST_BLOCK, hashBlock);
 
     LogPrint(BCLog::COINDB, "Writing final batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
+    written += batch.SizeEstimate();
     bool ret = db.WriteBatch(batch);
     LogPrint(BCLog::COINDB, "Committed %u changed transaction outputs (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
+    if (pnChanged)
+        *pnChanged = changed;
+    if (pnBytes)
+        *pnBytes = written;
     return ret;
 }
 
@@ -147,6 +176,24 @@ size_t CCoinsViewDB::EstimateSize() const
     return db.EstimateSize(DB_COIN, (char)(DB_COIN+1));
 }
 
+bool CCoinsViewDB::ReadKernelIndex(const uint256 &txid, CKernelIndexEntry &entry) const {
+    return db.Read(std::make_pair(DB_KERNEL_INDEX, txid), entry);
+}
+
+bool CCoinsViewDB::WriteKernelIndex(const std::vector<std::pair<uint256, CKernelIndexEntry> > &vect) {
+    CDBBatch batch(db);
+    for (const auto& item : vect)
+        batch.Write(std::make_pair(DB_KERNEL_INDEX, item.first), item.second);
+    return db.WriteBatch(batch);
+}
+
+bool CCoinsViewDB::EraseKernelIndex(const std::vector<uint256> &vTxid) {
+    CDBBatch batch(db);
+    for (const uint256& txid : vTxid)
+        batch.Erase(std::make_pair(DB_KERNEL_INDEX, txid));
+    return db.WriteBatch(batch);
+}
+
 CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
 }
 
@@ -226,6 +273,8 @@ void CCoinsViewDBCursor::Next()
 
 bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo) {
     CDBBatch batch(*this);
+    // Any change to the block index outdates the snapshot
+    batch.Erase(DB_BLOCK_INDEX_SNAPSHOT);
     for (std::vector<std::pair<int, const CBlockFileInfo*> >::const_iterator it=fileInfo.begin(); it != fileInfo.end(); it++) {
         batch.Write(std::make_pair(DB_BLOCK_FILES, it->first), *it->second);
     }
@@ -259,58 +308,180 @@ bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
     return true;
 }
 
+// Fill in a block index object read back from disk
+static void LoadDiskBlockIndex(const CDiskBlockIndex& diskindex, CBlockIndex* pindexNew, std::function<CBlockIndex*(const uint256&)>& insertBlockIndex)
+{
+    pindexNew->pprev          = insertBlockIndex(diskindex.hashPrev);
+    pindexNew->nHeight        = diskindex.nHeight;
+    pindexNew->nFile          = diskindex.nFile;
+    pindexNew->nDataPos       = diskindex.nDataPos;
+    pindexNew->nUndoPos       = diskindex.nUndoPos;
+    pindexNew->nVersion       = diskindex.nVersion;
+    pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+    pindexNew->nTime          = diskindex.nTime;
+    pindexNew->nBits          = diskindex.nBits;
+    pindexNew->nNonce         = diskindex.nNonce;
+    pindexNew->nStatus        = diskindex.nStatus;
+    pindexNew->nTx            = diskindex.nTx;
+
+     // peercoin related block index fields
+    pindexNew->nMint          = diskindex.nMint;
+    pindexNew->nMoneySupply   = diskindex.nMoneySupply;
+    pindexNew->nFlags         = diskindex.nFlags;
+    pindexNew->nStakeModifier = diskindex.nStakeModifier;
+    pindexNew->hashProofOfStake = diskindex.hashProofOfStake;
+    if (diskindex.IsProofOfStake())
+        pindexNew->SetStakeSource(diskindex.prevoutStake, diskindex.nStakeTime);
+}
+
 bool CBlockTreeDB::LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex)
 {
     std::unique_ptr<CDBIterator> pcursor(NewIterator());
 
     pcursor->Seek(std::make_pair(DB_BLOCK_INDEX, uint256()));
 
-    // Load mapBlockIndex
-    while (pcursor->Valid()) {
+    // Load mapBlockIndex. Entries are read in batches: the block hashes and
+    // proof-of-work of a batch are checked on another thread while the next
+    // batch is read, and then the batch is linked into the index.
+    std::vector<CDiskBlockIndex> vRead, vHashing;
+    std::vector<uint256> vHash;
+    std::future<int> hashing;
+    auto hashBatch = [&consensusParams](const std::vector<CDiskBlockIndex>& vIndex, std::vector<uint256>& vHashOut) {
+        vHashOut.resize(vIndex.size());
+        for (size_t i = 0; i < vIndex.size(); i++) {
+            vHashOut[i] = vIndex[i].GetBlockHash();
+            if (vIndex[i].IsProofOfWork() && !CheckProofOfWork(vHashOut[i], vIndex[i].nBits, consensusParams))
+                return (int)i;
+        }
+        return -1;
+    };
+    while (true) {
         boost::this_thread::interruption_point();
-        std::pair<char, uint256> key;
-        if (pcursor->GetKey(key) && key.first == DB_BLOCK_INDEX) {
-            CDiskBlockIndex diskindex;
-            if (pcursor->GetValue(diskindex)) {
-                // Construct block index object
-                CBlockIndex* pindexNew = insertBlockIndex(diskindex.GetBlockHash());
-                pindexNew->pprev          = insertBlockIndex(diskindex.hashPrev);
-                pindexNew->nHeight        = diskindex.nHeight;
-                pindexNew->nFile          = diskindex.nFile;
-                pindexNew->nDataPos       = diskindex.nDataPos;
-                pindexNew->nUndoPos       = diskindex.nUndoPos;
-                pindexNew->nVersion       = diskindex.nVersion;
-                pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
-                pindexNew->nTime          = diskindex.nTime;
-                pindexNew->nBits          = diskindex.nBits;
-                pindexNew->nNonce         = diskindex.nNonce;
-                pindexNew->nStatus        = diskindex.nStatus;
-                pindexNew->nTx            = diskindex.nTx;
-
-                 // peercoin related block index fields
-                pindexNew->nMint          = diskindex.nMint;
-                pindexNew->nMoneySupply   = diskindex.nMoneySupply;
-                pindexNew->nFlags         = diskindex.nFlags;
-                pindexNew->nStakeModifier = diskindex.nStakeModifier;
-                pindexNew->prevoutStake   = diskindex.prevoutStake;
-                pindexNew->nStakeTime     = diskindex.nStakeTime;
-                pindexNew->hashProofOfStake = diskindex.hashProofOfStake;
-
-                if (pindexNew->IsProofOfWork() && !CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits, consensusParams))
-                    return error("%s: CheckProofOfWork failed: %s", __func__, pindexNew->ToString());
-
-                pcursor->Next();
-            } else {
+        while (vRead.size() < BLOCK_INDEX_LOAD_BATCH) {
+            std::pair<char, uint256> key;
+            if (!pcursor->Valid() || !pcursor->GetKey(key) || key.first != DB_BLOCK_INDEX)
+                break;
+            vRead.emplace_back();
+            if (!pcursor->GetValue(vRead.back()))
                 return error("%s: failed to read value", __func__);
+            pcursor->Next();
+        }
+
+        if (hashing.valid()) {
+            int nFailed = hashing.get();
+            if (nFailed >= 0)
+                return error("%s: CheckProofOfWork failed: %s", __func__, vHashing[nFailed].ToString());
+            for (size_t i = 0; i < vHashing.size(); i++) {
+                // Construct block index object
+                CBlockIndex* pindexNew = insertBlockIndex(vHash[i]);
+                LoadDiskBlockIndex(vHashing[i], pindexNew, insertBlockIndex);
             }
-        } else {
-            break;
         }
+        if (vRead.empty())
+            break;
+
+        std::swap(vRead, vHashing);
+        vRead.clear();
+        hashing = std::async(std::launch::async, hashBatch, std::cref(vHashing), std::ref(vHash));
     }
 
     return true;
 }
 
+bool CBlockTreeDB::WriteBlockIndexSnapshot(const fs::path& path, const std::vector<const CBlockIndex*>& vSortedByHeight)
+{
+    // The snapshot is matched to the database by a random token, and by the
+    // state of the last block file as another check it is still current
+    uint256 token = GetRandHash();
+    int nLastFile = 0;
+    CBlockFileInfo infoLastFile;
+    if (!ReadLastBlockFile(nLastFile) || !ReadBlockFileInfo(nLastFile, infoLastFile))
+        return false;
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << BLOCK_INDEX_SNAPSHOT_VERSION << token << nLastFile << SerializeHash(infoLastFile);
+    ss << (uint64_t)vSortedByHeight.size();
+    for (const CBlockIndex* pindex : vSortedByHeight)
+        ss << pindex->GetBlockHash() << CDiskBlockIndex(pindex) << pindex->nStakeModifierChecksum;
+    ss << Hash(ss.begin(), ss.end());
+
+    fs::path pathTmp = path;
+    pathTmp += ".new";
+    FILE* file = fsbridge::fopen(pathTmp, "wb");
+    if (!file)
+        return false;
+    bool fWritten = fwrite(ss.data(), 1, ss.size(), file) == ss.size();
+    if (fWritten)
+        FileCommit(file);
+    fclose(file);
+    if (!fWritten || !RenameOver(pathTmp, path))
+        return false;
+    return Write(DB_BLOCK_INDEX_SNAPSHOT, token, true);
+}
+
+bool CBlockTreeDB::LoadBlockIndexSnapshot(const fs::path& path, std::function<CBlockIndex*(const uint256&)> insertBlockIndex, std::vector<CBlockIndex*>& vSortedByHeight)
+{
+    uint256 tokenDB;
+    if (!Read(DB_BLOCK_INDEX_SNAPSHOT, tokenDB))
+        return false;
+
+    // Read the whole file at once
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    FILE* file = fsbridge::fopen(path, "rb");
+    if (!file)
+        return false;
+    boost::system::error_code ec;
+    uintmax_t nSize = fs::file_size(path, ec);
+    if (!ec && nSize > sizeof(uint256)) {
+        ss.resize(nSize);
+        if (fread(ss.data(), 1, nSize, file) != nSize)
+            ss.clear();
+    }
+    fclose(file);
+    if (ss.size() <= sizeof(uint256))
+        return error("%s: failed to read %s", __func__, path.string());
+    uint256 checksum;
+    memcpy(checksum.begin(), ss.data() + ss.size() - sizeof(uint256), sizeof(uint256));
+    ss.resize(ss.size() - sizeof(uint256));
+    if (Hash(ss.begin(), ss.end()) != checksum)
+        return error("%s: checksum mismatch in %s", __func__, path.string());
+
+    try {
+        uint64_t nVersion;
+        uint256 token, hashLastFile;
+        int nLastFile = 0, nLastFileDB = 0;
+        CBlockFileInfo infoLastFileDB;
+        ss >> nVersion;
+        if (nVersion != BLOCK_INDEX_SNAPSHOT_VERSION)
+            return false;
+        ss >> token >> nLastFile >> hashLastFile;
+        if (token != tokenDB || !ReadLastBlockFile(nLastFileDB) || nLastFile != nLastFileDB ||
+            !ReadBlockFileInfo(nLastFileDB, infoLastFileDB) || SerializeHash(infoLastFileDB) != hashLastFile)
+            return false;
+
+        uint64_t nEntries;
+        ss >> nEntries;
+        vSortedByHeight.reserve(nEntries);
+        for (uint64_t i = 0; i < nEntries; i++) {
+            if (i % BLOCK_INDEX_LOAD_BATCH == 0)
+                boost::this_thread::interruption_point();
+            uint256 hash;
+            CDiskBlockIndex diskindex;
+            unsigned int nStakeModifierChecksum;
+            ss >> hash >> diskindex >> nStakeModifierChecksum;
+            CBlockIndex* pindexNew = insertBlockIndex(hash);
+            LoadDiskBlockIndex(diskindex, pindexNew, insertBlockIndex);
+            pindexNew->nStakeModifierChecksum = nStakeModifierChecksum;
+            vSortedByHeight.push_back(pindexNew);
+        }
+        if (!ss.empty())
+            return error("%s: trailing data in %s", __func__, path.string());
+    } catch (const std::exception& e) {
+        return error("%s: deserialize error in %s: %s", __func__, path.string(), e.what());
+    }
+    return true;
+}
+
 namespace {
 
 //! Legacy class to deserialize pre-pertxout database entries without reindex.
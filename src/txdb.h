@@ -9,6 +9,7 @@
 #include <coins.h>
 #include <dbwrapper.h>
 #include <chain.h>
+#include <fs.h>
 
 #include <map>
 #include <memory>
@@ -64,11 +65,38 @@ struct CDiskTxPos : public CDiskBlockPos
     }
 };
 
+/** peercoin: where a transaction sits in the block that connected it, as
+ *  hashed into the stake kernels of its outputs. Kept in the chainstate so
+ *  that checking a coinstake needs neither the transaction index nor the
+ *  block files. */
+struct CKernelIndexEntry
+{
+    int nHeight;
+    uint256 hashBlock; // entries may outlive their block after a crash, so this tells whether it is still active
+    unsigned int nTxOffset; // header included
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(VARINT(nHeight));
+        READWRITE(hashBlock);
+        READWRITE(VARINT(nTxOffset));
+    }
+
+    CKernelIndexEntry(int nHeightIn, const uint256& hashBlockIn, unsigned int nTxOffsetIn) : nHeight(nHeightIn), hashBlock(hashBlockIn), nTxOffset(nTxOffsetIn) {}
+
+    CKernelIndexEntry() : nHeight(0), nTxOffset(0) {}
+};
+
 /** CCoinsView backed by the coin database (chainstate/) */
 class CCoinsViewDB final : public CCoinsView
 {
 protected:
     CDBWrapper db;
+
+    //! Write the dirty entries of mapCoins, erasing all of them from it if fErase
+    bool WriteCoins(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fErase, size_t *pnChanged, size_t *pnBytes);
 public:
     explicit CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
@@ -78,9 +106,16 @@ public:
     std::vector<uint256> GetHeadBlocks() const override;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
     CCoinsViewCursor *Cursor() const override;
+    //! Like BatchWrite(), but leaves mapCoins alone so that others can read it meanwhile.
+    //! Reports the number of coins changed and the bytes written.
+    bool WriteSnapshot(const CCoinsMap &mapCoins, const uint256 &hashBlock, size_t &nChanged, size_t &nBytes);
 
     //! Attempt to update from an older database format. Returns whether an error occurred.
     bool Upgrade();
+    //! peercoin: kernel index entry of a transaction, written when a block containing it is connected and erased when it is disconnected
+    bool ReadKernelIndex(const uint256 &txid, CKernelIndexEntry &entry) const;
+    bool WriteKernelIndex(const std::vector<std::pair<uint256, CKernelIndexEntry> > &vect);
+    bool EraseKernelIndex(const std::vector<uint256> &vTxid);
     size_t EstimateSize() const override;
 };
 
@@ -125,6 +160,12 @@ public:
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
     bool LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex);
+    /** Write the whole block index, ordered by height, to a snapshot file for
+     *  a faster next startup. Only valid until the block index changes. */
+    bool WriteBlockIndexSnapshot(const fs::path& path, const std::vector<const CBlockIndex*>& vSortedByHeight);
+    /** Load a snapshot written by WriteBlockIndexSnapshot, if it still matches
+     *  the database. The stake modifier checksums are read, not verified. */
+    bool LoadBlockIndexSnapshot(const fs::path& path, std::function<CBlockIndex*(const uint256&)> insertBlockIndex, std::vector<CBlockIndex*>& vSortedByHeight);
 
     bool ReadSyncCheckpoint(uint256& hashCheckpoint);
     bool WriteSyncCheckpoint(uint256 hashCheckpoint);
@@ -34,6 +34,10 @@
 #include <sys/resource.h>
 #include <sys/stat.h>
 
+#ifdef __linux__
+#include <sched.h>
+#endif
+
 #else
 
 #ifdef _MSC_VER
@@ -894,6 +898,22 @@ void RenameThread(const char* name)
 #endif
 }
 
+bool PinThreadToCPU(int nCPU)
+{
+#if defined(__linux__) && defined(CPU_SET)
+    if (nCPU < 0 || nCPU >= CPU_SETSIZE)
+        return false;
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(nCPU, &cpuset);
+    return sched_setaffinity(0, sizeof(cpuset), &cpuset) == 0;
+#else
+    // Prevent warnings for unused parameters...
+    (void)nCPU;
+    return false;
+#endif
+}
+
 void SetupEnvironment()
 {
 #ifdef HAVE_MALLOPT_ARENA_MAX
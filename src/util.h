@@ -312,6 +312,9 @@ int GetNumCores();
 
 void RenameThread(const char* name);
 
+/** Run the calling thread on CPU nCPU only. Returns false where that is not supported. */
+bool PinThreadToCPU(int nCPU);
+
 /**
  * .. and a wrapper that just calls func once
  */
@@ -6,17 +6,23 @@
 #include <validation.h>
 
 #include <arith_uint256.h>
+#include <blockfilereader.h>
+#include <blockimport.h>
 #include <chain.h>
 #include <chainparams.h>
 #include <checkpoints.h>
 #include <checkqueue.h>
+#include <coinsflush.h>
+#include <coinsprefetch.h>
 #include <consensus/consensus.h>
 #include <consensus/merkle.h>
 #include <consensus/tx_verify.h>
 #include <consensus/validation.h>
+#include <crypto/common.h>
 #include <cuckoocache.h>
 #include <hash.h>
 #include <init.h>
+#include <memusage.h>
 #include <policy/policy.h>
 #include <pow.h>
 #include <primitives/block.h>
@@ -26,6 +32,7 @@
 #include <script/script.h>
 #include <script/sigcache.h>
 #include <script/standard.h>
+#include <stakeprecheck.h>
 #include <timedata.h>
 #include <tinyformat.h>
 #include <txdb.h>
@@ -39,12 +46,15 @@
 #include <warnings.h>
 
 #include <kernel.h>
-#include <bignum.h>
 #include <checkpointsync.h>
 #include <keystore.h>
 
+#include <atomic>
+#include <deque>
 #include <future>
 #include <sstream>
+#include <thread>
+#include <unordered_map>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/algorithm/string/join.hpp>
@@ -81,7 +91,6 @@ namespace {
             return false;
         }
     };
-    uint256 vStakeSeen[1024];
 } // anon namespace
 
 enum DisconnectResult
@@ -154,6 +163,12 @@ private:
      */
     CCriticalSection m_cs_chainstate;
 
+    /**
+     * peercoin: the signature checks of blocks about to be connected, queued
+     * for the stake precheck threads during initial block download.
+     */
+    StakePrecheckMap mapStakePrechecks;
+
 public:
     CChain chainActive;
     BlockMap mapBlockIndex;
@@ -189,6 +204,8 @@ public:
 private:
     bool ActivateBestChainStep(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexMostWork, const std::shared_ptr<const CBlock>& pblock, bool& fInvalidFound, ConnectTrace& connectTrace);
     bool ConnectTip(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexNew, const std::shared_ptr<const CBlock>& pblock, ConnectTrace& connectTrace, DisconnectedBlockTransactions &disconnectpool);
+    void PrecheckStake(const std::vector<CBlockIndex*>& vpindexToConnect, const Consensus::Params& consensusParams);
+    void PrefetchInputs(std::vector<CBlockIndex*>::const_reverse_iterator itNext, std::vector<CBlockIndex*>::const_reverse_iterator itEnd, const std::shared_ptr<const CBlock>& pblock, const Consensus::Params& consensusParams);
 
     CBlockIndex* AddToBlockIndex(const CBlockHeader& block, bool fSetAsProofOfstake);
     /** Create a new block index entry for a given block hash */
@@ -222,6 +239,7 @@ bool fRequireStandard = true;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
 size_t nCoinCacheUsage = 5000 * 300;
+bool fBackgroundFlush = DEFAULT_BACKGROUND_FLUSH;
 bool fAlerts = DEFAULT_ALERTS;
 int64_t nMaxTipAge = DEFAULT_MAX_TIP_AGE;
 
@@ -273,6 +291,7 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 std::unique_ptr<CCoinsViewDB> pcoinsdbview;
+std::unique_ptr<CCoinsViewFlusher> pcoinsflusher;
 std::unique_ptr<CCoinsViewCache> pcoinsTip;
 std::unique_ptr<CBlockTreeDB> pblocktree;
 
@@ -286,6 +305,7 @@ enum FlushStateMode {
 // See definition for documentation
 static bool FlushStateToDisk(const CChainParams& chainParams, CValidationState &state, FlushStateMode mode, int nManualPruneHeight=0);
 bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks = nullptr);
+static bool CheckInputsParallel(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, unsigned int flags, bool cacheSigStore, PrecomputedTransactionData& txdata);
 static FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 
 bool CheckFinalTx(const CTransaction &tx, int flags)
@@ -694,7 +714,7 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
         PrecomputedTransactionData txdata(tx);
-        if (!CheckInputs(tx, state, view, true, scriptVerifyFlags, true, false, txdata)) {
+        if (!CheckInputsParallel(tx, state, view, scriptVerifyFlags, true, txdata)) {
             // SCRIPT_VERIFY_CLEANSTACK requires SCRIPT_VERIFY_WITNESS, so we
             // need to turn both off, and compare against just turning off CLEANSTACK
             // to see if the failure is specifically due to witness validation.
@@ -862,21 +882,53 @@ static bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMes
     return true;
 }
 
+static CBlockFileReader blockfilereader(DEFAULT_BLOCK_FILE_MAPPINGS);
+
+void SetBlockFileMappings(size_t n)
+{
+    blockfilereader.SetMaxMappings(n);
+}
+
+/** The mapping of the block file pos is in, if that file is no longer written to */
+static std::shared_ptr<const CBlockFileReader::Mapping> MapBlockFile(const CDiskBlockPos& pos)
+{
+    {
+        LOCK(cs_LastBlockFile);
+        if (pos.IsNull() || (int)pos.nFile >= nLastBlockFile)
+            return nullptr;
+    }
+    return blockfilereader.Get(pos.nFile, GetBlockPosFilename(pos, "blk"));
+}
+
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
-
-    // Read block
-    try {
-        filein >> block;
-    }
-    catch (const std::exception& e) {
-        return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+    std::shared_ptr<const CBlockFileReader::Mapping> mapping = MapBlockFile(pos);
+    if (mapping) {
+        if (pos.nPos >= mapping->size())
+            return error("ReadBlockFromDisk: %s is past the end of the file", pos.ToString());
+        // Deserialize straight from the mapping
+        try {
+            CSpanReader reader(SER_DISK, CLIENT_VERSION, mapping->begin() + pos.nPos, mapping->end());
+            reader >> block;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize error - %s at %s", __func__, e.what(), pos.ToString());
+        }
+    } else {
+        // Open history file to read
+        CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+
+        // Read block
+        try {
+            filein >> block;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+        }
     }
 
     // Check the header
@@ -902,31 +954,104 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& message_start)
+{
+    block.clear();
+
+    // The block is preceded by the message start and its size, as written by WriteBlockToDisk()
+    unsigned char header[CMessageHeader::MESSAGE_START_SIZE + 4];
+    if (pos.IsNull() || pos.nPos < sizeof(header))
+        return error("%s: no block at %s", __func__, pos.ToString());
+    CDiskBlockPos posHeader(pos.nFile, pos.nPos - sizeof(header));
+
+    std::shared_ptr<const CBlockFileReader::Mapping> mapping = MapBlockFile(pos);
+    if (mapping) {
+        if (pos.nPos > mapping->size())
+            return error("%s: %s is past the end of the file", __func__, pos.ToString());
+        memcpy(header, mapping->begin() + posHeader.nPos, sizeof(header));
+    }
+    CAutoFile filein(mapping ? nullptr : OpenBlockFile(posHeader, true), SER_DISK, CLIENT_VERSION);
+    if (!mapping && filein.IsNull())
+        return error("%s: OpenBlockFile failed for %s", __func__, pos.ToString());
+
+    try {
+        if (!mapping)
+            filein.read((char*)header, sizeof(header));
+        if (memcmp(header, message_start, CMessageHeader::MESSAGE_START_SIZE))
+            return error("%s: no block at %s", __func__, pos.ToString());
+        unsigned int nSize = ReadLE32(header + CMessageHeader::MESSAGE_START_SIZE);
+        if (nSize < CBlockHeader::NORMAL_SERIALIZE_SIZE || nSize > MAX_BLOCK_SERIALIZED_SIZE)
+            return error("%s: block size %u out of range at %s", __func__, nSize, pos.ToString());
+        if (mapping) {
+            if (nSize > mapping->size() - pos.nPos)
+                return error("%s: block at %s runs past the end of the file", __func__, pos.ToString());
+            block.assign(mapping->begin() + pos.nPos, mapping->begin() + pos.nPos + nSize);
+        } else {
+            block.resize(nSize);
+            filein.read((char*)block.data(), nSize);
+        }
+    }
+    catch (const std::exception& e) {
+        block.clear();
+        return error("%s: I/O error - %s at %s", __func__, e.what(), pos.ToString());
+    }
+
+    return true;
+}
+
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& message_start)
+{
+    CDiskBlockPos blockPos;
+    {
+        LOCK(cs_main);
+        blockPos = pindex->GetBlockPos();
+    }
+
+    if (!ReadRawBlockFromDisk(block, blockPos, message_start))
+        return false;
+    CBlockHeader header;
+    CSpanReader(SER_DISK, CLIENT_VERSION, block.data(), block.data() + block.size()) >> header;
+    if (header.GetHash() != pindex->GetBlockHash()) {
+        block.clear();
+        return error("ReadRawBlockFromDisk(CBlockIndex*): GetHash() doesn't match index for %s at %s",
+                pindex->ToString(), blockPos.ToString());
+    }
+    return true;
+}
+
 int64_t GetProofOfWorkReward(unsigned int nBits)
 {
-    CBigNum bnSubsidyLimit = MAX_MINT_PROOF_OF_WORK;
-    CBigNum bnTarget;
-    bnTarget.SetCompact(nBits);
-    CBigNum bnTargetLimit(Params().GetConsensus().powLimit);
+    // Products below stay under 2^416. A target above the limit, or a
+    // negative one, settles every comparison the same way as the limit,
+    // or zero, would.
+    arith_uint512 bnSubsidyLimit = MAX_MINT_PROOF_OF_WORK;
+    arith_uint512 bnTarget;
+    bool fNegative, fOverflow;
+    bnTarget.SetCompact(nBits, &fNegative, &fOverflow);
+    arith_uint512 bnTargetLimit(UintToArith256(Params().GetConsensus().powLimit));
     bnTargetLimit.SetCompact(bnTargetLimit.GetCompact());
+    if (fNegative)
+        bnTarget = 0;
+    else if (fOverflow || bnTarget > bnTargetLimit)
+        bnTarget = bnTargetLimit;
 
     // peercoin: subsidy is cut in half every 16x multiply of difficulty
     // A reasonably continuous curve is used to avoid shock to market
     // (nSubsidyLimit / nSubsidy) ** 4 == bnProofOfWorkLimit / bnTarget
-    CBigNum bnLowerBound = CENT;
-    CBigNum bnUpperBound = bnSubsidyLimit;
+    arith_uint512 bnLowerBound = CENT;
+    arith_uint512 bnUpperBound = bnSubsidyLimit;
     while (bnLowerBound + CENT <= bnUpperBound)
     {
-        CBigNum bnMidValue = (bnLowerBound + bnUpperBound) / 2;
+        arith_uint512 bnMidValue = (bnLowerBound + bnUpperBound) / 2;
         if (gArgs.GetBoolArg("-printcreation", false))
-            LogPrintf("%s: lower=%lld upper=%lld mid=%lld\n", __func__, bnLowerBound.getuint64(), bnUpperBound.getuint64(), bnMidValue.getuint64());
+            LogPrintf("%s: lower=%lld upper=%lld mid=%lld\n", __func__, bnLowerBound.GetLow64(), bnUpperBound.GetLow64(), bnMidValue.GetLow64());
         if (bnMidValue * bnMidValue * bnMidValue * bnMidValue * bnTargetLimit > bnSubsidyLimit * bnSubsidyLimit * bnSubsidyLimit * bnSubsidyLimit * bnTarget)
             bnUpperBound = bnMidValue;
         else
             bnLowerBound = bnMidValue;
     }
 
-    int64_t nSubsidy = bnUpperBound.getuint64();
+    int64_t nSubsidy = bnUpperBound.GetLow64();
     nSubsidy = (nSubsidy / CENT) * CENT;
     if (gArgs.GetBoolArg("-printcreation", false))
         LogPrintf("%s: create=%s nBits=0x%08x nSubsidy=%lld\n", __func__, FormatMoney(nSubsidy), nBits, nSubsidy);
@@ -1127,18 +1252,83 @@ int GetSpendHeight(const CCoinsViewCache& inputs)
 }
 
 
-static CuckooCache::cache<uint256, SignatureCacheHasher> scriptExecutionCache;
+static CShardedSignatureCache scriptExecutionCache;
 static uint256 scriptExecutionCacheNonce(GetRandHash());
 
 void InitScriptExecutionCache() {
     // nMaxCacheSize is unsigned. If -maxsigcachesize is set to zero,
-    // setup_bytes creates the minimum possible cache (2 elements).
+    // Setup creates the minimum possible cache (2 elements per shard).
     size_t nMaxCacheSize = std::min(std::max((int64_t)0, gArgs.GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE) / 2), MAX_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
-    size_t nElems = scriptExecutionCache.setup_bytes(nMaxCacheSize);
+    size_t nElems = scriptExecutionCache.Setup(nMaxCacheSize);
     LogPrintf("Using %zu MiB out of %zu/2 requested for script execution cache, able to store %zu elements\n",
             (nElems*sizeof(uint256)) >>20, (nMaxCacheSize*2)>>20, nElems);
 }
 
+CShardedSignatureCache::Stats GetScriptExecutionCacheStats()
+{
+    return scriptExecutionCache.GetStats();
+}
+
+// peercoin: the block first seen using each stake, keyed by
+// SHA256(nonce || kernel outpoint || stake time). The stake and its block are
+// kept and dropped together, oldest stake first once the index is full, so a
+// stake no longer in the index is unknown rather than a duplicate.
+static std::unordered_map<uint256, uint256, BlockHasher> mapStakeSeen;
+static std::deque<uint256> dequeStakeSeen;
+static size_t nMaxStakeSeen = 0;
+static uint256 stakeSeenIndexNonce(GetRandHash());
+
+void InitStakeSeenIndex() {
+    LOCK(cs_main);
+    size_t nMaxSize = std::min(std::max((int64_t)0, gArgs.GetArg("-maxstakeseensize", DEFAULT_MAX_STAKESEEN_SIZE)), MAX_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
+    // A map node and bucket, and the stake again in the queue. A zero size
+    // still keeps the last two stakes.
+    size_t nEntrySize = memusage::MallocUsage(sizeof(memusage::unordered_node<std::pair<const uint256, uint256> >)) + sizeof(void*) + sizeof(uint256);
+    nMaxStakeSeen = std::max(nMaxSize / nEntrySize, (size_t)2);
+    mapStakeSeen.clear();
+    mapStakeSeen.reserve(nMaxStakeSeen);
+    dequeStakeSeen.clear();
+    LogPrintf("Using %zu MiB out of %zu requested for the stake seen index, able to store %zu stakes\n",
+            (nMaxStakeSeen*nEntrySize) >>20, nMaxSize>>20, nMaxStakeSeen);
+}
+
+static uint256 ComputeStakeSeenKey(const CBlock& block)
+{
+    const CTransaction& txCoinStake = *block.vtx[1];
+    const COutPoint& prevout = txCoinStake.vin[0].prevout;
+    unsigned char buf[8];
+    WriteLE32(buf, prevout.n);
+    WriteLE32(buf + 4, txCoinStake.nTime);
+    uint256 key;
+    CSHA256().Write(stakeSeenIndexNonce.begin(), 32).Write(prevout.hash.begin(), 32).Write(buf, sizeof(buf)).Finalize(key.begin());
+    return key;
+}
+
+void AddStakeSeen(const CBlock& block)
+{
+    AssertLockHeld(cs_main);
+    if (!block.IsProofOfStake())
+        return;
+    uint256 key = ComputeStakeSeenKey(block);
+    // The first block seen with a stake keeps it
+    if (!mapStakeSeen.emplace(key, block.GetHash()).second)
+        return;
+    dequeStakeSeen.push_back(key);
+    while (dequeStakeSeen.size() > nMaxStakeSeen) {
+        mapStakeSeen.erase(dequeStakeSeen.front());
+        dequeStakeSeen.pop_front();
+    }
+}
+
+bool IsDuplicateStake(const CBlock& block)
+{
+    AssertLockHeld(cs_main);
+    if (!block.IsProofOfStake())
+        return false;
+    auto it = mapStakeSeen.find(ComputeStakeSeenKey(block));
+    return it != mapStakeSeen.end() && it->second != block.GetHash();
+}
+
 /**
  * Check whether all inputs of this transaction are valid (no double spends, scripts & sigs, amounts)
  * This does not modify the UTXO set.
@@ -1180,8 +1370,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
             // round - giving us 19 + 32 + 4 = 55 bytes (+ 8 + 1 = 64)
             static_assert(55 - sizeof(flags) - 32 >= 128/8, "Want at least 128 bits of nonce for script execution cache");
             CSHA256().Write(scriptExecutionCacheNonce.begin(), 55 - sizeof(flags) - 32).Write(tx.GetWitnessHash().begin(), 32).Write((unsigned char*)&flags, sizeof(flags)).Finalize(hashCacheEntry.begin());
-            AssertLockHeld(cs_main); //TODO: Remove this requirement by making CuckooCache not require external locks
-            if (scriptExecutionCache.contains(hashCacheEntry, !cacheFullScriptStore)) {
+            if (scriptExecutionCache.Contains(hashCacheEntry, !cacheFullScriptStore)) {
                 return true;
             }
 
@@ -1228,7 +1417,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
             if (cacheFullScriptStore && !pvChecks) {
                 // We executed all of the provided scripts, and were told to
                 // cache the result. Do so now.
-                scriptExecutionCache.insert(hashCacheEntry);
+                scriptExecutionCache.Insert(hashCacheEntry);
             }
         }
     }
@@ -1476,13 +1665,89 @@ static bool WriteTxIndexDataForBlock(const CBlock& block, CValidationState& stat
     return true;
 }
 
-static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+// peercoin: record where the transactions of the block sit, for the stake
+// kernels of their outputs
+static bool WriteKernelIndexDataForBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex)
+{
+    unsigned int nTxOffset = CBlockHeader::NORMAL_SERIALIZE_SIZE + GetSizeOfCompactSize(block.vtx.size());
+    std::vector<std::pair<uint256, CKernelIndexEntry> > vEntry;
+    vEntry.reserve(block.vtx.size());
+    for (const CTransactionRef& tx : block.vtx)
+    {
+        vEntry.push_back(std::make_pair(tx->GetHash(), CKernelIndexEntry(pindex->nHeight, pindex->GetBlockHash(), nTxOffset)));
+        nTxOffset += ::GetSerializeSize(*tx, SER_DISK, CLIENT_VERSION);
+    }
+
+    if (!pcoinsdbview->WriteKernelIndex(vEntry)) {
+        return AbortNode(state, "Failed to write kernel index");
+    }
+
+    return true;
+}
+
+// peercoin: drop the kernel index entries of a block leaving the active chain
+static bool EraseKernelIndexDataForBlock(const CBlock& block, CValidationState& state)
+{
+    std::vector<uint256> vTxid;
+    vTxid.reserve(block.vtx.size());
+    for (const CTransactionRef& tx : block.vtx)
+        vTxid.push_back(tx->GetHash());
+
+    if (!pcoinsdbview->EraseKernelIndex(vTxid)) {
+        return AbortNode(state, "Failed to erase kernel index");
+    }
+
+    return true;
+}
+
+static CCheckQueue<CScriptCheck> scriptcheckqueue;
 
-void ThreadScriptCheck() {
+void ThreadScriptCheck(int nCPU) {
     RenameThread("peercoin-scriptch");
+    if (nCPU >= 0 && !PinThreadToCPU(nCPU))
+        LogPrintf("Could not pin script verification thread to CPU %d\n", nCPU);
     scriptcheckqueue.Thread();
 }
 
+/**
+ * CheckInputs() for a transaction entering the mempool. The script checks of
+ * a transaction with many inputs are run on the script check threads, the
+ * calling thread joining in, so that a large transaction from one peer does
+ * not hold up the others as long. Should one of them fail, the checks are run
+ * again inline to fill in state like CheckInputs() does; the inputs that
+ * passed are in the signature cache by then.
+ */
+static bool CheckInputsParallel(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, unsigned int flags, bool cacheSigStore, PrecomputedTransactionData& txdata)
+{
+    if (!nScriptCheckThreads || tx.vin.size() < MIN_PARALLEL_MEMPOOL_INPUTS)
+        return CheckInputs(tx, state, inputs, true, flags, cacheSigStore, false, txdata);
+
+    std::vector<CScriptCheck> vChecks;
+    if (!CheckInputs(tx, state, inputs, true, flags, cacheSigStore, false, txdata, &vChecks))
+        return false;
+    CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+    control.Add(vChecks);
+    if (control.Wait())
+        return true;
+    return CheckInputs(tx, state, inputs, true, flags, cacheSigStore, false, txdata);
+}
+
+static CCheckQueue<CStakePrecheckJob> stakeprecheckqueue;
+static std::atomic<int> nStakePrecheckThreads(0);
+
+void ThreadStakePrecheck() {
+    RenameThread("peercoin-stakepc");
+    nStakePrecheckThreads++;
+    stakeprecheckqueue.Thread();
+}
+
+static CCoinsPrefetcher coinsprefetcher;
+
+void ThreadCoinsPrefetch() {
+    RenameThread("peercoin-prefetch");
+    coinsprefetcher.Thread();
+}
+
 static unsigned int GetBlockScriptFlags(const CBlockIndex* pindex, const Consensus::Params& consensusparams) {
     AssertLockHeld(cs_main);
 
@@ -1499,7 +1764,7 @@ static unsigned int GetBlockScriptFlags(const CBlockIndex* pindex, const Consens
     }
 
     // Start enforcing CHECKLOCKTIMEVERIFY (BIP65) rule
-    if (IsProtocolV06(pindex->pprev)) {
+    if (pindex->pprev && IsProtocolV06(pindex->pprev)) {
         flags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
     }
 
@@ -1529,11 +1794,11 @@ static int64_t nTimeTotal = 0;
 static int64_t nBlocksTotal = 0;
 
 // These checks can only be done when all previous block have been added.
-bool PeercoinContextualBlockChecks(const CBlock& block, CValidationState& state, CBlockIndex* pindex, bool fJustCheck)
+bool PeercoinContextualBlockChecks(const CBlock& block, CValidationState& state, CBlockIndex* pindex, bool fJustCheck, bool fCheckSignature=true)
 {
     uint256 hashProofOfStake = uint256();
     // peercoin: verify hash target and signature of coinstake tx
-    if (block.IsProofOfStake() && !CheckProofOfStake(state, pindex->pprev, block.vtx[1], block.nBits, hashProofOfStake)) {
+    if (block.IsProofOfStake() && !CheckProofOfStake(state, pindex->pprev, block.vtx[1], block.nBits, hashProofOfStake, fCheckSignature)) {
         LogPrintf("WARNING: %s: check proof-of-stake failed for block %s\n", __func__, block.GetHash().ToString());
         return false; // do not error here as we expect this during initial block download
     }
@@ -1576,8 +1841,7 @@ bool PeercoinContextualBlockChecks(const CBlock& block, CValidationState& state,
     // write everything to index
     if (block.IsProofOfStake())
     {
-        pindex->prevoutStake = block.vtx[1]->vin[0].prevout;
-        pindex->nStakeTime = block.vtx[1]->nTime;
+        pindex->SetStakeSource(block.vtx[1]->vin[0].prevout, block.vtx[1]->nTime);
         pindex->hashProofOfStake = hashProofOfStake;
     }
     if (!pindex->SetStakeEntropyBit(nEntropyBit))
@@ -1602,7 +1866,11 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
            (*pindex->phashBlock == block.GetHash()));
     int64_t nTimeStart = GetTimeMicros();
 
-    if (pindex->nStakeModifier == 0 && pindex->nStakeModifierChecksum == 0 && !PeercoinContextualBlockChecks(block, state, pindex, fJustCheck))
+    // peercoin: the block and coinstake signatures may have been verified
+    // ahead on the stake precheck threads
+    bool fPrechecked = StakePrecheckPassed(mapStakePrechecks, pindex, block);
+
+    if (pindex->nStakeModifier == 0 && pindex->nStakeModifierChecksum == 0 && !PeercoinContextualBlockChecks(block, state, pindex, fJustCheck, !fPrechecked))
         return error("%s: failed PoS check %s", __func__, FormatStateMessage(state));
 
     // Check it again in case a previous version let a bad block in
@@ -1618,7 +1886,7 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     // is enforced in ContextualCheckBlockHeader(); we wouldn't want to
     // re-enforce that rule here (at least until we make it impossible for
     // GetAdjustedTime() to go backward).
-    if (!CheckBlock(block, state, chainparams.GetConsensus(), !fJustCheck, !fJustCheck))
+    if (!CheckBlock(block, state, chainparams.GetConsensus(), !fJustCheck, !fJustCheck, !fPrechecked))
         return error("%s: Consensus::CheckBlock: %s", __func__, FormatStateMessage(state));
 
     // verify that the view's current state corresponds to the previous block
@@ -1821,6 +2089,9 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     if (!WriteTxIndexDataForBlock(block, state, pindex))
         return false;
 
+    if (!WriteKernelIndexDataForBlock(block, state, pindex))
+        return false;
+
     assert(pindex->phashBlock);
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
@@ -1911,8 +2182,12 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
             // overwrite one. Still, use a conservative safety factor of 2.
             if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
                 return state.Error("out of disk space");
+            // Coins read ahead from the database may be outdated once it is written
+            coinsprefetcher.Clear();
             // Flush the chainstate (which may refer to block index entries).
-            if (!pcoinsTip->Flush())
+            // Unless the caller needs it on disk now, it may be written in the background.
+            bool fBackground = fBackgroundFlush && mode != FLUSH_STATE_ALWAYS && pcoinsflusher;
+            if (!(fBackground ? pcoinsflusher->FlushInBackground(*pcoinsTip) : pcoinsTip->Flush()))
                 return AbortNode(state, "Failed to write to coin database");
             nLastFlush = nNow;
         }
@@ -2029,6 +2304,8 @@ bool CChainState::DisconnectTip(CValidationState& state, const CChainParams& cha
         bool flushed = view.Flush();
         assert(flushed);
     }
+    if (!EraseKernelIndexDataForBlock(block, state))
+        return false;
     LogPrint(BCLog::BENCH, "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * MILLI);
     // Write the chain state to disk, if necessary.
     if (!FlushStateToDisk(chainparams, state, FLUSH_STATE_IF_NEEDED))
@@ -2048,6 +2325,7 @@ bool CChainState::DisconnectTip(CValidationState& state, const CChainParams& cha
     }
 
     chainActive.SetTip(pindexDelete->pprev);
+    stakeModifierIndex.SetTip(pindexDelete->pprev);
 
     UpdateTip(pindexDelete->pprev, chainparams);
     // Let wallets know transactions went from 1-confirmed to
@@ -2057,6 +2335,7 @@ bool CChainState::DisconnectTip(CValidationState& state, const CChainParams& cha
 }
 
 static int64_t nTimeReadFromDisk = 0;
+static int64_t nTimePrefetch = 0;
 static int64_t nTimeConnectTotal = 0;
 static int64_t nTimeFlush = 0;
 static int64_t nTimeChainState = 0;
@@ -2139,7 +2418,12 @@ bool CChainState::ConnectTip(CValidationState& state, const CChainParams& chainp
     // Read block from disk.
     int64_t nTime1 = GetTimeMicros();
     std::shared_ptr<const CBlock> pthisBlock;
-    if (!pblock) {
+    auto itPrecheck = mapStakePrechecks.find(pindexNew);
+    if (!pblock && itPrecheck != mapStakePrechecks.end()) {
+        pthisBlock = itPrecheck->second->GetBlock();
+    } else if (!pblock && (pthisBlock = coinsprefetcher.GetBlock(pindexNew->GetBlockHash()))) {
+        // Read ahead by PrefetchInputs()
+    } else if (!pblock) {
         std::shared_ptr<CBlock> pblockNew = std::make_shared<CBlock>();
         if (!ReadBlockFromDisk(*pblockNew, pindexNew, chainparams.GetConsensus()))
             return AbortNode(state, "Failed to read block");
@@ -2152,17 +2436,23 @@ bool CChainState::ConnectTip(CValidationState& state, const CChainParams& chainp
     int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
     int64_t nTime3;
     LogPrint(BCLog::BENCH, "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * MILLI, nTimeReadFromDisk * MICRO);
+    // Add the coins read ahead for this block to the cache, finishing the reads first
+    size_t nPrefetched = coinsprefetcher.Apply(pindexNew->GetBlockHash(), *pcoinsTip);
+    int64_t nTimePrefetched = GetTimeMicros(); nTimePrefetch += nTimePrefetched - nTime2;
+    LogPrint(BCLog::BENCH, "  - Prefetch inputs: %.2fms (%u coins) [%.2fs]\n", (nTimePrefetched - nTime2) * MILLI, (unsigned)nPrefetched, nTimePrefetch * MICRO);
     {
         CCoinsViewCache view(pcoinsTip.get());
         bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, chainparams);
+        if (itPrecheck != mapStakePrechecks.end())
+            mapStakePrechecks.erase(itPrecheck);
         GetMainSignals().BlockChecked(blockConnecting, state);
         if (!rv) {
             if (state.IsInvalid())
                 InvalidBlockFound(pindexNew, state);
             return error("ConnectTip(): ConnectBlock %s failed", pindexNew->GetBlockHash().ToString());
         }
-        nTime3 = GetTimeMicros(); nTimeConnectTotal += nTime3 - nTime2;
-        LogPrint(BCLog::BENCH, "  - Connect total: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime3 - nTime2) * MILLI, nTimeConnectTotal * MICRO, nTimeConnectTotal * MILLI / nBlocksTotal);
+        nTime3 = GetTimeMicros(); nTimeConnectTotal += nTime3 - nTimePrefetched;
+        LogPrint(BCLog::BENCH, "  - Connect total: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime3 - nTimePrefetched) * MILLI, nTimeConnectTotal * MICRO, nTimeConnectTotal * MILLI / nBlocksTotal);
         bool flushed = view.Flush();
         assert(flushed);
     }
@@ -2178,6 +2468,7 @@ bool CChainState::ConnectTip(CValidationState& state, const CChainParams& chainp
     disconnectpool.removeForBlock(blockConnecting.vtx);
     // Update chainActive & related variables.
     chainActive.SetTip(pindexNew);
+    stakeModifierIndex.SetTip(pindexNew);
     UpdateTip(pindexNew, chainparams);
 
     int64_t nTime6 = GetTimeMicros(); nTimePostConnect += nTime6 - nTime5; nTimeTotal += nTime6 - nTime1;
@@ -2250,6 +2541,85 @@ CBlockIndex* CChainState::FindMostWorkChain() {
  * Try to make some progress towards making pindexMostWork the active block.
  * pblock is either nullptr or a pointer to a CBlock corresponding to pindexMostWork.
  */
+/**
+ * peercoin: during initial block download, queue the signature checks of the
+ * blocks about to be connected, so the stake precheck threads verify them
+ * while earlier blocks connect. The kernel hash itself stays with
+ * ConnectBlock(), as it needs the stake modifiers of the blocks before it.
+ * vpindexToConnect is ordered from the highest block down.
+ */
+void CChainState::PrecheckStake(const std::vector<CBlockIndex*>& vpindexToConnect, const Consensus::Params& consensusParams)
+{
+    AssertLockHeld(cs_main);
+
+    if (vpindexToConnect.empty() || !nStakePrecheckThreads || !IsInitialBlockDownload()) {
+        mapStakePrechecks.clear();
+        return;
+    }
+
+    // Drop the prechecks of blocks connected since, or off the branch now
+    const CBlockIndex* pindexLast = vpindexToConnect.front();
+    for (auto it = mapStakePrechecks.begin(); it != mapStakePrechecks.end(); ) {
+        if (chainActive.Contains(it->first) || pindexLast->GetAncestor(it->first->nHeight) != it->first)
+            it = mapStakePrechecks.erase(it);
+        else
+            ++it;
+    }
+
+    std::vector<CStakePrecheckJob> vJobs;
+    for (CBlockIndex* pindex : vpindexToConnect) {
+        if (mapStakePrechecks.count(pindex) || !(pindex->nStatus & BLOCK_HAVE_DATA))
+            continue;
+        if (!pindex->IsProofOfStake() && IsBTC16BIPsEnabled(pindex->GetBlockTime()))
+            continue;
+        std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+        if (!ReadBlockFromDisk(*pblock, pindex, consensusParams))
+            continue; // ConnectTip() reports it
+        // The staked output is only known ahead while it is in the UTXO set,
+        // that is unless it is created within the window
+        std::shared_ptr<CStakePrecheck> pprecheck = CStakePrecheck::Make(pblock, *pcoinsTip);
+        if (!pprecheck)
+            continue;
+        mapStakePrechecks.emplace(pindex, pprecheck);
+        vJobs.emplace_back(pprecheck);
+    }
+    // The queue is worked from the back, where the next block to connect now is
+    stakeprecheckqueue.Add(vJobs);
+}
+
+/**
+ * Queue the reads of the coins spent by the next blocks to connect, itNext
+ * first, for the coins prefetch threads. The blocks read from disk for it
+ * are kept by the prefetcher for ConnectTip().
+ */
+void CChainState::PrefetchInputs(std::vector<CBlockIndex*>::const_reverse_iterator itNext, std::vector<CBlockIndex*>::const_reverse_iterator itEnd, const std::shared_ptr<const CBlock>& pblock, const Consensus::Params& consensusParams)
+{
+    AssertLockHeld(cs_main);
+
+    if (!coinsprefetcher.IsEnabled())
+        return;
+    coinsprefetcher.Prune(chainActive.Height() + 1);
+    const uint256 hashBlock = pblock ? pblock->GetHash() : uint256();
+    for (size_t n = 0; itNext != itEnd && n < CCoinsPrefetcher::MAX_PENDING_BLOCKS; ++itNext, n++) {
+        const CBlockIndex* pindex = *itNext;
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA) || coinsprefetcher.IsPending(pindex->GetBlockHash()))
+            continue;
+        std::shared_ptr<const CBlock> pblockNext;
+        auto itPrecheck = mapStakePrechecks.find(pindex);
+        if (pblock && hashBlock == pindex->GetBlockHash()) {
+            pblockNext = pblock;
+        } else if (itPrecheck != mapStakePrechecks.end()) {
+            pblockNext = itPrecheck->second->GetBlock();
+        } else {
+            std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
+            if (!ReadBlockFromDisk(*pblockRead, pindex, consensusParams))
+                return; // ConnectTip() reports it
+            pblockNext = pblockRead;
+        }
+        coinsprefetcher.Prefetch(pblockNext, pindex->nHeight, pcoinsflusher.get(), *pcoinsTip);
+    }
+}
+
 bool CChainState::ActivateBestChainStep(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexMostWork, const std::shared_ptr<const CBlock>& pblock, bool& fInvalidFound, ConnectTrace& connectTrace)
 {
     AssertLockHeld(cs_main);
@@ -2287,8 +2657,12 @@ bool CChainState::ActivateBestChainStep(CValidationState& state, const CChainPar
         }
         nHeight = nTargetHeight;
 
+        PrecheckStake(vpindexToConnect, chainparams.GetConsensus());
+
         // Connect new blocks.
-        for (CBlockIndex *pindexConnect : reverse_iterate(vpindexToConnect)) {
+        for (auto it = vpindexToConnect.crbegin(); it != vpindexToConnect.crend(); ++it) {
+            CBlockIndex *pindexConnect = *it;
+            PrefetchInputs(it, vpindexToConnect.crend(), pindexConnect == pindexMostWork ? pblock : std::shared_ptr<const CBlock>(), chainparams.GetConsensus());
             if (!ConnectTip(state, chainparams, pindexConnect, pindexConnect == pindexMostWork ? pblock : std::shared_ptr<const CBlock>(), connectTrace, disconnectpool)) {
                 if (state.IsInvalid()) {
                     // The block violates a consensus rule.
@@ -3326,6 +3700,9 @@ bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<cons
             // Store to disk
             ret = g_chainstate.AcceptBlock(pblock, state, chainparams, &pindex, fForceProcessing, nullptr, fNewBlock);
         }
+        // Start reading the coins a block on top of the tip spends, before it gets connected
+        if (ret && pindex->pprev == chainActive.Tip())
+            coinsprefetcher.Prefetch(pblock, pindex->nHeight, pcoinsflusher.get(), *pcoinsTip);
         if (ppindex)
             *ppindex = ret ? pindex : nullptr;
         if (!ret) {
@@ -3334,10 +3711,9 @@ bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<cons
         }
 
         if (pindex->IsProofOfStake()) {
-            int32_t ndx = univHash(pindex->hashProofOfStake);
-            if (fPoSDuplicate && vStakeSeen[ndx] == pindex->hashProofOfStake)
+            if (fPoSDuplicate && IsDuplicateStake(*pblock))
                 *fPoSDuplicate = true;
-            vStakeSeen[ndx] = pindex->hashProofOfStake;
+            AddStakeSeen(*pblock);
         }
     }
 
@@ -3456,25 +3832,70 @@ CBlockIndex * CChainState::InsertBlockIndex(const uint256& hash)
     return pindexNew;
 }
 
+// peercoin: verify the stake modifier checksums loaded with a block index
+// snapshot. A checksum only depends on the block's own fields and the stored
+// checksum of its parent, so segments of the index are verified in parallel.
+static bool VerifyStakeModifierChecksums(const std::vector<CBlockIndex*>& vSortedByHeight)
+{
+    const size_t nThreads = std::max(1, std::min(GetNumCores(), MAX_SCRIPTCHECK_THREADS));
+    const size_t nSegment = (vSortedByHeight.size() + nThreads - 1) / nThreads;
+    std::atomic<bool> fOk(true);
+    std::vector<std::thread> vThreads;
+    for (size_t nStart = 0; nStart < vSortedByHeight.size(); nStart += nSegment) {
+        vThreads.emplace_back([&vSortedByHeight, &fOk, nStart, nSegment] {
+            size_t nEnd = std::min(nStart + nSegment, vSortedByHeight.size());
+            for (size_t i = nStart; i < nEnd && fOk; i++) {
+                const CBlockIndex* pindex = vSortedByHeight[i];
+                if ((pindex->pprev && pindex->pprev->nHeight != pindex->nHeight - 1) || GetStakeModifierChecksum(pindex) != pindex->nStakeModifierChecksum)
+                    fOk = false;
+            }
+        });
+    }
+    for (std::thread& thread : vThreads)
+        thread.join();
+    return fOk;
+}
+
 bool CChainState::LoadBlockIndex(const Consensus::Params& consensus_params, CBlockTreeDB& blocktree)
 {
-    if (!blocktree.LoadBlockIndexGuts(consensus_params, [this](const uint256& hash){ return this->InsertBlockIndex(hash); }))
-        return false;
+    // peercoin: start from the snapshot written at the last clean shutdown,
+    // if it still matches the database
+    std::vector<CBlockIndex*> vSortedByHeight;
+    int64_t nTimeStart = GetTimeMicros();
+    bool fSnapshot = blocktree.LoadBlockIndexSnapshot(GetDataDir() / "blockindex.dat", [this](const uint256& hash){ return this->InsertBlockIndex(hash); }, vSortedByHeight);
+    if (fSnapshot && (mapBlockIndex.size() != vSortedByHeight.size() || !VerifyStakeModifierChecksums(vSortedByHeight))) {
+        LogPrintf("%s: block index snapshot does not match, loading from the database\n", __func__);
+        fSnapshot = false;
+    }
+    if (fSnapshot) {
+        LogPrintf("%s: loaded block index snapshot: %.2fs\n", __func__, (GetTimeMicros() - nTimeStart) * MICRO);
+    } else {
+        for (const auto& item : mapBlockIndex)
+            delete item.second;
+        mapBlockIndex.clear();
+        vSortedByHeight.clear();
 
-    boost::this_thread::interruption_point();
+        if (!blocktree.LoadBlockIndexGuts(consensus_params, [this](const uint256& hash){ return this->InsertBlockIndex(hash); }))
+            return false;
 
-    // Calculate nChainTrust
-    std::vector<std::pair<int, CBlockIndex*> > vSortedByHeight;
-    vSortedByHeight.reserve(mapBlockIndex.size());
-    for (const std::pair<uint256, CBlockIndex*>& item : mapBlockIndex)
-    {
-        CBlockIndex* pindex = item.second;
-        vSortedByHeight.push_back(std::make_pair(pindex->nHeight, pindex));
+        boost::this_thread::interruption_point();
+
+        std::vector<std::pair<int, CBlockIndex*> > vHeightIndex;
+        vHeightIndex.reserve(mapBlockIndex.size());
+        for (const std::pair<uint256, CBlockIndex*>& item : mapBlockIndex)
+        {
+            CBlockIndex* pindex = item.second;
+            vHeightIndex.push_back(std::make_pair(pindex->nHeight, pindex));
+        }
+        sort(vHeightIndex.begin(), vHeightIndex.end());
+        vSortedByHeight.reserve(vHeightIndex.size());
+        for (const std::pair<int, CBlockIndex*>& item : vHeightIndex)
+            vSortedByHeight.push_back(item.second);
     }
-    sort(vSortedByHeight.begin(), vSortedByHeight.end());
-    for (const std::pair<int, CBlockIndex*>& item : vSortedByHeight)
+
+    // Calculate nChainTrust
+    for (CBlockIndex* pindex : vSortedByHeight)
     {
-        CBlockIndex* pindex = item.second;
         pindex->nChainTrust = (pindex->pprev ? pindex->pprev->nChainTrust : 0) + GetBlockTrust(*pindex);
         pindex->nTimeMax = (pindex->pprev ? std::max(pindex->pprev->nTimeMax, pindex->nTime) : pindex->nTime);
         // We can link the chain of blocks for which we've received transactions at some point.
@@ -3505,7 +3926,8 @@ bool CChainState::LoadBlockIndex(const Consensus::Params& consensus_params, CBlo
             pindexBestHeader = pindex;
 
         // peercoin: calculate stake modifier checksum
-        pindex->nStakeModifierChecksum = GetStakeModifierChecksum(pindex);
+        if (!fSnapshot)
+            pindex->nStakeModifierChecksum = GetStakeModifierChecksum(pindex);
         if (chainActive.Contains(pindex))
             if (!CheckStakeModifierCheckpoints(pindex->nHeight, pindex->nStakeModifierChecksum))
                 return error("LoadBlockIndex() : Failed stake modifier checkpoint height=%d, modifier=0x%016llx", pindex->nHeight, pindex->nStakeModifier);
@@ -3593,6 +4015,7 @@ bool LoadChainTip(const CChainParams& chainparams)
     if (it == mapBlockIndex.end())
         return false;
     chainActive.SetTip(it->second);
+    stakeModifierIndex.SetTip(it->second);
 
     LogPrintf("Loaded best chain: hashBestChain=%s height=%d date=%s progress=%f\n",
         chainActive.Tip()->GetBlockHash().ToString(), chainActive.Height(),
@@ -3886,6 +4309,7 @@ void CChainState::UnloadBlockIndex() {
     nBlockSequenceId = 1;
     g_failed_blocks.clear();
     setBlockIndexCandidates.clear();
+    mapStakePrechecks.clear();
 }
 
 // May NOT be used after any connections are up as much
@@ -3895,6 +4319,9 @@ void UnloadBlockIndex()
 {
     LOCK(cs_main);
     chainActive.SetTip(nullptr);
+    stakeModifierIndex.SetTip(nullptr);
+    stakeModifierCandidates.Clear();
+    coinsprefetcher.Clear();
     pindexBestInvalid = nullptr;
     pindexBestHeader = nullptr;
     mempool.clear();
@@ -3974,49 +4401,42 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
     // Map of disk positions for blocks with unknown parent (only used for reindex)
     static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
     int64_t nStart = GetTimeMillis();
+    int64_t nLastProgress = nStart;
 
     int nLoaded = 0;
+    int nRead = 0;
+    uint64_t nBytesScanned = 0;
+    int64_t nWaitTime = 0;
     try {
-        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
-        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
-        uint64_t nRewind = blkdat.GetPos();
-        while (!blkdat.eof()) {
+        // Blocks are read, deserialized and checked ahead, and accepted here in file order
+        CBlockImportPipeline pipeline(fileIn, chainparams, std::max(1, nScriptCheckThreads));
+        CBlockImportPipeline::Item item;
+        while (pipeline.Next(item)) {
             boost::this_thread::interruption_point();
 
-            blkdat.SetPos(nRewind);
-            nRewind++; // start one byte further next time, in case of failure
-            blkdat.SetLimit(); // remove former limit
-            unsigned int nSize = 0;
-            try {
-                // locate a header
-                unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
-                blkdat.FindByte(chainparams.MessageStart()[0]);
-                nRewind = blkdat.GetPos()+1;
-                blkdat >> FLATDATA(buf);
-                if (memcmp(buf, chainparams.MessageStart(), CMessageHeader::MESSAGE_START_SIZE))
-                    continue;
-                // read size
-                blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
-                    continue;
-            } catch (const std::exception&) {
-                // no valid block header found; don't complain
-                break;
+            if (dbp)
+                dbp->nPos = item.nPos;
+            if (!item.pblock) {
+                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, item.strError);
+                continue;
+            }
+            nRead++;
+
+            int64_t nNow = GetTimeMillis();
+            if (nNow - nLastProgress >= 10000) {
+                nLastProgress = nNow;
+                uint64_t nScanned = pipeline.GetBytesScanned();
+                LogPrintf("Importing blocks: %.1f%% of the file, %i blocks loaded (%.1f MiB/s, %.1f blocks/s)\n",
+                    pipeline.GetFileSize() ? 100.0 * nScanned / pipeline.GetFileSize() : 0.0, nLoaded,
+                    nScanned / 1048576.0 / ((nNow - nStart) * 0.001), nRead / ((nNow - nStart) * 0.001));
             }
+
             try {
-                // read block
-                uint64_t nBlockPos = blkdat.GetPos();
-                if (dbp)
-                    dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
-                CBlock& block = *pblock;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
+                std::shared_ptr<CBlock> pblock = std::move(item.pblock);
+                const CBlock& block = *pblock;
 
                 // detect out of order blocks, and store them for later
-                uint256 hash = block.GetHash();
+                const uint256& hash = item.hash;
                 if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
                     LogPrint(BCLog::REINDEX, "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
                             block.hashPrevBlock.ToString());
@@ -4078,11 +4498,16 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
                 LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
             }
         }
+        nBytesScanned = pipeline.GetBytesScanned();
+        nWaitTime = pipeline.GetWaitTime();
     } catch (const std::runtime_error& e) {
         AbortNode(std::string("System error: ") + e.what());
     }
-    if (nLoaded > 0)
-        LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
+    if (nLoaded > 0) {
+        int64_t nTime = std::max<int64_t>(GetTimeMillis() - nStart, 1);
+        LogPrintf("Loaded %i blocks from external file in %dms (%.1f MiB/s, %.1f blocks/s, %dms waiting for blocks to be read and checked)\n",
+            nLoaded, nTime, nBytesScanned / 1048576.0 / (nTime * 0.001), nRead / (nTime * 0.001), nWaitTime / 1000);
+    }
     return nLoaded > 0;
 }
 
@@ -4385,6 +4810,27 @@ bool DumpMempool(void)
     return true;
 }
 
+bool DumpBlockIndex()
+{
+    int64_t nStart = GetTimeMicros();
+    LOCK(cs_main);
+    if (fReindex || !pblocktree)
+        return false;
+
+    std::vector<const CBlockIndex*> vSortedByHeight;
+    vSortedByHeight.reserve(mapBlockIndex.size());
+    for (const auto& item : mapBlockIndex)
+        vSortedByHeight.push_back(item.second);
+    std::sort(vSortedByHeight.begin(), vSortedByHeight.end(), [](const CBlockIndex* a, const CBlockIndex* b) { return a->nHeight < b->nHeight; });
+
+    if (!pblocktree->WriteBlockIndexSnapshot(GetDataDir() / "blockindex.dat", vSortedByHeight)) {
+        LogPrintf("Failed to dump block index. Continuing anyway.\n");
+        return false;
+    }
+    LogPrintf("Dumped block index: %gs\n", (GetTimeMicros() - nStart) * MICRO);
+    return true;
+}
+
 //! Guess how far we are in the verification process at the given block index
 double GuessVerificationProgress(const ChainTxData& data, const CBlockIndex *pindex) {
     if (pindex == nullptr)
@@ -4429,12 +4875,19 @@ public:
 // age (trust score) of competing branches.
 bool GetCoinAge(const CTransaction& tx, const CCoinsViewCache &view, uint64_t& nCoinAge)
 {
+    AssertLockHeld(cs_main);
     arith_uint256 bnCentSecond = 0;  // coin age in the unit of cent-seconds
     nCoinAge = 0;
 
     if (tx.IsCoinBase())
         return true;
 
+    // The coins of the view were connected on the branch of its best block
+    BlockMap::const_iterator mi = mapBlockIndex.find(view.GetBestBlock());
+    if (mi == mapBlockIndex.end())
+        return error("%s() : best block of the view not indexed", __PRETTY_FUNCTION__);
+    const CBlockIndex* pindexBest = mi->second;
+
     for (const auto& txin : tx.vin)
     {
         // First try finding the previous transaction in database
@@ -4446,37 +4899,19 @@ bool GetCoinAge(const CTransaction& tx, const CCoinsViewCache &view, uint64_t& n
         if (tx.nTime < coin.nTime)
             return false;  // Transaction timestamp violation
 
-        // Transaction index is required to get to block header
-        if (!fTxIndex)
-            return false;  // Transaction index not available
+        // The coin holds all but the time of its block
+        const CBlockIndex* pindexFrom = pindexBest->GetAncestor(coin.nHeight);
+        if (!pindexFrom)
+            return error("%s() : block of %s not on the branch of the view", __PRETTY_FUNCTION__, prevout.hash.ToString());
 
-        CDiskTxPos postx;
-        CTransactionRef txPrev;
-        if (pblocktree->ReadTxIndex(prevout.hash, postx))
-        {
-            CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-            CBlockHeader header;
-            try {
-                file >> header;
-                fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                file >> txPrev;
-            } catch (std::exception &e) {
-                return error("%s() : deserialize or I/O error in GetCoinAge()", __PRETTY_FUNCTION__);
-            }
-            if (txPrev->GetHash() != prevout.hash)
-                return error("%s() : txid mismatch in GetCoinAge()", __PRETTY_FUNCTION__);
+        if (pindexFrom->GetBlockTime() + Params().GetConsensus().nStakeMinAge > tx.nTime)
+            continue; // only count coins meeting min age requirement
 
-            if (header.GetBlockTime() + Params().GetConsensus().nStakeMinAge > tx.nTime)
-                continue; // only count coins meeting min age requirement
+        int64_t nValueIn = coin.out.nValue;
+        bnCentSecond += arith_uint256(nValueIn) * (tx.nTime-coin.nTime) / CENT;
 
-            int64_t nValueIn = txPrev->vout[txin.prevout.n].nValue;
-            bnCentSecond += arith_uint256(nValueIn) * (tx.nTime-txPrev->nTime) / CENT;
-
-            if (gArgs.GetBoolArg("-printcoinage", false))
-                LogPrintf("coin age nValueIn=%-12lld nTimeDiff=%d bnCentSecond=%s\n", nValueIn, tx.nTime - txPrev->nTime, bnCentSecond.ToString());
-        }
-        else
-            return error("%s() : tx missing in tx index in GetCoinAge()", __PRETTY_FUNCTION__);
+        if (gArgs.GetBoolArg("-printcoinage", false))
+            LogPrintf("coin age nValueIn=%-12lld nTimeDiff=%d bnCentSecond=%s\n", nValueIn, tx.nTime - coin.nTime, bnCentSecond.ToString());
     }
 
     arith_uint256 bnCoinDay = bnCentSecond * CENT / COIN / (24 * 60 * 60);
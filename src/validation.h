@@ -12,9 +12,11 @@
 
 #include <amount.h>
 #include <coins.h>
+#include <flathashmap.h>
 #include <fs.h>
 #include <protocol.h> // For CMessageHeader::MessageStartChars
 #include <script/script_error.h>
+#include <script/sigcache.h>
 #include <sync.h>
 #include <chain.h>
 
@@ -34,6 +36,7 @@ class CBlockIndex;
 class CBlockTreeDB;
 class CChainParams;
 class CCoinsViewDB;
+class CCoinsViewFlusher;
 class CInv;
 class CConnman;
 class CScriptCheck;
@@ -74,6 +77,16 @@ static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** Maximum number of coins prefetch threads allowed */
+static const int MAX_PREFETCH_THREADS = 16;
+/** -prefetchthreads default (threads reading the coins of blocks about to be connected) */
+static const int DEFAULT_PREFETCH_THREADS = 4;
+/** -backgroundflush default (write the coins cache to disk while validation goes on) */
+static const bool DEFAULT_BACKGROUND_FLUSH = false;
+/** -blockfilemaps default (block files kept mapped into memory, none where address space is short) */
+static const int DEFAULT_BLOCK_FILE_MAPPINGS = sizeof(void*) >= 8 ? 64 : 0;
+/** Transactions entering the mempool with at least this many inputs have their scripts checked on the script check threads */
+static const unsigned int MIN_PARALLEL_MEMPOOL_INPUTS = 8;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
@@ -117,6 +130,8 @@ static const int64_t BLOCK_DOWNLOAD_TIMEOUT_BASE = 1000000;
 static const int64_t BLOCK_DOWNLOAD_TIMEOUT_PER_PEER = 500000;
 
 static const int64_t DEFAULT_MAX_TIP_AGE = 24 * 60 * 60;
+/** peercoin: default size in MiB of the index of proof-of-stake block stakes seen */
+static const unsigned int DEFAULT_MAX_STAKESEEN_SIZE = 4;
 /** Maximum age of our tip in seconds for us to be considered current for fee estimation */
 static const int64_t MAX_FEE_ESTIMATION_TIP_AGE = 3 * 60 * 60;
 
@@ -149,7 +164,7 @@ struct BlockHasher
 extern CScript COINBASE_FLAGS;
 extern CCriticalSection cs_main;
 extern CTxMemPool mempool;
-typedef std::unordered_map<uint256, CBlockIndex*, BlockHasher> BlockMap;
+typedef flat_hash_map<uint256, CBlockIndex*, BlockHasher> BlockMap;
 extern BlockMap& mapBlockIndex;
 extern uint64_t nLastBlockTx;
 extern uint64_t nLastBlockWeight;
@@ -166,6 +181,7 @@ extern bool fRequireStandard;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
 extern size_t nCoinCacheUsage;
+extern bool fBackgroundFlush;
 extern bool fAlerts;
 /** If the tip is older than this (in seconds), the node is considered to be in initial block download. */
 extern int64_t nMaxTipAge;
@@ -252,8 +268,12 @@ bool LoadBlockIndex(const CChainParams& chainparams);
 bool LoadChainTip(const CChainParams& chainparams);
 /** Unload database information */
 void UnloadBlockIndex();
-/** Run an instance of the script checking thread */
-void ThreadScriptCheck();
+/** Run an instance of the script checking thread, pinned to CPU nCPU unless it is negative */
+void ThreadScriptCheck(int nCPU);
+/** Run an instance of the stake precheck thread */
+void ThreadStakePrecheck();
+/** Run an instance of the coins prefetch thread */
+void ThreadCoinsPrefetch();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 void AlertNotify(const std::string& strMessage, bool fUpdateUI = true);
@@ -363,11 +383,27 @@ public:
 
 /** Initializes the script-execution cache */
 void InitScriptExecutionCache();
+/** Hits, misses and evictions of the script execution cache */
+CShardedSignatureCache::Stats GetScriptExecutionCacheStats();
+
+/** peercoin: Initializes the index of the stakes (kernel outpoint and stake
+ *  time) used by the proof-of-stake blocks seen */
+void InitStakeSeenIndex();
+/** peercoin: Record the stake of a proof-of-stake block accepted to disk */
+void AddStakeSeen(const CBlock& block);
+/** peercoin: Whether a proof-of-stake block uses a stake already seen in another block */
+bool IsDuplicateStake(const CBlock& block);
 
 
 /** Functions for disk access for blocks */
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/** Read a block as serialized in its block file, which is with witness data and without the
+ *  PoS marker, to pass it on without deserializing it. Checks the hash of its header against pindex. */
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& message_start);
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& message_start);
+/** Keep up to n block files mapped into memory to read blocks from, 0 to read them through stdio */
+void SetBlockFileMappings(size_t n);
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -418,6 +454,9 @@ extern CChain& chainActive;
 /** Global variable that points to the coins database (protected by cs_main) */
 extern std::unique_ptr<CCoinsViewDB> pcoinsdbview;
 
+/** Global variable that points to the view writing the coins database in the background (protected by cs_main) */
+extern std::unique_ptr<CCoinsViewFlusher> pcoinsflusher;
+
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern std::unique_ptr<CCoinsViewCache> pcoinsTip;
 
@@ -453,6 +492,9 @@ bool DumpMempool();
 /** Load the mempool from disk. */
 bool LoadMempool();
 
+/** peercoin: Dump the block index to disk, to be loaded at the next startup */
+bool DumpBlockIndex();
+
 // peercoin:
 CAmount GetProofOfWorkReward(unsigned int nBits);
 CAmount GetProofOfStakeReward(int64_t nCoinAge);
@@ -700,4 +700,47 @@ BOOST_FIXTURE_TEST_CASE(ListCoins, ListCoinsTestingSetup)
     BOOST_CHECK_EQUAL(list.begin()->second.size(), 2);
 }
 
+BOOST_AUTO_TEST_CASE(stake_cache)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    AddKey(*pwalletMain, key);
+
+    // Pretend a block paying to the wallet was connected at the genesis index,
+    // which is the only block of the active chain in this setup.
+    CMutableTransaction coinbase;
+    coinbase.nTime = chainActive.Genesis()->nTime;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].prevout.SetNull();
+    coinbase.vin[0].scriptSig = CScript() << OP_0 << OP_0;
+    coinbase.vout.push_back(CTxOut(10 * COIN, GetScriptForRawPubKey(key.GetPubKey())));
+    coinbase.vout.push_back(CTxOut(5 * COIN, CScript() << OP_TRUE));
+    std::shared_ptr<CBlock> block = std::make_shared<CBlock>();
+    block->nTime = chainActive.Genesis()->nTime;
+    block->vtx.push_back(MakeTransactionRef(coinbase));
+    pwalletMain->BlockConnected(block, chainActive.Genesis(), {});
+
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+    CStakeCacheEntry entry;
+    BOOST_CHECK(pwalletMain->GetStakeCacheEntry(COutPoint(coinbase.GetHash(), 0), entry));
+    BOOST_CHECK(entry.hashBlock == chainActive.Genesis()->GetBlockHash());
+    BOOST_CHECK_EQUAL(entry.nTimeBlock, chainActive.Genesis()->nTime);
+    BOOST_CHECK_EQUAL(entry.nTxOffset, CBlockHeader::NORMAL_SERIALIZE_SIZE + GetSizeOfCompactSize(block->vtx.size()));
+    BOOST_CHECK_EQUAL(entry.nTimeTx, coinbase.nTime);
+    BOOST_CHECK_EQUAL(entry.nValue, 10 * COIN);
+
+    // Outputs that are not ours are not cached
+    BOOST_CHECK(!pwalletMain->GetStakeCacheEntry(COutPoint(coinbase.GetHash(), 1), entry));
+
+    // Entries pointing to a block outside the active chain are not trusted
+    CStakeCacheEntry stale = entry;
+    stale.hashBlock = InsecureRand256();
+    pwalletMain->LoadStakeCache(COutPoint(coinbase.GetHash(), 2), stale);
+    BOOST_CHECK(!pwalletMain->GetStakeCacheEntry(COutPoint(coinbase.GetHash(), 2), entry));
+
+    // Disconnecting the block drops its outputs from the cache
+    pwalletMain->BlockDisconnected(block);
+    BOOST_CHECK(!pwalletMain->GetStakeCacheEntry(COutPoint(coinbase.GetHash(), 0), entry));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -7,6 +7,7 @@
 
 #include <base58.h>
 #include <checkpoints.h>
+#include <checkqueue.h>
 #include <chain.h>
 #include <wallet/coincontrol.h>
 #include <consensus/consensus.h>
@@ -29,10 +30,10 @@
 #include <utilmoneystr.h>
 
 #include <kernel.h>
-#include <bignum.h>
 #include <txdb.h>
 
 #include <assert.h>
+#include <atomic>
 #include <future>
 
 #include <boost/algorithm/string/replace.hpp>
@@ -42,6 +43,7 @@
 std::vector<CWalletRef> vpwallets;
 unsigned int nTxConfirmTarget = DEFAULT_TX_CONFIRM_TARGET;
 bool bSpendZeroConfChange = DEFAULT_SPEND_ZEROCONF_CHANGE;
+int nStakeThreads = 0;
 OutputType g_address_type = OUTPUT_TYPE_NONE;
 OutputType g_change_type = OUTPUT_TYPE_NONE;
 
@@ -1249,6 +1251,7 @@ void CWallet::BlockConnected(const std::shared_ptr<const CBlock>& pblock, const
         SyncTransaction(pblock->vtx[i], pindex, i);
         TransactionRemovedFromMempool(pblock->vtx[i]);
     }
+    UpdateStakeCache(*pblock, pindex);
 
     m_last_block_processed = pindex;
 }
@@ -1259,6 +1262,128 @@ void CWallet::BlockDisconnected(const std::shared_ptr<const CBlock>& pblock) {
     for (const CTransactionRef& ptx : pblock->vtx) {
         SyncTransaction(ptx);
     }
+
+    // Outputs of disconnected transactions get new kernel inputs once they
+    // are mined again; outputs they spent are re-read on demand.
+    CWalletDB walletdb(*dbw);
+    for (const CTransactionRef& ptx : pblock->vtx) {
+        for (unsigned int i = 0; i < ptx->vout.size(); i++) {
+            COutPoint outpoint(ptx->GetHash(), i);
+            if (mapStakeCache.erase(outpoint))
+                walletdb.EraseStakeCache(outpoint);
+        }
+    }
+}
+
+void CWallet::UpdateStakeCache(const CBlock& block, const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_wallet);
+
+    CWalletDB walletdb(*dbw);
+    // Same offsets as the transaction index, see WriteTxIndexDataForBlock()
+    unsigned int nTxOffset = CBlockHeader::NORMAL_SERIALIZE_SIZE + GetSizeOfCompactSize(block.vtx.size());
+    for (const CTransactionRef& ptx : block.vtx) {
+        for (const CTxIn& txin : ptx->vin) {
+            if (mapStakeCache.erase(txin.prevout))
+                walletdb.EraseStakeCache(txin.prevout);
+        }
+        if (mapWallet.count(ptx->GetHash())) {
+            for (unsigned int i = 0; i < ptx->vout.size(); i++) {
+                if (!(IsMine(ptx->vout[i]) & ISMINE_SPENDABLE))
+                    continue;
+                CStakeCacheEntry entry;
+                entry.hashBlock = pindex->GetBlockHash();
+                entry.nTimeBlock = pindex->nTime;
+                entry.nTxOffset = nTxOffset;
+                entry.nTimeTx = ptx->nTime;
+                entry.nValue = ptx->vout[i].nValue;
+                COutPoint outpoint(ptx->GetHash(), i);
+                mapStakeCache[outpoint] = entry;
+                walletdb.WriteStakeCache(outpoint, entry);
+            }
+        }
+        nTxOffset += ::GetSerializeSize(*ptx, SER_DISK, CLIENT_VERSION);
+    }
+}
+
+void CWallet::LoadStakeCache(const COutPoint& outpoint, const CStakeCacheEntry& entry)
+{
+    AssertLockHeld(cs_wallet);
+    mapStakeCache[outpoint] = entry;
+}
+
+bool CWallet::LookupStakeCache(const COutPoint& outpoint, CStakeCacheEntry& entry)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    auto it = mapStakeCache.find(outpoint);
+    if (it == mapStakeCache.end())
+        return false;
+    // Entries written before a reorg that happened while the wallet was
+    // not loaded may point to a block that is no longer active
+    BlockMap::const_iterator mi = mapBlockIndex.find(it->second.hashBlock);
+    if (mi == mapBlockIndex.end() || !chainActive.Contains(mi->second))
+        return false;
+    entry = it->second;
+    return true;
+}
+
+// Read the kernel inputs of an output through the transaction index
+static bool ReadStakeCacheEntry(const COutPoint& outpoint, CStakeCacheEntry& entry)
+{
+    if (!fTxIndex)
+        return false;
+
+    LOCK(cs_main);
+    CDiskTxPos postx;
+    if (!pblocktree->ReadTxIndex(outpoint.hash, postx))
+        return false;
+
+    // Read block header
+    CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
+    CBlockHeader header;
+    CTransactionRef tx;
+    try {
+        file >> header;
+        fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
+        file >> tx;
+    } catch (std::exception &e) {
+        return error("%s() : deserialize or I/O error in GetStakeCacheEntry()", __PRETTY_FUNCTION__);
+    }
+    if (tx->GetHash() != outpoint.hash || outpoint.n >= tx->vout.size())
+        return error("%s() : txid mismatch in GetStakeCacheEntry()", __PRETTY_FUNCTION__);
+
+    entry.hashBlock = header.GetHash();
+    entry.nTimeBlock = header.nTime;
+    entry.nTxOffset = postx.nTxOffset + CBlockHeader::NORMAL_SERIALIZE_SIZE;
+    entry.nTimeTx = tx->nTime;
+    entry.nValue = tx->vout[outpoint.n].nValue;
+    return true;
+}
+
+bool CWallet::StoreStakeCache(const COutPoint& outpoint, const CStakeCacheEntry& entry)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    // The block may have been disconnected since the entry was read
+    BlockMap::const_iterator mi = mapBlockIndex.find(entry.hashBlock);
+    if (mi == mapBlockIndex.end() || !chainActive.Contains(mi->second))
+        return false;
+    mapStakeCache[outpoint] = entry;
+    CWalletDB(*dbw).WriteStakeCache(outpoint, entry);
+    return true;
+}
+
+bool CWallet::GetStakeCacheEntry(const COutPoint& outpoint, CStakeCacheEntry& entry)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    if (LookupStakeCache(outpoint, entry))
+        return true;
+    return ReadStakeCacheEntry(outpoint, entry) && StoreStakeCache(outpoint, entry);
 }
 
 
@@ -4241,151 +4366,249 @@ CTxDestination CWallet::AddAndGetDestinationForScript(const CScript& script, Out
 }
 
 
+// peercoin: the coinstake kernel search is spread over nStakeThreads threads
+static CCheckQueue<CStakeKernelCheck> stakecheckqueue;
+
+void ThreadStakeKernelCheck() {
+    RenameThread("peercoin-stakech");
+    stakecheckqueue.Thread();
+}
+
 // peercoin: create coin stake transaction
 typedef std::vector<unsigned char> valtype;
-bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int64_t nSearchInterval, CMutableTransaction& txNew)
+// Time CreateCoinStake held cs_main and cs_wallet, for the bench log
+static std::atomic<int64_t> nTimeStakeLocked(0);
+
+bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int64_t nSearchInterval, CMutableTransaction& txNew, uint64_t* pnKernels)
 {
     // The following split & combine thresholds are important to security
     // Should not be adjusted if you don't understand the consequences
     static unsigned int nStakeSplitAge = (60 * 60 * 24 * 90);
-    int64_t nCombineThreshold = GetProofOfWorkReward(GetLastBlockIndex(chainActive.Tip(), false)->nBits) / 3;
-
-    CBigNum bnTargetPerCoinDay;
-    bnTargetPerCoinDay.SetCompact(nBits);
 
     // Transaction index is required to get to block header
     if (!fTxIndex)
         return error("CreateCoinStake : transaction index unavailable");
     const Consensus::Params& params = Params().GetConsensus();
 
-    LOCK2(cs_main, cs_wallet);
-    txNew.vin.clear();
-    txNew.vout.clear();
-    // Mark coin stake transaction
-    CScript scriptEmpty;
-    scriptEmpty.clear();
-    txNew.vout.push_back(CTxOut(0, scriptEmpty));
-    // Choose coins to use
-    CAmount nBalance = GetBalance();
+    // A coin the kernel search runs over, with the output a coinstake from it pays to
+    struct CStakeCandidate
+    {
+        CInputCoin coin;
+        CStakeCacheEntry kernel;
+        CScript scriptPubKeyOut;
+        txnouttype whichType;
+    };
+
+    // Time the locks are held in each phase, logged with -debug=bench
+    // however the search ends
+    struct CLockTimes
+    {
+        int64_t nSnapshot = 0;
+        int64_t nSearch = 0;
+        int64_t nFinishStart = 0;
+        ~CLockTimes()
+        {
+            int64_t nFinish = nFinishStart ? GetTimeMicros() - nFinishStart : 0;
+            int64_t nTotal = nTimeStakeLocked += nSnapshot + nFinish;
+            LogPrint(BCLog::BENCH, "CreateCoinStake: locks held %.2fms to snapshot and %.2fms to finish, searched %.2fms unlocked [%.2fs locked in total]\n",
+                nSnapshot * 0.001, nFinish * 0.001, nSearch * 0.001, nTotal * 0.000001);
+        }
+    } times;
+
+    // Snapshot the tip, the chosen coins with their cached kernel inputs and
+    // the stake modifiers of the search window under a short lock
+    CBlockIndex* pindexPrev;
+    int64_t nCombineThreshold;
+    CAmount nBalance;
     CAmount nReserveBalance = 0;
-    if (gArgs.IsArgSet("-reservebalance") && !ParseMoney(gArgs.GetArg("-reservebalance", ""), nReserveBalance))
-        return error("CreateCoinStake : invalid reserve balance amount");
-    if (nBalance <= nReserveBalance)
-        return false;
     std::set<CInputCoin> setCoins;
-    std::vector<CTransactionRef> vwtxPrev;
-    CAmount nValueIn = 0;
-    std::vector<COutput> vAvailableCoins;
-    AvailableCoins(vAvailableCoins, true, nullptr, 1, MAX_MONEY, MAX_MONEY, 0, 0, 9999999, txNew.nTime);
-    if (!SelectCoins(vAvailableCoins, nBalance - nReserveBalance, setCoins, nValueIn, nullptr))
-        return false;
-    if (setCoins.empty())
-        return false;
-    CAmount nCredit = 0;
-    CScript scriptPubKeyKernel;
-    for (const auto& pcoin : setCoins)
+    std::map<COutPoint, CStakeCacheEntry> mapCoinKernels;
+    std::vector<COutPoint> vMissing;
+    CStakeModifierSnapshot modifiers;
+    unsigned int nSearch = std::min(nSearchInterval, MAX_STAKE_SEARCH_INTERVAL);
     {
-        CDiskTxPos postx;
-        if (!pblocktree->ReadTxIndex(pcoin.outpoint.hash, postx))
-            continue;
+        int64_t nStart = GetTimeMicros();
+        LOCK2(cs_main, cs_wallet);
+        pindexPrev = chainActive.Tip();
+        nCombineThreshold = GetProofOfWorkReward(GetLastBlockIndex(pindexPrev, false)->nBits) / 3;
+        txNew.vin.clear();
+        txNew.vout.clear();
+        // Mark coin stake transaction
+        CScript scriptEmpty;
+        scriptEmpty.clear();
+        txNew.vout.push_back(CTxOut(0, scriptEmpty));
+        // Choose coins to use
+        nBalance = GetBalance();
+        if (gArgs.IsArgSet("-reservebalance") && !ParseMoney(gArgs.GetArg("-reservebalance", ""), nReserveBalance))
+            return error("CreateCoinStake : invalid reserve balance amount");
+        if (nBalance <= nReserveBalance)
+            return false;
+        CAmount nValueIn = 0;
+        std::vector<COutput> vAvailableCoins;
+        AvailableCoins(vAvailableCoins, true, nullptr, 1, MAX_MONEY, MAX_MONEY, 0, 0, 9999999, txNew.nTime);
+        if (!SelectCoins(vAvailableCoins, nBalance - nReserveBalance, setCoins, nValueIn, nullptr))
+            return false;
+        if (setCoins.empty())
+            return false;
+        for (const auto& pcoin : setCoins)
+        {
+            CStakeCacheEntry kernel;
+            if (LookupStakeCache(pcoin.outpoint, kernel))
+                mapCoinKernels[pcoin.outpoint] = kernel;
+            else
+                vMissing.push_back(pcoin.outpoint);
+        }
+        modifiers.Take(pindexPrev, txNew.nTime, nSearch);
+        times.nSnapshot += GetTimeMicros() - nStart;
+    }
 
-        // Read block header
-        CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-        CBlockHeader header;
-        CTransactionRef tx;
-        try {
-            file >> header;
-            fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-            file >> tx;
-        } catch (std::exception &e) {
-            return error("%s() : deserialize or I/O error in CreateCoinStake()", __PRETTY_FUNCTION__);
+    // Coins missing from the stake cache are read from disk under cs_main
+    // alone, one at a time, and only cached under both locks
+    if (!vMissing.empty())
+    {
+        std::map<COutPoint, CStakeCacheEntry> mapRead;
+        for (const COutPoint& outpoint : vMissing)
+        {
+            CStakeCacheEntry kernel;
+            if (ReadStakeCacheEntry(outpoint, kernel))
+                mapRead[outpoint] = kernel;
+        }
+        int64_t nStart = GetTimeMicros();
+        LOCK2(cs_main, cs_wallet);
+        for (const auto& item : mapRead)
+        {
+            if (StoreStakeCache(item.first, item.second))
+                mapCoinKernels.insert(item);
         }
+        times.nSnapshot += GetTimeMicros() - nStart;
+    }
+
+    // Collect the kernels of the chosen coins and hash them without holding
+    // cs_main or cs_wallet, split over the stake search threads
+    int64_t nSearchStart = GetTimeMicros();
+    std::vector<CStakeCandidate> vCandidates;
+    std::vector<CStakeKernelCheck> vChecks;
+    CStakeKernelCheck::Result result;
+    for (const auto& pcoin : setCoins)
+    {
+        auto it = mapCoinKernels.find(pcoin.outpoint);
+        if (it == mapCoinKernels.end())
+            continue;
+        const CStakeCacheEntry& kernel = it->second;
 
-        static int nMaxStakeSearchInterval = 60;
-        if (header.GetBlockTime() + params.nStakeMinAge > txNew.nTime - nMaxStakeSearchInterval)
+        if (kernel.nTimeBlock + params.nStakeMinAge > txNew.nTime - MAX_STAKE_SEARCH_INTERVAL)
             continue; // only count coins meeting min age requirement
 
-        bool fKernelFound = false;
-        for (unsigned int n=0; n<std::min(nSearchInterval,(int64_t)nMaxStakeSearchInterval) && !fKernelFound; n++)
+        std::vector<valtype> vSolutions;
+        txnouttype whichType;
+        CScript scriptPubKeyOut;
+        if (!Solver(pcoin.txout.scriptPubKey, whichType, vSolutions))
+        {
+            if (gArgs.GetBoolArg("-debug", false) && gArgs.GetBoolArg("-printcoinstake", false))
+                LogPrintf("CreateCoinStake : failed to parse kernel type=%d\n", whichType);
+            continue;
+        }
+        if (whichType != TX_PUBKEY && whichType != TX_PUBKEYHASH && whichType != TX_WITNESS_V0_KEYHASH)
+        {
+            if (gArgs.GetBoolArg("-debug", false) && gArgs.GetBoolArg("-printcoinstake", false))
+                LogPrintf("CreateCoinStake : no support for kernel type=%d\n", whichType);
+            continue;  // only support pay to public key and pay to address and pay to witness keyhash
+        }
+        if (whichType == TX_PUBKEYHASH || whichType == TX_WITNESS_V0_KEYHASH) // pay to address type or witness keyhash
         {
-            // Search backward in time from the given txNew timestamp
-            // Search nSearchInterval seconds back up to nMaxStakeSearchInterval
-            uint256 hashProofOfStake = uint256();
-            COutPoint prevoutStake = pcoin.outpoint;
-            if (CheckStakeKernelHash(nBits, chainActive.Tip(), header, postx.nTxOffset + CBlockHeader::NORMAL_SERIALIZE_SIZE, tx, prevoutStake, txNew.nTime - n, hashProofOfStake))
+            // convert to pay to public key type
+            CKey key;
+            if (!keystore.GetKey(CKeyID(uint160(vSolutions[0])), key))
             {
-                // Found a kernel
-                if (gArgs.GetBoolArg("-debug", false) && gArgs.GetBoolArg("-printcoinstake", false))
-                    LogPrintf("CreateCoinStake : kernel found\n");
-                std::vector<valtype> vSolutions;
-                txnouttype whichType;
-                CScript scriptPubKeyOut;
-                scriptPubKeyKernel = pcoin.txout.scriptPubKey;
-                if (!Solver(scriptPubKeyKernel, whichType, vSolutions))
-                {
-                    if (gArgs.GetBoolArg("-debug", false) && gArgs.GetBoolArg("-printcoinstake", false))
-                        LogPrintf("CreateCoinStake : failed to parse kernel type=%d\n", whichType);
-                    break;
-                }
                 if (gArgs.GetBoolArg("-debug", false) && gArgs.GetBoolArg("-printcoinstake", false))
-                    LogPrintf("CreateCoinStake : parsed kernel type=%d\n", whichType);
-                if (whichType != TX_PUBKEY && whichType != TX_PUBKEYHASH && whichType != TX_WITNESS_V0_KEYHASH)
-                {
-                    if (gArgs.GetBoolArg("-debug", false) && gArgs.GetBoolArg("-printcoinstake", false))
-                        LogPrintf("CreateCoinStake : no support for kernel type=%d\n", whichType);
-                    break;  // only support pay to public key and pay to address and pay to witness keyhash
-                }
-                if (whichType == TX_PUBKEYHASH || whichType == TX_WITNESS_V0_KEYHASH) // pay to address type or witness keyhash
-                {
-                    // convert to pay to public key type
-                    CKey key;
-                    if (!keystore.GetKey(CKeyID(uint160(vSolutions[0])), key))
-                    {
-                        if (gArgs.GetBoolArg("-debug", false) && gArgs.GetBoolArg("-printcoinstake", false))
-                            LogPrintf("CreateCoinStake : failed to get key for kernel type=%d\n", whichType);
-                        break;  // unable to find corresponding public key
-                    }
-                    scriptPubKeyOut << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
-                }
-                else
-                    scriptPubKeyOut = scriptPubKeyKernel;
-
-                txNew.nTime -= n;
-                txNew.vin.push_back(CTxIn(pcoin.outpoint.hash, pcoin.outpoint.n));
-                nCredit += pcoin.txout.nValue;
-                vwtxPrev.push_back(tx);
-                txNew.vout.push_back(CTxOut(0, scriptPubKeyOut));
-                if (header.GetBlockTime() + nStakeSplitAge > txNew.nTime)
-                    txNew.vout.push_back(CTxOut(0, scriptPubKeyOut)); //split stake
-                if (gArgs.GetBoolArg("-debug", false) && gArgs.GetBoolArg("-printcoinstake", false))
-                    LogPrintf("CreateCoinStake : added kernel type=%d\n", whichType);
-                fKernelFound = true;
-                break;
+                    LogPrintf("CreateCoinStake : failed to get key for kernel type=%d\n", whichType);
+                continue;  // unable to find corresponding public key
             }
+            scriptPubKeyOut << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
         }
-        if (fKernelFound)
-            break; // if kernel is found stop searching
+        else
+            scriptPubKeyOut = pcoin.txout.scriptPubKey;
+
+        // Search backward in time from the given txNew timestamp
+        // Search nSearchInterval seconds back up to MAX_STAKE_SEARCH_INTERVAL
+        std::vector<KernelInput> vKernel;
+        if (modifiers.IsComplete())
+            modifiers.GetKernels(nBits, kernel.nTimeBlock, kernel.nTxOffset, kernel.nTimeTx, pcoin.outpoint, vKernel);
+        else
+        {
+            // Before v0.5 the modifier depends on the block the coin is from
+            int64_t nStart = GetTimeMicros();
+            LOCK(cs_main);
+            GetStakeKernels(nBits, pindexPrev, kernel.nTimeBlock, kernel.hashBlock, kernel.nTxOffset, kernel.nTimeTx, pcoin.outpoint, txNew.nTime, nSearch, vKernel);
+            times.nSnapshot += GetTimeMicros() - nStart;
+        }
+        if (vKernel.empty())
+            continue;
+        if (pnKernels)
+            *pnKernels += vKernel.size();
+        vChecks.emplace_back(std::move(vKernel), kernel.nValue, vCandidates.size(), &result);
+        vCandidates.push_back(CStakeCandidate{pcoin, kernel, scriptPubKeyOut, whichType});
     }
+
+    {
+        CCheckQueueControl<CStakeKernelCheck> control(nStakeThreads ? &stakecheckqueue : nullptr);
+        if (nStakeThreads)
+            control.Add(vChecks);
+        else
+        {
+            for (CStakeKernelCheck& check : vChecks)
+                if (!check())
+                    break; // if kernel is found stop searching
+        }
+        control.Wait();
+    }
+    times.nSearch = GetTimeMicros() - nSearchStart;
+    if (result.nCoin < 0)
+        return false;
+
+    // Re-validate the kernel found against the current tip and sign
+    times.nFinishStart = GetTimeMicros();
+    LOCK2(cs_main, cs_wallet);
+    if (chainActive.Tip() != pindexPrev)
+        return false; // the tip moved while searching
+
+    // The wallet may have spent the chosen coins while the locks were released
+    auto IsUnspent = [this](const COutPoint& outpoint) {
+        return !IsSpent(outpoint.hash, outpoint.n) && pcoinsTip->HaveCoin(outpoint);
+    };
+
+    // Found a kernel. Check it the usual way, which also logs it
+    const CStakeCandidate& candidate = vCandidates[result.nCoin];
+    const CInputCoin& pcoinKernel = candidate.coin;
+    const CStakeCacheEntry& kernelFound = candidate.kernel;
+    uint256 hashProofOfStake;
+    if (!CheckStakeKernelHash(nBits, pindexPrev, kernelFound.nTimeBlock, kernelFound.hashBlock, kernelFound.nTxOffset, kernelFound.nTimeTx, kernelFound.nValue, pcoinKernel.outpoint, result.nTimeTx, hashProofOfStake))
+        return error("CreateCoinStake : kernel found by the search fails the check");
+    if (gArgs.GetBoolArg("-debug", false) && gArgs.GetBoolArg("-printcoinstake", false))
+        LogPrintf("CreateCoinStake : kernel found\n");
+    auto mi = mapWallet.find(pcoinKernel.outpoint.hash);
+    if (mi == mapWallet.end() || !IsUnspent(pcoinKernel.outpoint))
+        return false;
+
+    CScript scriptPubKeyKernel = pcoinKernel.txout.scriptPubKey;
+    std::vector<CTransactionRef> vwtxPrev;
+    txNew.nTime = result.nTimeTx;
+    txNew.vin.push_back(CTxIn(pcoinKernel.outpoint.hash, pcoinKernel.outpoint.n));
+    CAmount nCredit = pcoinKernel.txout.nValue;
+    vwtxPrev.push_back(mi->second.tx);
+    txNew.vout.push_back(CTxOut(0, candidate.scriptPubKeyOut));
+    if (kernelFound.nTimeBlock + nStakeSplitAge > txNew.nTime)
+        txNew.vout.push_back(CTxOut(0, candidate.scriptPubKeyOut)); //split stake
+    if (gArgs.GetBoolArg("-debug", false) && gArgs.GetBoolArg("-printcoinstake", false))
+        LogPrintf("CreateCoinStake : added kernel type=%d\n", candidate.whichType);
     if (nCredit == 0 || nCredit > nBalance - nReserveBalance)
         return false;
     for (const auto& pcoin : setCoins)
     {
-        CDiskTxPos postx;
-        if (!pblocktree->ReadTxIndex(pcoin.outpoint.hash, postx))
+        auto it = mapCoinKernels.find(pcoin.outpoint);
+        if (it == mapCoinKernels.end())
             continue;
-
-        // Read block header
-        CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-        CBlockHeader header;
-        CTransactionRef tx;
-        try {
-            file >> header;
-            fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-            file >> tx;
-        } catch (std::exception &e) {
-            return error("%s() : deserialize or I/O error in CreateCoinStake()", __PRETTY_FUNCTION__);
-        }
-
+        const CStakeCacheEntry& kernel = it->second;
 
         // Attempt to add more inputs
         // Only add coins of the same key/address as kernel
@@ -4405,11 +4628,15 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
             if (pcoin.txout.nValue > nCombineThreshold)
                 continue;
             // Do not add input that is still too young
-            if (tx->nTime + params.nStakeMaxAge > txNew.nTime)
+            if (kernel.nTimeTx + params.nStakeMaxAge > txNew.nTime)
+                continue;
+            // Do not add input spent since it was chosen
+            auto miPrev = mapWallet.find(pcoin.outpoint.hash);
+            if (miPrev == mapWallet.end() || !IsUnspent(pcoin.outpoint))
                 continue;
             txNew.vin.push_back(CTxIn(pcoin.outpoint.hash, pcoin.outpoint.n));
             nCredit += pcoin.txout.nValue;
-            vwtxPrev.push_back(tx);
+            vwtxPrev.push_back(miPrev->second.tx);
         }
     }
     // Calculate coin age reward
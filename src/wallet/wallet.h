@@ -38,6 +38,7 @@ extern std::vector<CWalletRef> vpwallets;
 extern unsigned int nTxConfirmTarget;
 extern bool bSpendZeroConfChange;
 extern bool fWalletUnlockMintOnly;
+extern int nStakeThreads;
 
 static const unsigned int DEFAULT_KEYPOOL_SIZE = 1000;
 //! target minimum change amount
@@ -52,12 +53,23 @@ static const bool DEFAULT_WALLET_REJECT_LONG_CHAINS = false;
 static const unsigned int DEFAULT_TX_CONFIRM_TARGET = 6;
 static const bool DEFAULT_WALLETBROADCAST = true;
 static const bool DEFAULT_DISABLE_WALLET = false;
+//! -stakethreads default, the number of threads searching for stake kernels
+static const int DEFAULT_STAKE_THREADS = 1;
+//! Maximum number of stake search threads
+static const int MAX_STAKE_THREADS = 16;
+//! Most seconds back from the current time searched for a stake kernel
+static const int64_t MAX_STAKE_SEARCH_INTERVAL = 60;
+//! -stakeplanhours default, how far ahead the stake planner looks
+static const int DEFAULT_STAKE_PLAN_HOURS = 6;
 
 extern const char * DEFAULT_WALLET_DAT;
 
 static const int64_t TIMESTAMP_MIN = 0;
 
 class CBlockIndex;
+
+/** Run an instance of the stake kernel search thread */
+void ThreadStakeKernelCheck();
 class CCoinControl;
 class COutput;
 class CReserveKey;
@@ -503,6 +515,44 @@ public:
     }
 };
 
+/** peercoin: static kernel inputs of a mintable output.
+ * Cached by the wallet so that CreateCoinStake does not have to read the
+ * transaction index and block files for every coin on every search. */
+class CStakeCacheEntry
+{
+public:
+    uint256 hashBlock;        //!< block containing the transaction
+    unsigned int nTimeBlock;  //!< time of that block
+    unsigned int nTxOffset;   //!< offset of the transaction in the block, header included
+    unsigned int nTimeTx;     //!< transaction timestamp
+    CAmount nValue;           //!< value of the output
+
+    CStakeCacheEntry()
+    {
+        SetNull();
+    }
+
+    void SetNull()
+    {
+        hashBlock.SetNull();
+        nTimeBlock = 0;
+        nTxOffset = 0;
+        nTimeTx = 0;
+        nValue = 0;
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(hashBlock);
+        READWRITE(nTimeBlock);
+        READWRITE(nTxOffset);
+        READWRITE(nTimeTx);
+        READWRITE(nValue);
+    }
+};
+
 class COutput
 {
 public:
@@ -697,6 +747,13 @@ private:
      * Should be called with pindexBlock and posInBlock if this is for a transaction that is included in a block. */
     void SyncTransaction(const CTransactionRef& tx, const CBlockIndex *pindex = nullptr, int posInBlock = 0);
 
+    /* peercoin: kernel inputs of our mintable outputs, keyed by outpoint */
+    std::map<COutPoint, CStakeCacheEntry> mapStakeCache;
+
+    /* Add the outputs a connected block pays to us to the stake cache and
+     * drop the ones it spends. */
+    void UpdateStakeCache(const CBlock& block, const CBlockIndex* pindex);
+
     /* the HD chain data model (external chain counters) */
     CHDChain hdChain;
 
@@ -763,6 +820,16 @@ public:
 
     void LoadKeyPool(int64_t nIndex, const CKeyPool &keypool);
 
+    //! Adds a stake cache entry to the in-memory map only (used by LoadWallet)
+    void LoadStakeCache(const COutPoint& outpoint, const CStakeCacheEntry& entry);
+
+    //! Look up the kernel inputs of a mintable output, reading them from disk on a cache miss
+    bool GetStakeCacheEntry(const COutPoint& outpoint, CStakeCacheEntry& entry);
+    //! Look up the kernel inputs of a mintable output in the cache only
+    bool LookupStakeCache(const COutPoint& outpoint, CStakeCacheEntry& entry);
+    //! Cache kernel inputs read from disk, if their block is still active
+    bool StoreStakeCache(const COutPoint& outpoint, const CStakeCacheEntry& entry);
+
     // Map from Key ID to key metadata.
     std::map<CKeyID, CKeyMetadata> mapKeyMetadata;
 
@@ -967,7 +1034,10 @@ public:
      */
     bool CreateTransaction(const std::vector<CRecipient>& vecSend, CWalletTx& wtxNew, CReserveKey& reservekey, CAmount& nFeeRet, int& nChangePosInOut,
                            std::string& strFailReason, const CCoinControl& coin_control, bool sign = true);
-    bool CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int64_t nSearchInterval, CMutableTransaction &txNew);
+    /** peercoin: search nSearchInterval seconds back from txNew.nTime for a
+     *  stake kernel and build the coinstake. Adds the number of kernels
+     *  hashed to *pnKernels if given. */
+    bool CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int64_t nSearchInterval, CMutableTransaction &txNew, uint64_t* pnKernels = nullptr);
     bool CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey, CConnman* connman, CValidationState& state);
 
     void ListAccountCreditDebit(const std::string& strAccount, std::list<CAccountingEntry>& entries);
@@ -145,6 +145,16 @@ bool CWalletDB::ErasePool(int64_t nPool)
     return EraseIC(std::make_pair(std::string("pool"), nPool));
 }
 
+bool CWalletDB::WriteStakeCache(const COutPoint& outpoint, const CStakeCacheEntry& entry)
+{
+    return WriteIC(std::make_pair(std::string("stakecache"), outpoint), entry);
+}
+
+bool CWalletDB::EraseStakeCache(const COutPoint& outpoint)
+{
+    return EraseIC(std::make_pair(std::string("stakecache"), outpoint));
+}
+
 bool CWalletDB::WriteMinVersion(int nVersion)
 {
     return WriteIC(std::string("minversion"), nVersion);
@@ -461,6 +471,15 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
 
             pwallet->LoadKeyPool(nIndex, keypool);
         }
+        else if (strType == "stakecache")
+        {
+            COutPoint outpoint;
+            ssKey >> outpoint;
+            CStakeCacheEntry entry;
+            ssValue >> entry;
+
+            pwallet->LoadStakeCache(outpoint, entry);
+        }
         else if (strType == "version")
         {
             ssValue >> wss.nFileVersion;
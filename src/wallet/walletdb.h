@@ -40,6 +40,7 @@ struct CBlockLocator;
 class CKeyPool;
 class CMasterKey;
 class CScript;
+class CStakeCacheEntry;
 class CWallet;
 class CWalletTx;
 class uint160;
@@ -197,6 +198,9 @@ public:
     bool WritePool(int64_t nPool, const CKeyPool& keypool);
     bool ErasePool(int64_t nPool);
 
+    bool WriteStakeCache(const COutPoint& outpoint, const CStakeCacheEntry& entry);
+    bool EraseStakeCache(const COutPoint& outpoint);
+
     bool WriteMinVersion(int nVersion);
 
     /// This writes directly to the database, and will not update the CWallet's cached accounting entries!